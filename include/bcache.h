@@ -0,0 +1,102 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "types.h"
+#include "disk.h"
+
+/* Block buffer cache
+ *
+ * Every sector the filesystem reads or writes goes through a fixed pool of
+ * BCACHE_BUFFERS sector buffers, looked up by (drive, LBA) in a hash table
+ * and recycled in least-recently-used order. Repeated reads of the same
+ * sector (small reads of one file, metadata, re-reading a file) are served
+ * from memory.
+ *
+ * bcache_get() returns a buffer holding the sector and pins it; the caller
+ * copies what it needs and calls bcache_release(). Pinned buffers are never
+ * evicted. While a buffer is being filled from disk it is marked busy and
+ * other lookups of that sector sleep until the transfer is done; the disk
+ * I/O itself runs with interrupts enabled, and the disk driver serialises
+ * transfers on each ATA channel.
+ *
+ * Writes are write-back: bcache_write() and bcache_mark_dirty() only mark
+ * the buffer dirty. bcache_flush() writes the dirty buffers sorted by LBA,
+ * one multi-sector transfer per run of consecutive sectors. Dirty buffers
+ * are never evicted; a flush is forced when half the pool is dirty or
+ * when a miss finds nothing clean to recycle.
+ *
+ * bcache_prefetch() is the read-ahead path: it fills the missing sectors
+ * of a range with as few multi-sector transfers as possible, so sequential
+ * readers find the next sectors already cached.
+ */
+
+#define BCACHE_BUFFERS      128     /* 64 KB of sector data */
+#define BCACHE_HASH_SIZE    64      /* Power of two */
+#define BCACHE_PREFETCH_MAX 32      /* Sectors per read-ahead/write-back transfer */
+#define BCACHE_DIRTY_LIMIT  (BCACHE_BUFFERS / 2)    /* Flush when this many are dirty */
+
+/* Buffer flags */
+#define BCACHE_VALID        0x01    /* data holds the sector */
+#define BCACHE_BUSY         0x02    /* Transfer in progress */
+#define BCACHE_DIRTY        0x04    /* Newer than the disk */
+
+typedef struct {
+    uint8_t drive;
+    uint8_t flags;              /* BCACHE_* */
+    uint16_t refs;              /* Pins held by bcache_get() callers */
+    uint32_t lba;
+    int16_t hash_next;          /* Next buffer in the hash chain, -1 = end */
+    int16_t lru_prev;           /* Towards most recently used, -1 = head */
+    int16_t lru_next;           /* Towards least recently used, -1 = tail */
+    uint8_t* data;              /* SECTOR_SIZE bytes */
+} bcache_buf_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writes;            /* Sectors written back */
+    uint32_t flushes;           /* Disk commands used for them */
+    uint32_t prefetched;        /* Sectors read ahead */
+    uint32_t prefetch_reads;    /* Disk commands issued for them */
+} bcache_stats_t;
+
+/* Initialize the buffer pool (all buffers empty) */
+void bcache_init(void);
+
+/* Pin the buffer of a sector, reading it on a miss. Returns NULL on a disk
+ * error or if every buffer is pinned. */
+bcache_buf_t* bcache_get(uint8_t drive, uint32_t lba);
+
+/* Like bcache_get() for a sector that will be overwritten completely:
+ * a miss is not read from disk, the buffer is zeroed instead */
+bcache_buf_t* bcache_get_new(uint8_t drive, uint32_t lba);
+
+/* Drop a pin taken by bcache_get() */
+void bcache_release(bcache_buf_t* buf);
+
+/* The caller changed buf->data; write it back later */
+void bcache_mark_dirty(bcache_buf_t* buf);
+
+/* Write every dirty buffer that is not pinned; 0 or -1 on a disk error */
+int bcache_flush(void);
+
+/* Read the uncached sectors of [lba, lba + count) into the cache, one
+ * transfer per run of missing sectors. Does not pin anything; returns the
+ * number of sectors read (0 if another prefetch is in progress). */
+int bcache_prefetch(uint8_t drive, uint32_t lba, uint32_t count);
+
+/* Copy count sectors starting at lba into buffer; returns count or -1 */
+int bcache_read(uint8_t drive, uint32_t lba, uint32_t count, uint8_t* buffer);
+
+/* Copy count sectors into the cache as dirty buffers; returns count or -1 */
+int bcache_write(uint8_t drive, uint32_t lba, uint32_t count, const uint8_t* buffer);
+
+/* Hit/miss counters */
+void bcache_get_stats(bcache_stats_t* stats);
+void bcache_reset_stats(void);
+
+/* Print the counters (for the disk cache command) */
+void bcache_display_info(void);
+
+#endif
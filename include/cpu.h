@@ -0,0 +1,128 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "types.h"
+
+/* x86 control register and CPUID helpers */
+
+/* CR0 bits */
+#define CR0_MP              (1 << 1)    /* Monitor coprocessor */
+#define CR0_EM              (1 << 2)    /* x87 emulation */
+#define CR0_TS              (1 << 3)    /* Task switched (lazy FPU trap) */
+#define CR0_NE              (1 << 5)    /* Native x87 error reporting */
+#define CR0_PG              (1u << 31)  /* Paging enabled */
+
+/* CR4 bits */
+#define CR4_OSFXSR          (1 << 9)    /* FXSAVE/FXRSTOR and SSE enabled */
+#define CR4_OSXMMEXCPT      (1 << 10)   /* Unmasked SIMD exceptions raise #XM */
+
+/* EFLAGS bits */
+#define EFLAGS_IF           (1 << 9)    /* Interrupts enabled */
+
+/* CPUID leaf 1 EDX feature bits */
+#define CPUID_EDX_FPU       (1 << 0)
+#define CPUID_EDX_TSC       (1 << 4)    /* RDTSC */
+#define CPUID_EDX_SEP       (1 << 11)   /* SYSENTER/SYSEXIT */
+#define CPUID_EDX_FXSR      (1 << 24)
+#define CPUID_EDX_SSE       (1 << 25)
+#define CPUID_EDX_SSE2      (1 << 26)
+
+static inline uint32_t cpu_read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (value));
+    return value;
+}
+
+static inline void cpu_write_cr0(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr0" : : "r" (value) : "memory");
+}
+
+static inline uint32_t cpu_read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr4, %0" : "=r" (value));
+    return value;
+}
+
+static inline void cpu_write_cr4(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr4" : : "r" (value) : "memory");
+}
+
+static inline uint32_t cpu_read_cr2(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr2, %0" : "=r" (value));
+    return value;
+}
+
+static inline uint32_t cpu_read_cr3(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr3, %0" : "=r" (value));
+    return value;
+}
+
+static inline void cpu_write_cr3(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+/* Flush one page from the TLB */
+static inline void cpu_invlpg(uint32_t addr) {
+    __asm__ volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+/* Clear CR0.TS without a full CR0 read-modify-write */
+static inline void cpu_clts(void) {
+    __asm__ volatile("clts" : : : "memory");
+}
+
+/* Model-specific registers */
+#define MSR_SYSENTER_CS     0x174
+#define MSR_SYSENTER_ESP    0x175
+#define MSR_SYSENTER_EIP    0x176
+
+static inline uint64_t cpu_rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpu_wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c" (msr), "a" ((uint32_t)value),
+                     "d" ((uint32_t)(value >> 32)));
+}
+
+/* Read the time-stamp counter */
+static inline uint64_t cpu_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* 64-by-32 bit division with DIVL (no libgcc); the quotient must fit in
+ * 32 bits or the CPU raises #DE */
+static inline uint32_t cpu_div64_32(uint64_t dividend, uint32_t divisor) {
+    uint32_t quot, rem;
+    __asm__("divl %4"
+            : "=a" (quot), "=d" (rem)
+            : "a" ((uint32_t)dividend), "d" ((uint32_t)(dividend >> 32)), "rm" (divisor));
+    return quot;
+}
+
+/* Disable interrupts, returning the previous EFLAGS */
+static inline uint32_t cpu_irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushfl; popl %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+/* Restore the interrupt flag saved by cpu_irq_save() */
+static inline void cpu_irq_restore(uint32_t flags) {
+    __asm__ volatile("pushl %0; popfl" : : "r" (flags) : "memory", "cc");
+}
+
+static inline void cpu_cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx,
+                             uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile("cpuid"
+                     : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                     : "a" (leaf), "c" (0));
+}
+
+#endif
@@ -76,7 +76,8 @@ void disk_init(void);
 /* Identify ATA drives */
 void disk_identify(uint8_t drive);
 
-/* Read sectors from disk */
+/* Read sectors from disk; transfers on one channel run one at a time,
+ * so callers may be preempted (they sleep while the channel is busy) */
 int disk_read_sector(uint8_t drive, uint32_t lba, uint8_t* buffer);
 int disk_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buffer);
 
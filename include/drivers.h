@@ -2,6 +2,7 @@
 #define DRIVERS_H
 
 #include "types.h"
+#include "epoll.h"
 
 /* VGA Driver */
 void vga_init(void);
@@ -16,6 +17,8 @@ int vga_get_cursor_y(void);
 /* PS/2 Keyboard Driver */
 void keyboard_init(void);
 char keyboard_read_char(void);
+void keyboard_irq_handler(void);
+int keyboard_poll(poll_head_t** head);  /* EPOLLIN while input is queued */
 
 /* Programmable Interval Timer (PIT) */
 void pit_init(uint32_t frequency);
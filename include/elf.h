@@ -0,0 +1,69 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "types.h"
+
+/* ELF32 executable loader
+ *
+ * Programs are statically linked i386 ELF executables (ET_EXEC) placed
+ * anywhere in [USER_SPACE_START, USER_STACK_TOP - USER_STACK_SIZE), for
+ * example with `ld -m elf_i386 -Ttext 0x08048000`. PT_LOAD segments are
+ * not read at exec time; each page is read from the file on first access.
+ *
+ * The entry point is called as
+ *     void _start(uint32_t syscall_entry, int argc, char** argv);
+ * and must not return (it exits with SYS_EXIT through syscall_entry).
+ */
+
+/* e_ident */
+#define ELF_MAGIC0          0x7F
+#define ELF_MAGIC1          'E'
+#define ELF_MAGIC2          'L'
+#define ELF_MAGIC3          'F'
+#define ELF_CLASS32         1
+#define ELF_DATA2LSB        1
+
+#define ELF_ET_EXEC         2
+#define ELF_EM_386          3
+
+/* Program header types and flags */
+#define ELF_PT_LOAD         1
+#define ELF_PF_X            0x1
+#define ELF_PF_W            0x2
+#define ELF_PF_R            0x4
+
+#define ELF_MAX_PHDRS       16
+
+typedef struct {
+    uint8_t  e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} __attribute__((packed)) elf32_ehdr_t;
+
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} __attribute__((packed)) elf32_phdr_t;
+
+/* Load an executable from the file system and start it as a new process.
+ * argv[0..argc-1] are copied to the new process. Returns the PID or -1. */
+int elf_exec(const char* filename, int argc, const char* argv[]);
+
+#endif
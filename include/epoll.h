@@ -0,0 +1,88 @@
+#ifndef EPOLL_H
+#define EPOLL_H
+
+#include "types.h"
+#include "fdtable.h"
+
+/* Readiness notification (epoll-like)
+ *
+ * A process registers interest in event sources once with epoll_ctl() and
+ * sleeps in epoll_wait() until at least one of them is ready. Sources push
+ * readiness: each embeds a poll_head_t listing the watches on it (a bitmap,
+ * like wait_queue_t) and calls poll_wake() whenever its state changes, which
+ * marks those watches ready in their instance and wakes its waiter.
+ *
+ * Reporting is level-triggered: epoll_wait() re-checks every marked watch
+ * with the source's poll function, returns only the ones still ready, and
+ * unmarks the rest. A source therefore stays reported until it is drained.
+ */
+
+#define EPOLL_MAX_INSTANCES     8
+#define EPOLL_MAX_WATCHES       32  /* One bit per watch in poll_head_t */
+
+/* Events */
+#define EPOLLIN         0x001   /* Data to read */
+#define EPOLLOUT        0x004   /* Room to write */
+#define EPOLLERR        0x008   /* Error, e.g. no reader left (always reported) */
+#define EPOLLHUP        0x010   /* Peer closed or source gone (always reported) */
+
+/* epoll_ctl() operations */
+#define EPOLL_CTL_ADD   1
+#define EPOLL_CTL_DEL   2
+#define EPOLL_CTL_MOD   3
+
+/* Event sources */
+#define EPOLL_SRC_PIPE_READ     1   /* id = pipe id */
+#define EPOLL_SRC_PIPE_WRITE    2   /* id = pipe id */
+#define EPOLL_SRC_SOCKET        3   /* id = socket fd */
+#define EPOLL_SRC_KEYBOARD      4   /* id ignored */
+#define EPOLL_SRC_FILE          5   /* Regular file: always ready */
+
+typedef struct {
+    uint32_t events;        /* EPOLL* bits that are ready */
+    uint32_t data;          /* Value given to epoll_ctl() */
+} epoll_event_t;
+
+/* Watches registered on an event source */
+typedef struct {
+    volatile uint32_t watchers;     /* Bit n set = watch n */
+} poll_head_t;
+
+static inline void poll_head_init(poll_head_t* head) {
+    head->watchers = 0;
+}
+
+/* Mark the watches on head ready (safe from interrupt handlers) */
+void poll_notify(poll_head_t* head);
+
+/* Cheap check for the common case of nobody watching */
+static inline void poll_wake(poll_head_t* head) {
+    if (head->watchers) {
+        poll_notify(head);
+    }
+}
+
+/* Initialize the instance and watch tables */
+void epoll_init(void);
+
+/* Create an instance owned by the current process; returns its id or -1 */
+int epoll_create(void);
+
+/* Close an instance, dropping its watches; waiters return -1 */
+int epoll_close(int epfd);
+
+/* Add, modify or remove interest in (source, id) */
+int epoll_ctl(int epfd, int op, int source, int id, uint32_t events, uint32_t data);
+
+/* Store up to max_events ready sources in events. Sleeps until one is ready
+ * when block is nonzero, otherwise returns 0 at once. Returns the number
+ * stored, or -1 if the instance does not exist (or is closed meanwhile). */
+int epoll_wait(int epfd, epoll_event_t* events, int max_events, int block);
+
+/* Close the instances owned by an exiting process */
+void epoll_release_process(uint32_t pid);
+
+/* Descriptor operations (handle = instance id; only close) */
+extern const file_ops_t epoll_ops;
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+#include "types.h"
+
+/* Per-process file descriptor tables
+ *
+ * Every process owns a table mapping small integers to open objects:
+ * filesystem files, pipe ends, message queues, sockets and epoll
+ * instances. An entry pairs the object's id within its subsystem (handle)
+ * with that subsystem's file_ops_t, so read/write/close on a descriptor
+ * is one array index and one indirect call, whatever the object is.
+ *
+ * The first FD_TABLE_INLINE slots are embedded in the process, so creating
+ * a process never allocates; the table moves to the heap and doubles when
+ * they run out, up to FD_TABLE_MAX. New descriptors take the lowest free
+ * slot, and fds 0-2 start out as the console (stdin, stdout, stderr).
+ * fd_table_release() closes everything left open when the process exits
+ * or is killed.
+ */
+
+#define FD_TABLE_INLINE 8
+#define FD_TABLE_MAX    1024
+
+/* Operations on one kind of object; NULL entries fail with -1 */
+typedef struct file_ops {
+    const char* name;
+    uint8_t poll_source;        /* EPOLL_SRC_* for epoll_ctl(), 0 = not pollable */
+    int (*read)(int handle, void* buffer, uint32_t count);
+    int (*write)(int handle, const void* buffer, uint32_t count);
+    int (*seek)(int handle, uint32_t offset);
+    int (*close)(int handle);
+} file_ops_t;
+
+typedef struct {
+    const file_ops_t* ops;      /* NULL = free slot */
+    int handle;                 /* Object id within its subsystem */
+} fd_entry_t;
+
+typedef struct {
+    fd_entry_t* entries;        /* inline_entries or a heap array */
+    uint32_t capacity;
+    uint32_t lowest_free;       /* No free slot below this index */
+    fd_entry_t inline_entries[FD_TABLE_INLINE];
+} fd_table_t;
+
+/* Console streams installed as fds 0-2 */
+extern const file_ops_t console_in_ops;
+extern const file_ops_t console_out_ops;
+
+/* Empty table with the console on fds 0-2 */
+void fd_table_init(fd_table_t* table);
+
+/* Close every open descriptor and give back the heap array */
+void fd_table_release(fd_table_t* table);
+
+/* Store (ops, handle) in the lowest free slot, growing the table if
+ * needed; returns the fd or -1 */
+int fd_install(fd_table_t* table, const file_ops_t* ops, int handle);
+
+/* Free a slot without closing the object (undo of fd_install) */
+void fd_remove(fd_table_t* table, int fd);
+
+/* Close the object behind fd and free the slot */
+int fd_close(fd_table_t* table, int fd);
+
+/* Entry of an open descriptor, NULL if fd is not open */
+static inline fd_entry_t* fd_get(fd_table_t* table, int fd) {
+    if (fd < 0 || (uint32_t)fd >= table->capacity || !table->entries[fd].ops) {
+        return NULL;
+    }
+    return &table->entries[fd];
+}
+
+#endif
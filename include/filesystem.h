@@ -2,26 +2,76 @@
 #define FILESYSTEM_H
 
 #include "types.h"
+#include "fdtable.h"
+#include "vfs.h"
 
-/* FAT12 File System Header */
-
-/* Boot sector constants */
-#define FS_BYTES_PER_SECTOR     512
-#define FS_SECTORS_PER_CLUSTER  1
-#define FS_RESERVED_SECTORS     1
-#define FS_NUM_FATS             2
-#define FS_ROOT_ENTRIES         224
-#define FS_SECTORS_PER_TRACK    18
-#define FS_HEADS                2
-#define FS_TOTAL_SECTORS        2880    /* 1.44 MB floppy */
-#define FS_MEDIA_DESCRIPTOR     0xF0
-#define FS_SECTORS_PER_FAT      9
-
-/* Derived constants */
-#define FS_ROOT_DIR_SECTORS     ((FS_ROOT_ENTRIES * 32) / FS_BYTES_PER_SECTOR)
-#define FS_FAT_START_SECTOR     FS_RESERVED_SECTORS
-#define FS_ROOT_DIR_SECTOR      (FS_FAT_START_SECTOR + (FS_NUM_FATS * FS_SECTORS_PER_FAT))
-#define FS_DATA_START_SECTOR    (FS_ROOT_DIR_SECTOR + FS_ROOT_DIR_SECTORS)
+/* FAT12/FAT16/FAT32 File System Header
+ *
+ * The volume geometry comes from the BIOS parameter block at mount: either
+ * in sector 0 of the drive (superfloppy) or in the first FAT partition of
+ * an MBR partition table. The FAT type follows from the cluster count, as
+ * in the Microsoft specification.
+ */
+
+#define FS_BYTES_PER_SECTOR     512     /* The only sector size supported */
+
+#define FS_TYPE_FAT12           12
+#define FS_TYPE_FAT16           16
+#define FS_TYPE_FAT32           32
+
+/* BIOS parameter block (boot sector), with the FAT32 extension */
+typedef struct {
+    uint8_t  jump[3];
+    uint8_t  oem[8];
+    uint16_t bytes_per_sector;
+    uint8_t  sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t  num_fats;
+    uint16_t root_entries;          /* 0 on FAT32 */
+    uint16_t total_sectors_16;      /* 0 = see total_sectors_32 */
+    uint8_t  media;
+    uint16_t sectors_per_fat_16;    /* 0 on FAT32 */
+    uint16_t sectors_per_track;
+    uint16_t heads;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors_32;
+    /* FAT32 only */
+    uint32_t sectors_per_fat_32;
+    uint16_t ext_flags;
+    uint16_t fs_version;
+    uint32_t root_cluster;
+    uint16_t fsinfo_sector;         /* Relative to the volume start */
+    uint16_t backup_boot_sector;
+} __attribute__((packed)) fs_bpb_t;
+
+/* FSInfo sector (FAT32): free cluster hints */
+#define FS_FSINFO_LEAD_SIG      0x41615252
+#define FS_FSINFO_STRUCT_SIG    0x61417272
+#define FS_FSINFO_FREE_COUNT    488     /* Byte offsets in the sector */
+#define FS_FSINFO_NEXT_FREE     492
+#define FS_FSINFO_UNKNOWN       0xFFFFFFFF
+
+/* Geometry of the mounted volume (absolute LBAs on the drive) */
+typedef struct {
+    uint8_t  type;                  /* FS_TYPE_* */
+    uint8_t  num_fats;
+    uint8_t  sectors_per_cluster;
+    uint8_t  cluster_shift;         /* log2(bytes_per_cluster) */
+    uint32_t bytes_per_cluster;
+    uint32_t start;                 /* First sector of the volume */
+    uint32_t total_sectors;
+    uint32_t sectors_per_fat;
+    uint32_t fat_start;             /* First sector of FAT copy 0 */
+    uint32_t root_start;            /* Fixed root directory (FAT12/16) */
+    uint32_t root_sectors;          /* Its length, 0 on FAT32 */
+    uint32_t root_cluster;          /* First cluster of the root directory (FAT32) */
+    uint32_t data_start;            /* First sector of cluster 2 */
+    uint32_t cluster_count;         /* Valid clusters are 2 .. cluster_count + 1 */
+    uint32_t fsinfo;                /* FSInfo sector, 0 = none */
+} fs_volume_t;
+
+/* Largest root directory kept in memory (entries) */
+#define FS_ROOT_MAX_ENTRIES     4096
 
 /* File attributes */
 #define FS_ATTR_READ_ONLY   0x01
@@ -31,16 +81,34 @@
 #define FS_ATTR_DIRECTORY   0x10
 #define FS_ATTR_ARCHIVE     0x20
 
-/* Special cluster values */
-#define FS_CLUSTER_FREE     0x000
-#define FS_CLUSTER_RESERVED 0xFF0
-#define FS_CLUSTER_BAD      0xFF7
-#define FS_CLUSTER_MAX      0xFF8
-#define FS_CLUSTER_EOF      0xFFF
+/* Special cluster values, as FAT32 spells them; FAT12/16 entries are
+ * widened to these when read and truncated when written */
+#define FS_CLUSTER_FREE     0x00000000
+#define FS_CLUSTER_BAD      0x0FFFFFF7
+#define FS_CLUSTER_MAX      0x0FFFFFF8  /* This and above: end of chain */
+#define FS_CLUSTER_EOF      0x0FFFFFFF
 
 /* File descriptor table */
 #define FS_MAX_FILES        16
 
+/* fs_open() flags (same values as O_* in syscall.h) */
+#define FS_OPEN_WRONLY      0x01
+#define FS_OPEN_RDWR        0x02
+#define FS_OPEN_CREATE      0x04    /* Create the file if it does not exist */
+#define FS_OPEN_TRUNC       0x08    /* Drop existing contents */
+#define FS_OPEN_APPEND      0x10    /* Every write goes to the end */
+#define FS_OPEN_WRITE       (FS_OPEN_WRONLY | FS_OPEN_RDWR)
+
+/* Write-back: the sync daemon flushes dirty metadata and data this often (ticks) */
+#define FS_SYNC_INTERVAL    5000
+
+/* Extent map of an open file: initial capacity, doubled as needed */
+#define FS_EXTENTS_INITIAL  4
+
+/* Sequential read-ahead window (sectors) */
+#define FS_RA_MIN_SECTORS   4
+#define FS_RA_MAX_SECTORS   32
+
 /* Directory entry structure (32 bytes) */
 typedef struct {
     uint8_t filename[8];
@@ -58,6 +126,21 @@ typedef struct {
     uint32_t file_size;
 } __attribute__((packed)) fs_dir_entry_t;
 
+/* Run of contiguous clusters of a file */
+typedef struct {
+    uint32_t    file_cluster;   /* Index of the run's first cluster within the file */
+    uint32_t    disk_cluster;   /* Its cluster number on disk */
+    uint32_t    length;         /* Clusters in the run */
+} fs_extent_t;
+
+/* Where a directory entry lives */
+typedef struct {
+    uint32_t    dir;            /* First cluster of its directory, 0 = root */
+    uint32_t    index;          /* Entry number within the directory */
+    uint32_t    lba;            /* Sector holding it (subdirectories only) */
+    uint16_t    offset;         /* Byte offset in that sector */
+} fs_dirent_loc_t;
+
 /* File descriptor */
 typedef struct {
     uint32_t    start_cluster;
@@ -65,6 +148,16 @@ typedef struct {
     uint32_t    current_offset;
     uint32_t    file_size;
     uint32_t    position;
+    uint32_t    ra_next;        /* Position a sequential read continues from */
+    uint32_t    ra_limit;       /* Read ahead again once position reaches this */
+    uint16_t    ra_window;      /* Last read-ahead window in sectors, 0 = none */
+    fs_extent_t* extents;       /* Extent map, built from the FAT on demand */
+    uint16_t    extent_count;
+    uint16_t    extent_capacity;
+    uint32_t    mapped_clusters; /* Clusters covered by extents[] */
+    uint32_t    map_next;       /* Disk cluster following the mapped part */
+    fs_dirent_loc_t loc;        /* Directory entry of the file */
+    uint8_t     mode;           /* FS_OPEN_* flags */
     uint8_t     attributes;
     uint8_t     in_use;
     char        filename[16];
@@ -85,7 +178,11 @@ typedef struct {
 /* Initialize file system */
 int fs_init(void);
 
-/* Open file for reading */
+/* Paths are absolute or relative to the root, with '/' separators and 8.3
+ * components: "/logs/boot.txt". "." and ".." are followed as stored in
+ * each directory. */
+
+/* Open file; mode is a combination of FS_OPEN_* flags (0 = read only) */
 int fs_open(const char* filename, uint8_t mode);
 
 /* Close file */
@@ -94,22 +191,39 @@ int fs_close(int fd);
 /* Read from file */
 int fs_read(int fd, uint8_t* buffer, uint16_t count);
 
-/* Write to file */
+/* Write to file at the current position, growing it as needed. Data and
+ * metadata stay in memory until fs_sync() (or the sync daemon) runs. */
 int fs_write(int fd, const uint8_t* buffer, uint16_t count);
 
 /* Seek in file */
 int fs_seek(int fd, uint32_t offset);
 
+/* Descriptor operations (handle = fs fd; reads may target user memory) */
+extern const file_ops_t fs_file_ops;
+
+/* VFS filesystem type "fat" (the volume on drive 0) */
+extern const vfs_fs_type_t fat_fs_type;
+
 /* Get file size */
 uint32_t fs_get_size(int fd);
 
-/* Delete file */
+/* Geometry of the mounted volume, NULL before fs_init() */
+const fs_volume_t* fs_get_volume(void);
+
+/* Delete a file that is not open and free its clusters */
 int fs_delete(const char* filename);
 
-/* Create file */
+/* Create an empty file; -1 if it exists, its directory does not, or the
+ * directory cannot grow */
 int fs_create(const char* filename, uint8_t attributes);
 
-/* List directory */
+/* Create an empty directory */
+int fs_mkdir(const char* path);
+
+/* Remove an empty directory */
+int fs_rmdir(const char* path);
+
+/* List a directory ("" or "/" = root) without "." and ".."; returns the count or -1 */
 int fs_list_dir(const char* dirname, fs_dir_info_t* entries, int max_entries);
 
 /* Check if file exists */
@@ -118,19 +232,23 @@ int fs_file_exists(const char* filename);
 /* Get file info */
 int fs_get_file_info(const char* filename, fs_dir_info_t* info);
 
-/* Read a cluster from disk */
+/* Read a cluster (bytes_per_cluster bytes) from disk */
 int fs_read_cluster(uint32_t cluster, uint8_t* buffer);
 
-/* Write a cluster to disk */
+/* Write a cluster (bytes_per_cluster bytes) to disk */
 int fs_write_cluster(uint32_t cluster, const uint8_t* buffer);
 
 /* Get next cluster from FAT */
 uint32_t fs_get_next_cluster(uint32_t cluster);
 
-/* Allocate a new cluster */
+/* Allocate a free cluster (marked end of chain); FS_CLUSTER_EOF if full */
 uint32_t fs_allocate_cluster(void);
 
-/* Free a cluster chain */
+/* Write back everything dirty: changed FAT sectors (to both copies),
+ * changed root directory sectors and the cached file data */
+int fs_sync(void);
+
+/* Return a cluster chain to the free pool */
 int fs_free_cluster_chain(uint32_t start_cluster);
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+#include "process.h"
+
+/* Lazy FPU/SSE context management
+ *
+ * The FPU register file is only saved and restored when a process actually
+ * executes an x87/SSE instruction. On every context switch CR0.TS is set
+ * unless the incoming process already owns the FPU; the first FPU
+ * instruction then raises #NM (INT 7) and fpu_handle_nm() swaps state.
+ */
+
+/* Initialize the FPU (CR0/CR4 setup, default state image) */
+void fpu_init(void);
+
+/* Called by the scheduler before switching to a new process */
+void fpu_switch(process_t* next);
+
+/* Device-not-available (#NM) trap handler */
+void fpu_handle_nm(void);
+
+/* Drop FPU ownership of a terminated process */
+void fpu_release(process_t* proc);
+
+/* Check if SSE instructions may be used */
+int fpu_has_sse(void);
+
+#endif
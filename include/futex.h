@@ -0,0 +1,65 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "types.h"
+
+/* Fast user-space mutexes
+ *
+ * A futex is an aligned 32-bit word in memory that processes agree on (in
+ * a shared memory region, or anywhere for kernel processes). Lock and
+ * unlock are atomic operations on the word and never enter the kernel
+ * while there is no contention; only a process that has to wait calls
+ * futex_wait(), and only an unlock that saw waiters calls futex_wake().
+ *
+ * Waiters are keyed by the physical address of the word, so processes
+ * that map the same frame at different virtual addresses meet on the same
+ * key. The kernel keeps a hash table of wait queues indexed by that key;
+ * each sleeper records its key in its process structure, so a wake only
+ * picks sleepers of the same word even when keys share a bucket.
+ *
+ * futex_wait() checks the word and goes to sleep with interrupts disabled,
+ * so a futex_wake() issued after the word was changed cannot be missed.
+ */
+
+#define FUTEX_HASH_BITS     6
+#define FUTEX_HASH_SIZE     (1u << FUTEX_HASH_BITS)
+
+/* SYS_FUTEX operations */
+#define FUTEX_WAIT          0
+#define FUTEX_WAKE          1
+
+/* Initialize the wait queue table */
+void futex_init(void);
+
+/* Sleep until woken if *addr still equals expected. Returns 0 when woken,
+ * -1 if the value differed or addr is not a valid, aligned address. */
+int futex_wait(volatile uint32_t* addr, uint32_t expected);
+
+/* Wake up to count processes waiting on addr; returns the number woken */
+int futex_wake(volatile uint32_t* addr, uint32_t count);
+
+/* Mutex on a futex word (0 = unlocked, 1 = locked, 2 = locked with
+ * waiters). User code does the same with SYS_FUTEX. */
+static inline void futex_mutex_lock(volatile uint32_t* word) {
+    uint32_t state = 0;
+    if (__atomic_compare_exchange_n(word, &state, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;  /* Uncontended */
+    }
+
+    /* Announce a waiter, then sleep until the holder hands it back */
+    if (state != 2) {
+        state = __atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE);
+    }
+    while (state != 0) {
+        futex_wait(word, 2);
+        state = __atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline void futex_mutex_unlock(volatile uint32_t* word) {
+    if (__atomic_exchange_n(word, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(word, 1);
+    }
+}
+
+#endif
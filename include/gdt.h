@@ -0,0 +1,55 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "types.h"
+
+/* Global Descriptor Table and Task State Segment */
+
+/* Segment selectors (index * 8 | RPL) */
+#define GDT_KERNEL_CODE     0x08
+#define GDT_KERNEL_DATA     0x10
+#define GDT_USER_CODE       0x1B    /* 0x18 | ring 3 */
+#define GDT_USER_DATA       0x23    /* 0x20 | ring 3 */
+#define GDT_TSS             0x28
+
+/* 32-bit Task State Segment (only ss0/esp0 are used, no hardware switching) */
+typedef struct {
+    uint32_t prev_tss;
+    uint32_t esp0;          /* Kernel stack loaded on ring 3 -> ring 0 */
+    uint32_t ss0;           /* Kernel stack segment */
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t ebx;
+    uint32_t esp;
+    uint32_t ebp;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t es;
+    uint32_t cs;
+    uint32_t ss;
+    uint32_t ds;
+    uint32_t fs;
+    uint32_t gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+/* Load the kernel GDT (kernel + user segments, TSS) */
+void gdt_init(void);
+
+/* Set the kernel stack used when entering ring 0 from ring 3 */
+void tss_set_kernel_stack(uint32_t esp0);
+
+/* Address of TSS.esp0 (SYSENTER entry loads its stack from here) */
+uint32_t* tss_kernel_stack_slot(void);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include "types.h"
+
+/* Interrupt Descriptor Table and exception dispatch */
+
+/* Vector of the system call gate (int 0x80) */
+#define IDT_SYSCALL_VECTOR  0x80
+
+/* Register state saved by isr_common_stub (lowest address first) */
+typedef struct {
+    uint32_t ds;                                     /* Saved data segment */
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; /* pusha */
+    uint32_t int_no;                                 /* Vector number */
+    uint32_t err_code;                               /* CPU error code or 0 */
+    uint32_t eip, cs, eflags;                        /* Pushed by the CPU */
+    uint32_t user_esp, user_ss;                      /* Only valid from ring 3 */
+} interrupt_frame_t;
+
+/* Initialize IDT and remap the PIC */
+void idt_init(void);
+
+/* Exception dispatcher (called from isr_common_stub) */
+void isr_handler(interrupt_frame_t* frame);
+
+/* IRQ dispatcher (called from irq_common_stub) */
+void irq_handler(uint32_t irqnum);
+
+#endif
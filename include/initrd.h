@@ -0,0 +1,45 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include "types.h"
+#include "multiboot.h"
+
+/* Initial RAM disk
+ *
+ * GRUB loads archives named by "module" lines next to the kernel and lists
+ * them in the multiboot information. Each module is a cpio ("newc", as
+ * written by cpio -H newc) or tar (ustar or GNU) archive; at boot it is
+ * unpacked into a tmpfs mount sized to fit it, so the files are there
+ * before the shell starts and without touching the disk.
+ *
+ * The word after the module file name on the GRUB line is the mount path
+ * ("module /boot/initrd.tar /initrd"); INITRD_DEFAULT_PATH when it is
+ * missing. A module mounted at "/" replaces the FAT volume as the root.
+ *
+ * Boot order matters because GRUB puts modules in memory the kernel also
+ * wants: initrd_init() runs before the heap is used and moves modules out
+ * of the heap area, initrd_reserve() keeps the frame allocator off them,
+ * and their frames go back to the pool once unpacked.
+ */
+
+#define INITRD_MAX_MODULES      4
+#define INITRD_DEFAULT_PATH     "/initrd"
+
+/* Record the modules (before memory_init); returns how many are usable */
+int initrd_init(const multiboot_info_t* mbi, uint32_t mem_end);
+
+/* Mark the module frames in use (after pmm_init) */
+void initrd_reserve(void);
+
+/* Mount and unpack the module meant for "/", if any; returns its file
+ * count or -1 when there is none */
+int initrd_mount_root(void);
+
+/* Mount and unpack the other modules; returns the files unpacked */
+int initrd_mount_all(void);
+
+/* Unpack a cpio or tar archive under an existing directory; returns the
+ * files written or -1 if the data is not an archive */
+int initrd_unpack(const void* data, uint32_t size, const char* path);
+
+#endif
@@ -2,63 +2,158 @@
 #define IPC_H
 
 #include "types.h"
+#include "waitqueue.h"
+#include "spsc_ring.h"
+#include "epoll.h"
+#include "fdtable.h"
 
 /* Inter-Process Communication - Pipes and Message Queues */
 
-/* Pipe structure */
+/* Byte-stream pipe
+ * Data moves through a lock-free SPSC byte ring (see spsc_ring.h), so each
+ * end should be used by one process at a time. Readers sleep on `readable`
+ * while the pipe is empty, writers on `writable` while it is full.
+ */
 typedef struct {
-    uint32_t buffer[256];   /* Message buffer */
-    uint16_t read_pos;      /* Read position */
-    uint16_t write_pos;     /* Write position */
-    uint32_t message_count; /* Number of messages */
+    spsc_ring_t ring;       /* Byte ring, power-of-two capacity */
+    uint8_t* buffer;        /* Ring storage */
+    uint32_t alloc_size;    /* Size of the allocation kept for reuse */
+    uint8_t readers;        /* Open read ends */
+    uint8_t writers;        /* Open write ends */
     uint8_t in_use;         /* Is this pipe active */
     uint32_t owner_pid;     /* PID of process that created the pipe */
+    wait_queue_t readable;  /* Readers waiting for data */
+    wait_queue_t writable;  /* Writers waiting for space */
+    poll_head_t poll;       /* epoll watches on either end */
 } ipc_pipe_t;
 
-#define IPC_MAX_PIPES       32
-#define IPC_BUFFER_SIZE     256
-#define IPC_MESSAGE_SIZE    4   /* Messages are 32-bit values */
+#define IPC_MAX_PIPES               32
+#define IPC_PIPE_DEFAULT_CAPACITY   4096
+#define IPC_PIPE_MAX_CAPACITY       65536
+
+/* Pipe ends */
+#define IPC_PIPE_READ   0
+#define IPC_PIPE_WRITE  1
+
+/* Message queue
+ * Messages keep their boundaries: each is stored as a 32-bit length prefix
+ * followed by the payload in the byte ring of its priority level. A bitmap
+ * of non-empty levels lets receivers find the most urgent message in O(1).
+ * All levels share one byte budget (max_size, prefixes included), so
+ * senders block while the queue is full and receivers while it is empty.
+ * Queue operations are serialized with interrupts disabled; keep messages
+ * small and hand bulk data over through shared memory (see shm.h).
+ */
+#define IPC_QUEUE_PRIORITIES        4   /* 0 = most urgent */
+#define IPC_QUEUE_PRIO_NORMAL       2   /* Used by ipc_queue_send() */
+#define IPC_QUEUE_HEADER_SIZE       4   /* Length prefix per message */
 
-/* Message queue structure */
 typedef struct {
-    uint8_t* buffer;
-    uint32_t front;
-    uint32_t rear;
-    uint32_t size;
-    uint32_t max_size;
+    spsc_ring_t ring;       /* Length-prefixed messages */
+    uint8_t* buffer;        /* Ring storage, allocated on first use */
+    uint32_t alloc_size;    /* Size of the allocation kept for reuse */
+    uint8_t active;         /* Ring initialized for the current queue */
+} ipc_queue_level_t;
+
+typedef struct {
+    ipc_queue_level_t levels[IPC_QUEUE_PRIORITIES];
+    uint32_t ready_mask;    /* Bit n set = level n holds messages */
+    uint32_t ring_size;     /* Per-level ring capacity (power of two >= max_size) */
+    uint32_t size;          /* Bytes queued, length prefixes included */
+    uint32_t max_size;      /* Byte budget shared by all levels */
+    uint32_t messages;      /* Messages queued */
     uint8_t in_use;
+    wait_queue_t readable;  /* Receivers waiting for a message */
+    wait_queue_t writable;  /* Senders waiting for space */
 } ipc_queue_t;
 
-/* Create a pipe */
+/* Synchronous call/reply (L4-style rendezvous)
+ * ipc_call() blocks the caller until the server replies. If the server is
+ * already waiting in ipc_reply_wait() the message is copied into it and the
+ * CPU is handed over directly (process_switch_to()); the reply switches
+ * straight back the same way. Otherwise the caller queues on the server's
+ * ipc_senders bitmap until the server asks for the next request. Messages
+ * are a few words kept in the process structures, with no buffering.
+ */
+#define IPC_MSG_WORDS   4
+
+typedef struct {
+    uint32_t w[IPC_MSG_WORDS];
+} ipc_msg_t;
+
+#define IPC_STATE_NONE          0
+#define IPC_STATE_RECEIVING     1   /* Server waiting for a request */
+#define IPC_STATE_CALLING       2   /* Caller queued until the server receives */
+#define IPC_STATE_AWAIT_REPLY   3   /* Request delivered, waiting for the reply */
+
+/* Create a pipe with the default capacity (one read and one write end open) */
 int ipc_pipe_create(void);
 
-/* Close a pipe */
+/* Create a pipe; capacity is rounded up to a power of two */
+int ipc_pipe_create_size(uint32_t capacity);
+
+/* Close both ends of a pipe */
 int ipc_pipe_close(int pipe_id);
 
-/* Write to pipe */
-int ipc_pipe_write(int pipe_id, uint32_t message);
+/* Close one end (IPC_PIPE_READ/IPC_PIPE_WRITE); the pipe is freed when
+ * both sides are closed */
+int ipc_pipe_close_end(int pipe_id, int end);
+
+/* Write count bytes, blocking while the pipe is full. Returns the bytes
+ * written, or -1 if no reader is left before anything was written. */
+int ipc_pipe_write(int pipe_id, const void* data, uint32_t count);
 
-/* Read from pipe */
-int ipc_pipe_read(int pipe_id, uint32_t* message);
+/* Read up to count bytes, blocking while the pipe is empty. Returns the
+ * bytes read, 0 at end of stream (empty, no writers), -1 on error. */
+int ipc_pipe_read(int pipe_id, void* data, uint32_t count);
 
-/* Check if pipe has data */
+/* Bytes available to read */
 int ipc_pipe_has_data(int pipe_id);
 
-/* Create message queue */
+/* Current EPOLL* events of one end; -1 if the pipe does not exist. Stores
+ * the pipe's watch list in *head when head is not NULL. */
+int ipc_pipe_poll(int pipe_id, int end, poll_head_t** head);
+
+/* Create message queue holding up to size bytes (length prefixes included) */
 int ipc_queue_create(uint32_t size);
 
-/* Destroy message queue */
+/* Destroy message queue; blocked senders and receivers fail with -1 */
 int ipc_queue_destroy(int queue_id);
 
-/* Send message to queue */
+/* Send one message at IPC_QUEUE_PRIO_NORMAL, blocking while the queue is full */
 int ipc_queue_send(int queue_id, const void* data, uint32_t size);
 
-/* Receive message from queue */
+/* Send one message at the given priority (0 = most urgent) */
+int ipc_queue_send_prio(int queue_id, const void* data, uint32_t size, uint8_t priority);
+
+/* Receive the oldest message of the most urgent non-empty level, blocking
+ * while the queue is empty. Returns its length; -1 if it does not fit in
+ * max_size (it stays queued) or the queue is gone. */
 int ipc_queue_recv(int queue_id, void* data, uint32_t max_size);
 
-/* Check queue size */
+/* Bytes queued, length prefixes included */
 uint32_t ipc_queue_size(int queue_id);
 
+/* Messages queued */
+uint32_t ipc_queue_count(int queue_id);
+
+/* Descriptor operations: pipe ends (handle = pipe id) and message queues
+ * (handle = queue id, one message per read/write) */
+extern const file_ops_t ipc_pipe_read_ops;
+extern const file_ops_t ipc_pipe_write_ops;
+extern const file_ops_t ipc_queue_ops;
+
+/* Send msg to server dest and wait for the reply, which replaces msg.
+ * Returns 0, or -1 if dest does not exist or exits before replying. */
+int ipc_call(uint32_t dest, ipc_msg_t* msg);
+
+/* Server loop: reply to caller reply_to (if >= 0), then wait for the next
+ * request. Returns the caller's PID and stores the request in msg. */
+int ipc_reply_wait(int reply_to, const ipc_msg_t* reply, ipc_msg_t* msg);
+
+/* Fail calls that involve an exiting process */
+void ipc_release_process(uint32_t pid);
+
 /* Initialize IPC subsystem */
 void ipc_init(void);
 
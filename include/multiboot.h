@@ -0,0 +1,36 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "types.h"
+
+/* Multiboot (v1) boot information passed by the bootloader in EBX */
+
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+
+/* multiboot_info_t.flags bits */
+#define MULTIBOOT_INFO_MEMORY       (1 << 0)    /* mem_lower/mem_upper valid */
+#define MULTIBOOT_INFO_CMDLINE      (1 << 2)    /* cmdline valid */
+#define MULTIBOOT_INFO_MODS         (1 << 3)    /* mods_count/mods_addr valid */
+
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;         /* KB of memory below 1 MB */
+    uint32_t mem_upper;         /* KB of memory above 1 MB */
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed)) multiboot_info_t;
+
+/* Entry of the mods_addr array: a module loaded at [mod_start, mod_end) */
+typedef struct {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t cmdline;           /* Module line from the bootloader config */
+    uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+#endif
@@ -133,6 +133,12 @@ void net_poll(void);
 void net_receive_frame(uint8_t* data, uint16_t len);
 void net_send_packet(uint8_t* data, uint16_t len);
 
+/* Server sockets are served by one "netd" process sleeping in epoll_wait();
+ * handler runs whenever its socket has data */
+#define NET_MAX_SERVICES 8
+int net_service_register(int sockfd, void (*handler)(void));
+void net_service_unregister(int sockfd);
+
 /* Interface functions */
 net_interface_t* net_get_interface(const char* name);
 void net_set_ipaddr(net_interface_t* iface, ipv4_addr_t addr);
@@ -153,7 +159,7 @@ void icmp_handle_packet(uint8_t* data, uint16_t len);
 void icmp_send_echo_request(ipv4_addr_t dest);
 
 void udp_init(void);
-void udp_handle_packet(uint8_t* data, uint16_t len);
+void udp_handle_packet(ipv4_addr_t src, uint8_t* data, uint16_t len);
 
 void tcp_init(void);
 void tcp_handle_packet(uint8_t* data, uint16_t len);
@@ -26,10 +26,22 @@
 #define RTL8139_REG_CONFIG0  0x51   /* Configuration 0 */
 #define RTL8139_REG_CONFIG1  0x52   /* Configuration 1 */
 
+/* Frame queues between the interrupt path and the stack (lock-free SPSC
+ * rings; slot counts must be powers of two) */
+#define NETDRV_FRAME_MAX    (NET_MTU + 14)  /* Payload plus Ethernet header */
+#define NETDRV_RX_SLOTS     8
+#define NETDRV_TX_SLOTS     4
+
+typedef struct {
+	uint16_t len;
+	uint8_t data[NETDRV_FRAME_MAX];
+} netdrv_frame_t;
+
 /* Initialization functions */
 void rtl8139_init(void);
 void rtl8139_send(uint8_t* data, uint16_t len);
 void rtl8139_receive(void);
+int rtl8139_rx_queue(const uint8_t* data, uint16_t len);  /* RX interrupt path */
 void rtl8139_irq_handler(void);
 
 /* Generic network driver init */
@@ -0,0 +1,101 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "types.h"
+
+/* Physical frame allocator and x86 two-level paging
+ *
+ * The low PAGING_IDENTITY_LIMIT bytes of physical memory (kernel image,
+ * heap, stacks and the frame pool) are identity-mapped in every address
+ * space through shared page tables, so the kernel can touch any frame by
+ * its physical address. In the kernel address space those mappings are
+ * user-accessible, because the built-in ring 3 processes (page_dir 0) run
+ * code linked into the kernel image.
+ *
+ * Programs loaded from disk get a private page directory in which the
+ * identity map is supervisor-only; ring 3 sees just their user region
+ * [USER_SPACE_START, USER_SPACE_END), described by VMAs and populated
+ * lazily by the page fault handler, and the read-only vsyscall and time
+ * pages in the shared top region.
+ */
+
+#define PAGE_SIZE               4096
+#define PAGE_MASK               (~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_DOWN(x)      ((uint32_t)(x) & PAGE_MASK)
+#define PAGE_ALIGN_UP(x)        (((uint32_t)(x) + PAGE_SIZE - 1) & PAGE_MASK)
+
+/* Page directory / page table entry flags */
+#define PAGE_PRESENT            0x001
+#define PAGE_WRITE              0x002
+#define PAGE_USER               0x004
+#define PAGE_NOFREE             0x200   /* AVL bit: frame not owned by the address space */
+
+/* Page fault error code bits */
+#define PF_ERR_PRESENT          0x01    /* Protection violation (page was present) */
+#define PF_ERR_WRITE            0x02    /* Faulting access was a write */
+#define PF_ERR_USER             0x04    /* Fault happened in ring 3 */
+
+/* Memory layout */
+#define PAGING_IDENTITY_LIMIT   0x02000000  /* 32 MB identity-mapped for the kernel */
+#define PMM_POOL_START          0x00400000  /* Frames above kernel image and heap */
+#define USER_SPACE_START        PAGING_IDENTITY_LIMIT
+#define USER_SPACE_END          0xC0000000
+#define USER_STACK_TOP          USER_SPACE_END
+#define USER_STACK_SIZE         0x00010000  /* 64 KB, populated on demand */
+#define PAGING_SHARED_BASE      0xFFC00000  /* Top 4 MB: kernel pages visible to every process */
+
+/* Virtual memory area of a user address space */
+#define VMA_WRITE               0x01    /* Pages are mapped writable */
+#define VMA_FILE                0x02    /* Backed by the process image file */
+
+typedef struct {
+    uint32_t start;             /* Page-aligned start address */
+    uint32_t end;               /* Page-aligned end address (exclusive) */
+    uint32_t flags;             /* VMA_* */
+    uint32_t file_vaddr;        /* First address backed by file data */
+    uint32_t file_offset;       /* File offset of file_vaddr */
+    uint32_t file_size;         /* Bytes backed by the file; the rest is zero */
+} vm_area_t;
+
+/* Physical frame allocator */
+void pmm_init(uint32_t mem_end);
+uint32_t pmm_alloc_frame(void);         /* Returns 0 when out of memory */
+uint32_t pmm_alloc_contiguous(uint32_t count);  /* First of count adjacent frames, or 0 */
+void pmm_free_frame(uint32_t frame);
+void pmm_reserve(uint32_t start, uint32_t end);    /* Mark [start, end) in use */
+uint32_t pmm_free_frames(void);
+uint32_t pmm_total_frames(void);
+
+/* Build the kernel page directory and turn paging on */
+void paging_init(void);
+void paging_enable(void);
+
+/* Map a kernel page at a fixed address in the shared top region of every
+ * address space (e.g. read-only with PAGE_USER for the time page) */
+int paging_map_shared(uint32_t virt, uint32_t phys, uint32_t flags);
+
+/* Address spaces (identified by the physical address of their page directory,
+ * 0 = kernel address space) */
+uint32_t vmm_create_space(void);
+void vmm_destroy_space(uint32_t page_dir);
+void vmm_switch(uint32_t page_dir);
+int vmm_map_page(uint32_t page_dir, uint32_t virt, uint32_t phys, uint32_t flags);
+uint32_t vmm_unmap_page(uint32_t page_dir, uint32_t virt);  /* Old frame or 0; not freed */
+uint32_t vmm_lookup(uint32_t page_dir, uint32_t virt);  /* Physical address or 0 */
+
+/* Resolve a fault at addr for the current process; 0 if the page was mapped */
+int vmm_handle_fault(uint32_t addr, uint32_t err);
+
+/* Populate [addr, addr + len) of the current process before kernel code
+ * touches it; -1 if part of the range is not a valid user mapping (for
+ * processes with a page directory, anything outside the user region) */
+int vmm_prefault(uint32_t addr, uint32_t len);
+
+/* Copy a string from the current process (at most max bytes including the
+ * terminator); returns its length or -1 */
+int vmm_copy_user_string(char* dst, const char* src, uint32_t max);
+
+uint32_t virt_to_phys(uint32_t virt_addr);
+uint32_t phys_to_virt(uint32_t phys_addr);
+
+#endif
@@ -2,6 +2,10 @@
 #define PROCESS_H
 
 #include "types.h"
+#include "paging.h"
+#include "schedstat.h"
+#include "ipc.h"
+#include "fdtable.h"
 
 /* Process management header */
 
@@ -28,6 +32,15 @@ typedef struct {
     uint32_t eflags;
 } cpu_context_t;
 
+/* Memory areas per loaded program (segments + stack) */
+#define PROCESS_MAX_VMAS 8
+
+/* Command-line arguments passed to a loaded program */
+#define PROCESS_MAX_ARGS 16
+
+/* Size of the per-process FXSAVE area (must be 16-byte aligned) */
+#define FPU_STATE_SIZE 512
+
 /* Process structure */
 typedef struct {
     uint32_t pid;               /* Process ID (1-31, 0 reserved for kernel) */
@@ -36,10 +49,12 @@ typedef struct {
     uint8_t priority;           /* Priority (0=highest, 255=lowest) */
     uint8_t ticks;              /* Remaining time slice */
     
-    uint32_t stack_base;        /* Stack base address */
-    uint32_t stack_size;        /* Stack size (in bytes) */
+    uint32_t stack_base;        /* Kernel stack base address */
+    uint32_t stack_size;        /* Kernel stack size (in bytes) */
+    uint32_t user_stack;        /* User stack base (ring 3 processes) */
+    uint8_t user_mode;          /* Process runs in ring 3 */
     
-    cpu_context_t context;      /* CPU context at last switch */
+    cpu_context_t context;      /* CPU context at last switch (esp = saved kernel stack) */
     
     uint32_t entry_point;       /* Entry point for new processes */
     int exit_code;              /* Exit code */
@@ -48,9 +63,36 @@ typedef struct {
     
     uint32_t created_ticks;     /* Ticks when created */
     uint32_t terminated_ticks;  /* Ticks when terminated */
+
+    uint32_t page_dir;          /* Private page directory (physical), 0 = kernel's */
+    int image_fd;               /* vfs fd of the executable backing file VMAs, -1 if none */
+    uint8_t vma_count;          /* Entries used in vmas[] */
+    vm_area_t vmas[PROCESS_MAX_VMAS];  /* User memory layout (demand paged) */
+
+    uint64_t ready_tsc;         /* TSC when it last became READY (0 = not waiting) */
+    uint64_t run_tsc;           /* TSC when it last started running */
+    sched_hist_t wait_hist;     /* Wakeup-to-run latency */
+    sched_hist_t slice_hist;    /* Run slice length */
+
+    uint8_t ipc_state;          /* IPC_STATE_* for ipc_call()/ipc_reply_wait() */
+    int ipc_result;             /* Outcome delivered to a blocked caller */
+    uint32_t ipc_partner;       /* Server called, or the caller that sent ipc_msg */
+    uint32_t ipc_senders;       /* Bit n set = PID n is waiting to call us */
+    ipc_msg_t ipc_msg;          /* Message in transit */
+
+    fd_table_t fds;             /* Open descriptors, closed on exit */
+    uint32_t futex_key;         /* Physical address waited on in futex_wait(), 0 = none */
+    uint32_t wake_tick;         /* Tick process_sleep() returns at */
+    uint8_t kill_pending;       /* process_kill() asked it to exit */
+    uint8_t exiting;            /* In process_exit(), releasing its resources */
+    uint8_t locks_held;         /* Mutexes held (see waitqueue.h) */
+
+    uint8_t fpu_used;           /* Process has executed FPU/SSE code */
+    uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));  /* FXSAVE area */
 } process_t;
 
 #define MAX_PROCESSES 32
+#define PROCESS_DEFAULT_PRIORITY 128
 #define PROCESS_STACK_SIZE 4096  /* 4KB stack per process */
 #define PROCESS_TIME_SLICE 10    /* Timer ticks per time slice */
 
@@ -62,18 +104,48 @@ void process_init(void);
 /* Get current process */
 process_t* process_current(void);
 
-/* Create a new process (spawn) */
+/* Create a new kernel (ring 0) process (spawn) */
 int process_spawn(const char* name, void (*entry_point)(void), uint8_t priority);
 
+/* Create a new user (ring 3) process */
+int process_spawn_user(const char* name, void (*entry_point)(void), uint8_t priority);
+
+/* Create a ring 3 process in its own address space (see elf.c).
+ * Takes ownership of page_dir and image_fd only on success. */
+int process_spawn_image(const char* name, uint32_t page_dir, const vm_area_t* vmas,
+                        int vma_count, int image_fd, uint32_t entry,
+                        int argc, const char* argv[], uint8_t priority);
+
 /* Terminate current process with exit code */
 void process_exit(int exit_code);
 
-/* Terminate a specific process */
+/* Terminate a specific process. The process exits by itself once it
+ * runs again holding no mutex, so it never dies in the middle of an update. */
 int process_kill(uint32_t pid);
 
+/* Exit if a kill is pending and no mutex is held; called when the current
+ * process gets the CPU back and when it drops its last mutex */
+void process_exit_if_killed(void);
+
+/* Block the current process until process_wake() (see waitqueue.h) */
+int process_block(void);
+
+/* Make a blocked process READY again */
+int process_wake(uint32_t pid);
+
+/* Block the current process for at least ticks timer ticks (ms) */
+int process_sleep(uint32_t ticks);
+
+/* Switch directly to pid (BLOCKED or READY), bypassing the run queue. The
+ * caller sets its own state first; pid inherits the rest of its slice. */
+int process_switch_to(uint32_t pid);
+
 /* Schedule next process (called by timer interrupt) */
 void process_schedule(void);
 
+/* Timer tick: consume time slice (called from IRQ 0) */
+void process_tick(void);
+
 /* Get process info by PID */
 process_t* process_get(uint32_t pid);
 
@@ -0,0 +1,40 @@
+#ifndef SCHEDSTAT_H
+#define SCHEDSTAT_H
+
+#include "types.h"
+
+/* Scheduler latency statistics
+ *
+ * Durations are measured in TSC cycles and counted in log2 buckets:
+ * bucket n holds samples in [2^n, 2^(n+1)) cycles; the last bucket also
+ * collects everything larger. Two histograms are kept per process and
+ * globally:
+ *   - wakeup-to-run: READY (spawned, woken or preempted) until it runs
+ *   - run slice:     continuous time on the CPU until switched out
+ */
+
+#define SCHED_HIST_BUCKETS  40
+
+typedef struct {
+    uint32_t count[SCHED_HIST_BUCKETS];
+    uint32_t samples;
+    uint64_t max;               /* Largest sample in cycles */
+} sched_hist_t;
+
+/* Detect the TSC */
+void schedstat_init(void);
+
+/* Current TSC value, or 0 if statistics are unavailable */
+uint64_t sched_clock(void);
+
+/* Record a sample in a process histogram and the matching global one */
+void schedstat_record_wait(sched_hist_t* proc_hist, uint64_t cycles);
+void schedstat_record_slice(sched_hist_t* proc_hist, uint64_t cycles);
+
+/* Clear global and per-process histograms */
+void schedstat_reset(void);
+
+/* Print the histograms of one process, or the global ones if pid < 0 */
+int schedstat_display(int pid);
+
+#endif
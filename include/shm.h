@@ -0,0 +1,70 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "types.h"
+
+/* Shared memory regions
+ *
+ * A region is a run of physically contiguous frames that several processes
+ * map at the same time, so bulk data is handed over by passing an offset
+ * into the region instead of copying it through a pipe or queue.
+ *   - processes in the kernel address space (page_dir 0) see the region at
+ *     its identity-mapped physical address
+ *   - processes with a private address space get the frames mapped into the
+ *     [SHM_BASE, SHM_END) window with PAGE_NOFREE, so tearing down the
+ *     address space never frees them
+ *
+ * Reference counting: the creator holds one reference until shm_destroy()
+ * or its exit, and every mapping holds one more. The frames return to the
+ * pool when the last reference is dropped. shm_release_process() removes
+ * the mappings and the creator reference of an exiting process.
+ */
+
+#define SHM_MAX_REGIONS     16
+#define SHM_MAX_MAPPINGS    64
+#define SHM_MAX_SIZE        0x00100000  /* 1 MB per region */
+#define SHM_BASE            0xB0000000  /* Mapping window in private address spaces */
+#define SHM_END             0xBF000000  /* Below the user stack */
+
+typedef struct {
+    uint32_t phys;          /* First frame (identity-mapped) */
+    uint32_t pages;         /* Frames in the region */
+    uint32_t size;          /* Requested size in bytes */
+    uint32_t refs;          /* Creator reference + mappings */
+    uint32_t owner_pid;     /* Creator */
+    uint8_t owner_ref;      /* Creator still holds its reference */
+    uint8_t in_use;
+} shm_region_t;
+
+typedef struct {
+    uint32_t pid;           /* Process the region is mapped into */
+    int shm_id;
+    uint32_t vaddr;         /* Address returned by shm_map() */
+    uint8_t in_use;
+} shm_mapping_t;
+
+/* Initialize the region and mapping tables */
+void shm_init(void);
+
+/* Allocate a zeroed region of size bytes; returns its id or -1 */
+int shm_create(uint32_t size);
+
+/* Map a region into the current process; returns its address or NULL */
+void* shm_map(int shm_id);
+
+/* Remove a mapping of the current process made by shm_map() */
+int shm_unmap(void* addr);
+
+/* Drop the creator's reference; the region lives on while it is mapped */
+int shm_destroy(int shm_id);
+
+/* Size in bytes of a region, 0 if it does not exist */
+uint32_t shm_size(int shm_id);
+
+/* Drop all mappings and creator references of a process (on exit) */
+void shm_release_process(uint32_t pid);
+
+/* Print the region table (for the shm command) */
+void shm_display_info(void);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "types.h"
 #include "net.h"
+#include "epoll.h"
+#include "fdtable.h"
 
 /* Socket address family */
 #define AF_INET     2
@@ -26,8 +28,11 @@ typedef struct {
 	ipv4_addr_t remote_ip;
 	uint16_t remote_port;
 	int state;          /* Connection state */
-	void* buffer;       /* Receive buffer */
+	void* buffer;       /* Receive buffer (one datagram) */
 	uint16_t buf_len;
+	ipv4_addr_t from_ip;    /* Sender of the buffered datagram */
+	uint16_t from_port;
+	poll_head_t poll;   /* epoll watches */
 } socket_t;
 
 /* Socket states */
@@ -49,4 +54,15 @@ int sendto(int sockfd, uint8_t* buffer, uint16_t len, ipv4_addr_t addr, uint16_t
 int recvfrom(int sockfd, uint8_t* buffer, uint16_t maxlen, ipv4_addr_t* addr, uint16_t* port);
 int close(int sockfd);
 
+/* Readiness for epoll; -1 if the socket does not exist */
+int socket_poll(int sockfd, poll_head_t** head);
+
+/* Descriptor operations (handle = socket fd; read/write = recv/send) */
+extern const file_ops_t socket_ops;
+
+/* Hand a received UDP datagram to the socket bound to port (dropped if
+ * there is none or its buffer is still full) */
+void socket_deliver_udp(uint16_t port, ipv4_addr_t from, uint16_t from_port,
+                        const uint8_t* data, uint16_t len);
+
 #endif
@@ -0,0 +1,169 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include "types.h"
+#include "memory.h"
+
+/* Lock-free single-producer/single-consumer ring buffer
+ *
+ * One context only enqueues and one only dequeues (e.g. an IRQ handler and
+ * a process, or the two ends of a pipe). Neither side takes a lock or
+ * disables interrupts:
+ *   - head is written only by the producer, tail only by the consumer
+ *   - both are free-running counters; fill level = head - tail and the
+ *     slot index is counter & mask (capacity is a power of two)
+ *   - head and tail live on separate cache lines, and each side keeps a
+ *     private copy of the other's index so the shared line is only read
+ *     when the cached view says the ring is full/empty
+ *   - the producer publishes head with release ordering after copying the
+ *     data; the consumer reads head with acquire ordering before copying
+ *
+ * Capacity and element size are fixed at init; the caller owns the storage
+ * (capacity * elem_size bytes).
+ */
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct {
+    /* Producer side */
+    uint32_t head __attribute__((aligned(SPSC_CACHE_LINE)));
+    uint32_t tail_cache;        /* Producer's last view of tail */
+
+    /* Consumer side */
+    uint32_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+    uint32_t head_cache;        /* Consumer's last view of head */
+
+    /* Read-only after spsc_ring_init() */
+    uint8_t* buffer __attribute__((aligned(SPSC_CACHE_LINE)));
+    uint32_t mask;              /* Capacity in elements - 1 */
+    uint32_t elem_size;
+} spsc_ring_t;
+
+/* Initialize an empty ring; capacity must be a power of two */
+static inline int spsc_ring_init(spsc_ring_t* r, void* storage, uint32_t capacity,
+                                 uint32_t elem_size) {
+    if (!storage || capacity == 0 || (capacity & (capacity - 1)) || elem_size == 0) {
+        return -1;
+    }
+
+    r->head = 0;
+    r->tail_cache = 0;
+    r->tail = 0;
+    r->head_cache = 0;
+    r->buffer = (uint8_t*)storage;
+    r->mask = capacity - 1;
+    r->elem_size = elem_size;
+    return 0;
+}
+
+static inline uint32_t spsc_ring_capacity(const spsc_ring_t* r) {
+    return r->mask + 1;
+}
+
+/* Elements queued (exact for either side, a snapshot for observers) */
+static inline uint32_t spsc_ring_count(const spsc_ring_t* r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Free slots */
+static inline uint32_t spsc_ring_space(const spsc_ring_t* r) {
+    return spsc_ring_capacity(r) - spsc_ring_count(r);
+}
+
+/* Producer: copy up to n elements in; returns the number enqueued */
+static inline uint32_t spsc_ring_enqueue(spsc_ring_t* r, const void* items, uint32_t n) {
+    uint32_t head = r->head;
+    uint32_t cap = r->mask + 1;
+    uint32_t free_slots = cap - (head - r->tail_cache);
+
+    if (free_slots < n) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        free_slots = cap - (head - r->tail_cache);
+    }
+    if (n > free_slots) {
+        n = free_slots;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    /* At most two copies: up to the end of the storage, then from the start */
+    uint32_t idx = head & r->mask;
+    uint32_t first = cap - idx;
+    if (first > n) {
+        first = n;
+    }
+    memcpy(r->buffer + idx * r->elem_size, items, first * r->elem_size);
+    memcpy(r->buffer, (const uint8_t*)items + first * r->elem_size,
+           (n - first) * r->elem_size);
+
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Consumer: copy up to n elements out; returns the number dequeued */
+static inline uint32_t spsc_ring_dequeue(spsc_ring_t* r, void* items, uint32_t n) {
+    uint32_t tail = r->tail;
+    uint32_t avail = r->head_cache - tail;
+
+    if (avail < n) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        avail = r->head_cache - tail;
+    }
+    if (n > avail) {
+        n = avail;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    uint32_t cap = r->mask + 1;
+    uint32_t idx = tail & r->mask;
+    uint32_t first = cap - idx;
+    if (first > n) {
+        first = n;
+    }
+    memcpy(items, r->buffer + idx * r->elem_size, first * r->elem_size);
+    memcpy((uint8_t*)items + first * r->elem_size, r->buffer,
+           (n - first) * r->elem_size);
+
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Zero-copy producer: slot to fill in place, or NULL if full.
+ * spsc_ring_produce() publishes it. */
+static inline void* spsc_ring_producer_slot(spsc_ring_t* r) {
+    uint32_t head = r->head;
+    if (head - r->tail_cache > r->mask) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - r->tail_cache > r->mask) {
+            return NULL;
+        }
+    }
+    return r->buffer + (head & r->mask) * r->elem_size;
+}
+
+static inline void spsc_ring_produce(spsc_ring_t* r) {
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Zero-copy consumer: oldest element in place, or NULL if empty.
+ * spsc_ring_consume() releases it. */
+static inline void* spsc_ring_consumer_slot(spsc_ring_t* r) {
+    uint32_t tail = r->tail;
+    if (r->head_cache == tail) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (r->head_cache == tail) {
+            return NULL;
+        }
+    }
+    return r->buffer + (tail & r->mask) * r->elem_size;
+}
+
+static inline void spsc_ring_consume(spsc_ring_t* r) {
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define SYSCALL_H
 
 #include "types.h"
+#include "epoll.h"
 
 /* System Call Interface (int 0x80) */
 
@@ -22,6 +23,20 @@
 #define SYS_MKDIR       39
 #define SYS_RMDIR       40
 #define SYS_UNLINK      10
+#define SYS_SYNC        36
+#define SYS_SHM_CREATE  64
+#define SYS_SHM_MAP     65
+#define SYS_SHM_UNMAP   66
+#define SYS_SHM_DESTROY 67
+#define SYS_IPC_CALL    68  /* EBX = server PID, ESI/EDI = message words 0-1 */
+#define SYS_IPC_REPLY_WAIT 69  /* EBX = caller to reply to or -1, ESI/EDI = reply */
+#define SYS_EPOLL_CREATE 70
+#define SYS_EPOLL_CTL   71
+#define SYS_EPOLL_WAIT  72
+#define SYS_SOCKET      73  /* EBX = SOCK_DGRAM or SOCK_STREAM */
+#define SYS_CONNECT     74  /* EBX = fd, ECX = IPv4 address, EDX = port */
+#define SYS_MQ_CREATE   75  /* EBX = queue size in bytes */
+#define SYS_FUTEX       76  /* EBX = address, ECX = FUTEX_WAIT/WAKE, EDX = value/count */
 
 /* Standard file descriptors */
 #define STDIN           0
@@ -73,6 +88,18 @@ int sys_open(const char* filename, uint32_t flags);
 /* Close file */
 int sys_close(int fd);
 
+/* Remove a file (not while it is open) */
+int sys_unlink(const char* filename);
+
+/* Create a directory */
+int sys_mkdir(const char* path);
+
+/* Remove an empty directory */
+int sys_rmdir(const char* path);
+
+/* Write back cached filesystem changes */
+int sys_sync(void);
+
 /* Get current process ID */
 uint32_t sys_getpid(void);
 
@@ -94,4 +121,23 @@ int sys_pipe(int* fds);
 /* Seek in file */
 int sys_seek(int fd, uint32_t offset);
 
+/* Shared memory (see shm.h); sys_shm_map returns 0 on error */
+int sys_shm_create(uint32_t size);
+uint32_t sys_shm_map(int shm_id);
+int sys_shm_unmap(uint32_t addr);
+int sys_shm_destroy(int shm_id);
+
+/* Readiness notification (see epoll.h); descriptors instead of source ids */
+int sys_epoll_create(void);
+int sys_epoll_ctl(int epfd, int op, int fd, uint32_t events, uint32_t data);
+int sys_epoll_wait(int epfd, epoll_event_t* events, int max_events, int block);
+
+/* Sockets and message queues as descriptors */
+int sys_socket(int type);
+int sys_connect(int fd, uint32_t addr, uint16_t port);
+int sys_mq_create(uint32_t size);
+
+/* Futex wait/wake (see futex.h) */
+int sys_futex(uint32_t* addr, int op, uint32_t value);
+
 #endif
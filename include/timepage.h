@@ -0,0 +1,87 @@
+#ifndef TIMEPAGE_H
+#define TIMEPAGE_H
+
+#include "types.h"
+#include "cpu.h"
+
+/* Shared time page
+ *
+ * The kernel maps one read-only page at TIME_PAGE_VADDR into every address
+ * space and updates it from the timer interrupt. User code reads the time
+ * with time_page_ns() without entering the kernel.
+ *
+ * Readers use a sequence counter: the kernel makes seq odd before updating
+ * and even afterwards, so a reader retries if seq was odd or changed while
+ * it copied the fields.
+ */
+
+#define TIME_PAGE_VADDR     0xFFFFE000
+
+/* ns = (TSC cycles * tsc_mult) >> TIME_NS_SHIFT */
+#define TIME_NS_SHIFT       22
+
+typedef struct {
+    volatile uint32_t seq;          /* Odd while the kernel is updating */
+    volatile uint32_t ticks;        /* Timer ticks since boot */
+    volatile uint32_t tsc_lo;       /* TSC at the last tick */
+    volatile uint32_t tsc_hi;
+    volatile uint32_t tsc_khz;      /* Calibrated TSC frequency, 0 until known */
+    volatile uint32_t tsc_mult;     /* Cycles-to-ns multiplier, 0 until calibrated */
+    uint32_t tick_hz;               /* Timer interrupt frequency */
+    uint32_t ns_per_tick;           /* Nanoseconds per timer tick */
+} time_page_t;
+
+/* Kernel side */
+void timepage_init(uint32_t tick_hz);       /* Called by pit_init() */
+void timepage_tick(uint32_t ticks);         /* Called from IRQ 0 */
+
+static inline const time_page_t* time_page(void) {
+    return (const time_page_t*)TIME_PAGE_VADDR;
+}
+
+static inline uint32_t time_page_read_begin(const time_page_t* tp) {
+    uint32_t seq;
+    do {
+        seq = tp->seq;
+    } while (seq & 1);
+    __asm__ volatile("" : : : "memory");
+    return seq;
+}
+
+static inline int time_page_read_retry(const time_page_t* tp, uint32_t seq) {
+    __asm__ volatile("" : : : "memory");
+    return tp->seq != seq;
+}
+
+/* Timer ticks since boot */
+static inline uint32_t time_page_ticks(void) {
+    return time_page()->ticks;
+}
+
+/* Monotonic nanoseconds since boot: tick time plus the TSC cycles elapsed
+ * since the last tick (tick resolution until the TSC is calibrated) */
+static inline uint64_t time_page_ns(void) {
+    const time_page_t* tp = time_page();
+    uint32_t seq, ticks, ns_per_tick, mult, base, now = 0;
+
+    do {
+        seq = time_page_read_begin(tp);
+        ticks = tp->ticks;
+        ns_per_tick = tp->ns_per_tick;
+        mult = tp->tsc_mult;
+        base = tp->tsc_lo;
+        if (mult) {
+            now = (uint32_t)cpu_rdtsc();
+        }
+    } while (time_page_read_retry(tp, seq));
+
+    uint64_t ns = (uint64_t)ticks * ns_per_tick;
+    if (mult) {
+        uint32_t delta = (uint32_t)(((uint64_t)(now - base) * mult) >> TIME_NS_SHIFT);
+        /* Never run past the next tick, so time stays monotonic if it is late */
+        ns += (delta < ns_per_tick) ? delta : ns_per_tick - 1;
+    }
+    return ns;
+}
+
+#endif
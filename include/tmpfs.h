@@ -0,0 +1,28 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include "types.h"
+#include "vfs.h"
+
+/* RAM filesystem
+ *
+ * A tmpfs mount keeps a directory tree in a node table and file data in
+ * physical frames taken one page at a time, so reads and writes are
+ * memcpy between the caller and those pages and never touch a disk. Each
+ * file has an array of its frames indexed by page number; growing a file
+ * adds frames, truncating or deleting it gives them back.
+ *
+ * Every mount has its own limits, given as the mount source:
+ * "size=<bytes>[k|m],nodes=<n>" (either part may be left out). Writes
+ * past the size limit stop short, and creating more than the node limit
+ * fails. Contents vanish with the mount.
+ */
+
+#define TMPFS_DEFAULT_SIZE      0x00400000  /* 4 MB */
+#define TMPFS_DEFAULT_NODES     256
+#define TMPFS_MAX_FILES         32          /* Open files, all mounts */
+
+/* VFS filesystem type "tmpfs" */
+extern const vfs_fs_type_t tmpfs_fs_type;
+
+#endif
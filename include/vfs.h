@@ -0,0 +1,157 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include "types.h"
+#include "fdtable.h"
+
+/* Virtual filesystem
+ *
+ * Callers name files by path; the VFS walks the path one component at a
+ * time and hands each step to the filesystem that owns the directory.
+ * A filesystem type (vfs_fs_type_t) is registered once and mounted any
+ * number of times; each mount gets a superblock carrying three tables:
+ *   - vfs_super_ops_t: whole-filesystem operations (sync, statfs)
+ *   - vfs_inode_ops_t: namespace operations on a directory (lookup,
+ *     create, mkdir, unlink, rmdir, readdir) and open
+ *   - vfs_file_ops_t: I/O on an open file, by the backend's handle
+ *
+ * Inodes are small values filled in by lookup, not shared objects: they
+ * name a node of one superblock (ino) and carry a few words of
+ * backend-private state, such as where its directory entry lives.
+ *
+ * A mount is attached to a name inside a directory of another mount, and
+ * the walk checks for it before asking the backend, so the mount point
+ * need not exist on the underlying filesystem. ".." from the root of a
+ * mount leads back to that directory. The first mount is "/".
+ *
+ * Descriptors opened with vfs_open_file() hold the backend's own
+ * file_ops_t and handle, so read/write on them never pass through here.
+ */
+
+#define VFS_MAX_FS_TYPES    4
+#define VFS_MAX_MOUNTS      8
+#define VFS_MAX_FILES       32      /* Kernel-side opens (vfs_open) */
+#define VFS_NAME_MAX        32      /* Path component, with the terminator */
+#define VFS_PATH_MAX        128
+
+/* Node types */
+#define VFS_TYPE_FILE       1
+#define VFS_TYPE_DIR        2
+
+/* Open flags (same values as O_* in syscall.h and FS_OPEN_* in filesystem.h) */
+#define VFS_OPEN_WRONLY     0x01
+#define VFS_OPEN_RDWR       0x02
+#define VFS_OPEN_CREATE     0x04
+#define VFS_OPEN_TRUNC      0x08
+#define VFS_OPEN_APPEND     0x10
+
+typedef struct vfs_superblock vfs_superblock_t;
+
+typedef struct {
+    vfs_superblock_t* sb;
+    uint32_t ino;               /* Node number; unique among the directories of sb */
+    uint8_t type;               /* VFS_TYPE_* */
+    uint32_t size;              /* Bytes (files) */
+    uint32_t priv[4];           /* Backend-private */
+} vfs_inode_t;
+
+/* Directory listing / stat result */
+typedef struct {
+    char name[VFS_NAME_MAX];
+    uint8_t type;               /* VFS_TYPE_* */
+    uint32_t size;
+    uint32_t ino;
+} vfs_dirent_t;
+
+typedef struct {
+    uint32_t block_size;        /* Allocation unit in bytes */
+    uint32_t blocks;            /* Capacity in units */
+    uint32_t free_blocks;
+} vfs_statfs_t;
+
+/* Whole-filesystem operations; NULL entries fail with -1 (sync succeeds) */
+typedef struct {
+    int (*sync)(vfs_superblock_t* sb);
+    int (*statfs)(vfs_superblock_t* sb, vfs_statfs_t* st);
+} vfs_super_ops_t;
+
+/* Operations on directories (and open); name is a single component and
+ * lookup must also resolve "." and ".." within the filesystem */
+typedef struct {
+    int (*lookup)(vfs_inode_t* dir, const char* name, vfs_inode_t* out);
+    int (*create)(vfs_inode_t* dir, const char* name, vfs_inode_t* out);
+    int (*mkdir)(vfs_inode_t* dir, const char* name);
+    int (*unlink)(vfs_inode_t* dir, const char* name);
+    int (*rmdir)(vfs_inode_t* dir, const char* name);
+    int (*readdir)(vfs_inode_t* dir, vfs_dirent_t* entries, int max_entries);
+    int (*open)(vfs_inode_t* inode, uint32_t flags);     /* Returns a handle */
+} vfs_inode_ops_t;
+
+/* Operations on an open file, by handle. fd_ops is what descriptor tables
+ * get (buffers in user memory); the rest take kernel buffers. */
+typedef struct {
+    const file_ops_t* fd_ops;
+    int (*read)(int handle, void* buffer, uint32_t count);
+    int (*write)(int handle, const void* buffer, uint32_t count);
+    int (*seek)(int handle, uint32_t offset);
+    uint32_t (*size)(int handle);
+    int (*close)(int handle);
+} vfs_file_ops_t;
+
+typedef struct vfs_fs_type {
+    const char* name;
+    /* Fill in ops, root and priv of a new superblock; source is
+     * backend-specific (may be NULL) */
+    int (*mount)(vfs_superblock_t* sb, const char* source);
+} vfs_fs_type_t;
+
+struct vfs_superblock {
+    const vfs_fs_type_t* type;
+    const vfs_super_ops_t* s_ops;
+    const vfs_inode_ops_t* i_ops;
+    const vfs_file_ops_t* f_ops;
+    vfs_inode_t root;
+    void* priv;                 /* Backend state */
+};
+
+/* Clear the type, mount and open file tables */
+void vfs_init(void);
+
+/* Make a filesystem type available to vfs_mount() */
+int vfs_register(const vfs_fs_type_t* type);
+
+/* Mount a filesystem of the named type at path ("/" first) */
+int vfs_mount(const char* type, const char* path, const char* source);
+
+/* Resolve path to an inode, crossing mount points */
+int vfs_lookup(const char* path, vfs_inode_t* inode);
+
+/* Open for a descriptor table: the backend's ops and handle */
+int vfs_open_file(const char* path, uint32_t flags, const file_ops_t** ops, int* handle);
+
+/* Kernel-side open files; returns a vfs fd or -1 */
+int vfs_open(const char* path, uint32_t flags);
+int vfs_read(int fd, void* buffer, uint32_t count);
+int vfs_write(int fd, const void* buffer, uint32_t count);
+int vfs_seek(int fd, uint32_t offset);
+uint32_t vfs_size(int fd);
+int vfs_close(int fd);
+
+/* Namespace operations */
+int vfs_unlink(const char* path);
+int vfs_mkdir(const char* path);
+int vfs_rmdir(const char* path);
+
+/* List a directory, mount points in it included; returns the count or -1 */
+int vfs_list_dir(const char* path, vfs_dirent_t* entries, int max_entries);
+
+/* Type, size and node number of a path */
+int vfs_stat(const char* path, vfs_dirent_t* info);
+
+/* Write back every mounted filesystem */
+int vfs_sync(void);
+
+/* Print the mount table (for the mount command) */
+void vfs_display_mounts(void);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef VSYSCALL_H
+#define VSYSCALL_H
+
+#include "types.h"
+
+/* System call entry page
+ *
+ * At boot the kernel copies the fastest available system call stub into a
+ * page that user programs call instead of executing `int 0x80` directly:
+ *   - SYSENTER/SYSEXIT when CPUID reports SEP
+ *   - int 0x80 otherwise
+ * The stub takes the syscall number in EAX and arguments in EBX, ECX, EDX,
+ * ESI, EDI, and returns the result in EAX (same convention as int 0x80).
+ * Its address is passed to every user process on its initial stack. The
+ * page is mapped read-only at VSYSCALL_VADDR in the shared top region, so
+ * it is reachable from every address space.
+ */
+
+#define VSYSCALL_VADDR          0xFFFFD000  /* Below the time page */
+
+#define VSYSCALL_MODE_INT80     0
+#define VSYSCALL_MODE_SYSENTER  1
+
+/* Detect SEP, program the SYSENTER MSRs and install the stub (after
+ * paging_init(), which sets up the shared region) */
+void vsyscall_init(void);
+
+/* Address user code calls to enter the kernel */
+uint32_t vsyscall_entry(void);
+
+/* Selected entry mechanism (VSYSCALL_MODE_*) */
+int vsyscall_mode(void);
+
+/* Kernel side of SYSENTER: may the stub's save area at ebp be read? */
+int sysenter_frame_ok(uint32_t ebp);
+
+/* User-space helpers: call the entry stub. The entry address is taken
+ * from memory, since every register but EBP (which the stub uses itself)
+ * may carry an argument. */
+static inline int vsyscall3(uint32_t entry, uint32_t num,
+                            uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    int ret;
+    __asm__ volatile("call *%[entry]"
+                     : "=a" (ret)
+                     : [entry] "m" (entry), "a" (num), "b" (arg1), "c" (arg2), "d" (arg3)
+                     : "esi", "edi", "memory", "cc");
+    return ret;
+}
+
+/* Five arguments; ESI/EDI are passed in and read back through arg4/arg5
+ * (SYS_IPC_CALL and SYS_IPC_REPLY_WAIT return message words there) */
+static inline int vsyscall5(uint32_t entry, uint32_t num, uint32_t arg1, uint32_t arg2,
+                            uint32_t arg3, uint32_t* arg4, uint32_t* arg5) {
+    int ret;
+    __asm__ volatile("call *%[entry]"
+                     : "=a" (ret), "+S" (*arg4), "+D" (*arg5)
+                     : [entry] "m" (entry), "a" (num), "b" (arg1), "c" (arg2), "d" (arg3)
+                     : "memory", "cc");
+    return ret;
+}
+
+#endif
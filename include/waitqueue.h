@@ -0,0 +1,74 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include "types.h"
+
+/* Wait queues
+ *
+ * A wait queue is a bitmap of the PIDs sleeping on it (MAX_PROCESSES is 32).
+ * Callers check their condition and sleep with interrupts disabled, and
+ * re-check it after waking:
+ *
+ *     uint32_t flags = cpu_irq_save();
+ *     while (!condition) {
+ *         wait_queue_sleep(&wq);
+ *     }
+ *     ...
+ *     cpu_irq_restore(flags);
+ *
+ * Wakeups may be spurious (e.g. after a PID is reused), so the loop is required.
+ */
+
+typedef struct {
+    volatile uint32_t waiters;  /* Bit n set = PID n is sleeping here */
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { 0 }
+
+static inline void wait_queue_init(wait_queue_t* wq) {
+    wq->waiters = 0;
+}
+
+/* Block the current process until the queue is woken; -1 (at once) if
+ * the caller cannot block, as for the idle process */
+int wait_queue_sleep(wait_queue_t* wq);
+
+/* Wake every sleeper (safe from interrupt handlers) */
+void wait_queue_wake_all(wait_queue_t* wq);
+
+/* Wake one sleeper by PID, if it is on the queue */
+void wait_queue_wake(wait_queue_t* wq, uint32_t pid);
+
+/* Nonzero if any process is sleeping on the queue */
+static inline int wait_queue_active(const wait_queue_t* wq) {
+    return wq->waiters != 0;
+}
+
+/* Sleeping mutex
+ *
+ * For kernel code that must stay exclusive across something that can
+ * block or be preempted (disk transfers, filesystem updates). Contended
+ * lockers sleep on the wait queue. The owner may lock again; each lock
+ * needs its unlock. Not for interrupt handlers, nor for the idle process
+ * (contention panics rather than spin). A process killed while holding a
+ * mutex exits when it drops its last one (see process_kill()).
+ */
+
+typedef struct {
+    volatile uint32_t depth;    /* 0 = free */
+    uint32_t owner;             /* PID of the holder */
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_INIT { 0, 0, WAIT_QUEUE_INIT }
+
+static inline void mutex_init(mutex_t* m) {
+    m->depth = 0;
+    m->owner = 0;
+    wait_queue_init(&m->waiters);
+}
+
+void mutex_lock(mutex_t* m);
+void mutex_unlock(mutex_t* m);
+
+#endif
@@ -0,0 +1,476 @@
+#include "bcache.h"
+#include "waitqueue.h"
+#include "memory.h"
+#include "string.h"
+#include "drivers.h"
+#include "cpu.h"
+
+/* Block buffer cache (see bcache.h) */
+
+static bcache_buf_t g_bufs[BCACHE_BUFFERS];
+static uint8_t g_bcache_data[BCACHE_BUFFERS][SECTOR_SIZE];
+static int16_t g_hash[BCACHE_HASH_SIZE];
+static int16_t g_lru_head = -1;             /* Most recently used */
+static int16_t g_lru_tail = -1;             /* Least recently used */
+static wait_queue_t g_bcache_wait;          /* Lookups waiting for a busy buffer */
+static bcache_stats_t g_stats;
+
+static uint32_t g_dirty_count = 0;
+
+/* Staging areas for multi-sector read-ahead and write-back (one each at a time) */
+static uint8_t g_prefetch_data[BCACHE_PREFETCH_MAX * SECTOR_SIZE];
+static uint8_t g_prefetch_active = 0;
+static uint8_t g_flush_data[BCACHE_PREFETCH_MAX * SECTOR_SIZE];
+static uint8_t g_flush_active = 0;
+
+static inline uint32_t bcache_hash(uint8_t drive, uint32_t lba) {
+    return (lba ^ ((uint32_t)drive << 7)) & (BCACHE_HASH_SIZE - 1);
+}
+
+/* LRU list helpers; called with interrupts disabled */
+
+static void lru_unlink(int16_t n) {
+    bcache_buf_t* buf = &g_bufs[n];
+
+    if (buf->lru_prev >= 0) {
+        g_bufs[buf->lru_prev].lru_next = buf->lru_next;
+    } else {
+        g_lru_head = buf->lru_next;
+    }
+    if (buf->lru_next >= 0) {
+        g_bufs[buf->lru_next].lru_prev = buf->lru_prev;
+    } else {
+        g_lru_tail = buf->lru_prev;
+    }
+}
+
+static void lru_push_head(int16_t n) {
+    bcache_buf_t* buf = &g_bufs[n];
+
+    buf->lru_prev = -1;
+    buf->lru_next = g_lru_head;
+    if (g_lru_head >= 0) {
+        g_bufs[g_lru_head].lru_prev = n;
+    } else {
+        g_lru_tail = n;
+    }
+    g_lru_head = n;
+}
+
+static void lru_touch(int16_t n) {
+    if (g_lru_head != n) {
+        lru_unlink(n);
+        lru_push_head(n);
+    }
+}
+
+/* Hash chain helpers; called with interrupts disabled */
+
+static int16_t hash_find(uint8_t drive, uint32_t lba) {
+    int16_t n = g_hash[bcache_hash(drive, lba)];
+    while (n >= 0 && (g_bufs[n].lba != lba || g_bufs[n].drive != drive)) {
+        n = g_bufs[n].hash_next;
+    }
+    return n;
+}
+
+static void hash_insert(int16_t n) {
+    uint32_t h = bcache_hash(g_bufs[n].drive, g_bufs[n].lba);
+    g_bufs[n].hash_next = g_hash[h];
+    g_hash[h] = n;
+}
+
+static void hash_remove(int16_t n) {
+    int16_t* link = &g_hash[bcache_hash(g_bufs[n].drive, g_bufs[n].lba)];
+    while (*link >= 0) {
+        if (*link == n) {
+            *link = g_bufs[n].hash_next;
+            return;
+        }
+        link = &g_bufs[*link].hash_next;
+    }
+}
+
+/* Initialize the buffer pool */
+void bcache_init(void) {
+    for (int i = 0; i < BCACHE_HASH_SIZE; i++) {
+        g_hash[i] = -1;
+    }
+
+    g_lru_head = -1;
+    g_lru_tail = -1;
+    for (int16_t i = 0; i < BCACHE_BUFFERS; i++) {
+        g_bufs[i].flags = 0;
+        g_bufs[i].refs = 0;
+        g_bufs[i].hash_next = -1;
+        g_bufs[i].data = g_bcache_data[i];
+        lru_push_head(i);
+    }
+
+    wait_queue_init(&g_bcache_wait);
+    memset(&g_stats, 0, sizeof(g_stats));
+}
+
+/* Least recently used clean buffer nobody holds, -1 if there is none */
+static int16_t bcache_victim(void) {
+    for (int16_t n = g_lru_tail; n >= 0; n = g_bufs[n].lru_prev) {
+        if (g_bufs[n].refs == 0 && !(g_bufs[n].flags & (BCACHE_BUSY | BCACHE_DIRTY))) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+/* Claim a buffer for a sector that is not cached; interrupts disabled */
+static int16_t bcache_claim(uint8_t drive, uint32_t lba) {
+    int16_t n = bcache_victim();
+    if (n < 0) {
+        return -1;
+    }
+
+    bcache_buf_t* buf = &g_bufs[n];
+    if (buf->flags & BCACHE_VALID) {
+        hash_remove(n);
+        g_stats.evictions++;
+    }
+
+    buf->drive = drive;
+    buf->lba = lba;
+    buf->flags = BCACHE_BUSY;
+    buf->refs = 0;
+    hash_insert(n);
+    lru_touch(n);
+    return n;
+}
+
+/* Pin the buffer of a sector; on a miss read it (fill) or zero it */
+static bcache_buf_t* bcache_pin(uint8_t drive, uint32_t lba, int fill) {
+    uint32_t flags = cpu_irq_save();
+    int flushed = 0;
+    int16_t n;
+
+    while (1) {
+        while ((n = hash_find(drive, lba)) >= 0 && (g_bufs[n].flags & BCACHE_BUSY)) {
+            wait_queue_sleep(&g_bcache_wait);
+        }
+
+        if (n >= 0) {
+            g_stats.hits++;
+            g_bufs[n].refs++;
+            lru_touch(n);
+            cpu_irq_restore(flags);
+            return &g_bufs[n];
+        }
+
+        n = bcache_claim(drive, lba);
+        if (n >= 0 || flushed || g_dirty_count == 0) {
+            break;
+        }
+
+        /* Every unpinned buffer is dirty: write them back and retry */
+        cpu_irq_restore(flags);
+        bcache_flush();
+        flags = cpu_irq_save();
+        flushed = 1;
+    }
+
+    if (n < 0) {
+        cpu_irq_restore(flags);
+        return NULL;
+    }
+    g_stats.misses++;
+
+    bcache_buf_t* buf = &g_bufs[n];
+    buf->refs = 1;
+
+    if (!fill) {
+        memset(buf->data, 0, SECTOR_SIZE);
+        buf->flags = BCACHE_VALID;
+        cpu_irq_restore(flags);
+        return buf;
+    }
+
+    /* Fill it with interrupts enabled; lookups wait while it is busy */
+    cpu_irq_restore(flags);
+    int result = disk_read_sector(drive, lba, buf->data);
+
+    flags = cpu_irq_save();
+    if (result < 0) {
+        hash_remove(n);
+        buf->flags = 0;
+        buf->refs = 0;
+        buf = NULL;
+    } else {
+        buf->flags = BCACHE_VALID;
+    }
+    if (wait_queue_active(&g_bcache_wait)) {
+        wait_queue_wake_all(&g_bcache_wait);
+    }
+    cpu_irq_restore(flags);
+
+    return buf;
+}
+
+/* Pin the buffer of a sector */
+bcache_buf_t* bcache_get(uint8_t drive, uint32_t lba) {
+    return bcache_pin(drive, lba, 1);
+}
+
+/* Pin a buffer for a sector about to be overwritten */
+bcache_buf_t* bcache_get_new(uint8_t drive, uint32_t lba) {
+    return bcache_pin(drive, lba, 0);
+}
+
+/* Read ahead the missing sectors of a range */
+int bcache_prefetch(uint8_t drive, uint32_t lba, uint32_t count) {
+    uint32_t flags = cpu_irq_save();
+
+    if (g_prefetch_active) {
+        cpu_irq_restore(flags);
+        return 0;  /* Only a hint; the reader will fetch on demand */
+    }
+    g_prefetch_active = 1;
+
+    int fetched = 0;
+    while (count > 0) {
+        /* Skip what is already cached (or being read) */
+        while (count > 0 && hash_find(drive, lba) >= 0) {
+            lba++;
+            count--;
+        }
+
+        /* Claim the run of missing sectors that follows */
+        int16_t run[BCACHE_PREFETCH_MAX];
+        uint32_t n = 0;
+        while (n < count && n < BCACHE_PREFETCH_MAX && hash_find(drive, lba + n) < 0) {
+            int16_t b = bcache_claim(drive, lba + n);
+            if (b < 0) {
+                break;
+            }
+            run[n++] = b;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        /* One transfer for the whole run; the claimed buffers are busy, so
+         * nobody else touches them while interrupts are enabled */
+        cpu_irq_restore(flags);
+        int result = disk_read_sectors(drive, lba, (uint8_t)n, g_prefetch_data);
+        if (result >= 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                memcpy(g_bufs[run[i]].data, g_prefetch_data + i * SECTOR_SIZE, SECTOR_SIZE);
+            }
+        }
+        flags = cpu_irq_save();
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (result >= 0) {
+                g_bufs[run[i]].flags = BCACHE_VALID;
+            } else {
+                hash_remove(run[i]);
+                g_bufs[run[i]].flags = 0;
+            }
+        }
+        if (wait_queue_active(&g_bcache_wait)) {
+            wait_queue_wake_all(&g_bcache_wait);
+        }
+        if (result < 0) {
+            break;
+        }
+
+        g_stats.prefetched += n;
+        g_stats.prefetch_reads++;
+        fetched += (int)n;
+        lba += n;
+        count -= n;
+    }
+
+    g_prefetch_active = 0;
+    cpu_irq_restore(flags);
+    return fetched;
+}
+
+/* Drop a pin */
+void bcache_release(bcache_buf_t* buf) {
+    uint32_t flags = cpu_irq_save();
+    if (buf && buf->refs > 0) {
+        buf->refs--;
+    }
+    cpu_irq_restore(flags);
+}
+
+/* Mark a pinned buffer dirty */
+void bcache_mark_dirty(bcache_buf_t* buf) {
+    uint32_t flags = cpu_irq_save();
+    if (!(buf->flags & BCACHE_DIRTY)) {
+        buf->flags |= BCACHE_DIRTY;
+        g_dirty_count++;
+    }
+    uint32_t dirty = g_dirty_count;
+    cpu_irq_restore(flags);
+
+    if (dirty >= BCACHE_DIRTY_LIMIT) {
+        bcache_flush();
+    }
+}
+
+/* Insert n into list (sorted by drive, then LBA) */
+static void bcache_sorted_insert(int16_t* list, uint32_t count, int16_t n) {
+    uint64_t key = ((uint64_t)g_bufs[n].drive << 32) | g_bufs[n].lba;
+    uint32_t i = count;
+
+    while (i > 0) {
+        bcache_buf_t* prev = &g_bufs[list[i - 1]];
+        if ((((uint64_t)prev->drive << 32) | prev->lba) <= key) {
+            break;
+        }
+        list[i] = list[i - 1];
+        i--;
+    }
+    list[i] = n;
+}
+
+/* Write back the dirty buffers in LBA order, coalescing consecutive sectors */
+int bcache_flush(void) {
+    int16_t list[BCACHE_BUFFERS];
+    uint32_t count = 0;
+    int result = 0;
+
+    uint32_t flags = cpu_irq_save();
+    while (g_flush_active) {
+        wait_queue_sleep(&g_bcache_wait);
+    }
+    g_flush_active = 1;
+
+    /* Busy keeps them unchanged (and unreadable) until they are on disk */
+    for (int16_t n = 0; n < BCACHE_BUFFERS; n++) {
+        bcache_buf_t* buf = &g_bufs[n];
+        if ((buf->flags & BCACHE_DIRTY) && !(buf->flags & BCACHE_BUSY) && buf->refs == 0) {
+            buf->flags |= BCACHE_BUSY;
+            bcache_sorted_insert(list, count++, n);
+        }
+    }
+    cpu_irq_restore(flags);
+
+    for (uint32_t i = 0; i < count;) {
+        bcache_buf_t* first = &g_bufs[list[i]];
+        uint32_t run = 1;
+        while (i + run < count && run < BCACHE_PREFETCH_MAX &&
+               g_bufs[list[i + run]].drive == first->drive &&
+               g_bufs[list[i + run]].lba == first->lba + run) {
+            run++;
+        }
+
+        for (uint32_t k = 0; k < run; k++) {
+            memcpy(g_flush_data + k * SECTOR_SIZE, g_bufs[list[i + k]].data, SECTOR_SIZE);
+        }
+        int written = disk_write_sectors(first->drive, first->lba, (uint8_t)run, g_flush_data);
+
+        flags = cpu_irq_save();
+        for (uint32_t k = 0; k < run; k++) {
+            bcache_buf_t* buf = &g_bufs[list[i + k]];
+            buf->flags &= ~BCACHE_BUSY;
+            if (written >= 0) {
+                buf->flags &= ~BCACHE_DIRTY;
+                g_dirty_count--;
+            }
+        }
+        if (written < 0) {
+            result = -1;  /* Stays dirty for the next flush */
+        } else {
+            g_stats.writes += run;
+            g_stats.flushes++;
+        }
+        if (wait_queue_active(&g_bcache_wait)) {
+            wait_queue_wake_all(&g_bcache_wait);
+        }
+        cpu_irq_restore(flags);
+
+        i += run;
+    }
+
+    flags = cpu_irq_save();
+    g_flush_active = 0;
+    if (wait_queue_active(&g_bcache_wait)) {
+        wait_queue_wake_all(&g_bcache_wait);
+    }
+    cpu_irq_restore(flags);
+    return result;
+}
+
+/* Copy sectors out of the cache */
+int bcache_read(uint8_t drive, uint32_t lba, uint32_t count, uint8_t* buffer) {
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_buf_t* buf = bcache_get(drive, lba + i);
+        if (!buf) {
+            return -1;
+        }
+        memcpy(buffer + i * SECTOR_SIZE, buf->data, SECTOR_SIZE);
+        bcache_release(buf);
+    }
+    return (int)count;
+}
+
+/* Copy sectors into the cache, to be written back later */
+int bcache_write(uint8_t drive, uint32_t lba, uint32_t count, const uint8_t* buffer) {
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_buf_t* buf = bcache_get_new(drive, lba + i);
+        if (!buf) {
+            return -1;
+        }
+        memcpy(buf->data, buffer + i * SECTOR_SIZE, SECTOR_SIZE);
+        bcache_mark_dirty(buf);
+        bcache_release(buf);
+    }
+    return (int)count;
+}
+
+void bcache_get_stats(bcache_stats_t* stats) {
+    uint32_t flags = cpu_irq_save();
+    *stats = g_stats;
+    cpu_irq_restore(flags);
+}
+
+void bcache_reset_stats(void) {
+    uint32_t flags = cpu_irq_save();
+    memset(&g_stats, 0, sizeof(g_stats));
+    cpu_irq_restore(flags);
+}
+
+static void bcache_print_count(const char* label, uint32_t value) {
+    char buf[16];
+    vga_write_string(label);
+    itoa((int)value, buf, 10);
+    vga_write_string(buf);
+    vga_write_char('\n');
+}
+
+/* Print the counters */
+void bcache_display_info(void) {
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+
+    uint32_t cached = 0;
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        if (g_bufs[i].flags & BCACHE_VALID) {
+            cached++;
+        }
+    }
+
+    bcache_print_count("Buffers:   ", BCACHE_BUFFERS);
+    bcache_print_count("Cached:    ", cached);
+    bcache_print_count("Hits:      ", stats.hits);
+    bcache_print_count("Misses:    ", stats.misses);
+    bcache_print_count("Evictions: ", stats.evictions);
+    bcache_print_count("Dirty:     ", g_dirty_count);
+    bcache_print_count("Written:   ", stats.writes);
+    bcache_print_count("  in writes: ", stats.flushes);
+    bcache_print_count("Read ahead: ", stats.prefetched);
+    bcache_print_count("  in reads: ", stats.prefetch_reads);
+
+    uint32_t lookups = stats.hits + stats.misses;
+    if (lookups) {
+        bcache_print_count("Hit rate %: ", (stats.hits * 100) / lookups);
+    }
+}
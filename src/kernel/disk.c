@@ -2,11 +2,17 @@
 #include "types.h"
 #include "memory.h"
 #include "string.h"
+#include "waitqueue.h"
 
 /* Global disk information structure for up to 4 drives */
 static ata_disk_t g_disks[MAX_DRIVES];
 static uint8_t g_drive_count = 0;
 
+/* One transfer at a time per channel: the task file and data port are
+ * shared by master and slave, and callers may be preempted mid-transfer.
+ * A process killed during a transfer finishes it and unlocks first. */
+static mutex_t g_channel_locks[MAX_DRIVES / 2] = { MUTEX_INIT, MUTEX_INIT };
+
 /* Port I/O functions (defined in interrupts.asm) */
 extern void outb(uint16_t port, uint8_t value);
 extern uint8_t inb(uint16_t port);
@@ -131,8 +137,8 @@ int disk_read_sector(uint8_t drive, uint32_t lba, uint8_t* buffer) {
     return disk_read_sectors(drive, lba, 1, buffer);
 }
 
-/* Read multiple sectors from disk using CHS addressing */
-int disk_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buffer) {
+/* Read multiple sectors from disk using CHS addressing (channel locked) */
+static int ata_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buffer) {
     uint16_t base;
     uint8_t drive_sel;
     uint16_t* buffer_word = (uint16_t*)buffer;
@@ -189,8 +195,8 @@ int disk_write_sector(uint8_t drive, uint32_t lba, uint8_t* buffer) {
     return disk_write_sectors(drive, lba, 1, buffer);
 }
 
-/* Write multiple sectors to disk */
-int disk_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buffer) {
+/* Write multiple sectors to disk (channel locked) */
+static int ata_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buffer) {
     uint16_t base;
     uint8_t drive_sel;
     uint16_t* buffer_word = (uint16_t*)buffer;
@@ -242,6 +248,30 @@ int disk_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buff
     return count;
 }
 
+/* Read sectors, waiting for the channel if another transfer is using it */
+int disk_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buffer) {
+    if (drive >= MAX_DRIVES) {
+        return -1;
+    }
+
+    mutex_lock(&g_channel_locks[drive / 2]);
+    int result = ata_read_sectors(drive, lba, count, buffer);
+    mutex_unlock(&g_channel_locks[drive / 2]);
+    return result;
+}
+
+/* Write sectors, waiting for the channel if another transfer is using it */
+int disk_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t* buffer) {
+    if (drive >= MAX_DRIVES) {
+        return -1;
+    }
+
+    mutex_lock(&g_channel_locks[drive / 2]);
+    int result = ata_write_sectors(drive, lba, count, buffer);
+    mutex_unlock(&g_channel_locks[drive / 2]);
+    return result;
+}
+
 /* Get disk information */
 ata_disk_t* disk_get_info(uint8_t drive) {
     if (drive >= MAX_DRIVES) {
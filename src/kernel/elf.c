@@ -0,0 +1,144 @@
+#include "elf.h"
+#include "vfs.h"
+#include "paging.h"
+#include "process.h"
+
+/* ELF32 loader: validates headers and turns PT_LOAD segments into
+ * file-backed VMAs that are paged in by vmm_handle_fault() */
+
+/* Check the ELF header of an i386 executable */
+static int elf_check_header(const elf32_ehdr_t* ehdr) {
+    if (ehdr->e_ident[0] != ELF_MAGIC0 || ehdr->e_ident[1] != ELF_MAGIC1 ||
+        ehdr->e_ident[2] != ELF_MAGIC2 || ehdr->e_ident[3] != ELF_MAGIC3) {
+        return -1;
+    }
+
+    if (ehdr->e_ident[4] != ELF_CLASS32 || ehdr->e_ident[5] != ELF_DATA2LSB) {
+        return -1;
+    }
+
+    if (ehdr->e_type != ELF_ET_EXEC || ehdr->e_machine != ELF_EM_386) {
+        return -1;
+    }
+
+    if (ehdr->e_phentsize != sizeof(elf32_phdr_t) ||
+        ehdr->e_phnum == 0 || ehdr->e_phnum > ELF_MAX_PHDRS) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Add a PT_LOAD segment as a VMA */
+static int elf_add_segment(vm_area_t* vmas, int* count, const elf32_phdr_t* ph,
+                           uint32_t file_size) {
+    if (ph->p_memsz == 0) {
+        return 0;  /* Nothing to map */
+    }
+
+    uint32_t seg_end = ph->p_vaddr + ph->p_memsz;
+    if (ph->p_filesz > ph->p_memsz || seg_end < ph->p_vaddr) {
+        return -1;
+    }
+
+    /* Must lie in user space below the stack */
+    if (ph->p_vaddr < USER_SPACE_START ||
+        seg_end > USER_STACK_TOP - USER_STACK_SIZE) {
+        return -1;
+    }
+
+    if (ph->p_offset > file_size || ph->p_filesz > file_size - ph->p_offset) {
+        return -1;  /* Truncated file */
+    }
+
+    uint32_t start = PAGE_ALIGN_DOWN(ph->p_vaddr);
+    uint32_t end = PAGE_ALIGN_UP(seg_end);
+
+    /* Segments may not share pages: each page has one backing */
+    for (int i = 0; i < *count; i++) {
+        if (start < vmas[i].end && vmas[i].start < end) {
+            return -1;
+        }
+    }
+
+    if (*count >= PROCESS_MAX_VMAS - 1) {
+        return -1;  /* Last slot is reserved for the stack */
+    }
+
+    vm_area_t* vma = &vmas[(*count)++];
+    vma->start = start;
+    vma->end = end;
+    vma->flags = VMA_FILE;
+    if (ph->p_flags & ELF_PF_W) {
+        vma->flags |= VMA_WRITE;
+    }
+    vma->file_vaddr = ph->p_vaddr;
+    vma->file_offset = ph->p_offset;
+    vma->file_size = ph->p_filesz;
+
+    return 0;
+}
+
+/* Load and start an executable */
+int elf_exec(const char* filename, int argc, const char* argv[]) {
+    elf32_ehdr_t ehdr;
+    elf32_phdr_t ph;
+    vm_area_t vmas[PROCESS_MAX_VMAS];
+    int vma_count = 0;
+
+    int fd = vfs_open(filename, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    uint32_t file_size = vfs_size(fd);
+
+    if (vfs_read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr) ||
+        elf_check_header(&ehdr) < 0) {
+        vfs_close(fd);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < ehdr.e_phnum; i++) {
+        if (vfs_seek(fd, ehdr.e_phoff + i * sizeof(ph)) < 0 ||
+            vfs_read(fd, &ph, sizeof(ph)) != sizeof(ph)) {
+            vfs_close(fd);
+            return -1;
+        }
+
+        if (ph.p_type == ELF_PT_LOAD &&
+            elf_add_segment(vmas, &vma_count, &ph, file_size) < 0) {
+            vfs_close(fd);
+            return -1;
+        }
+    }
+
+    /* Entry point must be inside a loaded segment */
+    int entry_ok = 0;
+    for (int i = 0; i < vma_count; i++) {
+        if (ehdr.e_entry >= vmas[i].start && ehdr.e_entry < vmas[i].end) {
+            entry_ok = 1;
+        }
+    }
+    if (!entry_ok) {
+        vfs_close(fd);
+        return -1;
+    }
+
+    uint32_t page_dir = vmm_create_space();
+    if (!page_dir) {
+        vfs_close(fd);
+        return -1;
+    }
+
+    int pid = process_spawn_image(filename, page_dir, vmas, vma_count, fd,
+                                  ehdr.e_entry, argc, argv,
+                                  PROCESS_DEFAULT_PRIORITY);
+    if (pid < 0) {
+        vmm_destroy_space(page_dir);
+        vfs_close(fd);
+        return -1;
+    }
+
+    return pid;
+}
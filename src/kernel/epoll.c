@@ -0,0 +1,280 @@
+#include "epoll.h"
+#include "ipc.h"
+#include "socket.h"
+#include "drivers.h"
+#include "process.h"
+#include "waitqueue.h"
+#include "memory.h"
+#include "cpu.h"
+
+/* Readiness notification (see epoll.h) */
+
+typedef struct {
+    uint8_t in_use;
+    uint32_t ready;         /* Bit n set = watch n may be ready */
+    uint32_t owner_pid;
+    wait_queue_t waiters;
+} epoll_t;
+
+typedef struct {
+    uint8_t in_use;
+    uint8_t epfd;           /* Owning instance */
+    uint8_t source;         /* EPOLL_SRC_* */
+    int id;                 /* Pipe id / socket fd */
+    uint32_t events;        /* Interest mask */
+    uint32_t data;          /* Reported with the events */
+    poll_head_t* head;      /* Source's watch list, NULL for files */
+} epoll_watch_t;
+
+static epoll_t g_epolls[EPOLL_MAX_INSTANCES];
+static epoll_watch_t g_watches[EPOLL_MAX_WATCHES];
+
+/* Initialize the instance and watch tables */
+void epoll_init(void) {
+    memset(g_epolls, 0, sizeof(g_epolls));
+    memset(g_watches, 0, sizeof(g_watches));
+}
+
+static epoll_t* epoll_get(int epfd) {
+    if (epfd < 0 || epfd >= EPOLL_MAX_INSTANCES || !g_epolls[epfd].in_use) {
+        return NULL;
+    }
+    return &g_epolls[epfd];
+}
+
+/* Current events of a source, -1 if it does not exist */
+static int epoll_source_poll(int source, int id, poll_head_t** head) {
+    if (head) {
+        *head = NULL;
+    }
+
+    switch (source) {
+        case EPOLL_SRC_PIPE_READ:
+            return ipc_pipe_poll(id, IPC_PIPE_READ, head);
+        case EPOLL_SRC_PIPE_WRITE:
+            return ipc_pipe_poll(id, IPC_PIPE_WRITE, head);
+        case EPOLL_SRC_SOCKET:
+            return socket_poll(id, head);
+        case EPOLL_SRC_KEYBOARD:
+            return keyboard_poll(head);
+        case EPOLL_SRC_FILE:
+            return EPOLLIN | EPOLLOUT;
+        default:
+            return -1;
+    }
+}
+
+/* Mark the watches on head ready and wake their instances */
+void poll_notify(poll_head_t* head) {
+    uint32_t flags = cpu_irq_save();
+
+    uint32_t watchers = head->watchers;
+    while (watchers) {
+        uint32_t n = __builtin_ctz(watchers);
+        watchers &= watchers - 1;
+
+        epoll_t* ep = &g_epolls[g_watches[n].epfd];
+        ep->ready |= 1u << n;
+        if (wait_queue_active(&ep->waiters)) {
+            wait_queue_wake_all(&ep->waiters);
+        }
+    }
+
+    cpu_irq_restore(flags);
+}
+
+/* Create an instance */
+int epoll_create(void) {
+    uint32_t flags = cpu_irq_save();
+
+    for (int i = 0; i < EPOLL_MAX_INSTANCES; i++) {
+        epoll_t* ep = &g_epolls[i];
+        if (ep->in_use) {
+            continue;
+        }
+
+        process_t* proc = process_current();
+        ep->in_use = 1;
+        ep->ready = 0;
+        ep->owner_pid = proc ? proc->pid : 0;
+        wait_queue_init(&ep->waiters);
+
+        cpu_irq_restore(flags);
+        return i;
+    }
+
+    cpu_irq_restore(flags);
+    return -1;
+}
+
+/* Unhook a watch from its source; called with interrupts disabled */
+static void epoll_watch_remove(int n) {
+    epoll_watch_t* watch = &g_watches[n];
+
+    if (watch->head) {
+        watch->head->watchers &= ~(1u << n);
+    }
+    g_epolls[watch->epfd].ready &= ~(1u << n);
+    watch->in_use = 0;
+}
+
+/* Close an instance */
+int epoll_close(int epfd) {
+    uint32_t flags = cpu_irq_save();
+
+    epoll_t* ep = epoll_get(epfd);
+    if (!ep) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    for (int i = 0; i < EPOLL_MAX_WATCHES; i++) {
+        if (g_watches[i].in_use && g_watches[i].epfd == epfd) {
+            epoll_watch_remove(i);
+        }
+    }
+
+    ep->in_use = 0;
+    wait_queue_wake_all(&ep->waiters);
+
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+/* Find the watch of (source, id) in an instance */
+static int epoll_watch_find(int epfd, int source, int id) {
+    for (int i = 0; i < EPOLL_MAX_WATCHES; i++) {
+        epoll_watch_t* watch = &g_watches[i];
+        if (watch->in_use && watch->epfd == epfd && watch->source == source &&
+            watch->id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Free watch slot, or -1 */
+static int epoll_watch_alloc(void) {
+    for (int i = 0; i < EPOLL_MAX_WATCHES; i++) {
+        if (!g_watches[i].in_use) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Add, modify or remove interest in a source */
+int epoll_ctl(int epfd, int op, int source, int id, uint32_t events, uint32_t data) {
+    uint32_t flags = cpu_irq_save();
+    int result = -1;
+
+    epoll_t* ep = epoll_get(epfd);
+    int n = ep ? epoll_watch_find(epfd, source, id) : -1;
+
+    if (!ep) {
+        /* No instance */
+    } else if (op == EPOLL_CTL_DEL) {
+        if (n >= 0) {
+            epoll_watch_remove(n);
+            result = 0;
+        }
+    } else if (op == EPOLL_CTL_MOD) {
+        if (n >= 0) {
+            g_watches[n].events = events;
+            g_watches[n].data = data;
+            ep->ready |= 1u << n;  /* Re-evaluated by the next wait */
+            result = 0;
+        }
+    } else if (op == EPOLL_CTL_ADD && n < 0) {
+        poll_head_t* head;
+        n = epoll_watch_alloc();
+        if (n >= 0 && epoll_source_poll(source, id, &head) >= 0) {
+            epoll_watch_t* watch = &g_watches[n];
+            watch->in_use = 1;
+            watch->epfd = (uint8_t)epfd;
+            watch->source = (uint8_t)source;
+            watch->id = id;
+            watch->events = events;
+            watch->data = data;
+            watch->head = head;
+            if (head) {
+                head->watchers |= 1u << n;
+            }
+            ep->ready |= 1u << n;  /* May already be ready */
+            result = 0;
+        }
+    }
+
+    if (result == 0 && wait_queue_active(&ep->waiters)) {
+        wait_queue_wake_all(&ep->waiters);
+    }
+
+    cpu_irq_restore(flags);
+    return result;
+}
+
+/* Collect ready watches, sleeping until there is one if asked to */
+int epoll_wait(int epfd, epoll_event_t* events, int max_events, int block) {
+    if (!events || max_events <= 0) {
+        return -1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    epoll_t* ep = epoll_get(epfd);
+    if (!ep) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    int count = 0;
+    while (1) {
+        uint32_t pending = ep->ready;
+
+        while (pending && count < max_events) {
+            uint32_t n = __builtin_ctz(pending);
+            pending &= pending - 1;
+
+            /* Level-triggered: report only what is still ready */
+            epoll_watch_t* watch = &g_watches[n];
+            int ready = epoll_source_poll(watch->source, watch->id, NULL);
+            uint32_t mask = (ready < 0) ? EPOLLHUP
+                                        : (uint32_t)ready & (watch->events | EPOLLERR | EPOLLHUP);
+            if (!mask) {
+                ep->ready &= ~(1u << n);
+                continue;
+            }
+
+            events[count].events = mask;
+            events[count].data = watch->data;
+            count++;
+        }
+
+        if (count > 0 || !block) {
+            break;
+        }
+
+        wait_queue_sleep(&ep->waiters);
+        if (!ep->in_use) {
+            count = -1;  /* Closed while we slept */
+            break;
+        }
+    }
+
+    cpu_irq_restore(flags);
+    return count;
+}
+
+/* Close the instances owned by an exiting process */
+void epoll_release_process(uint32_t pid) {
+    for (int i = 0; i < EPOLL_MAX_INSTANCES; i++) {
+        if (g_epolls[i].in_use && g_epolls[i].owner_pid == pid) {
+            epoll_close(i);
+        }
+    }
+}
+
+const file_ops_t epoll_ops = {
+    .name = "epoll",
+    .close = epoll_close,
+};
@@ -0,0 +1,145 @@
+#include "fdtable.h"
+#include "epoll.h"
+#include "drivers.h"
+#include "memory.h"
+#include "cpu.h"
+
+/* Per-process file descriptor tables (see fdtable.h) */
+
+/* stdin: one line from the keyboard, without the newline */
+static int console_read(int handle, void* buffer, uint32_t count) {
+    (void)handle;
+
+    char* str = (char*)buffer;
+    uint32_t i = 0;
+    while (i < count) {
+        char c = keyboard_read_char();
+        if (c == '\n') {
+            str[i] = 0;
+            return (int)i;
+        }
+        str[i++] = c;
+    }
+    return (int)count;
+}
+
+/* stdout/stderr: the VGA console */
+static int console_write(int handle, const void* buffer, uint32_t count) {
+    (void)handle;
+
+    const char* str = (const char*)buffer;
+    for (uint32_t i = 0; i < count && str[i]; i++) {
+        vga_write_char(str[i]);
+    }
+    return (int)count;
+}
+
+const file_ops_t console_in_ops = {
+    .name = "console",
+    .poll_source = EPOLL_SRC_KEYBOARD,
+    .read = console_read,
+};
+
+const file_ops_t console_out_ops = {
+    .name = "console",
+    .write = console_write,
+};
+
+void fd_table_init(fd_table_t* table) {
+    memset(table->inline_entries, 0, sizeof(table->inline_entries));
+    table->entries = table->inline_entries;
+    table->capacity = FD_TABLE_INLINE;
+    table->lowest_free = 0;
+
+    fd_install(table, &console_in_ops, 0);
+    fd_install(table, &console_out_ops, 0);
+    fd_install(table, &console_out_ops, 0);
+}
+
+/* Double the table; the inline slots are copied out on the first growth */
+static int fd_table_grow(fd_table_t* table) {
+    if (table->capacity >= FD_TABLE_MAX) {
+        return -1;
+    }
+
+    uint32_t capacity = table->capacity * 2;
+    fd_entry_t* entries = (fd_entry_t*)malloc(capacity * sizeof(fd_entry_t));
+    if (!entries) {
+        return -1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    fd_entry_t* old = table->entries;
+    memcpy(entries, old, table->capacity * sizeof(fd_entry_t));
+    memset(entries + table->capacity, 0, (capacity - table->capacity) * sizeof(fd_entry_t));
+    table->entries = entries;
+    table->capacity = capacity;
+
+    cpu_irq_restore(flags);
+
+    if (old != table->inline_entries) {
+        free(old);
+    }
+    return 0;
+}
+
+int fd_install(fd_table_t* table, const file_ops_t* ops, int handle) {
+    if (!ops) {
+        return -1;
+    }
+
+    uint32_t fd = table->lowest_free;
+    while (fd < table->capacity && table->entries[fd].ops) {
+        fd++;
+    }
+
+    if (fd == table->capacity && fd_table_grow(table) < 0) {
+        return -1;  /* Too many open descriptors */
+    }
+
+    table->entries[fd].ops = ops;
+    table->entries[fd].handle = handle;
+    table->lowest_free = fd + 1;
+    return (int)fd;
+}
+
+void fd_remove(fd_table_t* table, int fd) {
+    if (!fd_get(table, fd)) {
+        return;
+    }
+
+    table->entries[fd].ops = NULL;
+    if ((uint32_t)fd < table->lowest_free) {
+        table->lowest_free = (uint32_t)fd;
+    }
+}
+
+int fd_close(fd_table_t* table, int fd) {
+    fd_entry_t* entry = fd_get(table, fd);
+    if (!entry) {
+        return -1;
+    }
+
+    /* Free the slot first so the fd never names a half-closed object */
+    const file_ops_t* ops = entry->ops;
+    int handle = entry->handle;
+    fd_remove(table, fd);
+
+    return ops->close ? ops->close(handle) : 0;
+}
+
+void fd_table_release(fd_table_t* table) {
+    for (uint32_t fd = 0; fd < table->capacity; fd++) {
+        if (table->entries[fd].ops) {
+            fd_close(table, (int)fd);
+        }
+    }
+
+    if (table->entries != table->inline_entries) {
+        free(table->entries);
+    }
+    table->entries = table->inline_entries;
+    table->capacity = FD_TABLE_INLINE;
+    table->lowest_free = 0;
+}
@@ -1,353 +1,1979 @@
 #include "filesystem.h"
 #include "disk.h"
+#include "bcache.h"
 #include "memory.h"
 #include "string.h"
-
-/* FAT12 File System Implementation */
+#include "paging.h"
+#include "epoll.h"
+#include "process.h"
+#include "cpu.h"
+#include "waitqueue.h"
+
+/* FAT12/FAT16/FAT32 File System Implementation
+ *
+ * All sector I/O goes through the buffer cache (bcache.h). The geometry
+ * comes from the BPB at mount (see fs_volume_t); clusters may span several
+ * sectors, and file positions map to clusters with shifts.
+ *
+ * Writes are write-back at every level: file data, FAT and subdirectory
+ * changes land in dirty cache buffers, root changes in the cached root
+ * directory, and the FAT and root keep masks of the sectors they touched.
+ * fs_sync() writes the changed FAT and root sectors into the cache and has
+ * it flush everything in LBA order. The "syncd" process, started by the
+ * first change, does that every FS_SYNC_INTERVAL ticks.
+ */
 
 /* Global state */
 static fs_file_t g_files[FS_MAX_FILES];
-static uint8_t* g_fat_cache = NULL;        /* Cached FAT (2 sectors = 1KB) */
+static fs_volume_t g_vol;                  /* Geometry from the BPB */
+static uint32_t* g_fat_dirty = NULL;       /* Bit n set = FAT sector n changed */
+static uint32_t g_fat_free_count = 0;
+static uint32_t g_fat_hint = 2;            /* Where the next free-cluster search starts */
+static uint16_t* g_fat_table = NULL;       /* Unpacked FAT (FAT12/16), NULL = read the cache */
+static uint32_t* g_free_map = NULL;        /* Bit n set = cluster n is free, NULL = scan */
+static uint8_t g_fsinfo_dirty = 0;         /* Free count changed since the last sync */
 static uint8_t* g_root_dir_cache = NULL;   /* Cached root directory */
+static uint32_t g_root_entries = 0;        /* Entries in g_root_dir_cache */
+static uint32_t* g_root_chain = NULL;      /* Clusters of the root directory (FAT32) */
+static uint32_t g_dir_dirty[(FS_ROOT_MAX_ENTRIES * sizeof(fs_dir_entry_t) / FS_BYTES_PER_SECTOR + 31) / 32];
+static int g_syncd_pid = -1;
 static uint8_t g_fs_initialized = 0;
 
-/* Cluster buffer for I/O */
-static uint8_t g_cluster_buffer[FS_BYTES_PER_SECTOR];
+/* Held by every entry point (fs_* and the VFS operations). The FAT, the
+ * open file table, the dentry cache and the root hash are updated across
+ * buffer cache calls that can sleep or be preempted, so two writers would
+ * otherwise take the same free cluster or file slot. Entry points call
+ * each other, which the mutex allows. */
+static mutex_t g_fs_lock = MUTEX_INIT;
+
+static void fs_lock(void) {
+    mutex_lock(&g_fs_lock);
+}
+
+static void fs_unlock(void) {
+    mutex_unlock(&g_fs_lock);
+}
 
-/* Helper: Convert LBA to cluster offset on disk */
+/* Helper: First sector of a data cluster */
 static uint32_t cluster_to_lba(uint32_t cluster) {
-    if (cluster < 2) {
-        return FS_ROOT_DIR_SECTOR;
+    return g_vol.data_start + (cluster - 2) * g_vol.sectors_per_cluster;
+}
+
+/* Cluster numbers that address the data area */
+static int cluster_valid(uint32_t cluster) {
+    return cluster >= 2 && cluster < g_vol.cluster_count + 2;
+}
+
+/* Sector s of the root directory */
+static uint32_t root_sector_lba(uint32_t s) {
+    if (g_vol.type != FS_TYPE_FAT32) {
+        return g_vol.root_start + s;
     }
-    return FS_DATA_START_SECTOR + ((cluster - 2) * FS_SECTORS_PER_CLUSTER);
+    return cluster_to_lba(g_root_chain[s / g_vol.sectors_per_cluster]) +
+           s % g_vol.sectors_per_cluster;
 }
 
-/* Helper: Find directory entry by filename */
-static int dir_find_entry(const char* filename, fs_dir_entry_t* entry) {
-    if (!g_root_dir_cache) {
+/* Root directory index
+ *
+ * Names are looked up through a hash table built at mount: every live
+ * root entry is chained into a bucket by the hash of its raw 11-byte 8.3
+ * name, and a lookup normalizes the requested name to that form
+ * ("readme.txt" -> "README  TXT") and compares 11 bytes per candidate.
+ * dir_index_add() indexes one entry, so creating a file only adds to it.
+ */
+
+#define DIR_HASH_SIZE   64      /* Power of two */
+
+static int16_t g_dir_hash[DIR_HASH_SIZE];      /* First entry per bucket, -1 = empty */
+static int16_t* g_dir_next = NULL;             /* Next entry in the same bucket */
+
+/* Convert "name.ext" to the padded, upper-case 8.3 form; -1 if it does not fit */
+static int fs_name_to_83(const char* filename, uint8_t name[11]) {
+    memset(name, ' ', 11);
+
+    int i = 0;
+    int len = 0;
+    for (; filename[i] && filename[i] != '.'; i++) {
+        if (len == 8) {
+            return -1;
+        }
+        name[len++] = (uint8_t)toupper(filename[i]);
+    }
+    if (len == 0) {
         return -1;
     }
 
-    fs_dir_entry_t* entries = (fs_dir_entry_t*)g_root_dir_cache;
-    
-    for (int i = 0; i < FS_ROOT_ENTRIES; i++) {
-        if (entries[i].filename[0] == 0x00) {
-            return -1;  /* End of directory */
-        }
-        
-        if (entries[i].filename[0] == 0xE5) {
-            continue;  /* Deleted entry */
+    if (filename[i] == '.') {
+        i++;
+        for (len = 0; filename[i]; i++) {
+            if (len == 3 || filename[i] == '.') {
+                return -1;
+            }
+            name[8 + len++] = (uint8_t)toupper(filename[i]);
         }
+    }
+    return 0;
+}
 
-        /* Convert 8.3 format to full filename */
-        char full_name[13];
-        int j = 0;
-        
-        /* Copy filename */
-        for (int k = 0; k < 8 && entries[i].filename[k] != ' '; k++) {
-            full_name[j++] = entries[i].filename[k];
+/* FNV-1a over the 11 name bytes */
+static uint32_t dir_hash(const uint8_t* name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 11; i++) {
+        hash = (hash ^ name[i]) * 16777619u;
+    }
+    return hash & (DIR_HASH_SIZE - 1);
+}
+
+/* Entries that are files or directories (not free, deleted, labels or LFN) */
+static int dir_entry_live(const fs_dir_entry_t* entry) {
+    return entry->filename[0] != 0x00 && entry->filename[0] != 0xE5 &&
+           !(entry->attributes & FS_ATTR_VOLUME);
+}
+
+/* First cluster of an entry (the high half is only used on FAT32) */
+static uint32_t dir_entry_cluster(const fs_dir_entry_t* entry) {
+    uint32_t cluster = entry->low_cluster;
+    if (g_vol.type == FS_TYPE_FAT32) {
+        cluster |= (uint32_t)entry->high_cluster << 16;
+    }
+    return cluster;
+}
+
+static void dir_entry_set_cluster(fs_dir_entry_t* entry, uint32_t cluster) {
+    entry->low_cluster = (uint16_t)cluster;
+    entry->high_cluster = (g_vol.type == FS_TYPE_FAT32) ? (uint16_t)(cluster >> 16) : 0;
+}
+
+/* "NAME.EXT" form of an entry's name (at most 13 bytes with the terminator) */
+static void dir_entry_name(const fs_dir_entry_t* entry, char* name) {
+    int j = 0;
+    for (int k = 0; k < 8 && entry->filename[k] != ' '; k++) {
+        name[j++] = (char)entry->filename[k];
+    }
+
+    if (entry->extension[0] != ' ') {
+        name[j++] = '.';
+        for (int k = 0; k < 3 && entry->extension[k] != ' '; k++) {
+            name[j++] = (char)entry->extension[k];
         }
+    }
+    name[j] = 0;
+}
 
-        /* Add dot if extension exists */
-        if (entries[i].extension[0] != ' ') {
-            full_name[j++] = '.';
-            for (int k = 0; k < 3 && entries[i].extension[k] != ' '; k++) {
-                full_name[j++] = entries[i].extension[k];
-            }
+static void dir_index_remove(int i) {
+    fs_dir_entry_t* entries = (fs_dir_entry_t*)g_root_dir_cache;
+    int16_t* link = &g_dir_hash[dir_hash(entries[i].filename)];
+
+    while (*link >= 0 && *link != i) {
+        link = &g_dir_next[*link];
+    }
+    if (*link == i) {
+        *link = g_dir_next[i];
+    }
+}
+
+static void dir_index_add(int i) {
+    fs_dir_entry_t* entries = (fs_dir_entry_t*)g_root_dir_cache;
+    uint32_t h = dir_hash(entries[i].filename);
+
+    g_dir_next[i] = g_dir_hash[h];
+    g_dir_hash[h] = (int16_t)i;
+}
+
+/* Index every live entry up to the end-of-directory marker */
+static void dir_index_build(void) {
+    fs_dir_entry_t* entries = (fs_dir_entry_t*)g_root_dir_cache;
+
+    for (int i = 0; i < DIR_HASH_SIZE; i++) {
+        g_dir_hash[i] = -1;
+    }
+
+    for (int i = 0; i < (int)g_root_entries && entries[i].filename[0] != 0x00; i++) {
+        if (dir_entry_live(&entries[i])) {
+            dir_index_add(i);
         }
-        full_name[j] = 0;
+    }
+}
+
+/* Entry of the root directory with an 8.3 name (one hash probe) */
+static int root_lookup(const uint8_t* name, fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    fs_dir_entry_t* entries = (fs_dir_entry_t*)g_root_dir_cache;
 
-        if (strcmp(full_name, filename) == 0) {
+    for (int16_t i = g_dir_hash[dir_hash(name)]; i >= 0; i = g_dir_next[i]) {
+        if (memcmp(entries[i].filename, name, 11) == 0) {
             *entry = entries[i];
-            return i;
+            loc->dir = 0;
+            loc->index = (uint32_t)i;
+            loc->lba = 0;
+            loc->offset = 0;
+            return 0;
         }
     }
 
     return -1;
 }
 
-/* Helper: Get next cluster from FAT12 */
-static uint32_t fat12_get_next(uint32_t cluster) {
-    if (!g_fat_cache) {
+/* File allocation table
+ *
+ * FAT sectors are read and written through the buffer cache like any
+ * other sector: fat_get()/fat_set() go to copy 0 and mark the sectors they
+ * change in g_fat_dirty. fat_flush() copies only those sectors to the
+ * other FAT copies. Entries are widened to FAT32 values on the way in
+ * (0xFF8 -> FS_CLUSTER_MAX...) so the rest of the code is type-agnostic.
+ *
+ * At mount the FAT is read once to count the free clusters and to fill a
+ * bitmap of them (16 KB for 128K clusters), and on FAT12/16 an unpacked
+ * copy of the table (at most 128 KB). fat_set() keeps both in step with
+ * the sectors. Allocation looks for the next set bit from a rotating hint,
+ * a word at a time. A FAT32 table would not fit the kernel heap, so
+ * fat_get() reads it from the cache. FAT32 volumes of more than
+ * FAT_FREE_MAP_MAX clusters take the free count from FSInfo instead, and
+ * without a bitmap (or when the heap is short) allocation scans entries.
+ */
+
+#define FAT_FREE_MAP_MAX    0x100000    /* Clusters; a 128 KB bitmap */
+
+/* Byte offset of a cluster's entry in the FAT */
+static uint32_t fat_offset(uint32_t cluster) {
+    switch (g_vol.type) {
+        case FS_TYPE_FAT12:
+            return cluster + cluster / 2;
+        case FS_TYPE_FAT16:
+            return cluster * 2;
+        default:
+            return cluster * 4;
+    }
+}
+
+/* Copy len bytes at a FAT offset out of (or, if store, into) FAT copy 0 */
+static int fat_access(uint32_t offset, void* data, uint32_t len, int store) {
+    uint8_t* bytes = (uint8_t*)data;
+
+    /* A FAT12 entry may straddle two sectors */
+    while (len > 0) {
+        uint32_t sector = offset / FS_BYTES_PER_SECTOR;
+        uint32_t in_sector = offset % FS_BYTES_PER_SECTOR;
+        uint32_t n = FS_BYTES_PER_SECTOR - in_sector;
+        if (n > len) {
+            n = len;
+        }
+
+        bcache_buf_t* buf = bcache_get(0, g_vol.fat_start + sector);
+        if (!buf) {
+            return -1;
+        }
+        if (store) {
+            memcpy(buf->data + in_sector, bytes, n);
+            bcache_mark_dirty(buf);
+            g_fat_dirty[sector / 32] |= 1u << (sector % 32);
+        } else {
+            memcpy(bytes, buf->data + in_sector, n);
+        }
+        bcache_release(buf);
+
+        offset += n;
+        bytes += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Helper: Get next cluster from the FAT */
+static uint32_t fat_get(uint32_t cluster) {
+    uint32_t value = 0;
+
+    if (!cluster_valid(cluster)) {
+        return FS_CLUSTER_EOF;
+    }
+    if (g_fat_table) {
+        value = g_fat_table[cluster];
+    } else if (fat_access(fat_offset(cluster), &value, g_vol.type == FS_TYPE_FAT32 ? 4 : 2, 0) < 0) {
         return FS_CLUSTER_EOF;
+    } else if (g_vol.type == FS_TYPE_FAT12) {
+        value = (cluster & 1) ? value >> 4 : value & 0xFFF;
     }
 
-    /* FAT12: Each entry is 1.5 bytes */
-    uint32_t fat_offset = cluster + (cluster / 2);
-    
-    if (fat_offset >= (FS_SECTORS_PER_FAT * FS_BYTES_PER_SECTOR)) {
+    switch (g_vol.type) {
+        case FS_TYPE_FAT12:
+            return value >= 0xFF7 ? value | 0x0FFFF000 : value;
+        case FS_TYPE_FAT16:
+            return value >= 0xFFF7 ? value | 0x0FFF0000 : value;
+        default:
+            return value & 0x0FFFFFFF;
+    }
+}
+
+/* Helper: Set next cluster in the FAT (copied to the other FATs by fat_flush()) */
+static void fat_set(uint32_t cluster, uint32_t next) {
+    if (!cluster_valid(cluster)) {
+        return;
+    }
+
+    uint32_t old = fat_get(cluster);
+    uint32_t offset = fat_offset(cluster);
+
+    if (g_vol.type == FS_TYPE_FAT12) {
+        uint16_t raw = 0;
+        fat_access(offset, &raw, 2, 0);
+        next &= 0xFFF;
+        raw = (cluster & 1) ? (uint16_t)((raw & 0x000F) | (next << 4))
+                            : (uint16_t)((raw & 0xF000) | next);
+        fat_access(offset, &raw, 2, 1);
+    } else if (g_vol.type == FS_TYPE_FAT16) {
+        uint16_t raw = (uint16_t)next;
+        fat_access(offset, &raw, 2, 1);
+    } else {
+        uint32_t raw = 0;
+        fat_access(offset, &raw, 4, 0);
+        raw = (raw & 0xF0000000) | (next & 0x0FFFFFFF);  /* Top 4 bits are reserved */
+        fat_access(offset, &raw, 4, 1);
+    }
+
+    if (g_fat_table) {
+        g_fat_table[cluster] = (uint16_t)next;
+    }
+    if (g_free_map) {
+        if (next == FS_CLUSTER_FREE) {
+            g_free_map[cluster / 32] |= 1u << (cluster % 32);
+        } else {
+            g_free_map[cluster / 32] &= ~(1u << (cluster % 32));
+        }
+    }
+
+    if (old == FS_CLUSTER_FREE && next != FS_CLUSTER_FREE) {
+        g_fat_free_count--;
+        g_fsinfo_dirty = 1;
+    } else if (old != FS_CLUSTER_FREE && next == FS_CLUSTER_FREE) {
+        g_fat_free_count++;
+        g_fsinfo_dirty = 1;
+    }
+}
+
+/* Find free cluster, starting after the last one handed out */
+static uint32_t fat_find_free_cluster(void) {
+    if (g_fat_free_count == 0) {
         return FS_CLUSTER_EOF;
     }
 
-    uint16_t value = *(uint16_t*)(g_fat_cache + fat_offset);
-    
-    if (cluster & 1) {
-        return (value >> 4) & 0xFFF;
+    uint32_t cluster = cluster_valid(g_fat_hint) ? g_fat_hint : 2;
+
+    if (g_free_map) {
+        /* Next set bit, a word at a time; ends back at the hint's own word */
+        uint32_t words = (g_vol.cluster_count + 2 + 31) / 32;
+        uint32_t w = cluster / 32;
+        uint32_t bits = g_free_map[w] & (0xFFFFFFFF << (cluster % 32));
+        for (uint32_t i = 0; i <= words; i++) {
+            if (bits) {
+                cluster = w * 32 + __builtin_ctz(bits);
+                g_fat_hint = cluster + 1;
+                return cluster;
+            }
+            w = (w + 1 < words) ? w + 1 : 0;
+            bits = g_free_map[w];
+        }
     } else {
-        return value & 0xFFF;
+        for (uint32_t i = 0; i < g_vol.cluster_count; i++, cluster++) {
+            if (!cluster_valid(cluster)) {
+                cluster = 2;
+            }
+            if (fat_get(cluster) == FS_CLUSTER_FREE) {
+                g_fat_hint = cluster + 1;
+                return cluster;
+            }
+        }
     }
+
+    g_fat_free_count = 0;  /* The count was off */
+    return FS_CLUSTER_EOF;
 }
 
-/* Helper: Set next cluster in FAT12 */
-static void fat12_set_next(uint32_t cluster, uint32_t next) {
-    if (!g_fat_cache) {
-        return;
+/* Count the free clusters, reading the FAT in large transfers; fills the
+ * unpacked table and free bitmap on the way when they are given */
+static uint32_t fat_count_free(uint16_t* table, uint32_t* free_map) {
+    uint32_t count = 0;
+    uint32_t prefetched = 0;
+
+    for (uint32_t cluster = 2; cluster < g_vol.cluster_count + 2; cluster++) {
+        uint32_t sector = (fat_offset(cluster) + 3) / FS_BYTES_PER_SECTOR;
+        if (sector >= prefetched && prefetched < g_vol.sectors_per_fat) {
+            uint32_t run = g_vol.sectors_per_fat - prefetched;
+            if (run > BCACHE_PREFETCH_MAX) {
+                run = BCACHE_PREFETCH_MAX;
+            }
+            bcache_prefetch(0, g_vol.fat_start + prefetched, run);
+            prefetched += run;
+        }
+
+        uint32_t next = fat_get(cluster);
+        if (table) {
+            table[cluster] = (uint16_t)next;
+        }
+        if (next == FS_CLUSTER_FREE) {
+            count++;
+            if (free_map) {
+                free_map[cluster / 32] |= 1u << (cluster % 32);
+            }
+        }
+    }
+    return count;
+}
+
+/* Allocate the unpacked FAT (FAT12/16) and the free bitmap and fill them
+ * from the FAT; either stays NULL if the heap has no room for it */
+static void fat_load(void) {
+    uint32_t clusters = g_vol.cluster_count + 2;
+    uint32_t map_size = ((clusters + 31) / 32) * sizeof(uint32_t);
+    uint16_t* table = NULL;
+
+    uint32_t* free_map = NULL;
+    if (clusters <= FAT_FREE_MAP_MAX) {
+        free_map = (uint32_t*)malloc(map_size);
+    }
+    if (free_map) {
+        memset(free_map, 0, map_size);
+    }
+    if (g_vol.type != FS_TYPE_FAT32) {
+        table = (uint16_t*)malloc(clusters * sizeof(uint16_t));
+    }
+
+    uint32_t fsinfo_count = g_fat_free_count;
+    g_fat_free_count = fat_count_free(table, free_map);
+    if (g_vol.fsinfo && g_fat_free_count != fsinfo_count) {
+        g_fsinfo_dirty = 1;  /* FSInfo was stale */
+    }
+
+    g_fat_table = table;
+    g_free_map = free_map;
+}
+
+/* Take the free count and search hint from FSInfo; -1 if it has none */
+static int fsinfo_load(void) {
+    if (!g_vol.fsinfo) {
+        return -1;
+    }
+
+    bcache_buf_t* buf = bcache_get(0, g_vol.fsinfo);
+    if (!buf) {
+        return -1;
+    }
+
+    uint32_t lead, sig, free_count, next_free;
+    memcpy(&lead, buf->data, 4);
+    memcpy(&sig, buf->data + 484, 4);
+    memcpy(&free_count, buf->data + FS_FSINFO_FREE_COUNT, 4);
+    memcpy(&next_free, buf->data + FS_FSINFO_NEXT_FREE, 4);
+    bcache_release(buf);
+
+    if (lead != FS_FSINFO_LEAD_SIG || sig != FS_FSINFO_STRUCT_SIG ||
+        free_count == FS_FSINFO_UNKNOWN || free_count > g_vol.cluster_count) {
+        return -1;
+    }
+
+    g_fat_free_count = free_count;
+    if (cluster_valid(next_free)) {
+        g_fat_hint = next_free;
+    }
+    return 0;
+}
+
+/* Store the current free count and hint in FSInfo */
+static int fsinfo_flush(void) {
+    if (!g_vol.fsinfo || !g_fsinfo_dirty) {
+        return 0;
+    }
+    g_fsinfo_dirty = 0;
+
+    bcache_buf_t* buf = bcache_get(0, g_vol.fsinfo);
+    if (!buf) {
+        g_fsinfo_dirty = 1;
+        return -1;
+    }
+
+    uint32_t lead;
+    memcpy(&lead, buf->data, 4);
+    if (lead == FS_FSINFO_LEAD_SIG) {
+        memcpy(buf->data + FS_FSINFO_FREE_COUNT, &g_fat_free_count, 4);
+        memcpy(buf->data + FS_FSINFO_NEXT_FREE, &g_fat_hint, 4);
+        bcache_mark_dirty(buf);
+    }
+    bcache_release(buf);
+    return 0;
+}
+
+/* Copy the changed sectors of FAT copy 0 to the other copies */
+static int fat_flush(void) {
+    uint32_t words = (g_vol.sectors_per_fat + 31) / 32;
+
+    for (uint32_t w = 0; w < words; w++) {
+        /* Snapshot: writers running meanwhile mark their sectors dirty again */
+        uint32_t flags = cpu_irq_save();
+        uint32_t dirty = g_fat_dirty[w];
+        g_fat_dirty[w] = 0;
+        cpu_irq_restore(flags);
+
+        while (dirty) {
+            uint32_t s = w * 32 + __builtin_ctz(dirty);
+            dirty &= dirty - 1;
+
+            bcache_buf_t* buf = bcache_get(0, g_vol.fat_start + s);
+            if (!buf) {
+                g_fat_dirty[w] |= 1u << (s % 32) | dirty;
+                return -1;
+            }
+            for (uint32_t copy = 1; copy < g_vol.num_fats; copy++) {
+                bcache_write(0, g_vol.fat_start + copy * g_vol.sectors_per_fat + s, 1, buf->data);
+            }
+            bcache_release(buf);
+        }
+    }
+    return 0;
+}
+
+/* Write the changed root directory sectors into the cache */
+static int dir_flush(void) {
+    uint8_t sector[FS_BYTES_PER_SECTOR];
+    uint32_t sectors = g_root_entries * sizeof(fs_dir_entry_t) / FS_BYTES_PER_SECTOR;
+
+    for (uint32_t s = 0; s < sectors; s++) {
+        uint32_t flags = cpu_irq_save();
+        if (!(g_dir_dirty[s / 32] & (1u << (s % 32)))) {
+            cpu_irq_restore(flags);
+            continue;
+        }
+        g_dir_dirty[s / 32] &= ~(1u << (s % 32));
+        memcpy(sector, g_root_dir_cache + s * FS_BYTES_PER_SECTOR, FS_BYTES_PER_SECTOR);
+        cpu_irq_restore(flags);
+
+        if (bcache_write(0, root_sector_lba(s), 1, sector) < 0) {
+            g_dir_dirty[s / 32] |= 1u << (s % 32);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Periodic write-back */
+static void fs_sync_daemon(void) {
+    while (1) {
+        process_sleep(FS_SYNC_INTERVAL);
+        fs_sync();
+    }
+}
+
+/* Something is waiting to be written back: make sure syncd runs */
+static void fs_dirtied(void) {
+    if (g_syncd_pid < 0) {
+        g_syncd_pid = process_spawn("syncd", fs_sync_daemon, PROCESS_DEFAULT_PRIORITY);
+    }
+}
+
+/* Directory entry i changed */
+static void dir_mark_dirty(int i) {
+    uint32_t s = (i * sizeof(fs_dir_entry_t)) / FS_BYTES_PER_SECTOR;
+    g_dir_dirty[s / 32] |= 1u << (s % 32);
+    fs_dirtied();
+}
+
+/* Mounting */
+
+/* Fill vol from the BPB in sector start; -1 if it does not hold a FAT volume */
+static int fs_parse_bpb(uint32_t start, fs_volume_t* vol) {
+    bcache_buf_t* buf = bcache_get(0, start);
+    if (!buf) {
+        return -1;
+    }
+    fs_bpb_t bpb;
+    memcpy(&bpb, buf->data, sizeof(bpb));
+    bcache_release(buf);
+
+    uint8_t spc = bpb.sectors_per_cluster;
+    if (bpb.bytes_per_sector != FS_BYTES_PER_SECTOR || spc == 0 || (spc & (spc - 1)) ||
+        bpb.reserved_sectors == 0 || bpb.num_fats == 0) {
+        return -1;
+    }
+
+    uint32_t total = bpb.total_sectors_16 ? bpb.total_sectors_16 : bpb.total_sectors_32;
+    uint32_t spf = bpb.sectors_per_fat_16 ? bpb.sectors_per_fat_16 : bpb.sectors_per_fat_32;
+    uint32_t root_sectors = (bpb.root_entries * sizeof(fs_dir_entry_t) + FS_BYTES_PER_SECTOR - 1) /
+                            FS_BYTES_PER_SECTOR;
+    uint32_t meta = bpb.reserved_sectors + bpb.num_fats * spf + root_sectors;
+    if (spf == 0 || total <= meta) {
+        return -1;
+    }
+
+    memset(vol, 0, sizeof(fs_volume_t));
+    vol->num_fats = bpb.num_fats;
+    vol->sectors_per_cluster = spc;
+    vol->bytes_per_cluster = (uint32_t)spc * FS_BYTES_PER_SECTOR;
+    vol->cluster_shift = (uint8_t)__builtin_ctz(vol->bytes_per_cluster);
+    vol->start = start;
+    vol->total_sectors = total;
+    vol->sectors_per_fat = spf;
+    vol->fat_start = start + bpb.reserved_sectors;
+    vol->root_start = vol->fat_start + bpb.num_fats * spf;
+    vol->root_sectors = root_sectors;
+    vol->data_start = start + meta;
+    vol->cluster_count = (total - meta) / spc;
+
+    /* The type is decided by the cluster count alone */
+    if (vol->cluster_count < 4085) {
+        vol->type = FS_TYPE_FAT12;
+    } else if (vol->cluster_count < 65525) {
+        vol->type = FS_TYPE_FAT16;
+    } else {
+        vol->type = FS_TYPE_FAT32;
+    }
+
+    if (vol->type == FS_TYPE_FAT32) {
+        if (bpb.root_entries != 0 || bpb.root_cluster < 2 ||
+            bpb.root_cluster >= vol->cluster_count + 2) {
+            return -1;
+        }
+        vol->root_cluster = bpb.root_cluster;
+        if (bpb.fsinfo_sector != 0 && bpb.fsinfo_sector != 0xFFFF) {
+            vol->fsinfo = start + bpb.fsinfo_sector;
+        }
+    } else if (root_sectors == 0 || bpb.root_entries > FS_ROOT_MAX_ENTRIES) {
+        return -1;
+    }
+
+    /* Never trust the cluster count beyond what the FAT can describe */
+    uint32_t fat_entries = (vol->type == FS_TYPE_FAT12) ? spf * FS_BYTES_PER_SECTOR * 2 / 3
+                                                        : spf * FS_BYTES_PER_SECTOR * 8 / vol->type;
+    if (vol->cluster_count + 2 > fat_entries) {
+        vol->cluster_count = fat_entries - 2;
+    }
+    return 0;
+}
+
+/* Find the volume: a BPB in sector 0, or the first FAT partition of an MBR */
+static int fs_find_volume(fs_volume_t* vol) {
+    if (fs_parse_bpb(0, vol) == 0) {
+        return 0;
+    }
+
+    uint8_t mbr[FS_BYTES_PER_SECTOR];
+    if (bcache_read(0, 0, 1, mbr) < 0 || mbr[510] != 0x55 || mbr[511] != 0xAA) {
+        return -1;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        const uint8_t* part = mbr + 446 + i * 16;
+        uint8_t type = part[4];
+        uint32_t lba;
+        memcpy(&lba, part + 8, 4);
+
+        if ((type == 0x01 || type == 0x04 || type == 0x06 || type == 0x0B ||
+             type == 0x0C || type == 0x0E) && lba != 0 && fs_parse_bpb(lba, vol) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Read the whole root directory into g_root_dir_cache */
+static int root_load(void) {
+    uint32_t sectors;
+
+    if (g_vol.type != FS_TYPE_FAT32) {
+        sectors = g_vol.root_sectors;
+    } else {
+        /* Follow the chain once to size it */
+        uint32_t per_cluster = g_vol.bytes_per_cluster / sizeof(fs_dir_entry_t);
+        uint32_t clusters = 0;
+        for (uint32_t c = g_vol.root_cluster; cluster_valid(c); c = fat_get(c)) {
+            if ((clusters + 1) * per_cluster > FS_ROOT_MAX_ENTRIES) {
+                return -1;
+            }
+            clusters++;
+        }
+
+        g_root_chain = (uint32_t*)malloc(clusters * sizeof(uint32_t));
+        if (!g_root_chain) {
+            return -1;
+        }
+        uint32_t c = g_vol.root_cluster;
+        for (uint32_t i = 0; i < clusters; i++, c = fat_get(c)) {
+            g_root_chain[i] = c;
+        }
+        sectors = clusters * g_vol.sectors_per_cluster;
+    }
+
+    g_root_entries = sectors * FS_BYTES_PER_SECTOR / sizeof(fs_dir_entry_t);
+    g_root_dir_cache = (uint8_t*)malloc(sectors * FS_BYTES_PER_SECTOR);
+    g_dir_next = (int16_t*)malloc(g_root_entries * sizeof(int16_t));
+    if (!g_root_dir_cache || !g_dir_next) {
+        return -1;
+    }
+
+    if (g_vol.type != FS_TYPE_FAT32) {
+        return bcache_read(0, g_vol.root_start, sectors, g_root_dir_cache) < 0 ? -1 : 0;
+    }
+
+    for (uint32_t i = 0; i < sectors / g_vol.sectors_per_cluster; i++) {
+        if (bcache_read(0, cluster_to_lba(g_root_chain[i]), g_vol.sectors_per_cluster,
+                        g_root_dir_cache + i * g_vol.bytes_per_cluster) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Add a zeroed cluster to a FAT32 root directory that is full */
+static int root_grow(void) {
+    uint32_t per_cluster = g_vol.bytes_per_cluster / sizeof(fs_dir_entry_t);
+    uint32_t clusters = g_root_entries / per_cluster;
+
+    if (g_vol.type != FS_TYPE_FAT32 || g_root_entries + per_cluster > FS_ROOT_MAX_ENTRIES) {
+        return -1;
+    }
+
+    uint32_t* chain = (uint32_t*)realloc(g_root_chain, (clusters + 1) * sizeof(uint32_t));
+    if (chain) {
+        g_root_chain = chain;
+    }
+    uint8_t* cache = (uint8_t*)realloc(g_root_dir_cache,
+                                       (clusters + 1) * g_vol.bytes_per_cluster);
+    if (cache) {
+        g_root_dir_cache = cache;
+    }
+    int16_t* next = (int16_t*)realloc(g_dir_next, (g_root_entries + per_cluster) * sizeof(int16_t));
+    if (next) {
+        g_dir_next = next;
+    }
+    if (!chain || !cache || !next) {
+        return -1;
+    }
+
+    uint32_t cluster = fs_allocate_cluster();
+    if (cluster >= FS_CLUSTER_MAX) {
+        return -1;
+    }
+    fat_set(g_root_chain[clusters - 1], cluster);
+    g_root_chain[clusters] = cluster;
+
+    memset(g_root_dir_cache + clusters * g_vol.bytes_per_cluster, 0, g_vol.bytes_per_cluster);
+    for (uint32_t i = 0; i < per_cluster; i += FS_BYTES_PER_SECTOR / sizeof(fs_dir_entry_t)) {
+        dir_mark_dirty((int)(g_root_entries + i));
+    }
+    g_root_entries += per_cluster;
+    return 0;
+}
+
+/* Directories
+ *
+ * A directory is named by its first cluster, 0 standing for the root. The
+ * root lives in g_root_dir_cache with its own name index; subdirectories
+ * are cluster chains read entry by entry through the buffer cache.
+ *
+ * Lookups in subdirectories go through the dentry cache, which maps
+ * (directory, 8.3 name) to where the entry lives, or records that the name
+ * does not exist there. A hit is one hash probe instead of a directory
+ * scan, so resolving a path touches no directory data for the levels seen
+ * before. Creating and deleting entries keep it current; removing a
+ * directory drops everything cached under it. Slots are recycled with a
+ * clock sweep that spares recently used ones.
+ */
+
+#define DCACHE_SIZE     128
+#define DCACHE_HASH     64      /* Buckets, a power of two */
+
+typedef struct {
+    uint32_t parent;            /* Directory searched, 0 = free slot */
+    uint8_t name[11];
+    uint8_t negative;           /* name does not exist in parent */
+    uint8_t referenced;         /* Used since the clock hand last passed */
+    int16_t hash_next;
+    fs_dirent_loc_t loc;
+} fs_dentry_t;
+
+static fs_dentry_t g_dcache[DCACHE_SIZE];
+static int16_t g_dcache_hash[DCACHE_HASH];
+static uint32_t g_dcache_hand = 0;
+
+static void dcache_init(void) {
+    memset(g_dcache, 0, sizeof(g_dcache));
+    for (int i = 0; i < DCACHE_HASH; i++) {
+        g_dcache_hash[i] = -1;
+    }
+    g_dcache_hand = 0;
+}
+
+static uint32_t dcache_bucket(uint32_t parent, const uint8_t* name) {
+    return (dir_hash(name) + parent * 31) & (DCACHE_HASH - 1);
+}
+
+static fs_dentry_t* dcache_find(uint32_t parent, const uint8_t* name) {
+    for (int16_t i = g_dcache_hash[dcache_bucket(parent, name)]; i >= 0;
+         i = g_dcache[i].hash_next) {
+        if (g_dcache[i].parent == parent && memcmp(g_dcache[i].name, name, 11) == 0) {
+            g_dcache[i].referenced = 1;
+            return &g_dcache[i];
+        }
+    }
+    return NULL;
+}
+
+/* Drop slot n from its hash chain and free it */
+static void dcache_drop(int n) {
+    int16_t* link = &g_dcache_hash[dcache_bucket(g_dcache[n].parent, g_dcache[n].name)];
+    while (*link >= 0) {
+        if (*link == n) {
+            *link = g_dcache[n].hash_next;
+            break;
+        }
+        link = &g_dcache[*link].hash_next;
+    }
+    g_dcache[n].parent = 0;
+}
+
+/* Record where (parent, name) lives, or with loc NULL that it does not exist */
+static void dcache_insert(uint32_t parent, const uint8_t* name, const fs_dirent_loc_t* loc) {
+    fs_dentry_t* d = dcache_find(parent, name);
+
+    if (!d) {
+        /* Clock sweep: take a free slot or one not used since the last pass */
+        int n;
+        while (1) {
+            n = (int)g_dcache_hand;
+            g_dcache_hand = (g_dcache_hand + 1) % DCACHE_SIZE;
+            if (!g_dcache[n].parent || !g_dcache[n].referenced) {
+                break;
+            }
+            g_dcache[n].referenced = 0;
+        }
+        if (g_dcache[n].parent) {
+            dcache_drop(n);
+        }
+
+        d = &g_dcache[n];
+        d->parent = parent;
+        memcpy(d->name, name, 11);
+        d->referenced = 1;
+        uint32_t bucket = dcache_bucket(parent, name);
+        d->hash_next = g_dcache_hash[bucket];
+        g_dcache_hash[bucket] = (int16_t)n;
+    }
+
+    d->negative = loc ? 0 : 1;
+    if (loc) {
+        d->loc = *loc;
+    }
+}
+
+/* Forget everything cached under a directory */
+static void dcache_purge(uint32_t parent) {
+    for (int i = 0; i < DCACHE_SIZE; i++) {
+        if (g_dcache[i].parent == parent) {
+            dcache_drop(i);
+        }
+    }
+}
+
+/* Copy a directory entry out of the root cache or its sector */
+static int dirent_load(const fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    if (loc->dir == 0) {
+        *entry = ((fs_dir_entry_t*)g_root_dir_cache)[loc->index];
+        return 0;
+    }
+
+    bcache_buf_t* buf = bcache_get(0, loc->lba);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(entry, buf->data + loc->offset, sizeof(fs_dir_entry_t));
+    bcache_release(buf);
+    return 0;
+}
+
+/* Store a directory entry; written back with the rest of the dirty state */
+static int dirent_store(const fs_dirent_loc_t* loc, const fs_dir_entry_t* entry) {
+    if (loc->dir == 0) {
+        ((fs_dir_entry_t*)g_root_dir_cache)[loc->index] = *entry;
+        dir_mark_dirty((int)loc->index);
+        return 0;
+    }
+
+    bcache_buf_t* buf = bcache_get(0, loc->lba);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf->data + loc->offset, entry, sizeof(fs_dir_entry_t));
+    bcache_mark_dirty(buf);
+    bcache_release(buf);
+    fs_dirtied();
+    return 0;
+}
+
+/* Directory a directory entry points to ("..", on FAT32, may name the root
+ * by its cluster rather than 0) */
+static uint32_t dir_entry_dir(const fs_dir_entry_t* entry) {
+    uint32_t cluster = dir_entry_cluster(entry);
+    if (g_vol.type == FS_TYPE_FAT32 && cluster == g_vol.root_cluster) {
+        return 0;
+    }
+    return cluster;
+}
+
+/* Zero every sector of a cluster in the cache, without reading it */
+static int cluster_zero(uint32_t cluster) {
+    for (uint32_t s = 0; s < g_vol.sectors_per_cluster; s++) {
+        bcache_buf_t* buf = bcache_get_new(0, cluster_to_lba(cluster) + s);
+        if (!buf) {
+            return -1;
+        }
+        bcache_mark_dirty(buf);
+        bcache_release(buf);
+    }
+    fs_dirtied();
+    return 0;
+}
+
+/* Walks the slots of a directory, free ones included */
+typedef struct {
+    uint32_t dir;
+    uint32_t index;             /* Slots visited */
+    uint32_t cluster;           /* Cluster of the next slot (subdirectories) */
+} dir_cursor_t;
+
+static void dir_open(dir_cursor_t* cur, uint32_t dir) {
+    cur->dir = dir;
+    cur->index = 0;
+    cur->cluster = dir;
+}
+
+/* Next slot and its location; -1 past the end of the directory */
+static int dir_next(dir_cursor_t* cur, fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    loc->dir = cur->dir;
+    loc->index = cur->index;
+    loc->lba = 0;
+    loc->offset = 0;
+
+    if (cur->dir == 0) {
+        if (cur->index >= g_root_entries) {
+            return -1;
+        }
+    } else {
+        uint32_t per_cluster = g_vol.bytes_per_cluster / sizeof(fs_dir_entry_t);
+        uint32_t byte = (cur->index % per_cluster) * sizeof(fs_dir_entry_t);
+
+        if (cur->index > 0 && byte == 0) {
+            cur->cluster = fat_get(cur->cluster);
+        }
+        if (!cluster_valid(cur->cluster)) {
+            return -1;
+        }
+        loc->lba = cluster_to_lba(cur->cluster) + byte / FS_BYTES_PER_SECTOR;
+        loc->offset = (uint16_t)(byte % FS_BYTES_PER_SECTOR);
+    }
+
+    if (dirent_load(loc, entry) < 0) {
+        return -1;
+    }
+    cur->index++;
+    return 0;
+}
+
+/* Find a name in a directory */
+static int dir_lookup(uint32_t dir, const uint8_t* name, fs_dirent_loc_t* loc,
+                      fs_dir_entry_t* entry) {
+    if (dir == 0) {
+        return root_lookup(name, loc, entry);
+    }
+
+    fs_dentry_t* d = dcache_find(dir, name);
+    if (d) {
+        if (d->negative) {
+            return -1;
+        }
+        *loc = d->loc;
+        return dirent_load(loc, entry);
+    }
+
+    dir_cursor_t cur;
+    dir_open(&cur, dir);
+    while (dir_next(&cur, loc, entry) == 0 && entry->filename[0] != 0x00) {
+        if (dir_entry_live(entry) && memcmp(entry->filename, name, 11) == 0) {
+            dcache_insert(dir, name, loc);
+            return 0;
+        }
+    }
+
+    dcache_insert(dir, name, NULL);
+    return -1;
+}
+
+/* Put a new entry in the first free slot of a directory, growing it when
+ * there is none; its location is returned in loc */
+static int dir_add_entry(uint32_t dir, const fs_dir_entry_t* entry, fs_dirent_loc_t* loc) {
+    fs_dir_entry_t slot;
+    uint32_t last = dir;
+    int found = 0;
+    dir_cursor_t cur;
+
+    dir_open(&cur, dir);
+    while (!found && dir_next(&cur, loc, &slot) == 0) {
+        last = cur.cluster;
+        found = (slot.filename[0] == 0x00 || slot.filename[0] == 0xE5);
+    }
+
+    if (!found) {
+        /* Full: the root has its own way to grow, a subdirectory gets a cluster */
+        if (dir == 0) {
+            loc->index = g_root_entries;
+            if (root_grow() < 0) {
+                return -1;
+            }
+        } else {
+            uint32_t cluster = fs_allocate_cluster();
+            if (cluster >= FS_CLUSTER_MAX) {
+                return -1;
+            }
+            fat_set(last, cluster);
+            if (cluster_zero(cluster) < 0) {
+                return -1;
+            }
+            loc->index = cur.index;
+            loc->lba = cluster_to_lba(cluster);
+            loc->offset = 0;
+        }
+    }
+
+    if (dirent_store(loc, entry) < 0) {
+        return -1;
+    }
+    if (dir == 0) {
+        dir_index_add((int)loc->index);
+    } else {
+        dcache_insert(dir, entry->filename, loc);
+    }
+    return 0;
+}
+
+/* Mark an entry deleted */
+static int dir_remove_entry(const fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    uint8_t name[11];
+
+    memcpy(name, entry->filename, 11);
+    if (loc->dir == 0) {
+        dir_index_remove((int)loc->index);
+    }
+    entry->filename[0] = 0xE5;
+    if (dirent_store(loc, entry) < 0) {
+        return -1;
+    }
+    if (loc->dir != 0) {
+        dcache_insert(loc->dir, name, NULL);
+    }
+    return 0;
+}
+
+/* Path resolution */
+
+/* Split the next component off *path; returns its length, 0 at the end */
+static int path_next(const char** path, const char** comp) {
+    const char* p = *path;
+
+    while (*p == '/') {
+        p++;
+    }
+    *comp = p;
+    while (*p && *p != '/') {
+        p++;
+    }
+    *path = p;
+    return (int)(p - *comp);
+}
+
+/* 8.3 form of a path component; "." and ".." as they are stored */
+static int path_component_83(const char* comp, int len, uint8_t name[11]) {
+    char buf[13];
+
+    if (len <= 0 || len > 12) {
+        return -1;
+    }
+    if (comp[0] == '.' && (len == 1 || (len == 2 && comp[1] == '.'))) {
+        memset(name, ' ', 11);
+        memset(name, '.', len);
+        return 0;
+    }
+    memcpy(buf, comp, len);
+    buf[len] = 0;
+    return fs_name_to_83(buf, name);
+}
+
+/* Directory holding the last component of a path, and that component in
+ * 8.3 form; -1 if the path is empty or a directory on the way is missing */
+static int path_parent(const char* path, uint32_t* dir, uint8_t name[11]) {
+    const char* comp;
+    int len = path_next(&path, &comp);
+    uint32_t cur = 0;
+
+    if (len == 0) {
+        return -1;
+    }
+
+    while (1) {
+        if (path_component_83(comp, len, name) < 0) {
+            return -1;
+        }
+
+        const char* next;
+        int next_len = path_next(&path, &next);
+        if (next_len == 0) {
+            *dir = cur;
+            return 0;
+        }
+
+        /* The root has no "." or ".." entries: both stay at the root */
+        if (cur != 0 || name[0] != '.') {
+            fs_dirent_loc_t loc;
+            fs_dir_entry_t entry;
+            if (dir_lookup(cur, name, &loc, &entry) < 0 ||
+                !(entry.attributes & FS_ATTR_DIRECTORY)) {
+                return -1;
+            }
+            cur = dir_entry_dir(&entry);
+        }
+
+        comp = next;
+        len = next_len;
+    }
+}
+
+/* Entry a path names; -1 if it does not exist or names the root */
+static int path_lookup(const char* path, fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    uint32_t dir;
+    uint8_t name[11];
+
+    if (!path || path_parent(path, &dir, name) < 0 || (dir == 0 && name[0] == '.')) {
+        return -1;
+    }
+    return dir_lookup(dir, name, loc, entry);
+}
+
+/* Directory a path names */
+static int path_dir(const char* path, uint32_t* dir) {
+    uint8_t name[11];
+    const char* comp;
+    const char* rest = path;
+
+    if (!path || path_next(&rest, &comp) == 0) {
+        *dir = 0;
+        return 0;
+    }
+    if (path_parent(path, dir, name) < 0) {
+        return -1;
+    }
+    if (*dir == 0 && name[0] == '.') {
+        return 0;
+    }
+
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+    if (dir_lookup(*dir, name, &loc, &entry) < 0 || !(entry.attributes & FS_ATTR_DIRECTORY)) {
+        return -1;
+    }
+    *dir = dir_entry_dir(&entry);
+    return 0;
+}
+
+/* Initialize file system */
+static int fs_init_locked(void) {
+    if (g_fs_initialized) {
+        return 0;
+    }
+
+    /* Initialize file table */
+    for (int i = 0; i < FS_MAX_FILES; i++) {
+        g_files[i].in_use = 0;
+    }
+
+    if (fs_find_volume(&g_vol) < 0) {
+        return -1;
+    }
+
+    g_fat_dirty = (uint32_t*)malloc(((g_vol.sectors_per_fat + 31) / 32) * sizeof(uint32_t));
+    if (!g_fat_dirty) {
+        return -1;
+    }
+    memset(g_fat_dirty, 0, ((g_vol.sectors_per_fat + 31) / 32) * sizeof(uint32_t));
+    memset(g_dir_dirty, 0, sizeof(g_dir_dirty));
+
+    /* FSInfo gives the hint, and the count if the FAT is not read now */
+    g_fat_hint = 2;
+    g_fat_free_count = 0;
+    if (fsinfo_load() < 0 || g_vol.cluster_count + 2 <= FAT_FREE_MAP_MAX) {
+        fat_load();
+    }
+
+    if (root_load() < 0) {
+        return -1;
+    }
+    dir_index_build();
+    dcache_init();
+
+    g_fs_initialized = 1;
+    return 0;
+}
+
+int fs_init(void) {
+    fs_lock();
+    int result = fs_init_locked();
+    fs_unlock();
+    return result;
+}
+
+static void fs_file_update(fs_file_t* file);
+
+/* Open the file whose directory entry is at loc */
+static int fs_open_entry(const fs_dirent_loc_t* loc, const fs_dir_entry_t* entry, uint8_t mode) {
+    /* Find free file descriptor */
+    int fd = -1;
+    for (int i = 0; i < FS_MAX_FILES; i++) {
+        if (!g_files[i].in_use) {
+            fd = i;
+            break;
+        }
+    }
+
+    if (fd < 0) {
+        return -1;  /* No free file descriptors */
+    }
+
+    if ((entry->attributes & FS_ATTR_DIRECTORY) ||
+        ((mode & FS_OPEN_WRITE) && (entry->attributes & FS_ATTR_READ_ONLY))) {
+        return -1;
+    }
+
+    /* Initialize file descriptor */
+    g_files[fd].in_use = 1;
+    uint32_t start_cluster = dir_entry_cluster(entry);
+    g_files[fd].start_cluster = start_cluster;
+    g_files[fd].current_cluster = start_cluster;
+    g_files[fd].current_offset = 0;
+    g_files[fd].file_size = entry->file_size;
+    g_files[fd].position = 0;
+    g_files[fd].ra_next = 0;
+    g_files[fd].ra_limit = 0;
+    g_files[fd].ra_window = 0;
+    g_files[fd].extents = NULL;
+    g_files[fd].extent_count = 0;
+    g_files[fd].extent_capacity = 0;
+    g_files[fd].mapped_clusters = 0;
+    g_files[fd].map_next = start_cluster;
+    g_files[fd].loc = *loc;
+    g_files[fd].mode = mode;
+    g_files[fd].attributes = entry->attributes;
+    dir_entry_name(entry, g_files[fd].filename);
+
+    if ((mode & FS_OPEN_TRUNC) && (mode & FS_OPEN_WRITE) && entry->file_size) {
+        fs_free_cluster_chain(start_cluster);
+        g_files[fd].start_cluster = 0;
+        g_files[fd].current_cluster = 0;
+        g_files[fd].file_size = 0;
+        g_files[fd].map_next = 0;
+        fs_file_update(&g_files[fd]);
+    }
+
+    return fd;
+}
+
+/* Open file */
+static int fs_open_locked(const char* filename, uint8_t mode) {
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+
+    if (!g_fs_initialized || !filename) {
+        return -1;
+    }
+
+    int found = path_lookup(filename, &loc, &entry);
+    if (found < 0 && (mode & FS_OPEN_CREATE) && fs_create(filename, 0) == 0) {
+        found = path_lookup(filename, &loc, &entry);
+    }
+    if (found < 0) {
+        return -1;  /* File not found */
+    }
+    return fs_open_entry(&loc, &entry, mode);
+}
+
+int fs_open(const char* filename, uint8_t mode) {
+    fs_lock();
+    int result = fs_open_locked(filename, mode);
+    fs_unlock();
+    return result;
+}
+
+/* Close file */
+int fs_close(int fd) {
+    if (fd < 0 || fd >= FS_MAX_FILES) {
+        return -1;
+    }
+
+    fs_lock();
+    int result = -1;
+    if (g_files[fd].in_use) {
+        free(g_files[fd].extents);
+        g_files[fd].extents = NULL;
+        g_files[fd].in_use = 0;
+        result = 0;
+    }
+    fs_unlock();
+    return result;
+}
+
+/* Map the next run of contiguous clusters from the FAT into the file's
+ * extent list; -1 at the end of the chain or when out of memory */
+static int fs_extent_extend(fs_file_t* file) {
+    uint32_t total = (file->file_size + g_vol.bytes_per_cluster - 1) >> g_vol.cluster_shift;
+    uint32_t start = file->map_next;
+
+    if (file->mapped_clusters >= total || !cluster_valid(start)) {
+        return -1;
+    }
+
+    if (file->extent_count == file->extent_capacity) {
+        uint16_t capacity = file->extent_capacity ? file->extent_capacity * 2 : FS_EXTENTS_INITIAL;
+        fs_extent_t* grown = (fs_extent_t*)realloc(file->extents, capacity * sizeof(fs_extent_t));
+        if (!grown) {
+            return -1;
+        }
+        file->extents = grown;
+        file->extent_capacity = capacity;
+    }
+
+    /* Follow the chain while it stays contiguous (and within the file) */
+    uint32_t length = 1;
+    uint32_t next = fat_get(start);
+    while (next == start + length && file->mapped_clusters + length < total) {
+        length++;
+        next = fat_get(next);
+    }
+
+    fs_extent_t* extent = &file->extents[file->extent_count++];
+    extent->file_cluster = file->mapped_clusters;
+    extent->disk_cluster = start;
+    extent->length = length;
+
+    file->mapped_clusters += length;
+    file->map_next = next;
+    return 0;
+}
+
+/* Extent holding cluster n of the file, NULL past the end of the chain */
+static fs_extent_t* fs_extent_find(fs_file_t* file, uint32_t n) {
+    while (n >= file->mapped_clusters) {
+        if (fs_extent_extend(file) < 0) {
+            return NULL;
+        }
+    }
+
+    /* Last extent starting at or before n */
+    uint32_t lo = 0;
+    uint32_t hi = file->extent_count - 1u;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (file->extents[mid].file_cluster <= n) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return &file->extents[lo];
+}
+
+/* Disk cluster of cluster n of the file, FS_CLUSTER_EOF past the end */
+static uint32_t fs_file_cluster(fs_file_t* file, uint32_t n) {
+    fs_extent_t* extent = fs_extent_find(file, n);
+    return extent ? extent->disk_cluster + (n - extent->file_cluster) : FS_CLUSTER_EOF;
+}
+
+/* Prefetch the clusters ahead of a sequential reader, one multi-sector
+ * transfer per extent. The window doubles on each
+ * call up to FS_RA_MAX_SECTORS; the next prefetch is due halfway through
+ * it, so the reader never waits for the disk while the pattern holds. */
+static void fs_readahead(fs_file_t* file) {
+    uint32_t window = file->ra_window ? file->ra_window * 2u : FS_RA_MIN_SECTORS;
+    if (window > FS_RA_MAX_SECTORS) {
+        window = FS_RA_MAX_SECTORS;
+    }
+    file->ra_window = (uint16_t)window;
+
+    /* Never past the end of the file */
+    uint32_t sector_pos = file->position - file->position % FS_BYTES_PER_SECTOR;
+    uint32_t left = (file->file_size - sector_pos + FS_BYTES_PER_SECTOR - 1) / FS_BYTES_PER_SECTOR;
+    if (window > left) {
+        window = left;
+    }
+
+    uint32_t n = sector_pos >> g_vol.cluster_shift;
+    uint32_t end = ((sector_pos + window * FS_BYTES_PER_SECTOR - 1) >> g_vol.cluster_shift) + 1;
+
+    while (n < end) {
+        fs_extent_t* extent = fs_extent_find(file, n);
+        if (!extent) {
+            break;
+        }
+
+        uint32_t run = extent->file_cluster + extent->length - n;
+        if (run > end - n) {
+            run = end - n;
+        }
+        bcache_prefetch(0, cluster_to_lba(extent->disk_cluster + (n - extent->file_cluster)),
+                        run * g_vol.sectors_per_cluster);
+        n += run;
+    }
+
+    uint32_t half = window > 1 ? window / 2 : 1;
+    file->ra_limit = sector_pos + half * FS_BYTES_PER_SECTOR;
+}
+
+/* Read from file */
+static int fs_read_locked(int fd, uint8_t* buffer, uint16_t count) {
+    if (fd < 0 || fd >= FS_MAX_FILES || !g_files[fd].in_use || !buffer) {
+        return -1;
+    }
+
+    fs_file_t* file = &g_files[fd];
+    uint32_t bytes_read = 0;
+    uint32_t remaining = count;
+
+    /* Sequential if this read continues where the last one stopped */
+    int sequential = (file->position == file->ra_next);
+    if (!sequential) {
+        file->ra_window = 0;
+        file->ra_limit = 0;
+
+        /* Fetch the part of the current cluster this read covers in one transfer */
+        uint32_t in_cluster = file->position & (g_vol.bytes_per_cluster - 1);
+        uint32_t span = g_vol.bytes_per_cluster - in_cluster;
+        if (span > count) {
+            span = count;
+        }
+        if (span > FS_BYTES_PER_SECTOR && file->position < file->file_size) {
+            uint32_t first = in_cluster / FS_BYTES_PER_SECTOR;
+            uint32_t last = (in_cluster + span - 1) / FS_BYTES_PER_SECTOR;
+            bcache_prefetch(0, cluster_to_lba(file->current_cluster) + first, last - first + 1);
+        }
+    }
+
+    while (remaining > 0 && file->position < file->file_size) {
+        if (sequential && file->position >= file->ra_limit) {
+            fs_readahead(file);
+        }
+
+        /* Sector of the current cluster, from the cache if possible */
+        uint32_t in_cluster = file->position & (g_vol.bytes_per_cluster - 1);
+        bcache_buf_t* buf = bcache_get(0, cluster_to_lba(file->current_cluster) +
+                                          in_cluster / FS_BYTES_PER_SECTOR);
+        if (!buf) {
+            break;
+        }
+
+        /* Copy data from the sector */
+        uint32_t offset_in_sector = file->position % FS_BYTES_PER_SECTOR;
+        uint32_t to_copy = FS_BYTES_PER_SECTOR - offset_in_sector;
+        
+        if (to_copy > remaining) {
+            to_copy = remaining;
+        }
+        if (file->position + to_copy > file->file_size) {
+            to_copy = file->file_size - file->position;
+        }
+
+        memcpy(buffer, buf->data + offset_in_sector, to_copy);
+        bcache_release(buf);
+
+        buffer += to_copy;
+        file->position += to_copy;
+        bytes_read += to_copy;
+        remaining -= to_copy;
+
+        /* Move to next cluster if needed */
+        if ((file->position & (g_vol.bytes_per_cluster - 1)) == 0 && file->position < file->file_size) {
+            uint32_t next = fs_file_cluster(file, file->position >> g_vol.cluster_shift);
+            if (next >= FS_CLUSTER_MAX) {
+                break;  /* EOF */
+            }
+            file->current_cluster = next;
+        }
+    }
+
+    file->ra_next = file->position;
+    return bytes_read;
+}
+
+int fs_read(int fd, uint8_t* buffer, uint16_t count) {
+    fs_lock();
+    int result = fs_read_locked(fd, buffer, count);
+    fs_unlock();
+    return result;
+}
+
+/* Append a newly allocated cluster to the file's chain and extent map */
+static int fs_extent_append(fs_file_t* file, uint32_t cluster) {
+    fs_extent_t* last = file->extent_count ? &file->extents[file->extent_count - 1] : NULL;
+
+    if (last && last->disk_cluster + last->length == cluster) {
+        last->length++;
+    } else {
+        if (file->extent_count == file->extent_capacity) {
+            uint16_t capacity = file->extent_capacity ? file->extent_capacity * 2 : FS_EXTENTS_INITIAL;
+            fs_extent_t* grown = (fs_extent_t*)realloc(file->extents, capacity * sizeof(fs_extent_t));
+            if (!grown) {
+                return -1;
+            }
+            file->extents = grown;
+            file->extent_capacity = capacity;
+        }
+
+        fs_extent_t* extent = &file->extents[file->extent_count++];
+        extent->file_cluster = file->mapped_clusters;
+        extent->disk_cluster = cluster;
+        extent->length = 1;
+    }
+
+    file->mapped_clusters++;
+    file->map_next = FS_CLUSTER_EOF;
+    return 0;
+}
+
+/* Disk cluster for cluster n of a file being written, allocating it when
+ * n is one past the end of the chain; FS_CLUSTER_EOF if the disk is full
+ * or n is further out (the chain has no holes) */
+static uint32_t fs_write_cluster_for(fs_file_t* file, uint32_t n) {
+    /* Map the whole chain first so a new cluster goes at its end */
+    uint32_t allocated = (file->file_size + g_vol.bytes_per_cluster - 1) >> g_vol.cluster_shift;
+    if (allocated > 0 && !fs_extent_find(file, allocated - 1)) {
+        return FS_CLUSTER_EOF;
+    }
+    if (n < file->mapped_clusters) {
+        return fs_file_cluster(file, n);
+    }
+    if (n != file->mapped_clusters) {
+        return FS_CLUSTER_EOF;
+    }
+
+    fs_extent_t* tail = file->extent_count ? &file->extents[file->extent_count - 1] : NULL;
+    uint32_t prev = tail ? tail->disk_cluster + tail->length - 1 : 0;
+
+    uint32_t cluster = fs_allocate_cluster();
+    if (cluster >= FS_CLUSTER_MAX) {
+        return FS_CLUSTER_EOF;
+    }
+    if (fs_extent_append(file, cluster) < 0) {
+        fat_set(cluster, FS_CLUSTER_FREE);
+        return FS_CLUSTER_EOF;
+    }
+
+    if (prev) {
+        fat_set(prev, cluster);
+    } else {
+        file->start_cluster = cluster;
+    }
+    return cluster;
+}
+
+/* Copy size and first cluster into the directory entry and into the other
+ * descriptors of the same file, whose extent maps are rebuilt on demand */
+static void fs_file_update(fs_file_t* file) {
+    fs_dir_entry_t entry;
+    if (dirent_load(&file->loc, &entry) == 0) {
+        dir_entry_set_cluster(&entry, file->start_cluster);
+        entry.file_size = file->file_size;
+        entry.attributes |= FS_ATTR_ARCHIVE;
+        dirent_store(&file->loc, &entry);
+    }
+
+    for (int i = 0; i < FS_MAX_FILES; i++) {
+        fs_file_t* other = &g_files[i];
+        if (!other->in_use || other == file || other->loc.dir != file->loc.dir ||
+            other->loc.index != file->loc.index) {
+            continue;
+        }
+        other->start_cluster = file->start_cluster;
+        other->file_size = file->file_size;
+        other->extent_count = 0;
+        other->mapped_clusters = 0;
+        other->map_next = file->start_cluster;
+        if (other->position > other->file_size) {
+            other->position = other->file_size;  /* Truncated under it */
+        }
+        if (other->position < other->file_size) {
+            other->current_cluster = fs_file_cluster(other, other->position >> g_vol.cluster_shift);
+        }
+    }
+}
+
+/* Write to file */
+static int fs_write_locked(int fd, const uint8_t* buffer, uint16_t count) {
+    if (fd < 0 || fd >= FS_MAX_FILES || !g_files[fd].in_use || !buffer) {
+        return -1;
+    }
+
+    fs_file_t* file = &g_files[fd];
+    if (!(file->mode & FS_OPEN_WRITE)) {
+        return -1;
+    }
+    if (file->mode & FS_OPEN_APPEND) {
+        file->position = file->file_size;
+    }
+
+    uint32_t written = 0;
+    uint32_t start_cluster = file->start_cluster;
+    while (written < count) {
+        uint32_t cluster = fs_write_cluster_for(file, file->position >> g_vol.cluster_shift);
+        if (cluster >= FS_CLUSTER_MAX) {
+            break;  /* Disk full */
+        }
+
+        uint32_t in_cluster = file->position & (g_vol.bytes_per_cluster - 1);
+        uint32_t lba = cluster_to_lba(cluster) + in_cluster / FS_BYTES_PER_SECTOR;
+        uint32_t offset = file->position % FS_BYTES_PER_SECTOR;
+        uint32_t to_copy = FS_BYTES_PER_SECTOR - offset;
+        if (to_copy > count - written) {
+            to_copy = count - written;
+        }
+
+        /* No need to read a sector that is overwritten or new */
+        bcache_buf_t* buf;
+        if (offset == 0 && (to_copy == FS_BYTES_PER_SECTOR || file->position >= file->file_size)) {
+            buf = bcache_get_new(0, lba);
+        } else {
+            buf = bcache_get(0, lba);
+        }
+        if (!buf) {
+            break;
+        }
+
+        memcpy(buf->data + offset, buffer + written, to_copy);
+        bcache_mark_dirty(buf);
+        bcache_release(buf);
+
+        file->current_cluster = cluster;
+        file->position += to_copy;
+        written += to_copy;
+        if (file->position > file->file_size) {
+            file->file_size = file->position;
+        }
+    }
+
+    if (written > 0 || file->start_cluster != start_cluster) {
+        fs_file_update(file);
+    }
+
+    /* fs_read() expects the cluster holding position */
+    if (file->position < file->file_size && (file->position & (g_vol.bytes_per_cluster - 1)) == 0) {
+        file->current_cluster = fs_file_cluster(file, file->position >> g_vol.cluster_shift);
+    }
+
+    return written > 0 ? (int)written : (count ? -1 : 0);
+}
+
+int fs_write(int fd, const uint8_t* buffer, uint16_t count) {
+    fs_lock();
+    int result = fs_write_locked(fd, buffer, count);
+    fs_unlock();
+    return result;
+}
+
+/* Seek in file */
+static int fs_seek_locked(int fd, uint32_t offset) {
+    if (fd < 0 || fd >= FS_MAX_FILES || !g_files[fd].in_use) {
+        return -1;
     }
 
-    uint32_t fat_offset = cluster + (cluster / 2);
+    fs_file_t* file = &g_files[fd];
     
-    if (cluster & 1) {
-        uint16_t* ptr = (uint16_t*)(g_fat_cache + fat_offset);
-        *ptr = (*ptr & 0x000F) | ((next & 0xFFF) << 4);
-    } else {
-        uint16_t* ptr = (uint16_t*)(g_fat_cache + fat_offset);
-        *ptr = (*ptr & 0xF000) | (next & 0xFFF);
+    if (offset > file->file_size) {
+        return -1;
     }
-}
 
-/* Find free cluster in FAT */
-static uint32_t fat12_find_free_cluster(void) {
-    for (uint32_t i = 2; i < 0xFF0; i++) {
-        if (fat12_get_next(i) == FS_CLUSTER_FREE) {
-            return i;
+    /* Binary search in the extent map (extended from the FAT on first use) */
+    if (offset < file->file_size) {
+        uint32_t cluster = fs_file_cluster(file, offset >> g_vol.cluster_shift);
+        if (cluster >= FS_CLUSTER_MAX) {
+            return -1;
         }
+        file->current_cluster = cluster;
     }
-    return FS_CLUSTER_EOF;
+
+    file->position = offset;
+    return 0;
 }
 
-/* Initialize file system */
-int fs_init(void) {
-    if (g_fs_initialized) {
-        return 0;
-    }
+int fs_seek(int fd, uint32_t offset) {
+    fs_lock();
+    int result = fs_seek_locked(fd, offset);
+    fs_unlock();
+    return result;
+}
 
-    /* Initialize file table */
-    for (int i = 0; i < FS_MAX_FILES; i++) {
-        g_files[i].in_use = 0;
-    }
+/* Descriptor operations */
 
-    /* Allocate FAT cache */
-    g_fat_cache = (uint8_t*)malloc(FS_SECTORS_PER_FAT * FS_BYTES_PER_SECTOR);
-    if (!g_fat_cache) {
-        return -1;
-    }
+/* fs_read()/fs_write() take 16-bit counts; larger requests are short
+ * transfers, which callers of read()/write() already handle */
+#define FS_IO_MAX       0x8000
 
-    /* Allocate root directory cache */
-    g_root_dir_cache = (uint8_t*)malloc(FS_ROOT_DIR_SECTORS * FS_BYTES_PER_SECTOR);
-    if (!g_root_dir_cache) {
-        free(g_fat_cache);
+static uint16_t fs_io_count(uint32_t count) {
+    return (uint16_t)(count > FS_IO_MAX ? FS_IO_MAX : count);
+}
+
+static int fs_fd_read(int fd, void* buffer, uint32_t count) {
+    /* Fault the buffer in first: demand paging reads through the
+     * filesystem too, and must not run in the middle of fs_read() */
+    uint16_t n = fs_io_count(count);
+    if (vmm_prefault((uint32_t)buffer, n) < 0) {
         return -1;
     }
+    return fs_read(fd, (uint8_t*)buffer, n);
+}
 
-    /* Read FAT from disk */
-    if (disk_read_sectors(0, FS_FAT_START_SECTOR, FS_SECTORS_PER_FAT, g_fat_cache) < 0) {
+static int fs_fd_write(int fd, const void* buffer, uint32_t count) {
+    uint16_t n = fs_io_count(count);
+    if (vmm_prefault((uint32_t)buffer, n) < 0) {
         return -1;
     }
+    return fs_write(fd, (const uint8_t*)buffer, n);
+}
 
-    /* Read root directory from disk */
-    if (disk_read_sectors(0, FS_ROOT_DIR_SECTOR, FS_ROOT_DIR_SECTORS, g_root_dir_cache) < 0) {
-        return -1;
+const file_ops_t fs_file_ops = {
+    .name = "file",
+    .poll_source = EPOLL_SRC_FILE,
+    .read = fs_fd_read,
+    .write = fs_fd_write,
+    .seek = fs_seek,
+    .close = fs_close,
+};
+
+/* Get file size */
+uint32_t fs_get_size(int fd) {
+    if (fd < 0 || fd >= FS_MAX_FILES) {
+        return 0;
     }
 
-    g_fs_initialized = 1;
-    return 0;
+    fs_lock();
+    uint32_t size = g_files[fd].in_use ? g_files[fd].file_size : 0;
+    fs_unlock();
+    return size;
 }
 
-/* Open file */
-int fs_open(const char* filename, uint8_t mode) {
-    (void)mode;  /* Mode not fully supported yet */
+/* Geometry of the mounted volume */
+const fs_volume_t* fs_get_volume(void) {
+    return g_fs_initialized ? &g_vol : NULL;
+}
 
-    if (!g_fs_initialized || !filename) {
+/* Delete the file whose entry is at loc */
+static int fat_delete(const fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    if (entry->attributes & (FS_ATTR_DIRECTORY | FS_ATTR_READ_ONLY)) {
         return -1;
     }
 
-    /* Find free file descriptor */
-    int fd = -1;
     for (int i = 0; i < FS_MAX_FILES; i++) {
-        if (!g_files[i].in_use) {
-            fd = i;
-            break;
+        if (g_files[i].in_use && g_files[i].loc.dir == loc->dir &&
+            g_files[i].loc.index == loc->index) {
+            return -1;  /* Still open */
         }
     }
 
-    if (fd < 0) {
-        return -1;  /* No free file descriptors */
+    if (dir_entry_cluster(entry)) {
+        fs_free_cluster_chain(dir_entry_cluster(entry));
     }
 
-    /* Find file in directory */
-    fs_dir_entry_t entry;
-    if (dir_find_entry(filename, &entry) < 0) {
-        return -1;  /* File not found */
-    }
+    return dir_remove_entry(loc, entry);
+}
 
-    /* Initialize file descriptor */
-    g_files[fd].in_use = 1;
-    g_files[fd].start_cluster = entry.low_cluster;
-    g_files[fd].current_cluster = entry.low_cluster;
-    g_files[fd].current_offset = 0;
-    g_files[fd].file_size = entry.file_size;
-    g_files[fd].position = 0;
-    g_files[fd].attributes = entry.attributes;
-    strncpy(g_files[fd].filename, filename, sizeof(g_files[fd].filename) - 1);
+/* Delete file */
+int fs_delete(const char* filename) {
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
 
-    return fd;
+    fs_lock();
+    int result = -1;
+    if (g_fs_initialized && path_lookup(filename, &loc, &entry) >= 0) {
+        result = fat_delete(&loc, &entry);
+    }
+    fs_unlock();
+    return result;
 }
 
-/* Close file */
-int fs_close(int fd) {
-    if (fd < 0 || fd >= FS_MAX_FILES || !g_files[fd].in_use) {
+/* New entry called name for dir; -1 if the name is taken or reserved */
+static int fat_new_entry(uint32_t dir, const uint8_t* name, uint8_t attributes,
+                         fs_dir_entry_t* entry) {
+    fs_dirent_loc_t loc;
+
+    if (name[0] == '.' || dir_lookup(dir, name, &loc, entry) == 0) {
         return -1;
     }
 
-    g_files[fd].in_use = 0;
+    memset(entry, 0, sizeof(fs_dir_entry_t));
+    memcpy(entry->filename, name, 11);
+    entry->attributes = attributes;
     return 0;
 }
 
-/* Read from file */
-int fs_read(int fd, uint8_t* buffer, uint16_t count) {
-    if (fd < 0 || fd >= FS_MAX_FILES || !g_files[fd].in_use || !buffer) {
+/* Create an empty file in dir */
+static int fat_create(uint32_t dir, const uint8_t* name, uint8_t attributes,
+                      fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    attributes = (uint8_t)((attributes & (FS_ATTR_READ_ONLY | FS_ATTR_HIDDEN | FS_ATTR_SYSTEM)) |
+                           FS_ATTR_ARCHIVE);
+    if (fat_new_entry(dir, name, attributes, entry) < 0) {
         return -1;
     }
+    return dir_add_entry(dir, entry, loc);
+}
 
-    fs_file_t* file = &g_files[fd];
-    uint32_t bytes_read = 0;
-    uint32_t remaining = count;
+/* Create file */
+int fs_create(const char* filename, uint8_t attributes) {
+    fs_dir_entry_t entry;
+    fs_dirent_loc_t loc;
+    uint8_t name[11];
+    uint32_t dir;
 
-    while (remaining > 0 && file->position < file->file_size) {
-        /* Read current cluster */
-        if (disk_read_sector(0, cluster_to_lba(file->current_cluster), g_cluster_buffer) < 0) {
-            break;
-        }
+    if (!filename) {
+        return -1;
+    }
 
-        /* Copy data from cluster */
-        uint32_t offset_in_cluster = file->position % FS_BYTES_PER_SECTOR;
-        uint32_t to_copy = FS_BYTES_PER_SECTOR - offset_in_cluster;
-        
-        if (to_copy > remaining) {
-            to_copy = remaining;
-        }
-        if (file->position + to_copy > file->file_size) {
-            to_copy = file->file_size - file->position;
-        }
+    fs_lock();
+    int result = -1;
+    if (g_fs_initialized && path_parent(filename, &dir, name) >= 0) {
+        result = fat_create(dir, name, attributes, &loc, &entry);
+    }
+    fs_unlock();
+    return result;
+}
 
-        memcpy(buffer, g_cluster_buffer + offset_in_cluster, to_copy);
+/* Create a directory in parent: one zeroed cluster holding "." and ".." */
+static int fat_mkdir(uint32_t parent, const uint8_t* name) {
+    fs_dir_entry_t entry;
+    fs_dirent_loc_t loc;
 
-        buffer += to_copy;
-        file->position += to_copy;
-        bytes_read += to_copy;
-        remaining -= to_copy;
+    if (fat_new_entry(parent, name, FS_ATTR_DIRECTORY, &entry) < 0) {
+        return -1;
+    }
 
-        /* Move to next cluster if needed */
-        if (file->position % FS_BYTES_PER_SECTOR == 0 && file->position < file->file_size) {
-            uint32_t next = fat12_get_next(file->current_cluster);
-            if (next >= FS_CLUSTER_MAX) {
-                break;  /* EOF */
-            }
-            file->current_cluster = next;
-        }
+    uint32_t cluster = fs_allocate_cluster();
+    if (cluster >= FS_CLUSTER_MAX) {
+        return -1;
+    }
+    if (cluster_zero(cluster) < 0) {
+        fs_free_cluster_chain(cluster);
+        return -1;
     }
 
-    return bytes_read;
+    fs_dir_entry_t dot = entry;
+    memset(dot.filename, ' ', 11);
+    dot.filename[0] = '.';
+    dir_entry_set_cluster(&dot, cluster);
+    loc.dir = cluster;
+    loc.index = 0;
+    loc.lba = cluster_to_lba(cluster);
+    loc.offset = 0;
+    dirent_store(&loc, &dot);
+
+    dot.filename[1] = '.';
+    dir_entry_set_cluster(&dot, parent);
+    loc.index = 1;
+    loc.offset = sizeof(fs_dir_entry_t);
+    dirent_store(&loc, &dot);
+
+    dir_entry_set_cluster(&entry, cluster);
+    if (dir_add_entry(parent, &entry, &loc) < 0) {
+        fs_free_cluster_chain(cluster);
+        return -1;
+    }
+    return 0;
 }
 
-/* Write to file (stub - not fully implemented) */
-int fs_write(int fd, const uint8_t* buffer, uint16_t count) {
-    (void)fd;
-    (void)buffer;
-    (void)count;
-    return -1;  /* Not implemented yet */
-}
+/* Create directory */
+int fs_mkdir(const char* path) {
+    uint8_t name[11];
+    uint32_t parent;
 
-/* Seek in file */
-int fs_seek(int fd, uint32_t offset) {
-    if (fd < 0 || fd >= FS_MAX_FILES || !g_files[fd].in_use) {
+    if (!path) {
         return -1;
     }
 
-    fs_file_t* file = &g_files[fd];
-    
-    if (offset > file->file_size) {
+    fs_lock();
+    int result = -1;
+    if (g_fs_initialized && path_parent(path, &parent, name) >= 0) {
+        result = fat_mkdir(parent, name);
+    }
+    fs_unlock();
+    return result;
+}
+
+/* Remove the directory whose entry is at loc, if it is empty */
+static int fat_rmdir(const fs_dirent_loc_t* loc, fs_dir_entry_t* entry) {
+    if (!(entry->attributes & FS_ATTR_DIRECTORY) || entry->filename[0] == '.') {
         return -1;
     }
 
-    file->position = offset;
-    
-    /* Reset to start and navigate to offset */
-    file->current_cluster = file->start_cluster;
-    uint32_t pos = 0;
+    uint32_t dir = dir_entry_dir(entry);
+    if (dir == 0) {
+        return -1;
+    }
 
-    while (pos < offset && pos < file->file_size) {
-        uint32_t next = fat12_get_next(file->current_cluster);
-        if (next >= FS_CLUSTER_MAX) {
+    /* Only "." and ".." may be left */
+    fs_dirent_loc_t child_loc;
+    fs_dir_entry_t child;
+    dir_cursor_t cur;
+    dir_open(&cur, dir);
+    while (dir_next(&cur, &child_loc, &child) == 0 && child.filename[0] != 0x00) {
+        if (dir_entry_live(&child) && child.filename[0] != '.') {
             return -1;
         }
-        file->current_cluster = next;
-        pos += FS_BYTES_PER_SECTOR;
     }
 
-    return 0;
-}
-
-/* Get file size */
-uint32_t fs_get_size(int fd) {
-    if (fd < 0 || fd >= FS_MAX_FILES || !g_files[fd].in_use) {
-        return 0;
-    }
-    return g_files[fd].file_size;
+    dcache_purge(dir);
+    fs_free_cluster_chain(dir);
+    return dir_remove_entry(loc, entry);
 }
 
-/* Delete file (stub) */
-int fs_delete(const char* filename) {
-    (void)filename;
-    return -1;  /* Not implemented yet */
-}
+/* Remove directory */
+int fs_rmdir(const char* path) {
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
 
-/* Create file (stub) */
-int fs_create(const char* filename, uint8_t attributes) {
-    (void)filename;
-    (void)attributes;
-    return -1;  /* Not implemented yet */
+    fs_lock();
+    int result = -1;
+    if (g_fs_initialized && path_lookup(path, &loc, &entry) >= 0) {
+        result = fat_rmdir(&loc, &entry);
+    }
+    fs_unlock();
+    return result;
 }
 
 /* List directory */
-int fs_list_dir(const char* dirname, fs_dir_info_t* entries, int max_entries) {
-    (void)dirname;
-    
-    if (!g_fs_initialized || !entries) {
+static int fs_list_dir_locked(const char* dirname, fs_dir_info_t* entries, int max_entries) {
+    uint32_t dir;
+
+    if (!g_fs_initialized || !entries || path_dir(dirname, &dir) < 0) {
         return -1;
     }
 
-    fs_dir_entry_t* dir_entries = (fs_dir_entry_t*)g_root_dir_cache;
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+    dir_cursor_t cur;
     int count = 0;
 
-    for (int i = 0; i < FS_ROOT_ENTRIES && count < max_entries; i++) {
-        if (dir_entries[i].filename[0] == 0x00) {
+    dir_open(&cur, dir);
+    while (count < max_entries && dir_next(&cur, &loc, &entry) == 0) {
+        if (entry.filename[0] == 0x00) {
             break;
         }
 
-        if (dir_entries[i].filename[0] == 0xE5 || dir_entries[i].attributes & FS_ATTR_VOLUME) {
+        if (!dir_entry_live(&entry) || entry.filename[0] == '.') {
             continue;
         }
 
-        /* Build filename */
-        int j = 0;
-        for (int k = 0; k < 8 && dir_entries[i].filename[k] != ' '; k++) {
-            entries[count].filename[j++] = dir_entries[i].filename[k];
-        }
-
-        if (dir_entries[i].extension[0] != ' ') {
-            entries[count].filename[j++] = '.';
-            for (int k = 0; k < 3 && dir_entries[i].extension[k] != ' '; k++) {
-                entries[count].filename[j++] = dir_entries[i].extension[k];
-            }
-        }
-        entries[count].filename[j] = 0;
-
-        entries[count].attributes = dir_entries[i].attributes;
-        entries[count].file_size = dir_entries[i].file_size;
-        entries[count].start_cluster = dir_entries[i].low_cluster;
-        entries[count].write_date = dir_entries[i].write_date;
-        entries[count].write_time = dir_entries[i].write_time;
+        dir_entry_name(&entry, entries[count].filename);
+        entries[count].attributes = entry.attributes;
+        entries[count].file_size = entry.file_size;
+        entries[count].start_cluster = dir_entry_cluster(&entry);
+        entries[count].write_date = entry.write_date;
+        entries[count].write_time = entry.write_time;
 
         count++;
     }
@@ -355,52 +1981,63 @@ int fs_list_dir(const char* dirname, fs_dir_info_t* entries, int max_entries) {
     return count;
 }
 
+int fs_list_dir(const char* dirname, fs_dir_info_t* entries, int max_entries) {
+    fs_lock();
+    int result = fs_list_dir_locked(dirname, entries, max_entries);
+    fs_unlock();
+    return result;
+}
+
 /* Check if file exists */
 int fs_file_exists(const char* filename) {
+    fs_dirent_loc_t loc;
     fs_dir_entry_t entry;
-    return (dir_find_entry(filename, &entry) >= 0) ? 1 : 0;
+
+    fs_lock();
+    int exists = (g_fs_initialized && path_lookup(filename, &loc, &entry) >= 0) ? 1 : 0;
+    fs_unlock();
+    return exists;
 }
 
 /* Get file info */
-int fs_get_file_info(const char* filename, fs_dir_info_t* info) {
+static int fs_get_file_info_locked(const char* filename, fs_dir_info_t* info) {
     if (!info) {
         return -1;
     }
 
+    fs_dirent_loc_t loc;
     fs_dir_entry_t entry;
-    if (dir_find_entry(filename, &entry) < 0) {
+    if (!g_fs_initialized || path_lookup(filename, &loc, &entry) < 0) {
         return -1;
     }
 
-    /* Build filename */
-    int j = 0;
-    for (int k = 0; k < 8 && entry.filename[k] != ' '; k++) {
-        info->filename[j++] = entry.filename[k];
-    }
-
-    if (entry.extension[0] != ' ') {
-        info->filename[j++] = '.';
-        for (int k = 0; k < 3 && entry.extension[k] != ' '; k++) {
-            info->filename[j++] = entry.extension[k];
-        }
-    }
-    info->filename[j] = 0;
-
+    dir_entry_name(&entry, info->filename);
     info->attributes = entry.attributes;
     info->file_size = entry.file_size;
-    info->start_cluster = entry.low_cluster;
+    info->start_cluster = dir_entry_cluster(&entry);
     info->write_date = entry.write_date;
     info->write_time = entry.write_time;
 
     return 0;
 }
 
+int fs_get_file_info(const char* filename, fs_dir_info_t* info) {
+    fs_lock();
+    int result = fs_get_file_info_locked(filename, info);
+    fs_unlock();
+    return result;
+}
+
 /* Read cluster from disk */
 int fs_read_cluster(uint32_t cluster, uint8_t* buffer) {
     if (!buffer) {
         return -1;
     }
-    return disk_read_sector(0, cluster_to_lba(cluster), buffer);
+
+    fs_lock();
+    int result = bcache_read(0, cluster_to_lba(cluster), g_vol.sectors_per_cluster, buffer);
+    fs_unlock();
+    return result;
 }
 
 /* Write cluster to disk */
@@ -408,21 +2045,316 @@ int fs_write_cluster(uint32_t cluster, const uint8_t* buffer) {
     if (!buffer) {
         return -1;
     }
-    return disk_write_sector(0, cluster_to_lba(cluster), (uint8_t*)buffer);
+
+    fs_lock();
+    fs_dirtied();
+    int result = bcache_write(0, cluster_to_lba(cluster), g_vol.sectors_per_cluster, buffer);
+    fs_unlock();
+    return result;
 }
 
 /* Get next cluster from FAT */
 uint32_t fs_get_next_cluster(uint32_t cluster) {
-    return fat12_get_next(cluster);
+    fs_lock();
+    uint32_t next = fat_get(cluster);
+    fs_unlock();
+    return next;
 }
 
-/* Allocate new cluster */
+/* Allocate new cluster, marked as the end of a chain */
 uint32_t fs_allocate_cluster(void) {
-    return fat12_find_free_cluster();
+    fs_lock();
+    uint32_t cluster = fat_find_free_cluster();
+    if (cluster < FS_CLUSTER_MAX) {
+        fat_set(cluster, FS_CLUSTER_EOF);
+        fs_dirtied();
+    }
+    fs_unlock();
+    return cluster;
+}
+
+/* Write back everything dirty, metadata first */
+static int fs_sync_locked(void) {
+    if (!g_fs_initialized) {
+        return -1;
+    }
+
+    int result = 0;
+    if (fat_flush() < 0 || fsinfo_flush() < 0) {
+        result = -1;
+    }
+    if (dir_flush() < 0) {
+        result = -1;
+    }
+    if (bcache_flush() < 0) {
+        result = -1;
+    }
+    return result;
+}
+
+int fs_sync(void) {
+    fs_lock();
+    int result = fs_sync_locked();
+    fs_unlock();
+    return result;
 }
 
 /* Free cluster chain */
 int fs_free_cluster_chain(uint32_t start_cluster) {
-    (void)start_cluster;
-    return -1;  /* Not implemented yet */
+    uint32_t cluster = start_cluster;
+
+    fs_lock();
+    /* Bounded, in case the chain loops on a damaged volume */
+    for (uint32_t n = 0; cluster_valid(cluster) && n < g_vol.cluster_count; n++) {
+        uint32_t next = fat_get(cluster);
+        fat_set(cluster, FS_CLUSTER_FREE);
+        cluster = next;
+    }
+    fs_dirtied();
+    fs_unlock();
+    return cluster_valid(cluster) ? -1 : 0;
+}
+
+/* VFS backend
+ *
+ * The volume on drive 0 mounts as type "fat". Directory inodes are
+ * numbered by their first cluster (0 = root); every inode keeps where its
+ * directory entry lives (fs_dirent_loc_t) in its private words, so open
+ * does not search the directory again. Handles are fs fds.
+ */
+
+static uint8_t g_fat_mounted = 0;
+
+static void fat_inode_fill(vfs_superblock_t* sb, const fs_dirent_loc_t* loc,
+                           const fs_dir_entry_t* entry, vfs_inode_t* inode) {
+    memset(inode, 0, sizeof(vfs_inode_t));
+    inode->sb = sb;
+    if (entry->attributes & FS_ATTR_DIRECTORY) {
+        inode->type = VFS_TYPE_DIR;
+        inode->ino = dir_entry_dir(entry);
+    } else {
+        inode->type = VFS_TYPE_FILE;
+        inode->ino = dir_entry_cluster(entry);
+        inode->size = entry->file_size;
+    }
+    memcpy(inode->priv, loc, sizeof(fs_dirent_loc_t));
+}
+
+static int fat_vfs_name(const char* name, uint8_t name83[11]) {
+    return path_component_83(name, (int)strlen(name), name83);
+}
+
+static int fat_vfs_lookup_locked(vfs_inode_t* dir, const char* name, vfs_inode_t* out) {
+    uint8_t name83[11];
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+
+    if (fat_vfs_name(name, name83) < 0) {
+        return -1;
+    }
+    if (dir->ino == 0 && name83[0] == '.') {
+        *out = *dir;  /* The root has no "." or ".." entries */
+        return 0;
+    }
+    if (dir_lookup(dir->ino, name83, &loc, &entry) < 0) {
+        return -1;
+    }
+    fat_inode_fill(dir->sb, &loc, &entry, out);
+    return 0;
+}
+
+static int fat_vfs_lookup(vfs_inode_t* dir, const char* name, vfs_inode_t* out) {
+    fs_lock();
+    int result = fat_vfs_lookup_locked(dir, name, out);
+    fs_unlock();
+    return result;
+}
+
+static int fat_vfs_create(vfs_inode_t* dir, const char* name, vfs_inode_t* out) {
+    uint8_t name83[11];
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+
+    if (fat_vfs_name(name, name83) < 0) {
+        return -1;
+    }
+
+    fs_lock();
+    int result = fat_create(dir->ino, name83, 0, &loc, &entry);
+    if (result == 0) {
+        fat_inode_fill(dir->sb, &loc, &entry, out);
+    }
+    fs_unlock();
+    return result < 0 ? -1 : 0;
+}
+
+static int fat_vfs_mkdir(vfs_inode_t* dir, const char* name) {
+    uint8_t name83[11];
+
+    if (fat_vfs_name(name, name83) < 0) {
+        return -1;
+    }
+
+    fs_lock();
+    int result = fat_mkdir(dir->ino, name83);
+    fs_unlock();
+    return result;
+}
+
+static int fat_vfs_unlink(vfs_inode_t* dir, const char* name) {
+    uint8_t name83[11];
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+
+    if (fat_vfs_name(name, name83) < 0) {
+        return -1;
+    }
+
+    fs_lock();
+    int result = -1;
+    if (dir_lookup(dir->ino, name83, &loc, &entry) >= 0) {
+        result = fat_delete(&loc, &entry);
+    }
+    fs_unlock();
+    return result;
+}
+
+static int fat_vfs_rmdir(vfs_inode_t* dir, const char* name) {
+    uint8_t name83[11];
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+
+    if (fat_vfs_name(name, name83) < 0) {
+        return -1;
+    }
+
+    fs_lock();
+    int result = -1;
+    if (dir_lookup(dir->ino, name83, &loc, &entry) >= 0) {
+        result = fat_rmdir(&loc, &entry);
+    }
+    fs_unlock();
+    return result;
+}
+
+static int fat_vfs_readdir_locked(vfs_inode_t* dir, vfs_dirent_t* entries, int max_entries) {
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+    dir_cursor_t cur;
+    int count = 0;
+
+    dir_open(&cur, dir->ino);
+    while (count < max_entries && dir_next(&cur, &loc, &entry) == 0 &&
+           entry.filename[0] != 0x00) {
+        if (!dir_entry_live(&entry) || entry.filename[0] == '.') {
+            continue;
+        }
+
+        vfs_inode_t inode;
+        fat_inode_fill(dir->sb, &loc, &entry, &inode);
+        dir_entry_name(&entry, entries[count].name);
+        entries[count].type = inode.type;
+        entries[count].size = inode.size;
+        entries[count].ino = inode.ino;
+        count++;
+    }
+    return count;
+}
+
+static int fat_vfs_readdir(vfs_inode_t* dir, vfs_dirent_t* entries, int max_entries) {
+    fs_lock();
+    int result = fat_vfs_readdir_locked(dir, entries, max_entries);
+    fs_unlock();
+    return result;
+}
+
+static int fat_vfs_open(vfs_inode_t* inode, uint32_t flags) {
+    fs_dirent_loc_t loc;
+    fs_dir_entry_t entry;
+
+    memcpy(&loc, inode->priv, sizeof(fs_dirent_loc_t));
+
+    fs_lock();
+    int result = -1;
+    if (dirent_load(&loc, &entry) >= 0) {
+        result = fs_open_entry(&loc, &entry, (uint8_t)flags);
+    }
+    fs_unlock();
+    return result;
+}
+
+static int fat_vfs_read(int handle, void* buffer, uint32_t count) {
+    return fs_read(handle, (uint8_t*)buffer, fs_io_count(count));
 }
+
+static int fat_vfs_write(int handle, const void* buffer, uint32_t count) {
+    return fs_write(handle, (const uint8_t*)buffer, fs_io_count(count));
+}
+
+static int fat_vfs_sync(vfs_superblock_t* sb) {
+    (void)sb;
+    return fs_sync();
+}
+
+static int fat_vfs_statfs(vfs_superblock_t* sb, vfs_statfs_t* st) {
+    (void)sb;
+    st->block_size = g_vol.bytes_per_cluster;
+    st->blocks = g_vol.cluster_count;
+    st->free_blocks = g_fat_free_count;
+    return 0;
+}
+
+static const vfs_super_ops_t fat_super_ops = {
+    .sync = fat_vfs_sync,
+    .statfs = fat_vfs_statfs,
+};
+
+static const vfs_inode_ops_t fat_inode_ops = {
+    .lookup = fat_vfs_lookup,
+    .create = fat_vfs_create,
+    .mkdir = fat_vfs_mkdir,
+    .unlink = fat_vfs_unlink,
+    .rmdir = fat_vfs_rmdir,
+    .readdir = fat_vfs_readdir,
+    .open = fat_vfs_open,
+};
+
+static const vfs_file_ops_t fat_file_ops = {
+    .fd_ops = &fs_file_ops,
+    .read = fat_vfs_read,
+    .write = fat_vfs_write,
+    .seek = fs_seek,
+    .size = fs_get_size,
+    .close = fs_close,
+};
+
+/* Only the one volume on drive 0; source is ignored */
+static int fat_vfs_mount_locked(vfs_superblock_t* sb, const char* source) {
+    (void)source;
+
+    if (g_fat_mounted || (!g_fs_initialized && fs_init() < 0)) {
+        return -1;
+    }
+
+    sb->s_ops = &fat_super_ops;
+    sb->i_ops = &fat_inode_ops;
+    sb->f_ops = &fat_file_ops;
+    memset(&sb->root, 0, sizeof(vfs_inode_t));
+    sb->root.sb = sb;
+    sb->root.type = VFS_TYPE_DIR;
+    sb->root.ino = 0;
+    g_fat_mounted = 1;
+    return 0;
+}
+
+static int fat_vfs_mount(vfs_superblock_t* sb, const char* source) {
+    fs_lock();
+    int result = fat_vfs_mount_locked(sb, source);
+    fs_unlock();
+    return result;
+}
+
+const vfs_fs_type_t fat_fs_type = {
+    .name = "fat",
+    .mount = fat_vfs_mount,
+};
@@ -0,0 +1,150 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "process.h"
+#include "memory.h"
+#include "kernel.h"
+
+/* Lazy FPU/SSE context switching
+ *
+ * g_fpu_owner is the process whose state currently lives in the FPU
+ * registers. Switching to any other process sets CR0.TS; the owner's state
+ * is only written back when somebody else executes an FPU instruction.
+ */
+
+static process_t* g_fpu_owner = NULL;  /* Process whose state is loaded */
+static uint8_t g_fpu_ts_set = 0;       /* Mirror of CR0.TS (avoids CR0 reads) */
+static uint8_t g_fpu_has_fxsr = 0;     /* FXSAVE/FXRSTOR available */
+static uint8_t g_fpu_has_sse = 0;      /* SSE enabled in CR4 */
+
+/* Clean state loaded into a process on its first FPU instruction */
+static uint8_t g_fpu_default_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+/* Save FPU registers into a state area */
+static void fpu_save(uint8_t* state) {
+    if (g_fpu_has_fxsr) {
+        __asm__ volatile("fxsave (%0)" : : "r" (state) : "memory");
+    } else {
+        __asm__ volatile("fnsave (%0)" : : "r" (state) : "memory");
+    }
+}
+
+/* Load FPU registers from a state area */
+static void fpu_restore(const uint8_t* state) {
+    if (g_fpu_has_fxsr) {
+        __asm__ volatile("fxrstor (%0)" : : "r" (state) : "memory");
+    } else {
+        __asm__ volatile("frstor (%0)" : : "r" (state) : "memory");
+    }
+}
+
+/* Set CR0.TS so the next FPU instruction traps */
+static void fpu_set_ts(void) {
+    if (!g_fpu_ts_set) {
+        cpu_write_cr0(cpu_read_cr0() | CR0_TS);
+        g_fpu_ts_set = 1;
+    }
+}
+
+/* Clear CR0.TS */
+static void fpu_clear_ts(void) {
+    if (g_fpu_ts_set) {
+        cpu_clts();
+        g_fpu_ts_set = 0;
+    }
+}
+
+/* Initialize FPU */
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    if (!(edx & CPUID_EDX_FPU)) {
+        kernel_panic("No x87 FPU present");
+    }
+
+    g_fpu_has_fxsr = (edx & CPUID_EDX_FXSR) ? 1 : 0;
+
+    /* Native FPU: no emulation, monitor coprocessor, native error reporting */
+    uint32_t cr0 = cpu_read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    cpu_write_cr0(cr0);
+    g_fpu_ts_set = 0;
+
+    /* Enable FXSAVE/FXRSTOR and SSE */
+    if (g_fpu_has_fxsr) {
+        uint32_t cr4 = cpu_read_cr4() | CR4_OSFXSR;
+        if (edx & CPUID_EDX_SSE) {
+            cr4 |= CR4_OSXMMEXCPT;
+            g_fpu_has_sse = 1;
+        }
+        cpu_write_cr4(cr4);
+    }
+
+    /* Capture the power-on state used for processes touching the FPU */
+    __asm__ volatile("fninit");
+    if (g_fpu_has_sse) {
+        uint32_t mxcsr = 0x1F80;  /* All SIMD exceptions masked */
+        __asm__ volatile("ldmxcsr %0" : : "m" (mxcsr));
+    }
+    memset(g_fpu_default_state, 0, sizeof(g_fpu_default_state));
+    fpu_save(g_fpu_default_state);
+
+    /* Nobody owns the FPU yet; trap on first use */
+    g_fpu_owner = NULL;
+    fpu_set_ts();
+}
+
+/* Prepare FPU for the next process */
+void fpu_switch(process_t* next) {
+    if (next == g_fpu_owner) {
+        fpu_clear_ts();  /* State is still live in the registers */
+    } else {
+        fpu_set_ts();
+    }
+}
+
+/* #NM: first FPU instruction since the last switch */
+void fpu_handle_nm(void) {
+    process_t* current = process_current();
+
+    fpu_clear_ts();
+
+    if (g_fpu_owner == current) {
+        return;
+    }
+
+    /* Write back the previous owner's registers */
+    if (g_fpu_owner) {
+        fpu_save(g_fpu_owner->fpu_state);
+    }
+
+    if (!current) {
+        g_fpu_owner = NULL;
+        return;
+    }
+
+    if (current->fpu_used) {
+        fpu_restore(current->fpu_state);
+    } else {
+        fpu_restore(g_fpu_default_state);
+        current->fpu_used = 1;
+    }
+
+    g_fpu_owner = current;
+}
+
+/* Forget the FPU state of a terminated process */
+void fpu_release(process_t* proc) {
+    if (proc && g_fpu_owner == proc) {
+        g_fpu_owner = NULL;
+    }
+    if (proc) {
+        proc->fpu_used = 0;
+    }
+}
+
+/* Check SSE availability */
+int fpu_has_sse(void) {
+    return g_fpu_has_sse;
+}
@@ -0,0 +1,95 @@
+#include "futex.h"
+#include "process.h"
+#include "paging.h"
+#include "waitqueue.h"
+#include "cpu.h"
+
+/* Futex wait/wake (see futex.h) */
+
+static wait_queue_t g_futex_queues[FUTEX_HASH_SIZE];
+
+/* Initialize the wait queue table */
+void futex_init(void) {
+    for (uint32_t i = 0; i < FUTEX_HASH_SIZE; i++) {
+        wait_queue_init(&g_futex_queues[i]);
+    }
+}
+
+/* Physical address of the caller's word, 0 if it is unusable. The page is
+ * faulted in first, so reading the word later cannot fault. */
+static uint32_t futex_key(process_t* proc, volatile uint32_t* addr) {
+    uint32_t virt = (uint32_t)addr;
+
+    if (!addr || (virt & 3)) {
+        return 0;
+    }
+    if (vmm_prefault(virt, sizeof(uint32_t)) < 0) {
+        return 0;
+    }
+    return vmm_lookup(proc->page_dir, virt);
+}
+
+static wait_queue_t* futex_queue(uint32_t key) {
+    return &g_futex_queues[((key >> 2) * 0x9E3779B1u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+/* Sleep while *addr == expected */
+int futex_wait(volatile uint32_t* addr, uint32_t expected) {
+    process_t* proc = process_current();
+    uint32_t key = proc ? futex_key(proc, addr) : 0;
+    if (!key) {
+        return -1;
+    }
+
+    wait_queue_t* wq = futex_queue(key);
+    uint32_t flags = cpu_irq_save();
+
+    if (*addr != expected) {
+        cpu_irq_restore(flags);
+        return -1;  /* Changed before we could sleep */
+    }
+
+    /* futex_wake() clears the key; anything else is a spurious wakeup */
+    proc->futex_key = key;
+    while (proc->futex_key == key) {
+        wait_queue_sleep(wq);
+    }
+
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+/* Wake up to count waiters of addr */
+int futex_wake(volatile uint32_t* addr, uint32_t count) {
+    process_t* proc = process_current();
+    uint32_t key = proc ? futex_key(proc, addr) : 0;
+    if (!key) {
+        return -1;
+    }
+
+    wait_queue_t* wq = futex_queue(key);
+    uint32_t flags = cpu_irq_save();
+
+    int woken = 0;
+    uint32_t waiters = wq->waiters;
+    while (waiters && (uint32_t)woken < count) {
+        uint32_t pid = __builtin_ctz(waiters);
+        waiters &= waiters - 1;
+
+        /* The bucket is shared with other keys and may hold stale PIDs.
+         * A waiter woken spuriously is READY with its key still set and
+         * will sleep again unless the key is cleared, so state is not
+         * checked. */
+        process_t* waiter = process_get(pid);
+        if (!waiter || waiter->futex_key != key) {
+            continue;
+        }
+
+        waiter->futex_key = 0;
+        wait_queue_wake(wq, pid);
+        woken++;
+    }
+
+    cpu_irq_restore(flags);
+    return woken;
+}
@@ -0,0 +1,80 @@
+#include "gdt.h"
+#include "memory.h"
+
+/* Global Descriptor Table setup
+ * 0x00: Null
+ * 0x08: Kernel code (ring 0)
+ * 0x10: Kernel data (ring 0)
+ * 0x18: User code (ring 3)
+ * 0x20: User data (ring 3)
+ * 0x28: TSS
+ * All code/data segments are flat 4 GB.
+ */
+
+#define GDT_ENTRIES 6
+
+/* GDT entry structure */
+struct gdt_entry {
+	uint16_t limit_lo;    /* Low 16 bits of limit */
+	uint16_t base_lo;     /* Low 16 bits of base */
+	uint8_t  base_mid;    /* Bits 16-23 of base */
+	uint8_t  access;      /* Present, DPL, type */
+	uint8_t  granularity; /* Flags + high 4 bits of limit */
+	uint8_t  base_hi;     /* Bits 24-31 of base */
+} __attribute__((packed));
+
+/* GDT descriptor */
+struct gdt_ptr {
+	uint16_t limit;       /* Size of GDT - 1 */
+	uint32_t base;        /* Base address of GDT */
+} __attribute__((packed));
+
+static struct gdt_entry gdt[GDT_ENTRIES];
+static struct gdt_ptr gdt_descriptor;
+static tss_t g_tss;
+
+/* Assembly helpers (interrupts.asm) */
+extern void gdt_flush(uint32_t gdt_ptr);
+extern void tss_flush(uint16_t selector);
+
+/* Set a GDT entry */
+static void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+	gdt[num].base_lo = base & 0xFFFF;
+	gdt[num].base_mid = (base >> 16) & 0xFF;
+	gdt[num].base_hi = (base >> 24) & 0xFF;
+	gdt[num].limit_lo = limit & 0xFFFF;
+	gdt[num].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+	gdt[num].access = access;
+}
+
+/* Initialize GDT and TSS */
+void gdt_init(void) {
+	gdt_descriptor.base = (uint32_t) &gdt;
+	gdt_descriptor.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
+
+	gdt_set_gate(0, 0, 0, 0, 0);                  /* Null segment */
+	gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);   /* Kernel code */
+	gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);   /* Kernel data */
+	gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF);   /* User code */
+	gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF);   /* User data */
+
+	/* TSS: only ss0/esp0 are used; no I/O permission bitmap */
+	memset(&g_tss, 0, sizeof(tss_t));
+	g_tss.ss0 = GDT_KERNEL_DATA;
+	g_tss.iomap_base = sizeof(tss_t);
+	gdt_set_gate(5, (uint32_t) &g_tss, sizeof(tss_t) - 1, 0x89, 0x00);
+
+	gdt_flush((uint32_t) &gdt_descriptor);
+	tss_flush(GDT_TSS);
+}
+
+/* Set kernel stack for the next ring 3 -> ring 0 transition */
+void tss_set_kernel_stack(uint32_t esp0) {
+	g_tss.esp0 = esp0;
+}
+
+/* Address of the esp0 field */
+uint32_t* tss_kernel_stack_slot(void) {
+	/* tss_t is packed but esp0 sits at a 4-byte aligned offset */
+	return (uint32_t*)((uint8_t*)&g_tss + __builtin_offsetof(tss_t, esp0));
+}
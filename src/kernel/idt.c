@@ -1,5 +1,13 @@
 #include "drivers.h"
 #include "types.h"
+#include "idt.h"
+#include "fpu.h"
+#include "gdt.h"
+#include "process.h"
+#include "paging.h"
+#include "cpu.h"
+#include "kernel.h"
+#include "string.h"
 
 /* Port I/O helper functions */
 extern void outb(uint16_t port, uint8_t value);
@@ -16,6 +24,13 @@ extern void pit_irq0_handler(void);
 
 #define IDT_ENTRIES 256
 
+/* 8259A PIC ports */
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+
 /* IDT entry structure */
 struct idt_entry {
 	uint16_t base_lo;     /* Low 16 bits of handler address */
@@ -37,10 +52,18 @@ static struct idt_ptr idt_descriptor;
 /* Stub handlers - will implement proper ones later */
 extern void isr0();   /* Divide by zero */
 extern void isr1();   /* Debug exception */
+extern void isr6();   /* Invalid opcode */
+extern void isr7();   /* Device not available (FPU) */
 extern void isr8();   /* Double fault */
+extern void isr11();  /* Segment not present */
+extern void isr12();  /* Stack-segment fault */
+extern void isr13();  /* General protection fault */
 extern void isr14();  /* Page fault */
+extern void isr16();  /* x87 floating-point error */
+extern void isr19();  /* SIMD floating-point exception */
 extern void irq0();   /* Timer */
 extern void irq1();   /* Keyboard */
+extern void isr128(); /* System call (int 0x80) */
 
 /* Set an IDT entry */
 static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags) {
@@ -51,6 +74,22 @@ static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags
 	idt[num].flags = flags;
 }
 
+/* Remap the PIC so IRQ 0-15 use vectors 32-47 instead of CPU exceptions */
+static void pic_remap(void) {
+	outb(PIC1_COMMAND, 0x11);  /* ICW1: init, expect ICW4 */
+	outb(PIC2_COMMAND, 0x11);
+	outb(PIC1_DATA, 32);       /* ICW2: master vector offset */
+	outb(PIC2_DATA, 40);       /* ICW2: slave vector offset */
+	outb(PIC1_DATA, 0x04);     /* ICW3: slave on IRQ 2 */
+	outb(PIC2_DATA, 0x02);     /* ICW3: slave cascade identity */
+	outb(PIC1_DATA, 0x01);     /* ICW4: 8086 mode */
+	outb(PIC2_DATA, 0x01);
+
+	/* Only unmask IRQs that have a handler (timer, keyboard) */
+	outb(PIC1_DATA, 0xFC);
+	outb(PIC2_DATA, 0xFF);
+}
+
 /* Initialize IDT */
 void idt_init(void) {
 	idt_descriptor.base = (uint32_t) &idt;
@@ -68,37 +107,113 @@ void idt_init(void) {
 	/* Set up exception handlers */
 	idt_set_gate(0, (uint32_t) isr0, 0x08, 0x8E);   /* Divide by zero */
 	idt_set_gate(1, (uint32_t) isr1, 0x08, 0x8E);   /* Debug */
+	idt_set_gate(6, (uint32_t) isr6, 0x08, 0x8E);   /* Invalid opcode */
+	idt_set_gate(7, (uint32_t) isr7, 0x08, 0x8E);   /* Device not available */
 	idt_set_gate(8, (uint32_t) isr8, 0x08, 0x8E);   /* Double fault */
+	idt_set_gate(11, (uint32_t) isr11, 0x08, 0x8E); /* Segment not present */
+	idt_set_gate(12, (uint32_t) isr12, 0x08, 0x8E); /* Stack-segment fault */
+	idt_set_gate(13, (uint32_t) isr13, 0x08, 0x8E); /* General protection */
 	idt_set_gate(14, (uint32_t) isr14, 0x08, 0x8E); /* Page fault */
+	idt_set_gate(16, (uint32_t) isr16, 0x08, 0x8E); /* x87 FPU error */
+	idt_set_gate(19, (uint32_t) isr19, 0x08, 0x8E); /* SIMD exception */
 
 	/* Set up hardware IRQ handlers */
 	idt_set_gate(32, (uint32_t) irq0, 0x08, 0x8E);  /* Timer */
 	idt_set_gate(33, (uint32_t) irq1, 0x08, 0x8E);  /* Keyboard */
 
+	/* System call gate: trap gate (interrupts stay enabled), callable from ring 3 */
+	idt_set_gate(IDT_SYSCALL_VECTOR, (uint32_t) isr128, GDT_KERNEL_CODE, 0xEF);
+
+	pic_remap();
+
 	/* Load IDT */
 	__asm__ volatile("lidt %0" : : "m" (idt_descriptor));
 }
 
-/* Exception handlers - stubs for now */
-void isr_handler(uint32_t isrnum) {
-	vga_write_string("Exception: ");
-
+/* Get exception name */
+static const char* isr_name(uint32_t isrnum) {
 	switch (isrnum) {
-		case 0: vga_write_string("Divide by zero\n"); break;
-		case 1: vga_write_string("Debug exception\n"); break;
-		case 8: vga_write_string("Double fault\n"); break;
-		case 14: vga_write_string("Page fault\n"); break;
-		default: vga_write_string("Unknown exception\n");
+		case 0: return "Divide by zero";
+		case 1: return "Debug exception";
+		case 6: return "Invalid opcode";
+		case 8: return "Double fault";
+		case 11: return "Segment not present";
+		case 12: return "Stack-segment fault";
+		case 13: return "General protection fault";
+		case 14: return "Page fault";
+		case 16: return "x87 floating-point error";
+		case 19: return "SIMD floating-point exception";
+		default: return "Unknown exception";
+	}
+}
+
+/* Exception handlers */
+void isr_handler(interrupt_frame_t* frame) {
+	/* Lazy FPU switch - not an error */
+	if (frame->int_no == 7) {
+		fpu_handle_nm();
+		return;
 	}
+
+	/* Page fault: demand paging for the current process */
+	if (frame->int_no == 14) {
+		uint32_t addr = cpu_read_cr2();
+		if (vmm_handle_fault(addr, frame->err_code) == 0) {
+			return;
+		}
+
+		/* Bad user pointer passed to a system call: kill the caller only */
+		process_t* proc = process_current();
+		if ((frame->cs & 3) == 0 && proc && proc->page_dir && addr >= USER_SPACE_START) {
+			vga_write_string("Exception: Page fault on user address - process killed\n");
+			process_exit(-1);
+			return;  /* Not reached */
+		}
+	}
+
+	/* Debug traps are informational */
+	if (frame->int_no == 1) {
+		vga_write_string("Exception: Debug exception\n");
+		return;
+	}
+
+	/* Fault in a user program: terminate only that process */
+	if ((frame->cs & 3) == 3) {
+		process_t* proc = process_current();
+		char buf[16];
+
+		vga_write_string("Exception: ");
+		vga_write_string(isr_name(frame->int_no));
+		vga_write_string(" in process ");
+		itoa(proc ? proc->pid : 0, buf, 10);
+		vga_write_string(buf);
+		vga_write_string(" at 0x");
+		itoa(frame->eip, buf, 16);
+		vga_write_string(buf);
+		vga_write_string(" - killed\n");
+
+		process_exit(-1);
+		return;  /* Not reached */
+	}
+
+	/* Fault in kernel code is fatal */
+	vga_write_string("Exception: ");
+	vga_write_string(isr_name(frame->int_no));
+	vga_write_string("\n");
+	kernel_panic(isr_name(frame->int_no));
 }
 
-/* IRQ handlers - stubs for now */
+/* IRQ handlers */
 void irq_handler(uint32_t irqnum) {
+	/* Acknowledge first: the handler may switch to another process */
+	if (irqnum >= 8) {
+		outb(PIC2_COMMAND, PIC_EOI);
+	}
+	outb(PIC1_COMMAND, PIC_EOI);
+
 	switch (irqnum) {
 		case 0: pit_irq0_handler(); break;
-		case 1: break; /* Keyboard IRQ */
+		case 1: keyboard_irq_handler(); break;
 		default: break;
 	}
-	/* Send EOI (End Of Interrupt) to PIC */
-	outb(0x20, 0x20);
 }
@@ -0,0 +1,521 @@
+#include "initrd.h"
+#include "vfs.h"
+#include "tmpfs.h"
+#include "paging.h"
+#include "memory.h"
+#include "string.h"
+#include "drivers.h"
+
+/* Initial RAM disk (see initrd.h)
+ *
+ * Archives are read in place: an entry is a name, a type and a pointer to
+ * its data inside the module, and unpacking copies that data straight
+ * into the filesystem. The same walk runs twice, once to size the tmpfs
+ * mount and once to fill it.
+ */
+
+/* Memory from the heap (memory.c) up to the frame pool is kernel-owned
+ * without the frame allocator knowing; modules there have to move */
+#define INITRD_UNSAFE_START     0x00200000
+#define INITRD_UNSAFE_END       PMM_POOL_START
+
+#define CPIO_HEADER_SIZE        110
+#define CPIO_MODE_TYPE          0170000
+#define CPIO_MODE_DIR           0040000
+#define CPIO_MODE_FILE          0100000
+
+#define TAR_BLOCK               512
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    char path[VFS_PATH_MAX];    /* Mount path */
+} initrd_module_t;
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t pos;
+    uint8_t tar;                /* 0 = cpio newc, 1 = tar */
+    char long_name[VFS_PATH_MAX];   /* GNU 'L' name for the next tar entry */
+} initrd_cursor_t;
+
+typedef struct {
+    char name[VFS_PATH_MAX];    /* Relative, no leading "./" or "/" */
+    uint8_t type;               /* VFS_TYPE_*, 0 = skipped (links, devices) */
+    const uint8_t* data;
+    uint32_t size;
+} initrd_entry_t;
+
+static initrd_module_t g_modules[INITRD_MAX_MODULES];
+static int g_module_count = 0;
+
+/* Archive formats */
+
+/* Parse digits of the given base; -1 on anything else */
+static int initrd_number(const uint8_t* s, int len, uint32_t base, uint32_t* value) {
+    uint32_t v = 0;
+    int digits = 0;
+
+    for (int i = 0; i < len; i++) {
+        uint32_t d;
+        if (s[i] >= '0' && s[i] <= '9') {
+            d = s[i] - '0';
+        } else if (base == 16 && s[i] >= 'a' && s[i] <= 'f') {
+            d = s[i] - 'a' + 10;
+        } else if (base == 16 && s[i] >= 'A' && s[i] <= 'F') {
+            d = s[i] - 'A' + 10;
+        } else if (base == 8 && (s[i] == ' ' || s[i] == '\0')) {
+            if (digits) {
+                break;      /* Tar fields end in a space or NUL */
+            }
+            continue;
+        } else {
+            return -1;
+        }
+        if (d >= base) {
+            return -1;
+        }
+        v = v * base + d;
+        digits++;
+    }
+
+    *value = v;
+    return 0;
+}
+
+/* Tar header checksum: the header's bytes with the checksum field as spaces */
+static int tar_checksum_ok(const uint8_t* h) {
+    uint32_t stored;
+    uint32_t sum = 0;
+
+    if (initrd_number(h + 148, 8, 8, &stored) < 0) {
+        return 0;
+    }
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : h[i];
+    }
+    return sum == stored;
+}
+
+/* "070701", or "070702" for newc with checksums (which are not checked) */
+static int cpio_magic_ok(const uint8_t* h) {
+    return memcmp(h, "07070", 5) == 0 && (h[5] == '1' || h[5] == '2');
+}
+
+/* Append at most len bytes of s (stopping at a NUL) to the entry name */
+static void initrd_name_append(char* name, const uint8_t* s, uint32_t len) {
+    uint32_t n = strlen(name);
+    for (uint32_t i = 0; i < len && s[i] && n < VFS_PATH_MAX - 1; i++) {
+        name[n++] = (char)s[i];
+    }
+    name[n] = '\0';
+}
+
+/* Drop leading "/" and "./" and any trailing "/" */
+static void initrd_name_clean(char* name) {
+    char* s = name;
+    while (*s == '/' || (s[0] == '.' && s[1] == '/')) {
+        s += (*s == '/') ? 1 : 2;
+    }
+    if (s[0] == '.' && s[1] == '\0') {
+        s++;
+    }
+
+    uint32_t n = 0;
+    while (s[n]) {
+        name[n] = s[n];
+        n++;
+    }
+    while (n > 0 && name[n - 1] == '/') {
+        n--;
+    }
+    name[n] = '\0';
+}
+
+static int initrd_open(initrd_cursor_t* cur, const void* data, uint32_t size) {
+    cur->data = (const uint8_t*)data;
+    cur->size = size;
+    cur->pos = 0;
+    cur->long_name[0] = '\0';
+
+    if (size >= CPIO_HEADER_SIZE && cpio_magic_ok(cur->data)) {
+        cur->tar = 0;
+        return 0;
+    }
+    if (size >= TAR_BLOCK && tar_checksum_ok(cur->data)) {
+        cur->tar = 1;
+        return 0;
+    }
+    return -1;
+}
+
+/* Next cpio newc entry: 110-byte ASCII header, name, data, each padded to 4 */
+static int cpio_next(initrd_cursor_t* cur, initrd_entry_t* entry) {
+    const uint8_t* h = cur->data + cur->pos;
+    uint32_t mode, file_size, name_size;
+
+    if (cur->size - cur->pos < CPIO_HEADER_SIZE || !cpio_magic_ok(h) ||
+        initrd_number(h + 14, 8, 16, &mode) < 0 ||
+        initrd_number(h + 54, 8, 16, &file_size) < 0 ||
+        initrd_number(h + 94, 8, 16, &name_size) < 0) {
+        return -1;
+    }
+
+    uint32_t data_pos = (cur->pos + CPIO_HEADER_SIZE + name_size + 3) & ~3u;
+    if (name_size == 0 || data_pos > cur->size || file_size > cur->size - data_pos) {
+        return -1;
+    }
+
+    entry->name[0] = '\0';
+    initrd_name_append(entry->name, h + CPIO_HEADER_SIZE, name_size);
+    if (strcmp(entry->name, "TRAILER!!!") == 0) {
+        return -1;
+    }
+
+    switch (mode & CPIO_MODE_TYPE) {
+        case CPIO_MODE_DIR:  entry->type = VFS_TYPE_DIR; break;
+        case CPIO_MODE_FILE: entry->type = VFS_TYPE_FILE; break;
+        default:             entry->type = 0; break;
+    }
+    entry->data = cur->data + data_pos;
+    entry->size = file_size;
+
+    cur->pos = (data_pos + file_size + 3) & ~3u;
+    if (cur->pos > cur->size) {
+        cur->pos = cur->size;
+    }
+    return 0;
+}
+
+/* Next tar entry: 512-byte header, data padded to 512; ends at a zero block */
+static int tar_next(initrd_cursor_t* cur, initrd_entry_t* entry) {
+    while (cur->size - cur->pos >= TAR_BLOCK) {
+        const uint8_t* h = cur->data + cur->pos;
+        uint32_t file_size;
+
+        if (h[0] == '\0' || !tar_checksum_ok(h) ||
+            initrd_number(h + 124, 12, 8, &file_size) < 0) {
+            return -1;
+        }
+
+        uint32_t data_pos = cur->pos + TAR_BLOCK;
+        if (file_size > cur->size - data_pos) {
+            return -1;
+        }
+        cur->pos = data_pos + ((file_size + TAR_BLOCK - 1) & ~(uint32_t)(TAR_BLOCK - 1));
+        if (cur->pos > cur->size) {
+            cur->pos = cur->size;
+        }
+
+        char flag = (char)h[156];
+        if (flag == 'L') {
+            /* GNU long name: the data is the next entry's name */
+            cur->long_name[0] = '\0';
+            initrd_name_append(cur->long_name, cur->data + data_pos, file_size);
+            continue;
+        }
+        if (flag == 'x' || flag == 'g' || flag == 'K') {
+            continue;           /* pax headers and long link names */
+        }
+
+        entry->name[0] = '\0';
+        if (cur->long_name[0]) {
+            initrd_name_append(entry->name, (const uint8_t*)cur->long_name, VFS_PATH_MAX);
+            cur->long_name[0] = '\0';
+        } else {
+            if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+                initrd_name_append(entry->name, h + 345, 155);  /* Prefix */
+                initrd_name_append(entry->name, (const uint8_t*)"/", 1);
+            }
+            initrd_name_append(entry->name, h, 100);
+        }
+
+        if (flag == '5') {
+            entry->type = VFS_TYPE_DIR;
+        } else if (flag == '0' || flag == '\0' || flag == '7') {
+            entry->type = VFS_TYPE_FILE;
+        } else {
+            entry->type = 0;
+        }
+        entry->data = cur->data + data_pos;
+        entry->size = file_size;
+        return 0;
+    }
+    return -1;
+}
+
+/* Next entry with a usable name; -1 at the end of the archive */
+static int initrd_next(initrd_cursor_t* cur, initrd_entry_t* entry) {
+    while ((cur->tar ? tar_next(cur, entry) : cpio_next(cur, entry)) == 0) {
+        initrd_name_clean(entry->name);
+        if (entry->name[0]) {
+            return 0;       /* "." itself is the mount root */
+        }
+    }
+    return -1;
+}
+
+/* Unpacking */
+
+/* Create every missing directory above path (an absolute path) */
+static void initrd_make_parents(char* path) {
+    for (char* p = path + 1; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        *p = '\0';
+        vfs_dirent_t info;
+        if (vfs_stat(path, &info) < 0) {
+            vfs_mkdir(path);
+        }
+        *p = '/';
+    }
+}
+
+static int initrd_write_file(const char* path, const uint8_t* data, uint32_t size) {
+    int fd = vfs_open(path, VFS_OPEN_WRONLY | VFS_OPEN_CREATE | VFS_OPEN_TRUNC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Backends may write less than asked (FAT caps a call) */
+    uint32_t done = 0;
+    while (done < size) {
+        int n = vfs_write(fd, data + done, size - done);
+        if (n <= 0) {
+            break;
+        }
+        done += (uint32_t)n;
+    }
+
+    vfs_close(fd);
+    return done == size ? 0 : -1;
+}
+
+int initrd_unpack(const void* data, uint32_t size, const char* path) {
+    initrd_cursor_t cur;
+    initrd_entry_t entry;
+    char full[VFS_PATH_MAX];
+    int files = 0;
+
+    if (initrd_open(&cur, data, size) < 0) {
+        return -1;
+    }
+
+    uint32_t base = strlen(path);
+    if (base > 0 && path[base - 1] == '/') {
+        base--;
+    }
+
+    while (initrd_next(&cur, &entry) == 0) {
+        if (!entry.type || base + 1 + strlen(entry.name) >= VFS_PATH_MAX) {
+            continue;
+        }
+        memcpy(full, path, base);
+        full[base] = '/';
+        strcpy(full + base + 1, entry.name);
+
+        initrd_make_parents(full);
+        if (entry.type == VFS_TYPE_DIR) {
+            vfs_dirent_t info;
+            if (vfs_stat(full, &info) < 0) {
+                vfs_mkdir(full);
+            }
+        } else if (initrd_write_file(full, entry.data, entry.size) == 0) {
+            files++;
+        } else {
+            vga_write_string("initrd: cannot write ");
+            vga_write_string(full);
+            vga_write_string("\n");
+        }
+    }
+
+    return files;
+}
+
+/* Modules */
+
+/* Copy a module to the top of the frame pool, below limit; returns the
+ * new start or 0. dest > src, so copying backwards is safe. */
+static uint32_t initrd_relocate(initrd_module_t* mod, uint32_t limit, uint32_t floor) {
+    uint32_t size = mod->end - mod->start;
+    uint32_t dest = PAGE_ALIGN_DOWN(limit - size);
+
+    if (size > limit || dest < floor || dest < PMM_POOL_START) {
+        return 0;
+    }
+
+    const uint8_t* src = (const uint8_t*)mod->start;
+    uint8_t* dst = (uint8_t*)dest;
+    for (uint32_t i = size; i > 0; i--) {
+        dst[i - 1] = src[i - 1];
+    }
+
+    mod->start = dest;
+    mod->end = dest + size;
+    return dest;
+}
+
+/* Mount path: the word after the file name on the module line */
+static void initrd_module_path(initrd_module_t* mod, const char* cmdline) {
+    strcpy(mod->path, INITRD_DEFAULT_PATH);
+    if (!cmdline) {
+        return;
+    }
+
+    while (*cmdline && *cmdline != ' ') {
+        cmdline++;
+    }
+    while (*cmdline == ' ') {
+        cmdline++;
+    }
+    if (*cmdline != '/') {
+        return;
+    }
+
+    uint32_t n = 0;
+    while (cmdline[n] && cmdline[n] != ' ' && n < VFS_PATH_MAX - 1) {
+        mod->path[n] = cmdline[n];
+        n++;
+    }
+    mod->path[n] = '\0';
+}
+
+int initrd_init(const multiboot_info_t* mbi, uint32_t mem_end) {
+    g_module_count = 0;
+    if (!(mbi->flags & MULTIBOOT_INFO_MODS)) {
+        return 0;
+    }
+
+    /* Copy out everything first: a module may be moved over the list */
+    const multiboot_module_t* mods = (const multiboot_module_t*)mbi->mods_addr;
+    uint32_t highest = 0;
+    for (uint32_t i = 0; i < mbi->mods_count && g_module_count < INITRD_MAX_MODULES; i++) {
+        if (mods[i].mod_end <= mods[i].mod_start || mods[i].mod_end > mem_end) {
+            continue;       /* Empty, or not identity-mapped once paging is on */
+        }
+        initrd_module_t* mod = &g_modules[g_module_count++];
+        mod->start = mods[i].mod_start;
+        mod->end = mods[i].mod_end;
+        initrd_module_path(mod, (const char*)mods[i].cmdline);
+        if (mod->end > highest) {
+            highest = mod->end;
+        }
+    }
+
+    /* Stack the ones in the way at the top of memory, above every module */
+    uint32_t limit = PAGE_ALIGN_DOWN(mem_end);
+    for (int i = 0; i < g_module_count; i++) {
+        initrd_module_t* mod = &g_modules[i];
+        if (mod->start >= INITRD_UNSAFE_END || mod->end <= INITRD_UNSAFE_START) {
+            continue;
+        }
+        limit = initrd_relocate(mod, limit, PAGE_ALIGN_UP(highest));
+        if (!limit) {
+            /* No room: drop it and everything not yet placed */
+            g_module_count = i;
+            break;
+        }
+    }
+
+    return g_module_count;
+}
+
+void initrd_reserve(void) {
+    for (int i = 0; i < g_module_count; i++) {
+        pmm_reserve(g_modules[i].start, g_modules[i].end);
+    }
+}
+
+/* Give a module's pool frames back; its data is gone afterwards */
+static void initrd_release(initrd_module_t* mod) {
+    uint32_t first = PAGE_ALIGN_UP(mod->start);
+    uint32_t last = PAGE_ALIGN_DOWN(mod->end);
+
+    /* Partial pages at either end may be shared with a neighbour */
+    for (uint32_t frame = first; frame < last; frame += PAGE_SIZE) {
+        pmm_free_frame(frame);
+    }
+    mod->start = mod->end = 0;
+}
+
+/* Mount a tmpfs big enough for the module at its path and unpack it */
+static int initrd_load(initrd_module_t* mod) {
+    initrd_cursor_t cur;
+    initrd_entry_t entry;
+    uint32_t pages = 0;
+    uint32_t nodes = 16;
+    int files;
+
+    if (initrd_open(&cur, (const void*)mod->start, mod->end - mod->start) < 0) {
+        vga_write_string("initrd: module for ");
+        vga_write_string(mod->path);
+        vga_write_string(" is not a cpio or tar archive\n");
+        initrd_release(mod);
+        return -1;
+    }
+
+    /* Every entry may need a node and every file whole pages; the slack
+     * covers parent directories the archive does not list */
+    while (initrd_next(&cur, &entry) == 0) {
+        nodes++;
+        if (entry.type == VFS_TYPE_FILE) {
+            pages += PAGE_ALIGN_UP(entry.size) / PAGE_SIZE;
+        }
+    }
+
+    char source[48];
+    char num[12];
+    uint32_t kb = pages * (PAGE_SIZE / 1024);
+    if (kb < TMPFS_DEFAULT_SIZE / 1024) {
+        kb = TMPFS_DEFAULT_SIZE / 1024;
+    }
+    if (nodes < TMPFS_DEFAULT_NODES) {
+        nodes = TMPFS_DEFAULT_NODES;
+    } else if (nodes > 0x7FFF) {
+        nodes = 0x7FFF;         /* tmpfs limit */
+    }
+    strcpy(source, "size=");
+    itoa((int)kb, num, 10);
+    strcat(source, num);
+    strcat(source, "k,nodes=");
+    itoa((int)nodes, num, 10);
+    strcat(source, num);
+
+    files = -1;
+    if (vfs_mount("tmpfs", mod->path, source) == 0) {
+        files = initrd_unpack((const void*)mod->start, mod->end - mod->start, mod->path);
+    } else {
+        vga_write_string("initrd: cannot mount ");
+        vga_write_string(mod->path);
+        vga_write_string("\n");
+    }
+
+    initrd_release(mod);
+    return files;
+}
+
+int initrd_mount_root(void) {
+    for (int i = 0; i < g_module_count; i++) {
+        if (g_modules[i].end && strcmp(g_modules[i].path, "/") == 0) {
+            return initrd_load(&g_modules[i]);
+        }
+    }
+    return -1;
+}
+
+int initrd_mount_all(void) {
+    int total = 0;
+
+    for (int i = 0; i < g_module_count; i++) {
+        if (!g_modules[i].end) {
+            continue;       /* Already unpacked */
+        }
+        int files = initrd_load(&g_modules[i]);
+        if (files > 0) {
+            total += files;
+        }
+    }
+    return total;
+}
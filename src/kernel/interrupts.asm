@@ -39,13 +39,40 @@ inw:
 	movzx eax, ax         ; Zero-extend ax to eax
 	ret
 
+; void gdt_flush(uint32_t gdt_ptr)
+global gdt_flush
+gdt_flush:
+	mov eax, [esp + 4]    ; Get GDT descriptor address
+	lgdt [eax]
+	mov ax, 0x10          ; Kernel data segment
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+	jmp 0x08:.flush       ; Reload CS with the kernel code segment
+.flush:
+	ret
+
+; void tss_flush(uint16_t selector)
+global tss_flush
+tss_flush:
+	mov ax, [esp + 4]     ; Get TSS selector
+	ltr ax
+	ret
+
 ; Forward declarations
 extern isr_handler
 extern irq_handler
+extern syscall_handler
+extern g_sysenter_return
+extern sysenter_frame_ok
 
 ; Exception handlers
-global isr0, isr1, isr8, isr14
+global isr0, isr1, isr6, isr7, isr8, isr11, isr12, isr13, isr14, isr16, isr19
 global irq0, irq1
+global isr128
+global sysenter_entry
 
 ; Divide by zero exception
 isr0:
@@ -59,16 +86,55 @@ isr1:
 	push dword 1
 	jmp isr_common_stub
 
+; Invalid opcode
+isr6:
+	push dword 0
+	push dword 6
+	jmp isr_common_stub
+
+; Device not available (FPU used with CR0.TS set)
+isr7:
+	push dword 0
+	push dword 7
+	jmp isr_common_stub
+
 ; Double fault
 isr8:
 	push dword 8
 	jmp isr_common_stub
 
+; Segment not present (error code pushed by CPU)
+isr11:
+	push dword 11
+	jmp isr_common_stub
+
+; Stack-segment fault (error code pushed by CPU)
+isr12:
+	push dword 12
+	jmp isr_common_stub
+
+; General protection fault (error code pushed by CPU)
+isr13:
+	push dword 13
+	jmp isr_common_stub
+
 ; Page fault (error code pushed by CPU)
 isr14:
 	push dword 14
 	jmp isr_common_stub
 
+; x87 floating-point error
+isr16:
+	push dword 0
+	push dword 16
+	jmp isr_common_stub
+
+; SIMD floating-point exception
+isr19:
+	push dword 0
+	push dword 19
+	jmp isr_common_stub
+
 ; IRQ 0 - Timer
 irq0:
 	push dword 0
@@ -91,7 +157,9 @@ isr_common_stub:
 	mov es, ax
 	mov fs, ax
 	mov gs, ax
+	push esp              ; interrupt_frame_t* for the C handler
 	call isr_handler
+	add esp, 4
 	pop eax
 	mov ds, ax
 	mov es, ax
@@ -111,7 +179,11 @@ irq_common_stub:
 	mov es, ax
 	mov fs, ax
 	mov gs, ax
+	mov eax, [esp + 36]   ; Interrupt number pushed by the stub
+	sub eax, 32           ; Convert vector to IRQ line
+	push eax
 	call irq_handler
+	add esp, 4
 	pop eax
 	mov ds, ax
 	mov es, ax
@@ -120,3 +192,99 @@ irq_common_stub:
 	popa
 	add esp, 8
 	iret
+
+; System call gate (int 0x80, DPL 3 trap gate)
+; Builds a syscall_context_t on the kernel stack. Arguments are passed in
+; EBX, ECX, EDX, ESI, EDI; the result is returned in EAX.
+isr128:
+	push es
+	push ds
+	push dword [esp + 16] ; EFLAGS from the iret frame
+	push dword [esp + 12] ; EIP from the iret frame
+	push dword [esp + 28] ; User ESP (only meaningful from ring 3)
+	push ebp
+	push edi
+	push esi
+	push edx
+	push ecx
+	push ebx
+	push eax
+	mov ax, 0x10
+	mov ds, ax
+	mov es, ax
+	push esp              ; syscall_context_t* for the C handler
+	call syscall_handler
+	add esp, 4
+	pop eax               ; Return value
+	pop ebx
+	pop ecx
+	pop edx
+	pop esi
+	pop edi
+	pop ebp
+	add esp, 12           ; Skip ESP, EIP, EFLAGS
+	pop ds
+	pop es
+	iret
+
+; SYSENTER fast system call entry
+; The CPU loads CS/SS from MSR_SYSENTER_CS and ESP = &tss.esp0. The user
+; stub (vsyscall_stubs.asm) saved ECX, EDX, EBP on the user stack and put
+; the user ESP in EBP. Builds the same syscall_context_t as isr128.
+; EBP comes from user code, so the save area is checked before it is read;
+; ECX/EDX are free until then (the stub restores them).
+sysenter_entry:
+	mov esp, [esp]        ; Current process's kernel stack (TSS.esp0)
+	mov cx, 0x10
+	mov ds, cx
+	mov es, cx
+	sti                   ; SYSENTER cleared IF
+	push eax
+	push ebp
+	call sysenter_frame_ok
+	add esp, 4
+	test eax, eax
+	pop eax
+	jz .bad_frame
+	push dword 0x23       ; ES
+	push dword 0x23       ; DS
+	pushfd                ; EFLAGS
+	push dword [g_sysenter_return] ; EIP
+	push ebp              ; User ESP
+	push dword [ebp]      ; User EBP
+	push edi
+	push esi
+	push dword [ebp + 4]  ; EDX (saved by the user stub)
+	push dword [ebp + 8]  ; ECX (saved by the user stub)
+	push ebx
+	push eax
+	push esp              ; syscall_context_t* for the C handler
+	call syscall_handler
+	add esp, 4
+	cli
+	pop eax               ; Return value
+	pop ebx
+	add esp, 8            ; ECX/EDX are restored by the user stub
+	pop esi
+	pop edi
+	add esp, 4            ; EBP is restored by the user stub
+	pop ecx               ; User ESP for SYSEXIT
+	pop edx               ; Return EIP for SYSEXIT
+	add esp, 4            ; Skip EFLAGS
+	pop ds
+	pop es
+	sti                   ; Takes effect after SYSEXIT
+	sysexit
+
+; Unreadable save area: fail with -1. The stub's pops then fault in ring 3,
+; which ends only the caller.
+.bad_frame:
+	cli
+	mov eax, -1
+	mov edx, [g_sysenter_return] ; Return EIP for SYSEXIT
+	mov cx, 0x23
+	mov ds, cx
+	mov es, cx
+	mov ecx, ebp          ; User ESP for SYSEXIT
+	sti                   ; Takes effect after SYSEXIT
+	sysexit
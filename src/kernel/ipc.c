@@ -2,6 +2,8 @@
 #include "memory.h"
 #include "string.h"
 #include "process.h"
+#include "waitqueue.h"
+#include "cpu.h"
 
 /* IPC Implementation - Pipes and Message Queues */
 
@@ -13,24 +15,46 @@ static ipc_queue_t g_queues[IPC_MAX_PIPES];
 void ipc_init(void) {
     for (int i = 0; i < IPC_MAX_PIPES; i++) {
         g_pipes[i].in_use = 0;
-        g_pipes[i].read_pos = 0;
-        g_pipes[i].write_pos = 0;
-        g_pipes[i].message_count = 0;
-        
-        g_queues[i].in_use = 0;
-        g_queues[i].buffer = NULL;
-        g_queues[i].front = 0;
-        g_queues[i].rear = 0;
-        g_queues[i].size = 0;
-        g_queues[i].max_size = 0;
+        g_pipes[i].buffer = NULL;
+        g_pipes[i].alloc_size = 0;
+        wait_queue_init(&g_pipes[i].readable);
+        wait_queue_init(&g_pipes[i].writable);
+        poll_head_init(&g_pipes[i].poll);
+
+        memset(&g_queues[i], 0, sizeof(ipc_queue_t));
+        wait_queue_init(&g_queues[i].readable);
+        wait_queue_init(&g_queues[i].writable);
     }
 }
 
+/* Look up an active pipe */
+static ipc_pipe_t* ipc_pipe_get(int pipe_id) {
+    if (pipe_id < 0 || pipe_id >= IPC_MAX_PIPES || !g_pipes[pipe_id].in_use) {
+        return NULL;
+    }
+    return &g_pipes[pipe_id];
+}
+
 /* Create a pipe */
 int ipc_pipe_create(void) {
+    return ipc_pipe_create_size(IPC_PIPE_DEFAULT_CAPACITY);
+}
+
+/* Create a pipe with the given capacity */
+int ipc_pipe_create_size(uint32_t capacity) {
+    if (capacity == 0 || capacity > IPC_PIPE_MAX_CAPACITY) {
+        return -1;
+    }
+
+    /* Round up to a power of two so indices are a mask, not a modulo */
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
     int pipe_id = -1;
-    
-    /* Find free pipe slot */
     for (int i = 0; i < IPC_MAX_PIPES; i++) {
         if (!g_pipes[i].in_use) {
             pipe_id = i;
@@ -39,103 +63,229 @@ int ipc_pipe_create(void) {
     }
 
     if (pipe_id < 0) {
+        cpu_irq_restore(flags);
         return -1;  /* No free pipes */
     }
 
-    /* Initialize pipe */
-    g_pipes[pipe_id].in_use = 1;
-    g_pipes[pipe_id].read_pos = 0;
-    g_pipes[pipe_id].write_pos = 0;
-    g_pipes[pipe_id].message_count = 0;
-    
+    ipc_pipe_t* pipe = &g_pipes[pipe_id];
+
+    /* Reuse the slot's previous buffer when it is large enough */
+    if (pipe->alloc_size < size) {
+        uint8_t* buffer = (uint8_t*)malloc(size);
+        if (!buffer) {
+            cpu_irq_restore(flags);
+            return -1;
+        }
+        free(pipe->buffer);
+        pipe->buffer = buffer;
+        pipe->alloc_size = size;
+    }
+
+    spsc_ring_init(&pipe->ring, pipe->buffer, size, 1);
+    pipe->in_use = 1;
+    pipe->readers = 1;
+    pipe->writers = 1;
+    wait_queue_init(&pipe->readable);
+    wait_queue_init(&pipe->writable);
+
     process_t* proc = process_current();
-    g_pipes[pipe_id].owner_pid = proc ? proc->pid : 0;
+    pipe->owner_pid = proc ? proc->pid : 0;
 
+    cpu_irq_restore(flags);
     return pipe_id;
 }
 
-/* Close a pipe */
-int ipc_pipe_close(int pipe_id) {
-    if (pipe_id < 0 || pipe_id >= IPC_MAX_PIPES) {
+/* Close one end of a pipe */
+int ipc_pipe_close_end(int pipe_id, int end) {
+    uint32_t flags = cpu_irq_save();
+
+    ipc_pipe_t* pipe = ipc_pipe_get(pipe_id);
+    if (!pipe) {
+        cpu_irq_restore(flags);
         return -1;
     }
 
-    if (!g_pipes[pipe_id].in_use) {
+    if (end == IPC_PIPE_READ && pipe->readers > 0) {
+        pipe->readers--;
+    } else if (end == IPC_PIPE_WRITE && pipe->writers > 0) {
+        pipe->writers--;
+    } else {
+        cpu_irq_restore(flags);
         return -1;
     }
 
-    g_pipes[pipe_id].in_use = 0;
+    /* Sleepers re-check: writers see no readers, readers see EOF */
+    wait_queue_wake_all(&pipe->readable);
+    wait_queue_wake_all(&pipe->writable);
+    poll_wake(&pipe->poll);
+
+    if (pipe->readers == 0 && pipe->writers == 0) {
+        pipe->in_use = 0;  /* Buffer stays with the slot */
+    }
+
+    cpu_irq_restore(flags);
     return 0;
 }
 
-/* Write to pipe */
-int ipc_pipe_write(int pipe_id, uint32_t message) {
-    if (pipe_id < 0 || pipe_id >= IPC_MAX_PIPES) {
+/* Close a pipe */
+int ipc_pipe_close(int pipe_id) {
+    uint32_t flags = cpu_irq_save();
+
+    ipc_pipe_t* pipe = ipc_pipe_get(pipe_id);
+    if (!pipe) {
+        cpu_irq_restore(flags);
         return -1;
     }
 
-    if (!g_pipes[pipe_id].in_use) {
+    pipe->readers = 0;
+    pipe->writers = 0;
+    pipe->in_use = 0;
+    wait_queue_wake_all(&pipe->readable);
+    wait_queue_wake_all(&pipe->writable);
+    poll_wake(&pipe->poll);
+
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+/* Write to pipe */
+int ipc_pipe_write(int pipe_id, const void* data, uint32_t count) {
+    const uint8_t* src = (const uint8_t*)data;
+    uint32_t written = 0;
+
+    if (!data) {
         return -1;
     }
 
-    ipc_pipe_t* pipe = &g_pipes[pipe_id];
+    while (written < count) {
+        ipc_pipe_t* pipe = ipc_pipe_get(pipe_id);
+        if (!pipe || pipe->readers == 0) {
+            break;  /* Broken pipe */
+        }
 
-    /* Check if buffer is full */
-    if (pipe->message_count >= IPC_BUFFER_SIZE) {
-        return -1;  /* Buffer full, can't write */
-    }
+        /* Fast path: lock-free copy of as much as fits */
+        uint32_t n = spsc_ring_enqueue(&pipe->ring, src + written, count - written);
+        if (n) {
+            written += n;
+            if (wait_queue_active(&pipe->readable)) {
+                wait_queue_wake_all(&pipe->readable);
+            }
+            poll_wake(&pipe->poll);
+            continue;
+        }
 
-    /* Write message */
-    pipe->buffer[pipe->write_pos] = message;
-    pipe->write_pos = (pipe->write_pos + 1) % IPC_BUFFER_SIZE;
-    pipe->message_count++;
+        /* Full: sleep unless the reader made room or went away meanwhile */
+        uint32_t flags = cpu_irq_save();
+        if (spsc_ring_space(&pipe->ring) == 0 && pipe->readers > 0 && pipe->in_use) {
+            wait_queue_sleep(&pipe->writable);
+        }
+        cpu_irq_restore(flags);
+    }
 
-    return 0;
+    return (written == 0 && count > 0) ? -1 : (int)written;
 }
 
 /* Read from pipe */
-int ipc_pipe_read(int pipe_id, uint32_t* message) {
-    if (pipe_id < 0 || pipe_id >= IPC_MAX_PIPES || !message) {
+int ipc_pipe_read(int pipe_id, void* data, uint32_t count) {
+    if (!data) {
         return -1;
     }
-
-    if (!g_pipes[pipe_id].in_use) {
-        return -1;
+    if (count == 0) {
+        return 0;
     }
 
-    ipc_pipe_t* pipe = &g_pipes[pipe_id];
-
-    /* Check if buffer is empty */
-    if (pipe->message_count == 0) {
-        return -1;  /* No data */
-    }
+    while (1) {
+        ipc_pipe_t* pipe = ipc_pipe_get(pipe_id);
+        if (!pipe) {
+            return -1;
+        }
 
-    /* Read message */
-    *message = pipe->buffer[pipe->read_pos];
-    pipe->read_pos = (pipe->read_pos + 1) % IPC_BUFFER_SIZE;
-    pipe->message_count--;
+        /* Fast path: lock-free copy of whatever is buffered */
+        uint32_t n = spsc_ring_dequeue(&pipe->ring, data, count);
+        if (n) {
+            if (wait_queue_active(&pipe->writable)) {
+                wait_queue_wake_all(&pipe->writable);
+            }
+            poll_wake(&pipe->poll);
+            return (int)n;
+        }
 
-    return 0;
+        /* Empty: end of stream without writers, otherwise sleep unless
+         * data arrived meanwhile */
+        uint32_t flags = cpu_irq_save();
+        if (spsc_ring_count(&pipe->ring) == 0) {
+            if (pipe->writers == 0 || !pipe->in_use) {
+                cpu_irq_restore(flags);
+                return 0;
+            }
+            wait_queue_sleep(&pipe->readable);
+        }
+        cpu_irq_restore(flags);
+    }
 }
 
-/* Check if pipe has data */
+/* Bytes available in pipe */
 int ipc_pipe_has_data(int pipe_id) {
-    if (pipe_id < 0 || pipe_id >= IPC_MAX_PIPES) {
+    ipc_pipe_t* pipe = ipc_pipe_get(pipe_id);
+    if (!pipe) {
         return 0;
     }
 
-    if (!g_pipes[pipe_id].in_use) {
-        return 0;
+    return (int)spsc_ring_count(&pipe->ring);
+}
+
+/* Look up an active queue */
+static ipc_queue_t* ipc_queue_get(int queue_id) {
+    if (queue_id < 0 || queue_id >= IPC_MAX_PIPES || !g_queues[queue_id].in_use) {
+        return NULL;
     }
+    return &g_queues[queue_id];
+}
 
-    return g_pipes[pipe_id].message_count > 0 ? 1 : 0;
+/* Readiness of one pipe end for epoll */
+int ipc_pipe_poll(int pipe_id, int end, poll_head_t** head) {
+    ipc_pipe_t* pipe = ipc_pipe_get(pipe_id);
+    if (!pipe) {
+        return -1;
+    }
+
+    if (head) {
+        *head = &pipe->poll;
+    }
+
+    int events = 0;
+    if (end == IPC_PIPE_READ) {
+        if (spsc_ring_count(&pipe->ring) > 0) {
+            events |= EPOLLIN;
+        }
+        if (pipe->writers == 0) {
+            events |= EPOLLHUP;
+        }
+    } else {
+        if (spsc_ring_space(&pipe->ring) > 0) {
+            events |= EPOLLOUT;
+        }
+        if (pipe->readers == 0) {
+            events |= EPOLLERR;
+        }
+    }
+    return events;
 }
 
 /* Create message queue */
 int ipc_queue_create(uint32_t size) {
+    if (size <= IPC_QUEUE_HEADER_SIZE || size > IPC_PIPE_MAX_CAPACITY) {
+        return -1;
+    }
+
+    uint32_t ring_size = 1;
+    while (ring_size < size) {
+        ring_size <<= 1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
     int queue_id = -1;
-    
-    /* Find free queue slot */
     for (int i = 0; i < IPC_MAX_PIPES; i++) {
         if (!g_queues[i].in_use) {
             queue_id = i;
@@ -144,124 +294,347 @@ int ipc_queue_create(uint32_t size) {
     }
 
     if (queue_id < 0) {
+        cpu_irq_restore(flags);
         return -1;  /* No free queues */
     }
 
-    /* Allocate buffer */
-    uint8_t* buffer = (uint8_t*)malloc(size);
-    if (!buffer) {
-        return -1;
+    /* Level rings are set up on first use; their buffers stay with the slot */
+    ipc_queue_t* queue = &g_queues[queue_id];
+    for (int i = 0; i < IPC_QUEUE_PRIORITIES; i++) {
+        queue->levels[i].active = 0;
     }
-
-    /* Initialize queue */
-    g_queues[queue_id].in_use = 1;
-    g_queues[queue_id].buffer = buffer;
-    g_queues[queue_id].front = 0;
-    g_queues[queue_id].rear = 0;
-    g_queues[queue_id].size = 0;
-    g_queues[queue_id].max_size = size;
-
+    queue->ready_mask = 0;
+    queue->ring_size = ring_size;
+    queue->size = 0;
+    queue->max_size = size;
+    queue->messages = 0;
+    queue->in_use = 1;
+    wait_queue_init(&queue->readable);
+    wait_queue_init(&queue->writable);
+
+    cpu_irq_restore(flags);
     return queue_id;
 }
 
 /* Destroy message queue */
 int ipc_queue_destroy(int queue_id) {
-    if (queue_id < 0 || queue_id >= IPC_MAX_PIPES) {
+    uint32_t flags = cpu_irq_save();
+
+    ipc_queue_t* queue = ipc_queue_get(queue_id);
+    if (!queue) {
+        cpu_irq_restore(flags);
         return -1;
     }
 
-    if (!g_queues[queue_id].in_use) {
-        return -1;
+    queue->in_use = 0;
+    wait_queue_wake_all(&queue->readable);
+    wait_queue_wake_all(&queue->writable);
+
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+/* Make a level's ring usable; called with interrupts disabled */
+static int ipc_queue_level_init(ipc_queue_t* queue, ipc_queue_level_t* level) {
+    if (level->active) {
+        return 0;
     }
 
-    if (g_queues[queue_id].buffer) {
-        free(g_queues[queue_id].buffer);
+    if (level->alloc_size < queue->ring_size) {
+        uint8_t* buffer = (uint8_t*)malloc(queue->ring_size);
+        if (!buffer) {
+            return -1;
+        }
+        free(level->buffer);
+        level->buffer = buffer;
+        level->alloc_size = queue->ring_size;
     }
 
-    g_queues[queue_id].in_use = 0;
+    /* Holds the whole byte budget, so it never fills before the queue does */
+    spsc_ring_init(&level->ring, level->buffer, queue->ring_size, 1);
+    level->active = 1;
     return 0;
 }
 
 /* Send message to queue */
 int ipc_queue_send(int queue_id, const void* data, uint32_t data_size) {
-    if (queue_id < 0 || queue_id >= IPC_MAX_PIPES || !data) {
+    return ipc_queue_send_prio(queue_id, data, data_size, IPC_QUEUE_PRIO_NORMAL);
+}
+
+/* Send message at a priority */
+int ipc_queue_send_prio(int queue_id, const void* data, uint32_t data_size, uint8_t priority) {
+    if ((!data && data_size > 0) || priority >= IPC_QUEUE_PRIORITIES) {
         return -1;
     }
 
-    if (!g_queues[queue_id].in_use) {
-        return -1;
+    uint32_t record = IPC_QUEUE_HEADER_SIZE + data_size;
+    uint32_t flags = cpu_irq_save();
+
+    ipc_queue_t* queue = ipc_queue_get(queue_id);
+    if (!queue || data_size > queue->max_size - IPC_QUEUE_HEADER_SIZE) {
+        cpu_irq_restore(flags);
+        return -1;  /* No queue, or the message could never fit */
     }
 
-    ipc_queue_t* queue = &g_queues[queue_id];
+    /* Full: wait for receivers to make room */
+    while (queue->size + record > queue->max_size) {
+        wait_queue_sleep(&queue->writable);
+        if (!queue->in_use) {
+            cpu_irq_restore(flags);
+            return -1;
+        }
+    }
 
-    /* Check if buffer has enough space */
-    if (queue->size + data_size > queue->max_size) {
-        return -1;  /* No space */
+    ipc_queue_level_t* level = &queue->levels[priority];
+    if (ipc_queue_level_init(queue, level) < 0) {
+        cpu_irq_restore(flags);
+        return -1;
     }
 
-    /* Copy data to queue */
-    uint32_t space_at_end = queue->max_size - queue->rear;
-    
-    if (data_size <= space_at_end) {
-        memcpy(queue->buffer + queue->rear, data, data_size);
-        queue->rear = (queue->rear + data_size) % queue->max_size;
-    } else {
-        /* Wrap around */
-        memcpy(queue->buffer + queue->rear, data, space_at_end);
-        memcpy(queue->buffer, (uint8_t*)data + space_at_end, data_size - space_at_end);
-        queue->rear = data_size - space_at_end;
+    spsc_ring_enqueue(&level->ring, &data_size, IPC_QUEUE_HEADER_SIZE);
+    spsc_ring_enqueue(&level->ring, data, data_size);
+    queue->ready_mask |= 1u << priority;
+    queue->size += record;
+    queue->messages++;
+
+    if (wait_queue_active(&queue->readable)) {
+        wait_queue_wake_all(&queue->readable);
     }
 
-    queue->size += data_size;
+    cpu_irq_restore(flags);
     return 0;
 }
 
 /* Receive message from queue */
 int ipc_queue_recv(int queue_id, void* data, uint32_t max_size) {
-    if (queue_id < 0 || queue_id >= IPC_MAX_PIPES || !data) {
+    if (!data && max_size > 0) {
         return -1;
     }
 
-    if (!g_queues[queue_id].in_use) {
+    uint32_t flags = cpu_irq_save();
+
+    ipc_queue_t* queue = ipc_queue_get(queue_id);
+    if (!queue) {
+        cpu_irq_restore(flags);
         return -1;
     }
 
-    ipc_queue_t* queue = &g_queues[queue_id];
+    /* Empty: wait for a sender */
+    while (queue->ready_mask == 0) {
+        wait_queue_sleep(&queue->readable);
+        if (!queue->in_use) {
+            cpu_irq_restore(flags);
+            return -1;
+        }
+    }
 
-    /* Check if queue is empty */
-    if (queue->size == 0) {
-        return 0;  /* No data */
+    /* Most urgent non-empty level */
+    uint32_t priority = __builtin_ctz(queue->ready_mask);
+    spsc_ring_t* ring = &queue->levels[priority].ring;
+
+    /* Peek at the length prefix; an oversized message stays queued */
+    uint32_t len;
+    uint8_t* prefix = (uint8_t*)&len;
+    for (uint32_t i = 0; i < IPC_QUEUE_HEADER_SIZE; i++) {
+        prefix[i] = ring->buffer[(ring->tail + i) & ring->mask];
+    }
+    if (len > max_size) {
+        cpu_irq_restore(flags);
+        return -1;
     }
 
-    /* Determine read size */
-    uint32_t read_size = max_size < queue->size ? max_size : queue->size;
+    spsc_ring_dequeue(ring, &len, IPC_QUEUE_HEADER_SIZE);
+    spsc_ring_dequeue(ring, data, len);
+    if (spsc_ring_count(ring) == 0) {
+        queue->ready_mask &= ~(1u << priority);
+    }
+    queue->size -= IPC_QUEUE_HEADER_SIZE + len;
+    queue->messages--;
 
-    /* Copy data from queue */
-    uint32_t space_at_end = queue->max_size - queue->front;
-    
-    if (read_size <= space_at_end) {
-        memcpy(data, queue->buffer + queue->front, read_size);
-        queue->front = (queue->front + read_size) % queue->max_size;
-    } else {
-        /* Wrap around */
-        memcpy(data, queue->buffer + queue->front, space_at_end);
-        memcpy((uint8_t*)data + space_at_end, queue->buffer, read_size - space_at_end);
-        queue->front = read_size - space_at_end;
+    if (wait_queue_active(&queue->writable)) {
+        wait_queue_wake_all(&queue->writable);
     }
 
-    queue->size -= read_size;
-    return (int)read_size;
+    cpu_irq_restore(flags);
+    return (int)len;
 }
 
-/* Check queue size */
+/* Bytes queued */
 uint32_t ipc_queue_size(int queue_id) {
-    if (queue_id < 0 || queue_id >= IPC_MAX_PIPES) {
-        return 0;
+    ipc_queue_t* queue = ipc_queue_get(queue_id);
+    return queue ? queue->size : 0;
+}
+
+/* Messages queued */
+uint32_t ipc_queue_count(int queue_id) {
+    ipc_queue_t* queue = ipc_queue_get(queue_id);
+    return queue ? queue->messages : 0;
+}
+
+/* Descriptor operations */
+
+static int ipc_pipe_close_read(int pipe_id) {
+    return ipc_pipe_close_end(pipe_id, IPC_PIPE_READ);
+}
+
+static int ipc_pipe_close_write(int pipe_id) {
+    return ipc_pipe_close_end(pipe_id, IPC_PIPE_WRITE);
+}
+
+const file_ops_t ipc_pipe_read_ops = {
+    .name = "pipe",
+    .poll_source = EPOLL_SRC_PIPE_READ,
+    .read = ipc_pipe_read,
+    .close = ipc_pipe_close_read,
+};
+
+const file_ops_t ipc_pipe_write_ops = {
+    .name = "pipe",
+    .poll_source = EPOLL_SRC_PIPE_WRITE,
+    .write = ipc_pipe_write,
+    .close = ipc_pipe_close_write,
+};
+
+const file_ops_t ipc_queue_ops = {
+    .name = "queue",
+    .read = ipc_queue_recv,
+    .write = ipc_queue_send,
+    .close = ipc_queue_destroy,
+};
+
+/* Synchronous call/reply */
+
+/* Send a request and wait for the reply */
+int ipc_call(uint32_t dest, ipc_msg_t* msg) {
+    process_t* self = process_current();
+    if (!self || !msg) {
+        return -1;
     }
 
-    if (!g_queues[queue_id].in_use) {
-        return 0;
+    uint32_t flags = cpu_irq_save();
+
+    process_t* server = process_get(dest);
+    if (!server || server == self || server->state == PROC_STATE_TERMINATED) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    self->ipc_msg = *msg;
+    self->ipc_partner = dest;
+    self->ipc_result = 0;
+
+    if (server->ipc_state == IPC_STATE_RECEIVING) {
+        /* Rendezvous: deliver now and run the server on our time slice */
+        server->ipc_msg = *msg;
+        server->ipc_partner = self->pid;
+        server->ipc_state = IPC_STATE_NONE;
+        self->ipc_state = IPC_STATE_AWAIT_REPLY;
+        self->state = PROC_STATE_BLOCKED;
+        if (process_switch_to(dest) < 0) {
+            self->state = PROC_STATE_RUNNING;
+        }
+    } else {
+        /* Server busy: queue until it asks for the next request */
+        self->ipc_state = IPC_STATE_CALLING;
+        server->ipc_senders |= 1u << self->pid;
+    }
+
+    while (self->ipc_state != IPC_STATE_NONE) {
+        process_block();
+    }
+
+    *msg = self->ipc_msg;
+    int result = self->ipc_result;
+
+    cpu_irq_restore(flags);
+    return result;
+}
+
+/* Reply to the last caller and wait for the next request */
+int ipc_reply_wait(int reply_to, const ipc_msg_t* reply, ipc_msg_t* msg) {
+    process_t* self = process_current();
+    if (!self || !msg || (reply_to >= 0 && !reply)) {
+        return -1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    /* Complete the previous call, if the caller is still waiting for us */
+    process_t* client = (reply_to >= 0) ? process_get((uint32_t)reply_to) : NULL;
+    if (client && client->ipc_state == IPC_STATE_AWAIT_REPLY &&
+        client->ipc_partner == self->pid) {
+        client->ipc_msg = *reply;
+        client->ipc_result = 0;
+        client->ipc_state = IPC_STATE_NONE;
+    } else {
+        client = NULL;
+    }
+
+    /* Callers that queued while we were busy come first */
+    while (self->ipc_senders) {
+        uint32_t pid = __builtin_ctz(self->ipc_senders);
+        self->ipc_senders &= ~(1u << pid);
+
+        process_t* caller = process_get(pid);
+        if (!caller || caller->ipc_state != IPC_STATE_CALLING || caller->ipc_partner != self->pid) {
+            continue;
+        }
+
+        *msg = caller->ipc_msg;
+        caller->ipc_state = IPC_STATE_AWAIT_REPLY;
+        if (client) {
+            process_wake(client->pid);
+        }
+
+        cpu_irq_restore(flags);
+        return (int)pid;
+    }
+
+    self->ipc_state = IPC_STATE_RECEIVING;
+    if (client) {
+        /* Reply and wait in one step: switch straight back to the caller */
+        self->state = PROC_STATE_BLOCKED;
+        if (process_switch_to(client->pid) < 0) {
+            self->state = PROC_STATE_RUNNING;
+        }
+    }
+
+    while (self->ipc_state == IPC_STATE_RECEIVING) {
+        process_block();
+    }
+
+    *msg = self->ipc_msg;
+    int caller_pid = (int)self->ipc_partner;
+
+    cpu_irq_restore(flags);
+    return caller_pid;
+}
+
+/* Fail calls to or queued on an exiting process */
+void ipc_release_process(uint32_t pid) {
+    uint32_t flags = cpu_irq_save();
+
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        process_t* proc = process_get_at_index((uint8_t)i);
+        if (proc->state == PROC_STATE_UNUSED) {
+            continue;
+        }
+
+        proc->ipc_senders &= ~(1u << pid);
+
+        if (proc->pid != pid && proc->ipc_partner == pid &&
+            (proc->ipc_state == IPC_STATE_CALLING || proc->ipc_state == IPC_STATE_AWAIT_REPLY)) {
+            proc->ipc_result = -1;
+            proc->ipc_state = IPC_STATE_NONE;
+            process_wake(proc->pid);
+        }
+    }
+
+    process_t* self = process_get(pid);
+    if (self) {
+        self->ipc_state = IPC_STATE_NONE;
+        self->ipc_senders = 0;
     }
 
-    return g_queues[queue_id].size;
+    cpu_irq_restore(flags);
 }
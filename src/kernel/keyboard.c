@@ -1,5 +1,9 @@
 #include "drivers.h"
 #include "types.h"
+#include "cpu.h"
+#include "spsc_ring.h"
+#include "waitqueue.h"
+#include "epoll.h"
 
 /* Port I/O helper functions */
 extern void outb(uint16_t port, uint8_t value);
@@ -7,7 +11,10 @@ extern uint8_t inb(uint16_t port);
 
 /* PS/2 Keyboard driver
  * Reads scan codes from PS/2 controller port 0x60
- * Uses IRQ 1
+ * Uses IRQ 1: the handler translates make codes and queues the characters
+ * in a lock-free SPSC ring that keyboard_read_char() consumes. Several
+ * processes may read at once (the shell and a program on stdin), so the
+ * consumer side is serialised: each dequeue runs with interrupts disabled
  */
 
 #define KB_PORT 0x60
@@ -37,15 +44,76 @@ static const char scancode_map[] = {
 	0,                  /* Scroll lock */
 };
 
+#define KB_BUFFER_SIZE 256  /* Power of two */
+
+static char g_kb_storage[KB_BUFFER_SIZE];
+static spsc_ring_t g_kb_ring;           /* IRQ 1 produces, readers consume one at a time */
+static wait_queue_t g_kb_wait;          /* Readers waiting for a key */
+static poll_head_t g_kb_poll;           /* epoll watches */
+
+/* Translate a scancode; 0 for break codes and unmapped keys */
+static char keyboard_translate(uint8_t scancode) {
+	if (scancode & 0x80) {
+		return 0;  /* Key release */
+	}
+	if (scancode < sizeof(scancode_map)) {
+		return scancode_map[scancode];
+	}
+	return 0;
+}
+
 /* Initialize keyboard */
 void keyboard_init(void) {
 	/* Keyboard is already initialized by BIOS */
 	/* Enable PS/2 controller if needed */
+	spsc_ring_init(&g_kb_ring, g_kb_storage, KB_BUFFER_SIZE, 1);
+	wait_queue_init(&g_kb_wait);
+	poll_head_init(&g_kb_poll);
 	vga_write_string("Keyboard driver loaded\n");
 }
 
+/* IRQ 1: drain the controller into the ring (EOI is sent by irq_handler) */
+void keyboard_irq_handler(void) {
+	while (inb(KB_STATUS_PORT) & KB_STATUS_OUT_FULL) {
+		char c = keyboard_translate(inb(KB_PORT));
+		if (c) {
+			spsc_ring_enqueue(&g_kb_ring, &c, 1);  /* Dropped if full */
+		}
+	}
+
+	if (wait_queue_active(&g_kb_wait)) {
+		wait_queue_wake_all(&g_kb_wait);
+	}
+	poll_wake(&g_kb_poll);
+}
+
+/* Readiness for epoll: EPOLLIN while characters are queued */
+int keyboard_poll(poll_head_t** head) {
+	if (head) {
+		*head = &g_kb_poll;
+	}
+	return spsc_ring_count(&g_kb_ring) ? EPOLLIN : 0;
+}
+
 /* Read character from keyboard (blocking) */
 char keyboard_read_char(void) {
+	char c;
+
+	while (1) {
+		/* The ring has one consumer: no other reader can run until the
+		 * dequeue is done (the kernel is uniprocessor) */
+		uint32_t flags = cpu_irq_save();
+		if (spsc_ring_dequeue(&g_kb_ring, &c, 1)) {
+			cpu_irq_restore(flags);
+			return c;
+		}
+		if (!(flags & EFLAGS_IF)) {
+			break;  /* Called with interrupts off: IRQ 1 cannot fire, poll */
+		}
+		wait_queue_sleep(&g_kb_wait);
+		cpu_irq_restore(flags);
+	}
+
 	while (1) {
 		/* Check if data is available from keyboard */
 		uint8_t status = inb(KB_PORT + 4);  /* 0x60 + 4 = 0x64 */
@@ -54,11 +122,9 @@ char keyboard_read_char(void) {
 			/* Read scancode */
 			uint8_t scancode = inb(KB_PORT);
 
-			/* Check if it's a make code (not break code) */
-			if (!(scancode & 0x80)) {
-				if (scancode < sizeof(scancode_map)) {
-					return scancode_map[scancode];
-				}
+			c = keyboard_translate(scancode);
+			if (c) {
+				return c;
 			}
 		}
 	}
@@ -1,19 +1,32 @@
 #include "kernel.h"
 #include "drivers.h"
 #include "disk.h"
+#include "bcache.h"
 #include "process.h"
 #include "filesystem.h"
+#include "vfs.h"
+#include "tmpfs.h"
+#include "initrd.h"
 #include "ipc.h"
+#include "shm.h"
+#include "epoll.h"
+#include "futex.h"
 #include "memory.h"
 #include "types.h"
 #include "shell.h"
-
-/* Forward declarations */
-void idt_init(void);
+#include "fpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "vsyscall.h"
+#include "paging.h"
+#include "multiboot.h"
+#include "string.h"
 
 /* Kernel entry point called from bootloader */
 void kmain(uint32_t magic, uint32_t addr) {
-	(void) addr;  /* Unused parameter */
+	multiboot_info_t* mbi = (multiboot_info_t*) addr;
+	char buf[16];
+
 	/* Disable interrupts during initialization */
 	__asm__ volatile("cli");
 
@@ -33,14 +46,48 @@ void kmain(uint32_t magic, uint32_t addr) {
 
 	vga_write_string("Initializing kernel...\n");
 
+	/* End of usable memory, capped at the identity-mapped region */
+	uint32_t mem_end = PAGING_IDENTITY_LIMIT;
+	if ((mbi->flags & MULTIBOOT_INFO_MEMORY) &&
+	    mbi->mem_upper < (PAGING_IDENTITY_LIMIT - 0x100000) / 1024) {
+		mem_end = 0x100000 + mbi->mem_upper * 1024;
+	}
+
+	/* Boot modules, before the heap can overwrite them */
+	int modules = initrd_init(mbi, mem_end);
+
 	/* Initialize memory management */
 	memory_init();
 	vga_write_string("Memory management initialized\n");
 
+	/* Load kernel GDT (kernel/user segments and TSS) */
+	gdt_init();
+	vga_write_string("GDT and TSS initialized\n");
+
 	/* Initialize interrupt descriptor table */
 	idt_init();
 	vga_write_string("Interrupt handler initialized\n");
 
+	/* Initialize FPU/SSE (lazy context switching) */
+	fpu_init();
+	vga_write_string("FPU initialized\n");
+
+	/* Frame allocator and paging (identity-mapped kernel, per-process user space) */
+	pmm_init(mem_end);
+	initrd_reserve();
+	paging_init();
+	paging_enable();
+	vga_write_string("Paging enabled (");
+	itoa(pmm_free_frames() * (PAGE_SIZE / 1024), buf, 10);
+	vga_write_string(buf);
+	vga_write_string(" KB free)\n");
+
+	/* Select the system call entry mechanism (SYSENTER or int 0x80);
+	 * the stub page lives in the shared region paging_init() built */
+	vsyscall_init();
+	vga_write_string(vsyscall_mode() == VSYSCALL_MODE_SYSENTER ?
+		"System calls: SYSENTER\n" : "System calls: int 0x80\n");
+
 	/* Initialize process manager */
 	process_init();
 	vga_write_string("Process manager initialized\n");
@@ -55,14 +102,35 @@ void kmain(uint32_t magic, uint32_t addr) {
 
 	/* Initialize disk subsystem */
 	disk_init();
+	bcache_init();
 	vga_write_string("Disk subsystem initialized\n");
 
 	/* Initialize file system */
-	fs_init();
+	vfs_init();
+	vfs_register(&fat_fs_type);
+	vfs_register(&tmpfs_fs_type);
+	int initrd_files = initrd_mount_root();
+	if (initrd_files >= 0) {
+		vga_write_string("Root file system from initrd\n");
+	} else if (vfs_mount("fat", "/", NULL) < 0) {
+		vga_write_string("No FAT volume, using a RAM root\n");
+		vfs_mount("tmpfs", "/", NULL);
+	}
+	vfs_mount("tmpfs", "/tmp", NULL);
+	if (modules > 0) {
+		initrd_files = (initrd_files > 0 ? initrd_files : 0) + initrd_mount_all();
+		vga_write_string("Initrd: ");
+		itoa(initrd_files, buf, 10);
+		vga_write_string(buf);
+		vga_write_string(" files unpacked\n");
+	}
 	vga_write_string("File system initialized\n");
 
 	/* Initialize IPC subsystem */
 	ipc_init();
+	shm_init();
+	epoll_init();
+	futex_init();
 	vga_write_string("IPC subsystem initialized\n");
 
 	/* Enable interrupts */
@@ -1,34 +1,137 @@
 #include "memory.h"
 #include "types.h"
+#include "cpu.h"
 
-/* Simple memory allocator - very basic for now */
+/* Kernel heap: first-fit free-list allocator
+ *
+ * The heap is a chain of blocks in address order, each preceded by a
+ * heap_block_t header. malloc() takes the first free block that fits and
+ * splits off the remainder; free() merges the block with free neighbours,
+ * so the heap does not fragment into ever smaller pieces over time.
+ */
 
 #define HEAP_START 0x200000
 #define HEAP_SIZE  0x100000  /* 1 MB heap */
 #define HEAP_END   (HEAP_START + HEAP_SIZE)
+#define HEAP_ALIGN 16
+#define HEAP_MIN_SPLIT 32    /* Smallest remainder worth a block of its own */
 
-static uint8_t* heap = (uint8_t*) HEAP_START;
-static uint8_t* heap_ptr = (uint8_t*) HEAP_START;
+typedef struct heap_block {
+	uint32_t size;              /* Payload bytes */
+	uint32_t free;
+	struct heap_block* prev;    /* Neighbours in address order */
+	struct heap_block* next;
+} heap_block_t;                 /* 16 bytes, keeps payloads aligned */
+
+static heap_block_t* heap = NULL;
 
 /* Initialize memory management */
 void memory_init(void) {
-	heap_ptr = heap;
+	heap = (heap_block_t*) HEAP_START;
+	heap->size = HEAP_SIZE - sizeof(heap_block_t);
+	heap->free = 1;
+	heap->prev = NULL;
+	heap->next = NULL;
 }
 
 /* Allocate memory from heap */
 void* malloc(size_t size) {
-	if (heap_ptr + size >= (uint8_t*) HEAP_END) {
+	if (size == 0 || size > HEAP_SIZE) {
+		return NULL;
+	}
+	size = (size + HEAP_ALIGN - 1) & ~(size_t)(HEAP_ALIGN - 1);
+
+	uint32_t flags = cpu_irq_save();
+
+	if (!heap) {
+		memory_init();
+	}
+
+	heap_block_t* block = heap;
+	while (block && (!block->free || block->size < size)) {
+		block = block->next;
+	}
+
+	if (!block) {
+		cpu_irq_restore(flags);
 		return NULL;  /* Out of memory */
 	}
 
-	void* ptr = heap_ptr;
-	heap_ptr += size;
-	return ptr;
+	/* Split off the tail if it is large enough to be useful */
+	if (block->size >= size + sizeof(heap_block_t) + HEAP_MIN_SPLIT) {
+		heap_block_t* rest = (heap_block_t*) ((uint8_t*) (block + 1) + size);
+		rest->size = block->size - size - sizeof(heap_block_t);
+		rest->free = 1;
+		rest->prev = block;
+		rest->next = block->next;
+		if (rest->next) {
+			rest->next->prev = rest;
+		}
+		block->next = rest;
+		block->size = size;
+	}
+
+	block->free = 0;
+	cpu_irq_restore(flags);
+	return block + 1;
+}
+
+/* Merge block with the free block that follows it */
+static void heap_merge_next(heap_block_t* block) {
+	heap_block_t* next = block->next;
+
+	block->size += sizeof(heap_block_t) + next->size;
+	block->next = next->next;
+	if (block->next) {
+		block->next->prev = block;
+	}
 }
 
-/* Free memory (no-op for now) */
+/* Return memory to the heap */
 void free(void* ptr) {
-	(void) ptr;  /* Not implemented - no memory reclamation yet */
+	if (!ptr) {
+		return;
+	}
+
+	heap_block_t* block = (heap_block_t*) ptr - 1;
+	if ((uint32_t) block < HEAP_START || (uint32_t) ptr >= HEAP_END || block->free) {
+		return;  /* Not a live heap block */
+	}
+
+	uint32_t flags = cpu_irq_save();
+
+	block->free = 1;
+	if (block->next && block->next->free) {
+		heap_merge_next(block);
+	}
+	if (block->prev && block->prev->free) {
+		heap_merge_next(block->prev);
+	}
+
+	cpu_irq_restore(flags);
+}
+
+/* Resize an allocation, moving it if it cannot grow in place */
+void* realloc(void* ptr, size_t size) {
+	if (!ptr) {
+		return malloc(size);
+	}
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	heap_block_t* block = (heap_block_t*) ptr - 1;
+	if (block->size >= size) {
+		return ptr;
+	}
+
+	void* moved = malloc(size);
+	if (moved) {
+		memcpy(moved, ptr, block->size);
+		free(ptr);
+	}
+	return moved;
 }
 
 /* Copy memory */
@@ -68,25 +171,6 @@ void* memset(void* s, int c, size_t n) {
 	return s;
 }
 
-/* Paging stub - not fully implemented */
-void paging_init(void) {
-	/* TODO: Implement paging */
-}
-
-void paging_enable(void) {
-	/* TODO: Enable paging in CR0 */
-}
-
-uint32_t virt_to_phys(uint32_t virt_addr) {
-	/* Identity mapping for now */
-	return virt_addr;
-}
-
-uint32_t phys_to_virt(uint32_t phys_addr) {
-	/* Identity mapping for now */
-	return phys_addr;
-}
-
 /* Virtual memory allocation (same as malloc for now) */
 void* vmalloc(size_t size) {
 	return malloc(size);
@@ -0,0 +1,406 @@
+#include "paging.h"
+#include "memory.h"
+#include "process.h"
+#include "vfs.h"
+#include "cpu.h"
+
+/* Physical frame allocator, page tables and demand paging */
+
+#define PD_ENTRIES          1024
+#define PT_ENTRIES          1024
+#define KERNEL_PDES         (PAGING_IDENTITY_LIMIT / (PAGE_SIZE * PT_ENTRIES))
+
+#define SHARED_PDE          (PAGING_SHARED_BASE >> 22)
+
+#define PD_INDEX(v)         ((v) >> 22)
+#define PT_INDEX(v)         (((v) >> 12) & 0x3FF)
+
+/* Frame bitmap: bit set = frame in use */
+#define PMM_MAX_FRAMES      ((PAGING_IDENTITY_LIMIT - PMM_POOL_START) / PAGE_SIZE)
+
+static uint32_t g_frame_bitmap[PMM_MAX_FRAMES / 32];
+static uint32_t g_frame_count = 0;      /* Frames in the pool */
+static uint32_t g_frames_free = 0;
+static uint32_t g_frame_hint = 0;       /* Bitmap word to start searching from */
+
+/* Kernel page directory and the identity-mapped page tables shared by all
+ * address spaces */
+static uint32_t g_kernel_pd[PD_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t g_kernel_pts[KERNEL_PDES][PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t g_shared_pt[PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static int g_paging_enabled = 0;
+
+/* Initialize the frame pool [PMM_POOL_START, mem_end) */
+void pmm_init(uint32_t mem_end) {
+	if (mem_end > PAGING_IDENTITY_LIMIT) {
+		mem_end = PAGING_IDENTITY_LIMIT;
+	}
+
+	g_frame_count = 0;
+	if (mem_end > PMM_POOL_START) {
+		g_frame_count = (mem_end - PMM_POOL_START) / PAGE_SIZE;
+	}
+	g_frames_free = g_frame_count;
+	g_frame_hint = 0;
+
+	/* Frames past the end of memory are permanently in use */
+	memset(g_frame_bitmap, 0xFF, sizeof(g_frame_bitmap));
+	for (uint32_t i = 0; i < g_frame_count; i++) {
+		g_frame_bitmap[i / 32] &= ~(1u << (i % 32));
+	}
+}
+
+/* Allocate one 4 KB frame */
+uint32_t pmm_alloc_frame(void) {
+	uint32_t words = PMM_MAX_FRAMES / 32;
+
+	for (uint32_t n = 0; n < words; n++) {
+		uint32_t w = (g_frame_hint + n) % words;
+		if (g_frame_bitmap[w] == 0xFFFFFFFF) {
+			continue;
+		}
+
+		uint32_t bit = __builtin_ctz(~g_frame_bitmap[w]);
+		g_frame_bitmap[w] |= 1u << bit;
+		g_frames_free--;
+		g_frame_hint = w;
+		return PMM_POOL_START + (w * 32 + bit) * PAGE_SIZE;
+	}
+
+	return 0;  /* Out of memory */
+}
+
+/* Allocate count physically adjacent frames (first fit) */
+uint32_t pmm_alloc_contiguous(uint32_t count) {
+	uint32_t run = 0;
+
+	if (count == 0 || count > g_frames_free) {
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < g_frame_count; i++) {
+		if (g_frame_bitmap[i / 32] & (1u << (i % 32))) {
+			run = 0;
+			continue;
+		}
+		if (++run < count) {
+			continue;
+		}
+
+		uint32_t first = i + 1 - count;
+		for (uint32_t j = first; j <= i; j++) {
+			g_frame_bitmap[j / 32] |= 1u << (j % 32);
+		}
+		g_frames_free -= count;
+		return PMM_POOL_START + first * PAGE_SIZE;
+	}
+
+	return 0;
+}
+
+/* Take the frames covering [start, end) out of the pool (boot modules) */
+void pmm_reserve(uint32_t start, uint32_t end) {
+	for (uint32_t frame = PAGE_ALIGN_DOWN(start); frame < end; frame += PAGE_SIZE) {
+		if (frame < PMM_POOL_START || frame >= PMM_POOL_START + g_frame_count * PAGE_SIZE) {
+			continue;
+		}
+
+		uint32_t i = (frame - PMM_POOL_START) / PAGE_SIZE;
+		if (!(g_frame_bitmap[i / 32] & (1u << (i % 32)))) {
+			g_frame_bitmap[i / 32] |= 1u << (i % 32);
+			g_frames_free--;
+		}
+	}
+}
+
+/* Return a frame to the pool */
+void pmm_free_frame(uint32_t frame) {
+	if (frame < PMM_POOL_START || frame >= PMM_POOL_START + g_frame_count * PAGE_SIZE) {
+		return;
+	}
+
+	uint32_t i = (frame - PMM_POOL_START) / PAGE_SIZE;
+	if (g_frame_bitmap[i / 32] & (1u << (i % 32))) {
+		g_frame_bitmap[i / 32] &= ~(1u << (i % 32));
+		g_frames_free++;
+	}
+}
+
+uint32_t pmm_free_frames(void) {
+	return g_frames_free;
+}
+
+uint32_t pmm_total_frames(void) {
+	return g_frame_count;
+}
+
+/* Build the kernel page directory: identity map [0, PAGING_IDENTITY_LIMIT) */
+void paging_init(void) {
+	memset(g_kernel_pd, 0, sizeof(g_kernel_pd));
+
+	for (uint32_t t = 0; t < KERNEL_PDES; t++) {
+		for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+			uint32_t addr = (t * PT_ENTRIES + i) * PAGE_SIZE;
+			g_kernel_pts[t][i] = addr | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+		}
+		g_kernel_pd[t] = (uint32_t)g_kernel_pts[t] | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+	}
+
+	/* Shared top region; per-page permissions come from the PTEs */
+	memset(g_shared_pt, 0, sizeof(g_shared_pt));
+	g_kernel_pd[SHARED_PDE] = (uint32_t)g_shared_pt | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+}
+
+/* Map a page into the region shared by all address spaces */
+int paging_map_shared(uint32_t virt, uint32_t phys, uint32_t flags) {
+	if (virt < PAGING_SHARED_BASE) {
+		return -1;
+	}
+
+	g_shared_pt[PT_INDEX(virt)] = (phys & PAGE_MASK) | (flags & 0xFFF) | PAGE_PRESENT;
+	if (g_paging_enabled) {
+		cpu_invlpg(virt);
+	}
+	return 0;
+}
+
+/* Load the kernel page directory and set CR0.PG */
+void paging_enable(void) {
+	cpu_write_cr3((uint32_t)g_kernel_pd);
+	cpu_write_cr0(cpu_read_cr0() | CR0_PG);
+	g_paging_enabled = 1;
+}
+
+static uint32_t* vmm_directory(uint32_t page_dir) {
+	return page_dir ? (uint32_t*)page_dir : g_kernel_pd;
+}
+
+/* Create an address space sharing the kernel mappings. The identity map
+ * is supervisor-only here (the user bit of a PDE gates its whole table);
+ * only the shared top region stays reachable from ring 3. */
+uint32_t vmm_create_space(void) {
+	uint32_t frame = pmm_alloc_frame();
+	if (!frame) {
+		return 0;
+	}
+
+	uint32_t* pd = (uint32_t*)frame;
+	memset(pd, 0, PAGE_SIZE);
+	for (uint32_t i = 0; i < KERNEL_PDES; i++) {
+		pd[i] = g_kernel_pd[i] & ~PAGE_USER;
+	}
+	pd[SHARED_PDE] = g_kernel_pd[SHARED_PDE];
+
+	return frame;
+}
+
+/* Free all user pages, page tables and the directory itself (frames
+ * mapped with PAGE_NOFREE belong to someone else and are left alone) */
+void vmm_destroy_space(uint32_t page_dir) {
+	if (!page_dir) {
+		return;  /* Kernel address space is never freed */
+	}
+
+	uint32_t* pd = (uint32_t*)page_dir;
+	for (uint32_t i = KERNEL_PDES; i < SHARED_PDE; i++) {
+		if (!(pd[i] & PAGE_PRESENT)) {
+			continue;
+		}
+
+		uint32_t* pt = (uint32_t*)(pd[i] & PAGE_MASK);
+		for (uint32_t j = 0; j < PT_ENTRIES; j++) {
+			if ((pt[j] & PAGE_PRESENT) && !(pt[j] & PAGE_NOFREE)) {
+				pmm_free_frame(pt[j] & PAGE_MASK);
+			}
+		}
+		pmm_free_frame((uint32_t)pt);
+	}
+
+	pmm_free_frame(page_dir);
+}
+
+/* Load an address space into CR3 */
+void vmm_switch(uint32_t page_dir) {
+	uint32_t cr3 = (uint32_t)vmm_directory(page_dir);
+	if (g_paging_enabled && cpu_read_cr3() != cr3) {
+		cpu_write_cr3(cr3);
+	}
+}
+
+/* Map one page; allocates the page table on first use */
+int vmm_map_page(uint32_t page_dir, uint32_t virt, uint32_t phys, uint32_t flags) {
+	uint32_t* pd = vmm_directory(page_dir);
+	uint32_t pdi = PD_INDEX(virt);
+
+	if (pdi < KERNEL_PDES || pdi >= SHARED_PDE) {
+		return -1;  /* Shared kernel tables are never modified */
+	}
+
+	if (!(pd[pdi] & PAGE_PRESENT)) {
+		uint32_t pt = pmm_alloc_frame();
+		if (!pt) {
+			return -1;
+		}
+		memset((void*)pt, 0, PAGE_SIZE);
+		pd[pdi] = pt | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+	}
+
+	uint32_t* pt = (uint32_t*)(pd[pdi] & PAGE_MASK);
+	pt[PT_INDEX(virt)] = (phys & PAGE_MASK) | (flags & 0xFFF) | PAGE_PRESENT;
+
+	if (g_paging_enabled && cpu_read_cr3() == (uint32_t)pd) {
+		cpu_invlpg(virt);
+	}
+	return 0;
+}
+
+/* Remove one mapping; the caller decides what happens to the frame */
+uint32_t vmm_unmap_page(uint32_t page_dir, uint32_t virt) {
+	uint32_t* pd = vmm_directory(page_dir);
+	uint32_t pdi = PD_INDEX(virt);
+
+	if (pdi < KERNEL_PDES || pdi >= SHARED_PDE || !(pd[pdi] & PAGE_PRESENT)) {
+		return 0;
+	}
+
+	uint32_t* pt = (uint32_t*)(pd[pdi] & PAGE_MASK);
+	uint32_t pte = pt[PT_INDEX(virt)];
+	if (!(pte & PAGE_PRESENT)) {
+		return 0;
+	}
+
+	pt[PT_INDEX(virt)] = 0;
+	if (g_paging_enabled && cpu_read_cr3() == (uint32_t)pd) {
+		cpu_invlpg(virt);
+	}
+	return pte & PAGE_MASK;
+}
+
+/* Translate a virtual address in the given address space */
+uint32_t vmm_lookup(uint32_t page_dir, uint32_t virt) {
+	uint32_t* pd = vmm_directory(page_dir);
+	uint32_t pde = pd[PD_INDEX(virt)];
+
+	if (!(pde & PAGE_PRESENT)) {
+		return 0;
+	}
+
+	uint32_t pte = ((uint32_t*)(pde & PAGE_MASK))[PT_INDEX(virt)];
+	if (!(pte & PAGE_PRESENT)) {
+		return 0;
+	}
+
+	return (pte & PAGE_MASK) | (virt & ~PAGE_MASK);
+}
+
+/* Find the VMA containing addr */
+static vm_area_t* vmm_find_area(process_t* proc, uint32_t addr) {
+	for (int i = 0; i < proc->vma_count; i++) {
+		if (addr >= proc->vmas[i].start && addr < proc->vmas[i].end) {
+			return &proc->vmas[i];
+		}
+	}
+	return NULL;
+}
+
+/* Demand paging: back the faulting page with a zeroed frame and, for
+ * file-backed VMAs, the matching bytes of the process image */
+int vmm_handle_fault(uint32_t addr, uint32_t err) {
+	process_t* proc = process_current();
+	if (!proc || !proc->page_dir || (err & PF_ERR_PRESENT)) {
+		return -1;  /* No address space, or a protection violation */
+	}
+
+	vm_area_t* vma = vmm_find_area(proc, addr);
+	if (!vma) {
+		return -1;
+	}
+
+	uint32_t page = PAGE_ALIGN_DOWN(addr);
+	uint32_t frame = pmm_alloc_frame();
+	if (!frame) {
+		return -1;
+	}
+	memset((void*)frame, 0, PAGE_SIZE);
+
+	if (vma->flags & VMA_FILE) {
+		uint32_t lo = page;
+		uint32_t hi = page + PAGE_SIZE;
+		uint32_t file_end = vma->file_vaddr + vma->file_size;
+
+		if (lo < vma->file_vaddr) {
+			lo = vma->file_vaddr;
+		}
+		if (hi > file_end) {
+			hi = file_end;
+		}
+
+		if (lo < hi) {
+			uint16_t len = (uint16_t)(hi - lo);
+			if (vfs_seek(proc->image_fd, vma->file_offset + (lo - vma->file_vaddr)) < 0 ||
+			    vfs_read(proc->image_fd, (void*)(frame + (lo - page)), len) != len) {
+				pmm_free_frame(frame);
+				return -1;
+			}
+		}
+	}
+
+	uint32_t flags = PAGE_USER;
+	if (vma->flags & VMA_WRITE) {
+		flags |= PAGE_WRITE;
+	}
+
+	if (vmm_map_page(proc->page_dir, page, frame, flags) < 0) {
+		pmm_free_frame(frame);
+		return -1;
+	}
+	return 0;
+}
+
+/* Make a user buffer resident before the kernel touches it */
+int vmm_prefault(uint32_t addr, uint32_t len) {
+	process_t* proc = process_current();
+	if (!proc || !proc->page_dir || len == 0) {
+		return 0;
+	}
+
+	/* Kernel memory is not the caller's to read or write */
+	uint32_t end = addr + len;
+	if (addr < USER_SPACE_START || end < addr || end > USER_SPACE_END) {
+		return -1;
+	}
+
+	for (uint32_t page = PAGE_ALIGN_DOWN(addr); page < end; page += PAGE_SIZE) {
+		if (!vmm_lookup(proc->page_dir, page) && vmm_handle_fault(page, 0) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Copy a NUL-terminated string from the current process; returns its length */
+int vmm_copy_user_string(char* dst, const char* src, uint32_t max) {
+	for (uint32_t i = 0; i < max; i++) {
+		uint32_t addr = (uint32_t)(src + i);
+		if ((i == 0 || (addr & ~PAGE_MASK) == 0) && vmm_prefault(addr, 1) < 0) {
+			return -1;
+		}
+		dst[i] = src[i];
+		if (dst[i] == '\0') {
+			return (int)i;
+		}
+	}
+	return -1;  /* Too long */
+}
+
+uint32_t virt_to_phys(uint32_t virt_addr) {
+	if (!g_paging_enabled) {
+		return virt_addr;
+	}
+	return vmm_lookup(cpu_read_cr3(), virt_addr);
+}
+
+uint32_t phys_to_virt(uint32_t phys_addr) {
+	/* Only the identity-mapped region has a kernel virtual address */
+	return phys_addr < PAGING_IDENTITY_LIMIT ? phys_addr : 0;
+}
@@ -1,5 +1,6 @@
 #include "drivers.h"
 #include "types.h"
+#include "timepage.h"
 
 /* Port I/O helper functions */
 extern void outb(uint16_t port, uint8_t value);
@@ -22,13 +23,13 @@ extern void process_tick(void);
 
 static uint32_t ticks = 0;
 
-/* PIT interrupt handler */
+/* PIT interrupt handler (EOI is sent by irq_handler) */
 void pit_irq0_handler(void) {
 	ticks++;
+	/* Publish the new time to the shared time page */
+	timepage_tick(ticks);
 	/* Call process scheduler */
 	process_tick();
-	/* Send EOI to PIC */
-	outb(0x20, 0x20);
 }
 
 /* Initialize PIT to generate interrupts at specified frequency */
@@ -49,6 +50,7 @@ void pit_init(uint32_t frequency) {
 	outb(PIT_PORT_0, hi);
 
 	ticks = 0;
+	timepage_init(frequency);
 }
 
 /* Get number of ticks since initialization */
@@ -2,23 +2,51 @@
 #include "memory.h"
 #include "string.h"
 #include "drivers.h"
+#include "fpu.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "vsyscall.h"
+#include "paging.h"
+#include "vfs.h"
+#include "schedstat.h"
+#include "shm.h"
+#include "ipc.h"
+#include "epoll.h"
 
 /* Global process table */
 static process_t g_process_table[MAX_PROCESSES];
 static uint32_t g_current_pid = 0;      /* Current process ID */
 static uint8_t g_process_count = 0;     /* Number of active processes */
 static uint32_t g_next_pid = 1;         /* Next PID to allocate */
+static uint32_t g_idle_pid = 0;         /* Runs when nothing else can (0 = none yet) */
+static volatile uint32_t g_sleepers = 0; /* Bit n set = PID n is in process_sleep() */
 
 /* Process stack area (shared by all processes) */
 static uint8_t g_process_stacks[MAX_PROCESSES * PROCESS_STACK_SIZE];
 
+/* User-mode stacks for ring 3 processes */
+static uint8_t g_user_stacks[MAX_PROCESSES * PROCESS_STACK_SIZE] __attribute__((aligned(16)));
+
+/* Context switch and process entry trampolines (switch.asm) */
+extern void context_switch(uint32_t* old_esp, uint32_t new_esp);
+extern void process_start_kernel(void);
+extern void process_start_user(void);
+
+/* Idle process: halt until the next interrupt, then look for work */
+static void process_idle(void) {
+    while (1) {
+        __asm__ volatile("hlt");
+        process_schedule();
+    }
+}
+
 /* Initialize process manager */
 void process_init(void) {
     /* Initialize process table */
     for (int i = 0; i < MAX_PROCESSES; i++) {
         g_process_table[i].pid = 0;
         g_process_table[i].state = PROC_STATE_UNUSED;
-        g_process_table[i].priority = 128;  /* Default priority */
+        g_process_table[i].priority = PROCESS_DEFAULT_PRIORITY;
         g_process_table[i].exit_code = 0;
         g_process_table[i].name[0] = '\0';
     }
@@ -32,10 +60,28 @@ void process_init(void) {
     strcpy(g_process_table[0].name, "kernel");
     g_process_table[0].stack_base = (uint32_t)g_process_stacks;
     g_process_table[0].stack_size = PROCESS_STACK_SIZE;
+    g_process_table[0].page_dir = 0;
+    g_process_table[0].image_fd = -1;
+    g_process_table[0].vma_count = 0;
+    fd_table_init(&g_process_table[0].fds);
+    g_process_table[0].futex_key = 0;
+    g_process_table[0].kill_pending = 0;
+    g_process_table[0].exiting = 0;
+    g_process_table[0].locks_held = 0;
 
     g_current_pid = 0;
     g_process_count = 1;
     g_next_pid = 1;
+
+    schedstat_init();
+    g_process_table[0].ready_tsc = 0;
+    g_process_table[0].run_tsc = sched_clock();
+
+    /* Lets the kernel process block too */
+    int idle = process_spawn("idle", process_idle, 255);
+    g_idle_pid = idle > 0 ? (uint32_t)idle : 0;
+
+    tss_set_kernel_stack(g_process_table[0].stack_base + PROCESS_STACK_SIZE);
 }
 
 /* Get current process */
@@ -70,12 +116,19 @@ uint8_t process_count(void) {
     return g_process_count;
 }
 
+/* Slot can be (re)used: never used, or terminated and switched away from */
+static int process_slot_free(uint32_t pid) {
+    process_state_t state = g_process_table[pid].state;
+    return state == PROC_STATE_UNUSED ||
+           (state == PROC_STATE_TERMINATED && pid != g_current_pid);
+}
+
 /* Allocate a PID */
 static uint32_t process_allocate_pid(void) {
     uint32_t pid = g_next_pid;
     
     while (pid < MAX_PROCESSES) {
-        if (g_process_table[pid].state == PROC_STATE_UNUSED) {
+        if (process_slot_free(pid)) {
             g_next_pid = pid + 1;
             if (g_next_pid >= MAX_PROCESSES) {
                 g_next_pid = 1;  /* Wrap around, skip kernel PID 0 */
@@ -87,7 +140,7 @@ static uint32_t process_allocate_pid(void) {
 
     /* Wrap around and try again */
     for (pid = 1; pid < g_next_pid; pid++) {
-        if (g_process_table[pid].state == PROC_STATE_UNUSED) {
+        if (process_slot_free(pid)) {
             return pid;
         }
     }
@@ -95,12 +148,28 @@ static uint32_t process_allocate_pid(void) {
     return 0;  /* No PIDs available */
 }
 
-/* Create a new process */
-int process_spawn(const char* name, void (*entry_point)(void), uint8_t priority) {
+/* Prime a new kernel stack so the first context_switch() to it
+ * "returns" into the given trampoline with EBX/ESI preloaded */
+static void process_setup_stack(process_t* proc, void (*trampoline)(void),
+                                uint32_t ebx, uint32_t esi) {
+    uint32_t* sp = (uint32_t*)(proc->stack_base + proc->stack_size);
+
+    *--sp = (uint32_t)trampoline;  /* Return address */
+    *--sp = 0x002;                 /* EFLAGS (IF clear until trampoline) */
+    *--sp = 0;                     /* EBP */
+    *--sp = ebx;                   /* EBX */
+    *--sp = esi;                   /* ESI */
+    *--sp = 0;                     /* EDI */
+
+    proc->context.esp = (uint32_t)sp;
+}
+
+/* Allocate and initialize a process slot */
+static process_t* process_create(const char* name, void (*entry_point)(void), uint8_t priority) {
     uint32_t pid = process_allocate_pid();
     
     if (pid == 0 || pid >= MAX_PROCESSES) {
-        return -1;  /* No available PIDs */
+        return NULL;  /* No available PIDs */
     }
 
     process_t* proc = &g_process_table[pid];
@@ -108,27 +177,39 @@ int process_spawn(const char* name, void (*entry_point)(void), uint8_t priority)
     /* Initialize process */
     proc->pid = pid;
     proc->parent_pid = g_current_pid;
-    proc->state = PROC_STATE_READY;
     proc->priority = priority;
     proc->ticks = PROCESS_TIME_SLICE;
     proc->exit_code = 0;
-
-    /* Set up stack */
+    proc->fpu_used = 0;
+    proc->user_mode = 0;
+    proc->user_stack = 0;
+    proc->page_dir = 0;
+    proc->image_fd = -1;
+    proc->vma_count = 0;
+    proc->ready_tsc = 0;
+    proc->run_tsc = 0;
+    memset(&proc->wait_hist, 0, sizeof(sched_hist_t));
+    memset(&proc->slice_hist, 0, sizeof(sched_hist_t));
+    proc->ipc_state = IPC_STATE_NONE;
+    proc->ipc_result = 0;
+    proc->ipc_partner = 0;
+    proc->ipc_senders = 0;
+    fd_table_init(&proc->fds);
+    proc->futex_key = 0;
+    proc->wake_tick = 0;
+    proc->kill_pending = 0;
+    proc->exiting = 0;
+    proc->locks_held = 0;
+    g_sleepers &= ~(1u << pid);
+
+    /* Set up kernel stack */
     proc->stack_base = (uint32_t)g_process_stacks + (pid * PROCESS_STACK_SIZE);
     proc->stack_size = PROCESS_STACK_SIZE;
-    uint32_t stack_top = proc->stack_base + PROCESS_STACK_SIZE - 4;
 
     /* Initialize context */
-    proc->context.esp = stack_top;
+    memset(&proc->context, 0, sizeof(cpu_context_t));
     proc->context.eip = (uint32_t)entry_point;
-    proc->context.ebp = stack_top;
     proc->context.eflags = 0x200;  /* IF flag set (interrupts enabled) */
-    proc->context.eax = 0;
-    proc->context.ebx = 0;
-    proc->context.ecx = 0;
-    proc->context.edx = 0;
-    proc->context.esi = 0;
-    proc->context.edi = 0;
 
     proc->entry_point = (uint32_t)entry_point;
     proc->created_ticks = pit_get_ticks();
@@ -137,8 +218,185 @@ int process_spawn(const char* name, void (*entry_point)(void), uint8_t priority)
     strncpy(proc->name, name, sizeof(proc->name) - 1);
     proc->name[sizeof(proc->name) - 1] = '\0';
 
+    return proc;
+}
+
+/* Create a new kernel process */
+int process_spawn(const char* name, void (*entry_point)(void), uint8_t priority) {
+    uint32_t flags = cpu_irq_save();
+
+    process_t* proc = process_create(name, entry_point, priority);
+    if (!proc) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    process_setup_stack(proc, process_start_kernel, (uint32_t)entry_point, 0);
+
+    proc->state = PROC_STATE_READY;
+    proc->ready_tsc = sched_clock();
+    g_process_count++;
+
+    cpu_irq_restore(flags);
+    return (int)proc->pid;
+}
+
+/* Create a new user process (runs in ring 3 on its own user stack) */
+int process_spawn_user(const char* name, void (*entry_point)(void), uint8_t priority) {
+    uint32_t flags = cpu_irq_save();
+
+    process_t* proc = process_create(name, entry_point, priority);
+    if (!proc) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    proc->user_mode = 1;
+    proc->user_stack = (uint32_t)g_user_stacks + (proc->pid * PROCESS_STACK_SIZE);
+    uint32_t user_stack_top = proc->user_stack + PROCESS_STACK_SIZE - 16;
+
+    /* Initial user stack: entry(uint32_t syscall_entry) with no return address */
+    uint32_t* usp = (uint32_t*)user_stack_top;
+    *--usp = vsyscall_entry();
+    *--usp = 0;
+    user_stack_top = (uint32_t)usp;
+
+    process_setup_stack(proc, process_start_user, (uint32_t)entry_point, user_stack_top);
+
+    proc->state = PROC_STATE_READY;
+    proc->ready_tsc = sched_clock();
+    g_process_count++;
+
+    cpu_irq_restore(flags);
+    return (int)proc->pid;
+}
+
+/* Copy argv onto the top user stack page (frame is identity-mapped) and
+ * build the entry frame: entry(syscall_entry, argc, argv). Returns the
+ * initial user ESP, or 0 if the arguments do not fit. */
+static uint32_t process_build_user_stack(uint32_t frame, int argc, const char* argv[]) {
+    uint32_t page_va = USER_STACK_TOP - PAGE_SIZE;
+    uint32_t off = PAGE_SIZE;
+    uint32_t arg_va[PROCESS_MAX_ARGS];
+
+    if (argc < 0 || argc > PROCESS_MAX_ARGS) {
+        return 0;
+    }
+
+    /* Strings at the very top */
+    for (int i = argc - 1; i >= 0; i--) {
+        uint32_t len = strlen(argv[i]) + 1;
+        if (len > off - 256) {
+            return 0;  /* Keep room for the pointer array and frame */
+        }
+        off -= len;
+        memcpy((void*)(frame + off), argv[i], len);
+        arg_va[i] = page_va + off;
+    }
+
+    /* argv[] array (NULL-terminated), 16-byte aligned */
+    off &= ~15u;
+    off -= (argc + 1) * sizeof(uint32_t);
+    uint32_t* array = (uint32_t*)(frame + off);
+    for (int i = 0; i < argc; i++) {
+        array[i] = arg_va[i];
+    }
+    array[argc] = 0;
+    uint32_t argv_va = page_va + off;
+
+    /* Entry arguments and a null return address */
+    uint32_t* sp = (uint32_t*)(frame + (off & ~15u));
+    *--sp = argv_va;
+    *--sp = (uint32_t)argc;
+    *--sp = vsyscall_entry();
+    *--sp = 0;
+
+    return page_va + ((uint32_t)sp - frame);
+}
+
+/* Create a user process running a loaded program image */
+int process_spawn_image(const char* name, uint32_t page_dir, const vm_area_t* vmas,
+                        int vma_count, int image_fd, uint32_t entry,
+                        int argc, const char* argv[], uint8_t priority) {
+    if (vma_count < 0 || vma_count >= PROCESS_MAX_VMAS) {
+        return -1;  /* No room left for the stack */
+    }
+
+    /* The top stack page is populated now to hold argv */
+    uint32_t stack_frame = pmm_alloc_frame();
+    if (!stack_frame) {
+        return -1;
+    }
+    memset((void*)stack_frame, 0, PAGE_SIZE);
+
+    uint32_t user_esp = process_build_user_stack(stack_frame, argc, argv);
+    if (!user_esp ||
+        vmm_map_page(page_dir, USER_STACK_TOP - PAGE_SIZE, stack_frame,
+                     PAGE_USER | PAGE_WRITE) < 0) {
+        pmm_free_frame(stack_frame);
+        return -1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    process_t* proc = process_create(name, (void (*)(void))entry, priority);
+    if (!proc) {
+        cpu_irq_restore(flags);
+        return -1;  /* Stack frame is freed with page_dir by the caller */
+    }
+
+    proc->user_mode = 1;
+    proc->user_stack = USER_STACK_TOP - USER_STACK_SIZE;
+    proc->page_dir = page_dir;
+    proc->image_fd = image_fd;
+
+    for (int i = 0; i < vma_count; i++) {
+        proc->vmas[i] = vmas[i];
+    }
+    proc->vmas[vma_count].start = USER_STACK_TOP - USER_STACK_SIZE;
+    proc->vmas[vma_count].end = USER_STACK_TOP;
+    proc->vmas[vma_count].flags = VMA_WRITE;
+    proc->vmas[vma_count].file_vaddr = 0;
+    proc->vmas[vma_count].file_offset = 0;
+    proc->vmas[vma_count].file_size = 0;
+    proc->vma_count = (uint8_t)(vma_count + 1);
+
+    process_setup_stack(proc, process_start_user, entry, user_esp);
+
+    proc->state = PROC_STATE_READY;
+    proc->ready_tsc = sched_clock();
     g_process_count++;
-    return (int)pid;
+
+    cpu_irq_restore(flags);
+    return (int)proc->pid;
+}
+
+/* Close its descriptors, fail pending IPC with the process, close its
+ * remaining epoll instances, then free its shared memory mappings,
+ * address space and image file */
+static void process_release_space(process_t* proc) {
+    fd_table_release(&proc->fds);
+    ipc_release_process(proc->pid);
+    epoll_release_process(proc->pid);
+    shm_release_process(proc->pid);
+
+    if (proc->page_dir) {
+        /* Not preempted with page_dir naming a freed directory */
+        uint32_t flags = cpu_irq_save();
+        if (proc->pid == g_current_pid) {
+            vmm_switch(0);  /* Never free the directory in CR3 */
+        }
+        vmm_destroy_space(proc->page_dir);
+        proc->page_dir = 0;
+        cpu_irq_restore(flags);
+    }
+
+    if (proc->image_fd >= 0) {
+        vfs_close(proc->image_fd);
+        proc->image_fd = -1;
+    }
+
+    proc->vma_count = 0;
 }
 
 /* Terminate current process */
@@ -148,42 +406,148 @@ void process_exit(int exit_code) {
         return;
     }
 
+    if (proc->pid == 0) {
+        return;  /* Kernel process cannot exit */
+    }
+
+    /* Release everything while still runnable: closing files can sleep on
+     * a filesystem or disk mutex, and a sleeping process must be able to
+     * wake up again */
+    proc->kill_pending = 0;
+    proc->exiting = 1;
     proc->exit_code = exit_code;
+    process_release_space(proc);
+
+    /* Interrupts stay off until the next process restores its own flags */
+    cpu_irq_save();
+
+    proc->futex_key = 0;
+    g_sleepers &= ~(1u << proc->pid);
     proc->state = PROC_STATE_TERMINATED;
     proc->terminated_ticks = pit_get_ticks();
+    fpu_release(proc);
     g_process_count--;
 
-    /* Force context switch to next process */
+    /* Switch away for good; a terminated process is never scheduled again */
     process_schedule();
 }
 
-/* Terminate a specific process */
+/* Terminate a specific process. Tearing it down from here could leave a
+ * mutex it holds locked for good, so only mark it; it exits in its own
+ * context via process_exit_if_killed(). */
 int process_kill(uint32_t pid) {
     process_t* proc = process_get(pid);
     if (!proc) {
         return -1;
     }
 
-    if (pid == 0) {
-        return -1;  /* Cannot kill kernel */
+    if (pid == 0 || pid == g_idle_pid) {
+        return -1;  /* Cannot kill kernel or idle */
     }
 
-    proc->exit_code = -1;
-    proc->state = PROC_STATE_TERMINATED;
-    proc->terminated_ticks = pit_get_ticks();
+    uint32_t flags = cpu_irq_save();
 
-    if (g_process_count > 0) {
-        g_process_count--;
+    if (proc->state == PROC_STATE_TERMINATED) {
+        cpu_irq_restore(flags);
+        return -1;  /* Already dead */
     }
 
-    /* If we killed the current process, schedule next */
-    if (g_current_pid == pid) {
-        process_schedule();
+    if (!proc->exiting) {
+        proc->kill_pending = 1;
+
+        /* A sleeper holding no mutex is woken to exit; one holding a
+         * mutex goes when it drops the last one */
+        if (!proc->locks_held) {
+            process_wake(pid);
+        }
     }
 
+    cpu_irq_restore(flags);
+
+    process_exit_if_killed();  /* We may have killed ourselves */
+    return 0;
+}
+
+/* Act on a pending kill at a point where the process holds no mutex */
+void process_exit_if_killed(void) {
+    process_t* proc = process_current();
+    if (proc && proc->kill_pending && !proc->locks_held) {
+        process_exit(-1);
+    }
+}
+
+/* Block the current process until it is woken */
+int process_block(void) {
+    process_t* proc = process_current();
+    if (!proc || !g_idle_pid || proc->pid == g_idle_pid) {
+        return -1;  /* The idle process must always be runnable */
+    }
+    if (proc->state == PROC_STATE_TERMINATED) {
+        return -1;  /* Nothing may make a dead process runnable again */
+    }
+
+    uint32_t flags = cpu_irq_save();
+    proc->state = PROC_STATE_BLOCKED;
+    process_schedule();
+    cpu_irq_restore(flags);
     return 0;
 }
 
+/* Wake a blocked process; its wakeup-to-run latency starts now */
+int process_wake(uint32_t pid) {
+    process_t* proc = process_get(pid);
+    if (!proc) {
+        return -1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+    if (proc->state != PROC_STATE_BLOCKED) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+    proc->state = PROC_STATE_READY;
+    proc->ready_tsc = sched_clock();
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+/* Sleep for a number of timer ticks; process_tick() wakes us */
+int process_sleep(uint32_t ticks) {
+    process_t* proc = process_current();
+    if (!proc) {
+        return -1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+    proc->wake_tick = pit_get_ticks() + ticks;
+    g_sleepers |= 1u << proc->pid;
+    while (g_sleepers & (1u << proc->pid)) {
+        if (process_block() < 0) {
+            g_sleepers &= ~(1u << proc->pid);
+            cpu_irq_restore(flags);
+            return -1;
+        }
+    }
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+/* Wake the sleepers whose time has come (interrupts disabled) */
+static void process_wake_sleepers(void) {
+    uint32_t now = pit_get_ticks();
+    uint32_t pending = g_sleepers;
+
+    while (pending) {
+        uint32_t pid = __builtin_ctz(pending);
+        pending &= pending - 1;
+
+        if ((int32_t)(now - g_process_table[pid].wake_tick) >= 0) {
+            g_sleepers &= ~(1u << pid);
+            process_wake(pid);
+        }
+    }
+}
+
 /* Round-robin scheduler with priority support */
 process_t* process_find_next(void) {
     uint32_t start_pid = g_current_pid;
@@ -197,7 +561,7 @@ process_t* process_find_next(void) {
         uint32_t check_pid = (next_pid + i) % MAX_PROCESSES;
         process_t* proc = &g_process_table[check_pid];
 
-        if (proc->state == PROC_STATE_READY) {
+        if (proc->state == PROC_STATE_READY && check_pid != g_idle_pid) {
             if (proc->priority < best_priority) {
                 best_priority = proc->priority;
                 best_pid = check_pid;
@@ -210,31 +574,89 @@ process_t* process_find_next(void) {
         return &g_process_table[best_pid];
     }
 
-    /* Fallback: return current process if still ready */
-    if (g_process_table[g_current_pid].state == PROC_STATE_READY) {
+    /* Fallback: keep running the current process if it still can */
+    if (g_process_table[g_current_pid].state == PROC_STATE_READY ||
+        g_process_table[g_current_pid].state == PROC_STATE_RUNNING) {
         return &g_process_table[g_current_pid];
     }
 
-    /* No ready process found, return kernel */
-    return &g_process_table[0];
+    /* Nothing can run: idle until an interrupt wakes someone */
+    return &g_process_table[g_idle_pid];
+}
+
+/* Switch from current to next with interrupts disabled; next gets
+ * `ticks` of CPU time */
+static void process_switch(process_t* current, process_t* next, uint8_t ticks) {
+    /* Switch state: current -> READY, next -> RUNNING */
+    uint64_t now = sched_clock();
+    if (current && current->state == PROC_STATE_RUNNING) {
+        current->state = PROC_STATE_READY;
+        current->ready_tsc = now;
+    }
+
+    if (current != next) {
+        /* Latency accounting: current's slice ends, next's wait ends
+         * (the idle process is left out) */
+        if (current && current->run_tsc && now && current->pid != g_idle_pid) {
+            schedstat_record_slice(&current->slice_hist, now - current->run_tsc);
+        }
+        if (next->ready_tsc && now && next->pid != g_idle_pid) {
+            schedstat_record_wait(&next->wait_hist, now - next->ready_tsc);
+        }
+        next->run_tsc = now;
+    }
+    next->ready_tsc = 0;
+
+    /* Trap the next FPU instruction unless next already owns the FPU */
+    fpu_switch(next);
+
+    g_current_pid = next->pid;
+    next->state = PROC_STATE_RUNNING;
+    next->ticks = ticks;
+
+    if (current && current != next) {
+        /* Ring 3 -> ring 0 transitions land on next's kernel stack */
+        tss_set_kernel_stack(next->stack_base + next->stack_size);
+        vmm_switch(next->page_dir);
+        context_switch(&current->context.esp, next->context.esp);
+    }
 }
 
 /* Schedule: Switch to next process */
 void process_schedule(void) {
+    uint32_t flags = cpu_irq_save();
+
     process_t* next = process_find_next();
     if (!next) {
         next = &g_process_table[0];
     }
 
-    /* Switch state: current -> READY, next -> RUNNING */
-    process_t* current = process_current();
-    if (current && current->pid != 0 && current->state == PROC_STATE_RUNNING) {
-        current->state = PROC_STATE_READY;
+    process_switch(process_current(), next, PROCESS_TIME_SLICE);
+
+    cpu_irq_restore(flags);
+
+    /* Back on the CPU: a kill that arrived meanwhile takes effect now */
+    process_exit_if_killed();
+}
+
+/* Hand the CPU straight to pid without consulting the run queue */
+int process_switch_to(uint32_t pid) {
+    process_t* next = process_get(pid);
+    if (!next || (next->state != PROC_STATE_BLOCKED && next->state != PROC_STATE_READY)) {
+        return -1;
     }
 
-    g_current_pid = next->pid;
-    next->state = PROC_STATE_RUNNING;
-    next->ticks = PROCESS_TIME_SLICE;
+    uint32_t flags = cpu_irq_save();
+
+    /* next runs on the rest of the caller's time slice */
+    process_t* current = process_current();
+    uint8_t ticks = (current && current->ticks) ? current->ticks : 1;
+    process_switch(current, next, ticks);
+
+    cpu_irq_restore(flags);
+
+    process_exit_if_killed();
+    return 0;
 }
 
 /* Called from timer interrupt - decrement time slice */
@@ -244,6 +666,10 @@ void process_tick(void) {
         return;
     }
 
+    if (g_sleepers) {
+        process_wake_sleepers();
+    }
+
     if (proc->ticks > 0) {
         proc->ticks--;
     }
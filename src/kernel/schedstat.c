@@ -0,0 +1,186 @@
+#include "schedstat.h"
+#include "process.h"
+#include "timepage.h"
+#include "drivers.h"
+#include "string.h"
+#include "memory.h"
+#include "cpu.h"
+
+/* Scheduler latency histograms (TSC based, no 64-bit division) */
+
+#define SCHED_BAR_WIDTH 30
+
+static sched_hist_t g_wait_hist;
+static sched_hist_t g_slice_hist;
+static int g_have_tsc = 0;
+
+/* Detect the TSC */
+void schedstat_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    g_have_tsc = (edx & CPUID_EDX_TSC) != 0;
+
+    memset(&g_wait_hist, 0, sizeof(g_wait_hist));
+    memset(&g_slice_hist, 0, sizeof(g_slice_hist));
+}
+
+uint64_t sched_clock(void) {
+    return g_have_tsc ? cpu_rdtsc() : 0;
+}
+
+/* log2 bucket of a cycle count */
+static uint32_t sched_bucket(uint64_t cycles) {
+    uint32_t hi = (uint32_t)(cycles >> 32);
+    uint32_t lo = (uint32_t)cycles;
+    uint32_t n;
+
+    if (hi) {
+        n = 63 - __builtin_clz(hi);
+    } else if (lo) {
+        n = 31 - __builtin_clz(lo);
+    } else {
+        n = 0;
+    }
+
+    return n < SCHED_HIST_BUCKETS ? n : SCHED_HIST_BUCKETS - 1;
+}
+
+static void sched_hist_add(sched_hist_t* hist, uint64_t cycles) {
+    hist->count[sched_bucket(cycles)]++;
+    hist->samples++;
+    if (cycles > hist->max) {
+        hist->max = cycles;
+    }
+}
+
+void schedstat_record_wait(sched_hist_t* proc_hist, uint64_t cycles) {
+    sched_hist_add(proc_hist, cycles);
+    sched_hist_add(&g_wait_hist, cycles);
+}
+
+void schedstat_record_slice(sched_hist_t* proc_hist, uint64_t cycles) {
+    sched_hist_add(proc_hist, cycles);
+    sched_hist_add(&g_slice_hist, cycles);
+}
+
+/* Clear all histograms */
+void schedstat_reset(void) {
+    uint32_t flags = cpu_irq_save();
+
+    memset(&g_wait_hist, 0, sizeof(g_wait_hist));
+    memset(&g_slice_hist, 0, sizeof(g_slice_hist));
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        process_t* proc = process_get_at_index(i);
+        memset(&proc->wait_hist, 0, sizeof(sched_hist_t));
+        memset(&proc->slice_hist, 0, sizeof(sched_hist_t));
+    }
+
+    cpu_irq_restore(flags);
+}
+
+static void sched_print_num(uint32_t value, const char* unit) {
+    char buf[16];
+    itoa((int)value, buf, 10);
+    vga_write_string(buf);
+    vga_write_string(unit);
+}
+
+/* Print a cycle count as ns/us/ms using the calibrated TSC frequency.
+ * Buckets stop at 2^39 cycles, so cycles / khz always fits in 32 bits. */
+static void sched_print_duration(uint64_t cycles, uint32_t khz) {
+    if (!khz) {
+        sched_print_num((uint32_t)cycles, " cyc");
+        return;
+    }
+
+    if (cycles >> 39) {
+        cycles = (uint64_t)1 << 39;
+    }
+
+    uint32_t ms = cpu_div64_32(cycles, khz);
+    uint32_t rem = (uint32_t)(cycles - (uint64_t)ms * khz);
+
+    if (ms >= 10) {
+        sched_print_num(ms, "ms");
+        return;
+    }
+
+    uint32_t us = ms * 1000 + cpu_div64_32((uint64_t)rem * 1000, khz);
+    if (us >= 10) {
+        sched_print_num(us, "us");
+        return;
+    }
+
+    uint32_t ns = ms * 1000000 + cpu_div64_32((uint64_t)rem * 1000000, khz);
+    sched_print_num(ns, "ns");
+}
+
+static void sched_hist_print(const char* title, const sched_hist_t* hist, uint32_t khz) {
+    uint32_t peak = 0;
+    char buf[16];
+
+    vga_write_string(title);
+    vga_write_string(": ");
+    itoa((int)hist->samples, buf, 10);
+    vga_write_string(buf);
+    vga_write_string(" samples, max ");
+    sched_print_duration(hist->max, khz);
+    vga_write_char('\n');
+
+    for (int i = 0; i < SCHED_HIST_BUCKETS; i++) {
+        if (hist->count[i] > peak) {
+            peak = hist->count[i];
+        }
+    }
+
+    for (int i = 0; i < SCHED_HIST_BUCKETS; i++) {
+        if (!hist->count[i]) {
+            continue;
+        }
+
+        vga_write_string("  >= ");
+        sched_print_duration((uint64_t)1 << i, khz);
+        vga_write_char('\t');
+        itoa((int)hist->count[i], buf, 10);
+        vga_write_string(buf);
+        vga_write_char('\t');
+
+        uint32_t bar = (hist->count[i] * SCHED_BAR_WIDTH + peak - 1) / peak;
+        for (uint32_t j = 0; j < bar; j++) {
+            vga_write_char('#');
+        }
+        vga_write_char('\n');
+    }
+}
+
+/* Print histograms for one process, or globally when pid < 0 */
+int schedstat_display(int pid) {
+    uint32_t khz = time_page()->tsc_khz;
+    const sched_hist_t* wait = &g_wait_hist;
+    const sched_hist_t* slice = &g_slice_hist;
+    sched_hist_t wait_copy, slice_copy;
+
+    if (!g_have_tsc) {
+        vga_write_string("Scheduler statistics need a TSC\n");
+        return -1;
+    }
+
+    if (pid >= 0) {
+        process_t* proc = process_get((uint32_t)pid);
+        if (!proc) {
+            return -1;
+        }
+        wait = &proc->wait_hist;
+        slice = &proc->slice_hist;
+    }
+
+    /* Snapshot, so the scheduler cannot update them while printing */
+    uint32_t flags = cpu_irq_save();
+    wait_copy = *wait;
+    slice_copy = *slice;
+    cpu_irq_restore(flags);
+
+    sched_hist_print("Wakeup-to-run latency", &wait_copy, khz);
+    sched_hist_print("Run slice length", &slice_copy, khz);
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include "shm.h"
+#include "paging.h"
+#include "process.h"
+#include "memory.h"
+#include "string.h"
+#include "drivers.h"
+#include "cpu.h"
+
+/* Shared memory regions (see shm.h) */
+
+static shm_region_t g_regions[SHM_MAX_REGIONS];
+static shm_mapping_t g_mappings[SHM_MAX_MAPPINGS];
+
+/* Initialize the region and mapping tables */
+void shm_init(void) {
+    memset(g_regions, 0, sizeof(g_regions));
+    memset(g_mappings, 0, sizeof(g_mappings));
+}
+
+static shm_region_t* shm_get(int shm_id) {
+    if (shm_id < 0 || shm_id >= SHM_MAX_REGIONS || !g_regions[shm_id].in_use) {
+        return NULL;
+    }
+    return &g_regions[shm_id];
+}
+
+static uint32_t shm_current_pid(void) {
+    process_t* proc = process_current();
+    return proc ? proc->pid : 0;
+}
+
+/* Drop one reference; the last one returns the frames to the pool */
+static void shm_put(shm_region_t* region) {
+    if (--region->refs > 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < region->pages; i++) {
+        pmm_free_frame(region->phys + i * PAGE_SIZE);
+    }
+    region->in_use = 0;
+}
+
+/* Allocate a zeroed region */
+int shm_create(uint32_t size) {
+    if (size == 0 || size > SHM_MAX_SIZE) {
+        return -1;
+    }
+
+    uint32_t pages = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+    uint32_t flags = cpu_irq_save();
+
+    int shm_id = -1;
+    for (int i = 0; i < SHM_MAX_REGIONS; i++) {
+        if (!g_regions[i].in_use) {
+            shm_id = i;
+            break;
+        }
+    }
+
+    /* Contiguous, so kernel-space processes can use the identity mapping */
+    uint32_t phys = (shm_id >= 0) ? pmm_alloc_contiguous(pages) : 0;
+    if (!phys) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    shm_region_t* region = &g_regions[shm_id];
+    region->phys = phys;
+    region->pages = pages;
+    region->size = size;
+    region->refs = 1;
+    region->owner_pid = shm_current_pid();
+    region->owner_ref = 1;
+    region->in_use = 1;
+
+    cpu_irq_restore(flags);
+
+    memset((void*)phys, 0, pages * PAGE_SIZE);
+    return shm_id;
+}
+
+/* Does [start, end) overlap anything the process already has mapped? */
+static int shm_range_busy(process_t* proc, uint32_t start, uint32_t end, uint32_t* next) {
+    for (int i = 0; i < SHM_MAX_MAPPINGS; i++) {
+        shm_mapping_t* m = &g_mappings[i];
+        if (!m->in_use || m->pid != proc->pid) {
+            continue;
+        }
+        uint32_t m_end = m->vaddr + g_regions[m->shm_id].pages * PAGE_SIZE;
+        if (start < m_end && m->vaddr < end) {
+            *next = m_end;
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < proc->vma_count; i++) {
+        if (start < proc->vmas[i].end && proc->vmas[i].start < end) {
+            *next = proc->vmas[i].end;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* First free range of pages in the mapping window, 0 if none */
+static uint32_t shm_find_window(process_t* proc, uint32_t pages) {
+    uint32_t start = SHM_BASE;
+    uint32_t len = pages * PAGE_SIZE;
+
+    while (start + len <= SHM_END) {
+        uint32_t next;
+        if (!shm_range_busy(proc, start, start + len, &next)) {
+            return start;
+        }
+        start = PAGE_ALIGN_UP(next);
+    }
+    return 0;
+}
+
+/* Unmap a mapping's pages and release its reference */
+static void shm_detach(shm_mapping_t* m, uint32_t page_dir) {
+    shm_region_t* region = &g_regions[m->shm_id];
+
+    if (page_dir) {
+        for (uint32_t i = 0; i < region->pages; i++) {
+            vmm_unmap_page(page_dir, m->vaddr + i * PAGE_SIZE);
+        }
+    }
+
+    m->in_use = 0;
+    shm_put(region);
+}
+
+/* Map a region into the current process */
+void* shm_map(int shm_id) {
+    process_t* proc = process_current();
+    if (!proc) {
+        return NULL;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    shm_region_t* region = shm_get(shm_id);
+    shm_mapping_t* m = NULL;
+    for (int i = 0; region && i < SHM_MAX_MAPPINGS; i++) {
+        if (!g_mappings[i].in_use) {
+            m = &g_mappings[i];
+            break;
+        }
+    }
+    if (!m) {
+        cpu_irq_restore(flags);
+        return NULL;
+    }
+
+    uint32_t vaddr = region->phys;
+    if (proc->page_dir) {
+        vaddr = shm_find_window(proc, region->pages);
+        if (!vaddr) {
+            cpu_irq_restore(flags);
+            return NULL;
+        }
+
+        for (uint32_t i = 0; i < region->pages; i++) {
+            if (vmm_map_page(proc->page_dir, vaddr + i * PAGE_SIZE, region->phys + i * PAGE_SIZE,
+                             PAGE_USER | PAGE_WRITE | PAGE_NOFREE) < 0) {
+                while (i-- > 0) {
+                    vmm_unmap_page(proc->page_dir, vaddr + i * PAGE_SIZE);
+                }
+                cpu_irq_restore(flags);
+                return NULL;
+            }
+        }
+    }
+
+    m->pid = proc->pid;
+    m->shm_id = shm_id;
+    m->vaddr = vaddr;
+    m->in_use = 1;
+    region->refs++;
+
+    cpu_irq_restore(flags);
+    return (void*)vaddr;
+}
+
+/* Remove a mapping of the current process */
+int shm_unmap(void* addr) {
+    process_t* proc = process_current();
+    if (!proc) {
+        return -1;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    for (int i = 0; i < SHM_MAX_MAPPINGS; i++) {
+        shm_mapping_t* m = &g_mappings[i];
+        if (m->in_use && m->pid == proc->pid && m->vaddr == (uint32_t)addr) {
+            shm_detach(m, proc->page_dir);
+            cpu_irq_restore(flags);
+            return 0;
+        }
+    }
+
+    cpu_irq_restore(flags);
+    return -1;
+}
+
+/* Drop the creator's reference */
+int shm_destroy(int shm_id) {
+    uint32_t flags = cpu_irq_save();
+
+    shm_region_t* region = shm_get(shm_id);
+    if (!region || !region->owner_ref || region->owner_pid != shm_current_pid()) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    region->owner_ref = 0;
+    shm_put(region);
+
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+uint32_t shm_size(int shm_id) {
+    shm_region_t* region = shm_get(shm_id);
+    return region ? region->size : 0;
+}
+
+/* Process exit: drop its mappings, then the regions it created */
+void shm_release_process(uint32_t pid) {
+    process_t* proc = process_get(pid);
+    uint32_t page_dir = proc ? proc->page_dir : 0;
+    uint32_t flags = cpu_irq_save();
+
+    for (int i = 0; i < SHM_MAX_MAPPINGS; i++) {
+        if (g_mappings[i].in_use && g_mappings[i].pid == pid) {
+            shm_detach(&g_mappings[i], page_dir);
+        }
+    }
+
+    for (int i = 0; i < SHM_MAX_REGIONS; i++) {
+        shm_region_t* region = &g_regions[i];
+        if (region->in_use && region->owner_ref && region->owner_pid == pid) {
+            region->owner_ref = 0;
+            shm_put(region);
+        }
+    }
+
+    cpu_irq_restore(flags);
+}
+
+/* Print the region table */
+void shm_display_info(void) {
+    char buf[16];
+
+    vga_write_string("ID  SIZE      PHYS      REFS  OWNER\n");
+    vga_write_string("==  ========  ========  ====  =====\n");
+
+    for (int i = 0; i < SHM_MAX_REGIONS; i++) {
+        shm_region_t* region = &g_regions[i];
+        if (!region->in_use) {
+            continue;
+        }
+
+        itoa(i, buf, 10);
+        vga_write_string(buf);
+        for (int j = strlen(buf); j < 4; j++) {
+            vga_write_char(' ');
+        }
+
+        itoa((int)region->size, buf, 10);
+        vga_write_string(buf);
+        for (int j = strlen(buf); j < 10; j++) {
+            vga_write_char(' ');
+        }
+
+        itoa((int)region->phys, buf, 16);
+        vga_write_string(buf);
+        for (int j = strlen(buf); j < 10; j++) {
+            vga_write_char(' ');
+        }
+
+        itoa((int)region->refs, buf, 10);
+        vga_write_string(buf);
+        for (int j = strlen(buf); j < 6; j++) {
+            vga_write_char(' ');
+        }
+
+        if (region->owner_ref) {
+            itoa((int)region->owner_pid, buf, 10);
+            vga_write_string(buf);
+        } else {
+            vga_write_string("-");
+        }
+        vga_write_char('\n');
+    }
+}
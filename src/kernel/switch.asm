@@ -0,0 +1,58 @@
+; Context switching and ring 3 entry for VlsOs
+; NASM syntax
+
+BITS 32
+
+section .text
+
+extern process_exit
+
+global context_switch
+global process_start_kernel
+global process_start_user
+
+; void context_switch(uint32_t* old_esp, uint32_t new_esp)
+; Saves callee-saved registers and EFLAGS on the current kernel stack,
+; stores ESP in *old_esp and resumes the stack at new_esp.
+context_switch:
+	mov eax, [esp + 4]    ; Where to store the old stack pointer
+	mov edx, [esp + 8]    ; Stack pointer to resume
+	pushfd
+	push ebp
+	push ebx
+	push esi
+	push edi
+	mov [eax], esp
+	mov esp, edx
+	pop edi
+	pop esi
+	pop ebx
+	pop ebp
+	popfd
+	ret
+
+; First return target of a new kernel process
+; EBX = entry point
+process_start_kernel:
+	sti
+	call ebx
+	push dword 0          ; Exit code
+	call process_exit
+.hang:
+	hlt
+	jmp .hang
+
+; First return target of a new user process: iret into ring 3
+; EBX = user entry point, ESI = user stack pointer
+process_start_user:
+	mov ax, 0x23          ; User data segment
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	push dword 0x23       ; SS
+	push esi              ; ESP
+	push dword 0x202      ; EFLAGS (IF set)
+	push dword 0x1B       ; CS (user code segment)
+	push ebx              ; EIP
+	iret
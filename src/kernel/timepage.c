@@ -0,0 +1,83 @@
+#include "timepage.h"
+#include "paging.h"
+#include "memory.h"
+#include "cpu.h"
+
+/* Kernel side of the shared time page */
+
+/* Backing page: nothing else may share it, since it is user-readable */
+static uint8_t g_time_page_mem[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static time_page_t* const g_tp = (time_page_t*)g_time_page_mem;
+
+static int g_has_tsc = 0;
+
+/* TSC calibration against the timer over ~100 ms of ticks */
+static uint32_t g_cal_ticks = 0;        /* Window length in ticks */
+static uint32_t g_cal_start_tick = 0;
+static uint64_t g_cal_start_tsc = 0;
+static int g_cal_started = 0;
+
+/* Initialize the page and map it read-only into all address spaces */
+void timepage_init(uint32_t tick_hz) {
+    uint32_t eax, ebx, ecx, edx;
+
+    memset(g_time_page_mem, 0, sizeof(g_time_page_mem));
+    g_tp->tick_hz = tick_hz;
+    g_tp->ns_per_tick = 1000000000u / tick_hz;
+
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    g_has_tsc = (edx & CPUID_EDX_TSC) != 0;
+
+    g_cal_ticks = tick_hz / 10;
+    if (g_cal_ticks == 0) {
+        g_cal_ticks = 1;
+    }
+    g_cal_started = 0;
+
+    paging_map_shared(TIME_PAGE_VADDR, (uint32_t)g_time_page_mem, PAGE_USER);
+}
+
+/* Derive tsc_khz/tsc_mult once the calibration window has elapsed */
+static void timepage_calibrate(uint32_t ticks, uint64_t tsc) {
+    if (!g_cal_started) {
+        g_cal_start_tick = ticks;
+        g_cal_start_tsc = tsc;
+        g_cal_started = 1;
+        return;
+    }
+
+    uint32_t elapsed = ticks - g_cal_start_tick;
+    if (elapsed < g_cal_ticks) {
+        return;
+    }
+
+    /* Window duration in microseconds (~100000), then cycles per ms */
+    uint32_t us = (elapsed * g_tp->ns_per_tick) / 1000u;
+    uint64_t cycles = tsc - g_cal_start_tsc;
+    uint32_t khz = us ? cpu_div64_32(cycles * 1000u, us) : 0;
+
+    if (khz > 1000) {
+        g_tp->tsc_khz = khz;
+        g_tp->tsc_mult = cpu_div64_32((uint64_t)1000000u << TIME_NS_SHIFT, khz);
+    } else {
+        g_cal_started = 0;  /* Implausible, try again */
+    }
+}
+
+/* Timer tick: publish the new tick count and TSC base */
+void timepage_tick(uint32_t ticks) {
+    uint64_t tsc = g_has_tsc ? cpu_rdtsc() : 0;
+
+    g_tp->seq++;
+    __asm__ volatile("" : : : "memory");
+
+    g_tp->ticks = ticks;
+    g_tp->tsc_lo = (uint32_t)tsc;
+    g_tp->tsc_hi = (uint32_t)(tsc >> 32);
+    if (g_has_tsc && !g_tp->tsc_mult) {
+        timepage_calibrate(ticks, tsc);
+    }
+
+    __asm__ volatile("" : : : "memory");
+    g_tp->seq++;
+}
@@ -0,0 +1,561 @@
+#include "tmpfs.h"
+#include "paging.h"
+#include "memory.h"
+#include "string.h"
+#include "epoll.h"
+#include "cpu.h"
+#include "waitqueue.h"
+
+/* RAM filesystem (see tmpfs.h)
+ *
+ * Nodes live in a per-mount table; the inode number is the index, and the
+ * root is node 0. Directories link their children through first_child /
+ * next_sibling. Each mount has a mutex held by every operation that walks
+ * or changes its nodes, including the whole copy of a read or write, so
+ * an O_TRUNC open cannot free the pages under a copy in progress. A killed
+ * process finishes the operation and unlocks before it exits, and closes
+ * its descriptors from its own context, so it can wait for the lock. The
+ * open file table is shared by all mounts and guarded with interrupts
+ * disabled.
+ */
+
+typedef struct {
+    uint8_t type;               /* VFS_TYPE_*, 0 = free */
+    uint8_t open_count;
+    int16_t parent;
+    int16_t first_child;        /* Directories: -1 when empty */
+    int16_t next_sibling;
+    char name[VFS_NAME_MAX];
+    uint32_t size;
+    uint32_t* pages;            /* Frame of each page of data */
+    uint32_t page_count;        /* Frames in pages[] */
+    uint32_t page_capacity;     /* Slots in pages[] */
+} tmpfs_node_t;
+
+typedef struct {
+    tmpfs_node_t* nodes;
+    uint32_t max_nodes;
+    uint32_t max_pages;
+    uint32_t used_pages;
+    mutex_t lock;
+} tmpfs_t;
+
+typedef struct {
+    uint8_t in_use;
+    uint8_t flags;              /* VFS_OPEN_* */
+    int16_t node;
+    tmpfs_t* fs;
+    uint32_t position;
+} tmpfs_file_t;
+
+static tmpfs_file_t g_tmpfs_files[TMPFS_MAX_FILES];
+
+/* Pages: callers hold the mount lock. The frame allocator has no lock of
+ * its own, so calls into it still run with interrupts disabled. */
+
+/* Add zeroed frames until the node has count of them; -1 if the size
+ * limit or physical memory runs out first (the frames added so far stay) */
+static int tmpfs_reserve(tmpfs_t* fs, tmpfs_node_t* node, uint32_t count) {
+    if (count > node->page_capacity) {
+        uint32_t capacity = node->page_capacity ? node->page_capacity : 4;
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        uint32_t* pages = (uint32_t*)realloc(node->pages, capacity * sizeof(uint32_t));
+        if (!pages) {
+            return -1;
+        }
+        node->pages = pages;
+        node->page_capacity = capacity;
+    }
+
+    while (node->page_count < count) {
+        if (fs->used_pages >= fs->max_pages) {
+            return -1;
+        }
+        uint32_t flags = cpu_irq_save();
+        uint32_t frame = pmm_alloc_frame();
+        cpu_irq_restore(flags);
+        if (!frame) {
+            return -1;
+        }
+        memset((void*)frame, 0, PAGE_SIZE);
+        node->pages[node->page_count++] = frame;
+        fs->used_pages++;
+    }
+    return 0;
+}
+
+/* Drop the file's data */
+static void tmpfs_truncate(tmpfs_t* fs, tmpfs_node_t* node) {
+    uint32_t flags = cpu_irq_save();
+    for (uint32_t i = 0; i < node->page_count; i++) {
+        pmm_free_frame(node->pages[i]);
+    }
+    cpu_irq_restore(flags);
+    fs->used_pages -= node->page_count;
+    free(node->pages);
+    node->pages = NULL;
+    node->page_count = 0;
+    node->page_capacity = 0;
+    node->size = 0;
+}
+
+/* Nodes */
+
+static void tmpfs_inode_fill(vfs_superblock_t* sb, int n, vfs_inode_t* inode) {
+    tmpfs_node_t* node = &((tmpfs_t*)sb->priv)->nodes[n];
+
+    memset(inode, 0, sizeof(vfs_inode_t));
+    inode->sb = sb;
+    inode->ino = (uint32_t)n;
+    inode->type = node->type;
+    inode->size = node->size;
+}
+
+/* Child of dir called name, or -1 */
+static int tmpfs_find(tmpfs_t* fs, int dir, const char* name) {
+    for (int n = fs->nodes[dir].first_child; n >= 0; n = fs->nodes[n].next_sibling) {
+        if (strcmp(fs->nodes[n].name, name) == 0) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+/* New empty node in dir; -1 if the name is taken or the node table is full */
+static int tmpfs_new(tmpfs_t* fs, int dir, const char* name, uint8_t type) {
+    uint32_t len = strlen(name);
+    if (len == 0 || len >= VFS_NAME_MAX) {
+        return -1;
+    }
+
+    mutex_lock(&fs->lock);
+
+    int n = -1;
+    if (tmpfs_find(fs, dir, name) < 0) {
+        for (uint32_t i = 1; i < fs->max_nodes; i++) {
+            if (!fs->nodes[i].type) {
+                n = (int)i;
+                break;
+            }
+        }
+    }
+    if (n < 0) {
+        mutex_unlock(&fs->lock);
+        return -1;
+    }
+
+    tmpfs_node_t* node = &fs->nodes[n];
+    memset(node, 0, sizeof(tmpfs_node_t));
+    node->type = type;
+    node->parent = (int16_t)dir;
+    node->first_child = -1;
+    memcpy(node->name, name, len + 1);
+    node->next_sibling = fs->nodes[dir].first_child;
+    fs->nodes[dir].first_child = (int16_t)n;
+
+    mutex_unlock(&fs->lock);
+    return n;
+}
+
+/* Unlink a node from its directory and free its slot */
+static void tmpfs_remove(tmpfs_t* fs, int n) {
+    int16_t* link = &fs->nodes[fs->nodes[n].parent].first_child;
+    while (*link >= 0) {
+        if (*link == n) {
+            *link = fs->nodes[n].next_sibling;
+            break;
+        }
+        link = &fs->nodes[*link].next_sibling;
+    }
+    tmpfs_truncate(fs, &fs->nodes[n]);
+    fs->nodes[n].type = 0;
+}
+
+/* Inode operations */
+
+static int tmpfs_lookup(vfs_inode_t* dir, const char* name, vfs_inode_t* out) {
+    tmpfs_t* fs = (tmpfs_t*)dir->sb->priv;
+    int n;
+
+    mutex_lock(&fs->lock);
+    if (strcmp(name, ".") == 0) {
+        n = (int)dir->ino;
+    } else if (strcmp(name, "..") == 0) {
+        n = fs->nodes[dir->ino].parent;
+    } else if ((n = tmpfs_find(fs, (int)dir->ino, name)) < 0) {
+        mutex_unlock(&fs->lock);
+        return -1;
+    }
+
+    tmpfs_inode_fill(dir->sb, n, out);
+    mutex_unlock(&fs->lock);
+    return 0;
+}
+
+static int tmpfs_create(vfs_inode_t* dir, const char* name, vfs_inode_t* out) {
+    int n = tmpfs_new((tmpfs_t*)dir->sb->priv, (int)dir->ino, name, VFS_TYPE_FILE);
+    if (n < 0) {
+        return -1;
+    }
+    tmpfs_inode_fill(dir->sb, n, out);
+    return 0;
+}
+
+static int tmpfs_mkdir(vfs_inode_t* dir, const char* name) {
+    return (tmpfs_new((tmpfs_t*)dir->sb->priv, (int)dir->ino, name, VFS_TYPE_DIR) < 0) ? -1 : 0;
+}
+
+/* Remove a file that is not open, or an empty directory */
+static int tmpfs_unlink_type(vfs_inode_t* dir, const char* name, uint8_t type) {
+    tmpfs_t* fs = (tmpfs_t*)dir->sb->priv;
+    mutex_lock(&fs->lock);
+
+    int n = tmpfs_find(fs, (int)dir->ino, name);
+    if (n < 0 || fs->nodes[n].type != type || fs->nodes[n].open_count ||
+        fs->nodes[n].first_child >= 0) {
+        mutex_unlock(&fs->lock);
+        return -1;
+    }
+
+    tmpfs_remove(fs, n);
+    mutex_unlock(&fs->lock);
+    return 0;
+}
+
+static int tmpfs_unlink(vfs_inode_t* dir, const char* name) {
+    return tmpfs_unlink_type(dir, name, VFS_TYPE_FILE);
+}
+
+static int tmpfs_rmdir(vfs_inode_t* dir, const char* name) {
+    return tmpfs_unlink_type(dir, name, VFS_TYPE_DIR);
+}
+
+static int tmpfs_readdir(vfs_inode_t* dir, vfs_dirent_t* entries, int max_entries) {
+    tmpfs_t* fs = (tmpfs_t*)dir->sb->priv;
+    int count = 0;
+
+    mutex_lock(&fs->lock);
+    for (int n = fs->nodes[dir->ino].first_child; n >= 0 && count < max_entries;
+         n = fs->nodes[n].next_sibling) {
+        memcpy(entries[count].name, fs->nodes[n].name, VFS_NAME_MAX);
+        entries[count].type = fs->nodes[n].type;
+        entries[count].size = fs->nodes[n].size;
+        entries[count].ino = (uint32_t)n;
+        count++;
+    }
+    mutex_unlock(&fs->lock);
+    return count;
+}
+
+static int tmpfs_open(vfs_inode_t* inode, uint32_t flags) {
+    tmpfs_t* fs = (tmpfs_t*)inode->sb->priv;
+    tmpfs_node_t* node = &fs->nodes[inode->ino];
+
+    mutex_lock(&fs->lock);
+    if (node->type != VFS_TYPE_FILE || node->open_count == 0xFF) {
+        mutex_unlock(&fs->lock);
+        return -1;
+    }
+
+    uint32_t irq = cpu_irq_save();
+    int handle = -1;
+    for (int i = 0; i < TMPFS_MAX_FILES; i++) {
+        if (!g_tmpfs_files[i].in_use) {
+            g_tmpfs_files[i].in_use = 1;
+            handle = i;
+            break;
+        }
+    }
+    cpu_irq_restore(irq);
+    if (handle < 0) {
+        mutex_unlock(&fs->lock);
+        return -1;
+    }
+
+    tmpfs_file_t* file = &g_tmpfs_files[handle];
+    file->flags = (uint8_t)flags;
+    file->node = (int16_t)inode->ino;
+    file->fs = fs;
+    file->position = 0;
+    node->open_count++;
+
+    if ((flags & VFS_OPEN_TRUNC) && (flags & (VFS_OPEN_WRONLY | VFS_OPEN_RDWR))) {
+        tmpfs_truncate(fs, node);
+    }
+
+    mutex_unlock(&fs->lock);
+    return handle;
+}
+
+/* File operations */
+
+static tmpfs_file_t* tmpfs_get_file(int handle) {
+    if (handle < 0 || handle >= TMPFS_MAX_FILES || !g_tmpfs_files[handle].in_use) {
+        return NULL;
+    }
+    return &g_tmpfs_files[handle];
+}
+
+static int tmpfs_read(int handle, void* buffer, uint32_t count) {
+    tmpfs_file_t* file = tmpfs_get_file(handle);
+    if (!file) {
+        return -1;
+    }
+
+    tmpfs_t* fs = file->fs;
+    tmpfs_node_t* node = &fs->nodes[file->node];
+    mutex_lock(&fs->lock);
+    if (file->position >= node->size) {
+        mutex_unlock(&fs->lock);
+        return 0;  /* End of file, or truncated by another opener */
+    }
+    if (count > node->size - file->position) {
+        count = node->size - file->position;
+    }
+
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t pos = file->position + done;
+        uint32_t offset = pos & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - offset;
+        if (chunk > count - done) {
+            chunk = count - done;
+        }
+        memcpy((uint8_t*)buffer + done, (uint8_t*)(node->pages[pos / PAGE_SIZE] + offset), chunk);
+        done += chunk;
+    }
+
+    file->position += done;
+    mutex_unlock(&fs->lock);
+    return (int)done;
+}
+
+static int tmpfs_write(int handle, const void* buffer, uint32_t count) {
+    tmpfs_file_t* file = tmpfs_get_file(handle);
+    if (!file || !(file->flags & (VFS_OPEN_WRONLY | VFS_OPEN_RDWR))) {
+        return -1;
+    }
+
+    tmpfs_t* fs = file->fs;
+    tmpfs_node_t* node = &fs->nodes[file->node];
+    mutex_lock(&fs->lock);
+    if (file->flags & VFS_OPEN_APPEND) {
+        file->position = node->size;
+    }
+
+    /* Frames for the whole range up front; a full mount shortens the write */
+    if (count > 0xFFFFFFFF - file->position) {
+        count = 0xFFFFFFFF - file->position;
+    }
+    uint32_t end = file->position + count;
+    uint32_t pages = end / PAGE_SIZE + ((end & (PAGE_SIZE - 1)) ? 1 : 0);
+
+    if (tmpfs_reserve(fs, node, pages) < 0 && end > node->page_count * PAGE_SIZE) {
+        end = node->page_count * PAGE_SIZE;
+    }
+
+    if (end <= file->position) {
+        mutex_unlock(&fs->lock);
+        return count ? -1 : 0;
+    }
+    count = end - file->position;
+
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t pos = file->position + done;
+        uint32_t offset = pos & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - offset;
+        if (chunk > count - done) {
+            chunk = count - done;
+        }
+        memcpy((uint8_t*)(node->pages[pos / PAGE_SIZE] + offset), (const uint8_t*)buffer + done, chunk);
+        done += chunk;
+    }
+
+    file->position += done;
+    if (file->position > node->size) {
+        node->size = file->position;
+    }
+    mutex_unlock(&fs->lock);
+    return (int)done;
+}
+
+static int tmpfs_seek(int handle, uint32_t offset) {
+    tmpfs_file_t* file = tmpfs_get_file(handle);
+    if (!file) {
+        return -1;
+    }
+
+    mutex_lock(&file->fs->lock);
+    int result = -1;
+    if (offset <= file->fs->nodes[file->node].size) {
+        file->position = offset;
+        result = 0;
+    }
+    mutex_unlock(&file->fs->lock);
+    return result;
+}
+
+static uint32_t tmpfs_size(int handle) {
+    tmpfs_file_t* file = tmpfs_get_file(handle);
+    return file ? file->fs->nodes[file->node].size : 0;
+}
+
+static int tmpfs_close(int handle) {
+    tmpfs_file_t* file = tmpfs_get_file(handle);
+    if (!file) {
+        return -1;
+    }
+
+    mutex_lock(&file->fs->lock);
+    file->fs->nodes[file->node].open_count--;
+    file->in_use = 0;
+    mutex_unlock(&file->fs->lock);
+    return 0;
+}
+
+/* Descriptor operations: fault user buffers in before copying, as for FAT
+ * files (demand paging may read through the VFS) */
+
+static int tmpfs_fd_read(int handle, void* buffer, uint32_t count) {
+    if (vmm_prefault((uint32_t)buffer, count) < 0) {
+        return -1;
+    }
+    return tmpfs_read(handle, buffer, count);
+}
+
+static int tmpfs_fd_write(int handle, const void* buffer, uint32_t count) {
+    if (vmm_prefault((uint32_t)buffer, count) < 0) {
+        return -1;
+    }
+    return tmpfs_write(handle, buffer, count);
+}
+
+static const file_ops_t tmpfs_fd_ops = {
+    .name = "tmpfs",
+    .poll_source = EPOLL_SRC_FILE,
+    .read = tmpfs_fd_read,
+    .write = tmpfs_fd_write,
+    .seek = tmpfs_seek,
+    .close = tmpfs_close,
+};
+
+/* Superblock operations */
+
+static int tmpfs_statfs(vfs_superblock_t* sb, vfs_statfs_t* st) {
+    tmpfs_t* fs = (tmpfs_t*)sb->priv;
+
+    st->block_size = PAGE_SIZE;
+    st->blocks = fs->max_pages;
+    st->free_blocks = fs->max_pages - fs->used_pages;
+    return 0;
+}
+
+static const vfs_super_ops_t tmpfs_super_ops = {
+    .statfs = tmpfs_statfs,
+};
+
+static const vfs_inode_ops_t tmpfs_inode_ops = {
+    .lookup = tmpfs_lookup,
+    .create = tmpfs_create,
+    .mkdir = tmpfs_mkdir,
+    .unlink = tmpfs_unlink,
+    .rmdir = tmpfs_rmdir,
+    .readdir = tmpfs_readdir,
+    .open = tmpfs_open,
+};
+
+static const vfs_file_ops_t tmpfs_file_ops = {
+    .fd_ops = &tmpfs_fd_ops,
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .seek = tmpfs_seek,
+    .size = tmpfs_size,
+    .close = tmpfs_close,
+};
+
+/* Mounting */
+
+/* Parse "size=<bytes>[k|m],nodes=<n>" */
+static int tmpfs_parse_options(const char* s, uint32_t* size, uint32_t* nodes) {
+    while (s && *s) {
+        uint32_t* target;
+        if (strncmp(s, "size=", 5) == 0) {
+            target = size;
+            s += 5;
+        } else if (strncmp(s, "nodes=", 6) == 0) {
+            target = nodes;
+            s += 6;
+        } else {
+            return -1;
+        }
+
+        if (!isdigit(*s)) {
+            return -1;
+        }
+        uint32_t value = 0;
+        while (isdigit(*s)) {
+            value = value * 10 + (uint32_t)(*s++ - '0');
+        }
+        if (*s == 'k' || *s == 'K') {
+            value *= 1024;
+            s++;
+        } else if (*s == 'm' || *s == 'M') {
+            value *= 1024 * 1024;
+            s++;
+        }
+        *target = value;
+
+        if (*s == ',') {
+            s++;
+        } else if (*s) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int tmpfs_mount(vfs_superblock_t* sb, const char* source) {
+    uint32_t size = TMPFS_DEFAULT_SIZE;
+    uint32_t max_nodes = TMPFS_DEFAULT_NODES;
+
+    if (tmpfs_parse_options(source, &size, &max_nodes) < 0 || max_nodes < 1 ||
+        max_nodes > 0x7FFF) {
+        return -1;
+    }
+
+    tmpfs_t* fs = (tmpfs_t*)malloc(sizeof(tmpfs_t));
+    tmpfs_node_t* nodes = (tmpfs_node_t*)malloc(max_nodes * sizeof(tmpfs_node_t));
+    if (!fs || !nodes) {
+        free(fs);
+        free(nodes);
+        return -1;
+    }
+    memset(nodes, 0, max_nodes * sizeof(tmpfs_node_t));
+
+    fs->nodes = nodes;
+    fs->max_nodes = max_nodes;
+    fs->max_pages = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+    fs->used_pages = 0;
+    mutex_init(&fs->lock);
+
+    /* Node 0 is the root, its own parent */
+    nodes[0].type = VFS_TYPE_DIR;
+    nodes[0].parent = 0;
+    nodes[0].first_child = -1;
+    nodes[0].next_sibling = -1;
+
+    sb->s_ops = &tmpfs_super_ops;
+    sb->i_ops = &tmpfs_inode_ops;
+    sb->f_ops = &tmpfs_file_ops;
+    sb->priv = fs;
+    tmpfs_inode_fill(sb, 0, &sb->root);
+    return 0;
+}
+
+const vfs_fs_type_t tmpfs_fs_type = {
+    .name = "tmpfs",
+    .mount = tmpfs_mount,
+};
@@ -0,0 +1,485 @@
+#include "vfs.h"
+#include "memory.h"
+#include "string.h"
+#include "drivers.h"
+#include "cpu.h"
+
+/* Virtual filesystem (see vfs.h) */
+
+typedef struct {
+    uint8_t in_use;
+    vfs_inode_t parent;         /* Directory the mount is attached in (none for "/") */
+    char name[VFS_NAME_MAX];    /* Name within parent */
+    char path[VFS_PATH_MAX];    /* As given to vfs_mount(), for display */
+    vfs_superblock_t sb;
+} vfs_mount_t;
+
+typedef struct {
+    uint8_t in_use;
+    const vfs_file_ops_t* ops;
+    int handle;
+} vfs_file_t;
+
+static const vfs_fs_type_t* g_fs_types[VFS_MAX_FS_TYPES];
+static vfs_mount_t g_mounts[VFS_MAX_MOUNTS];
+static vfs_mount_t* g_root_mount = NULL;
+static vfs_file_t g_vfs_files[VFS_MAX_FILES];
+
+/* Clear the type, mount and open file tables */
+void vfs_init(void) {
+    memset(g_fs_types, 0, sizeof(g_fs_types));
+    memset(g_mounts, 0, sizeof(g_mounts));
+    memset(g_vfs_files, 0, sizeof(g_vfs_files));
+    g_root_mount = NULL;
+}
+
+/* Register a filesystem type */
+int vfs_register(const vfs_fs_type_t* type) {
+    for (int i = 0; i < VFS_MAX_FS_TYPES; i++) {
+        if (!g_fs_types[i]) {
+            g_fs_types[i] = type;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static const vfs_fs_type_t* vfs_find_type(const char* name) {
+    for (int i = 0; i < VFS_MAX_FS_TYPES; i++) {
+        if (g_fs_types[i] && strcmp(g_fs_types[i]->name, name) == 0) {
+            return g_fs_types[i];
+        }
+    }
+    return NULL;
+}
+
+/* Path walking */
+
+/* Copy the next component of *path into name; returns its length, 0 at
+ * the end of the path and -1 if it is too long */
+static int vfs_next_component(const char** path, char* name) {
+    const char* p = *path;
+
+    while (*p == '/') {
+        p++;
+    }
+    int len = 0;
+    while (p[len] && p[len] != '/') {
+        len++;
+    }
+    if (len >= VFS_NAME_MAX) {
+        return -1;
+    }
+
+    memcpy(name, p, len);
+    name[len] = 0;
+    *path = p + len;
+    return len;
+}
+
+/* Mount attached as name in dir */
+static vfs_mount_t* vfs_mount_at(const vfs_inode_t* dir, const char* name) {
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* m = &g_mounts[i];
+        if (m->in_use && m != g_root_mount && m->parent.sb == dir->sb &&
+            m->parent.ino == dir->ino && strcmp(m->name, name) == 0) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+/* Mount owning a superblock */
+static vfs_mount_t* vfs_mount_of(const vfs_superblock_t* sb) {
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (&g_mounts[i].sb == sb) {
+            return &g_mounts[i];
+        }
+    }
+    return NULL;
+}
+
+/* Move cur to its child name, switching filesystems at mount points */
+static int vfs_step(vfs_inode_t* cur, const char* name) {
+    if (cur->type != VFS_TYPE_DIR) {
+        return -1;
+    }
+    if (strcmp(name, ".") == 0) {
+        return 0;
+    }
+
+    int at_root = (cur->ino == cur->sb->root.ino);
+    if (strcmp(name, "..") == 0) {
+        if (at_root) {
+            vfs_mount_t* m = vfs_mount_of(cur->sb);
+            if (m && m != g_root_mount) {
+                *cur = m->parent;
+            }
+            return 0;
+        }
+    } else {
+        vfs_mount_t* m = vfs_mount_at(cur, name);
+        if (m) {
+            *cur = m->sb.root;
+            return 0;
+        }
+    }
+
+    vfs_inode_t next;
+    if (!cur->sb->i_ops->lookup || cur->sb->i_ops->lookup(cur, name, &next) < 0) {
+        return -1;
+    }
+    *cur = next;
+    return 0;
+}
+
+/* Resolve path to an inode */
+int vfs_lookup(const char* path, vfs_inode_t* inode) {
+    char name[VFS_NAME_MAX];
+    int len;
+
+    if (!path || !g_root_mount) {
+        return -1;
+    }
+
+    *inode = g_root_mount->sb.root;
+    while ((len = vfs_next_component(&path, name)) > 0) {
+        if (vfs_step(inode, name) < 0) {
+            return -1;
+        }
+    }
+    return len;
+}
+
+/* Directory holding the last component of path, and that component; -1
+ * if the path is empty, ends in "." or "..", or a directory is missing */
+static int vfs_lookup_parent(const char* path, vfs_inode_t* dir, char* name) {
+    int len;
+
+    if (!path || !g_root_mount) {
+        return -1;
+    }
+
+    *dir = g_root_mount->sb.root;
+    if ((len = vfs_next_component(&path, name)) <= 0) {
+        return -1;
+    }
+    while (1) {
+        char next[VFS_NAME_MAX];
+        int next_len = vfs_next_component(&path, next);
+        if (next_len < 0) {
+            return -1;
+        }
+        if (next_len == 0) {
+            break;
+        }
+        if (vfs_step(dir, name) < 0) {
+            return -1;
+        }
+        memcpy(name, next, next_len + 1);
+    }
+
+    if (dir->type != VFS_TYPE_DIR || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Mounting */
+
+int vfs_mount(const char* type_name, const char* path, const char* source) {
+    const vfs_fs_type_t* type = type_name ? vfs_find_type(type_name) : NULL;
+    if (!type || !path || strlen(path) >= VFS_PATH_MAX) {
+        return -1;
+    }
+
+    vfs_mount_t* m = NULL;
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (!g_mounts[i].in_use) {
+            m = &g_mounts[i];
+            break;
+        }
+    }
+    if (!m) {
+        return -1;
+    }
+    memset(m, 0, sizeof(vfs_mount_t));
+
+    /* "/" mounts the root; anything else attaches to a directory of it */
+    const char* rest = path;
+    char name[VFS_NAME_MAX];
+    if (vfs_next_component(&rest, name) == 0) {
+        if (g_root_mount) {
+            return -1;
+        }
+    } else if (vfs_lookup_parent(path, &m->parent, m->name) < 0 ||
+               vfs_mount_at(&m->parent, m->name)) {
+        return -1;
+    }
+
+    m->sb.type = type;
+    if (type->mount(&m->sb, source) < 0) {
+        return -1;
+    }
+    m->sb.root.sb = &m->sb;
+    memcpy(m->path, path, strlen(path) + 1);
+    m->in_use = 1;
+    if (!m->parent.sb) {
+        g_root_mount = m;
+    }
+    return 0;
+}
+
+/* Open files */
+
+/* Find or create the file and open it in its backend */
+static int vfs_open_inode(const char* path, uint32_t flags, vfs_superblock_t** sb) {
+    vfs_inode_t inode;
+
+    if (vfs_lookup(path, &inode) < 0) {
+        vfs_inode_t dir;
+        char name[VFS_NAME_MAX];
+        if (!(flags & VFS_OPEN_CREATE) || vfs_lookup_parent(path, &dir, name) < 0 ||
+            vfs_mount_at(&dir, name) || !dir.sb->i_ops->create ||
+            dir.sb->i_ops->create(&dir, name, &inode) < 0) {
+            return -1;
+        }
+    }
+
+    if (inode.type != VFS_TYPE_FILE || !inode.sb->i_ops->open) {
+        return -1;
+    }
+    *sb = inode.sb;
+    return inode.sb->i_ops->open(&inode, flags);
+}
+
+/* Open for a descriptor table */
+int vfs_open_file(const char* path, uint32_t flags, const file_ops_t** ops, int* handle) {
+    vfs_superblock_t* sb;
+    int h = vfs_open_inode(path, flags, &sb);
+    if (h < 0) {
+        return -1;
+    }
+
+    *ops = sb->f_ops->fd_ops;
+    *handle = h;
+    return 0;
+}
+
+static vfs_file_t* vfs_get_file(int fd) {
+    if (fd < 0 || fd >= VFS_MAX_FILES || !g_vfs_files[fd].ops) {
+        return NULL;
+    }
+    return &g_vfs_files[fd];
+}
+
+/* Kernel-side open */
+int vfs_open(const char* path, uint32_t flags) {
+    uint32_t irq = cpu_irq_save();
+    int fd = -1;
+    for (int i = 0; i < VFS_MAX_FILES; i++) {
+        if (!g_vfs_files[i].in_use) {
+            g_vfs_files[i].in_use = 1;  /* Reserved while the backend opens */
+            fd = i;
+            break;
+        }
+    }
+    cpu_irq_restore(irq);
+    if (fd < 0) {
+        return -1;
+    }
+
+    vfs_superblock_t* sb;
+    int handle = vfs_open_inode(path, flags, &sb);
+    if (handle < 0) {
+        g_vfs_files[fd].in_use = 0;
+        return -1;
+    }
+
+    g_vfs_files[fd].ops = sb->f_ops;
+    g_vfs_files[fd].handle = handle;
+    return fd;
+}
+
+int vfs_read(int fd, void* buffer, uint32_t count) {
+    vfs_file_t* file = vfs_get_file(fd);
+    return (file && file->ops->read) ? file->ops->read(file->handle, buffer, count) : -1;
+}
+
+int vfs_write(int fd, const void* buffer, uint32_t count) {
+    vfs_file_t* file = vfs_get_file(fd);
+    return (file && file->ops->write) ? file->ops->write(file->handle, buffer, count) : -1;
+}
+
+int vfs_seek(int fd, uint32_t offset) {
+    vfs_file_t* file = vfs_get_file(fd);
+    return (file && file->ops->seek) ? file->ops->seek(file->handle, offset) : -1;
+}
+
+uint32_t vfs_size(int fd) {
+    vfs_file_t* file = vfs_get_file(fd);
+    return (file && file->ops->size) ? file->ops->size(file->handle) : 0;
+}
+
+int vfs_close(int fd) {
+    vfs_file_t* file = vfs_get_file(fd);
+    if (!file) {
+        return -1;
+    }
+
+    int result = file->ops->close ? file->ops->close(file->handle) : 0;
+    file->ops = NULL;
+    file->in_use = 0;
+    return result;
+}
+
+/* Namespace operations */
+
+int vfs_unlink(const char* path) {
+    vfs_inode_t dir;
+    char name[VFS_NAME_MAX];
+
+    if (vfs_lookup_parent(path, &dir, name) < 0 || vfs_mount_at(&dir, name) ||
+        !dir.sb->i_ops->unlink) {
+        return -1;
+    }
+    return dir.sb->i_ops->unlink(&dir, name);
+}
+
+int vfs_mkdir(const char* path) {
+    vfs_inode_t dir;
+    char name[VFS_NAME_MAX];
+
+    if (vfs_lookup_parent(path, &dir, name) < 0 || vfs_mount_at(&dir, name) ||
+        !dir.sb->i_ops->mkdir) {
+        return -1;
+    }
+    return dir.sb->i_ops->mkdir(&dir, name);
+}
+
+int vfs_rmdir(const char* path) {
+    vfs_inode_t dir;
+    char name[VFS_NAME_MAX];
+
+    if (vfs_lookup_parent(path, &dir, name) < 0 || vfs_mount_at(&dir, name) ||
+        !dir.sb->i_ops->rmdir) {
+        return -1;
+    }
+    return dir.sb->i_ops->rmdir(&dir, name);
+}
+
+/* List a directory; mount points attached in it are listed as directories */
+int vfs_list_dir(const char* path, vfs_dirent_t* entries, int max_entries) {
+    vfs_inode_t dir;
+
+    if (!entries || vfs_lookup(path, &dir) < 0 || dir.type != VFS_TYPE_DIR ||
+        !dir.sb->i_ops->readdir) {
+        return -1;
+    }
+
+    int count = dir.sb->i_ops->readdir(&dir, entries, max_entries);
+    if (count < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < VFS_MAX_MOUNTS && count < max_entries; i++) {
+        vfs_mount_t* m = &g_mounts[i];
+        if (!m->in_use || m == g_root_mount || m->parent.sb != dir.sb ||
+            m->parent.ino != dir.ino) {
+            continue;
+        }
+
+        /* A mount hides an entry of the same name */
+        int shadowed = -1;
+        for (int j = 0; j < count; j++) {
+            if (strcmp(entries[j].name, m->name) == 0) {
+                shadowed = j;
+            }
+        }
+        int n = (shadowed >= 0) ? shadowed : count++;
+        memcpy(entries[n].name, m->name, VFS_NAME_MAX);
+        entries[n].type = VFS_TYPE_DIR;
+        entries[n].size = 0;
+        entries[n].ino = m->sb.root.ino;
+    }
+
+    return count;
+}
+
+/* Type, size and node number of a path */
+int vfs_stat(const char* path, vfs_dirent_t* info) {
+    vfs_inode_t inode;
+
+    if (!info || vfs_lookup(path, &inode) < 0) {
+        return -1;
+    }
+
+    /* Name: the last component of the path */
+    char name[VFS_NAME_MAX];
+    info->name[0] = 0;
+    while (vfs_next_component(&path, name) > 0) {
+        memcpy(info->name, name, VFS_NAME_MAX);
+    }
+    if (!info->name[0]) {
+        memcpy(info->name, "/", 2);
+    }
+
+    info->type = inode.type;
+    info->size = inode.size;
+    info->ino = inode.ino;
+    return 0;
+}
+
+/* Write back every mounted filesystem */
+int vfs_sync(void) {
+    int result = 0;
+
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* m = &g_mounts[i];
+        if (m->in_use && m->sb.s_ops->sync && m->sb.s_ops->sync(&m->sb) < 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/* Print the mount table */
+void vfs_display_mounts(void) {
+    char buf[16];
+
+    vga_write_string("PATH              TYPE    SIZE KB   FREE KB\n");
+    vga_write_string("================  ======  ========  ========\n");
+
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* m = &g_mounts[i];
+        if (!m->in_use) {
+            continue;
+        }
+
+        vga_write_string(m->path);
+        for (int j = strlen(m->path); j < 18; j++) {
+            vga_write_char(' ');
+        }
+
+        vga_write_string(m->sb.type->name);
+        for (int j = strlen(m->sb.type->name); j < 8; j++) {
+            vga_write_char(' ');
+        }
+
+        vfs_statfs_t st;
+        if (m->sb.s_ops->statfs && m->sb.s_ops->statfs(&m->sb, &st) == 0) {
+            uint32_t unit_kb = st.block_size / 1024;
+            itoa((int)(unit_kb ? st.blocks * unit_kb : st.blocks / (1024 / st.block_size)), buf, 10);
+            vga_write_string(buf);
+            for (int j = strlen(buf); j < 10; j++) {
+                vga_write_char(' ');
+            }
+            itoa((int)(unit_kb ? st.free_blocks * unit_kb : st.free_blocks / (1024 / st.block_size)),
+                 buf, 10);
+            vga_write_string(buf);
+        } else {
+            vga_write_string("-         -");
+        }
+        vga_write_char('\n');
+    }
+}
@@ -0,0 +1,96 @@
+#include "vsyscall.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "memory.h"
+#include "paging.h"
+#include "process.h"
+
+/* Fast system call entry (SYSENTER/SYSEXIT) and the user entry stub page */
+
+/* Kernel entry point for SYSENTER (interrupts.asm) */
+extern void sysenter_entry(void);
+
+/* Position-independent user stubs (vsyscall_stubs.asm) */
+extern uint8_t vsyscall_int80_start[];
+extern uint8_t vsyscall_int80_end[];
+extern uint8_t vsyscall_sysenter_start[];
+extern uint8_t vsyscall_sysenter_return[];
+extern uint8_t vsyscall_sysenter_end[];
+
+/* Page holding the selected stub */
+static uint8_t g_vsyscall_page[4096] __attribute__((aligned(4096)));
+static int g_vsyscall_mode = VSYSCALL_MODE_INT80;
+
+/* EIP that SYSEXIT returns to (read by sysenter_entry) */
+uint32_t g_sysenter_return = 0;
+
+/* Check if SYSENTER/SYSEXIT is usable */
+static int vsyscall_has_sep(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    if (!(edx & CPUID_EDX_SEP)) {
+        return 0;
+    }
+
+    /* Early Pentium Pro (family 6, model < 3, stepping < 3) reports SEP
+     * without supporting it */
+    uint32_t family = (eax >> 8) & 0x0F;
+    uint32_t model = (eax >> 4) & 0x0F;
+    uint32_t stepping = eax & 0x0F;
+    if (family == 6 && model < 3 && stepping < 3) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Initialize system call entry */
+void vsyscall_init(void) {
+    memset(g_vsyscall_page, 0xCC, sizeof(g_vsyscall_page));  /* int3 padding */
+
+    if (vsyscall_has_sep()) {
+        /* CS+8 = kernel SS, CS+16 = user CS, CS+24 = user SS (see gdt.h) */
+        cpu_wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+        /* ESP points at TSS.esp0; the entry stub loads its stack from there */
+        cpu_wrmsr(MSR_SYSENTER_ESP, (uint32_t)tss_kernel_stack_slot());
+        cpu_wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+
+        memcpy(g_vsyscall_page, vsyscall_sysenter_start,
+               vsyscall_sysenter_end - vsyscall_sysenter_start);
+        g_sysenter_return = VSYSCALL_VADDR +
+                            (vsyscall_sysenter_return - vsyscall_sysenter_start);
+        g_vsyscall_mode = VSYSCALL_MODE_SYSENTER;
+    } else {
+        memcpy(g_vsyscall_page, vsyscall_int80_start,
+               vsyscall_int80_end - vsyscall_int80_start);
+        g_vsyscall_mode = VSYSCALL_MODE_INT80;
+    }
+
+    /* Read-only and user-visible, also from private address spaces */
+    paging_map_shared(VSYSCALL_VADDR, (uint32_t)g_vsyscall_page, PAGE_USER);
+}
+
+/* Called by sysenter_entry before it reads the stub's save area
+ * [ebp, ebp + 12): nonzero if that is memory the caller may read */
+int sysenter_frame_ok(uint32_t ebp) {
+    if (ebp > USER_SPACE_END - 12) {
+        return 0;
+    }
+
+    process_t* proc = process_current();
+    if (proc && proc->page_dir) {
+        return vmm_prefault(ebp, 12) == 0;
+    }
+    return ebp <= PAGING_IDENTITY_LIMIT - 12;
+}
+
+/* Get user entry address */
+uint32_t vsyscall_entry(void) {
+    return VSYSCALL_VADDR;
+}
+
+/* Get selected mechanism */
+int vsyscall_mode(void) {
+    return g_vsyscall_mode;
+}
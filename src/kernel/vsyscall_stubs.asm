@@ -0,0 +1,33 @@
+; User-mode system call stubs for VlsOs
+; One of these is copied into the vsyscall page at boot (see vsyscall.c).
+; Both must be position-independent.
+; NASM syntax
+
+BITS 32
+
+section .text
+
+global vsyscall_int80_start, vsyscall_int80_end
+global vsyscall_sysenter_start, vsyscall_sysenter_return, vsyscall_sysenter_end
+
+; Legacy path: software interrupt
+vsyscall_int80_start:
+	int 0x80
+	ret
+vsyscall_int80_end:
+
+; Fast path: SYSENTER
+; SYSEXIT clobbers ECX/EDX (return ESP/EIP), so they are saved on the user
+; stack together with EBP, which carries the user ESP into the kernel.
+vsyscall_sysenter_start:
+	push ecx
+	push edx
+	push ebp
+	mov ebp, esp
+	sysenter
+vsyscall_sysenter_return:
+	pop ebp
+	pop edx
+	pop ecx
+	ret
+vsyscall_sysenter_end:
@@ -0,0 +1,101 @@
+#include "waitqueue.h"
+#include "process.h"
+#include "cpu.h"
+#include "kernel.h"
+
+/* Wait queues on top of process_block()/process_wake() */
+
+/* Sleep on a wait queue */
+int wait_queue_sleep(wait_queue_t* wq) {
+    uint32_t flags = cpu_irq_save();
+
+    int result = -1;
+    process_t* proc = process_current();
+    if (proc) {
+        wq->waiters |= 1u << proc->pid;
+        result = process_block();
+        if (result < 0) {
+            wq->waiters &= ~(1u << proc->pid);
+        }
+    }
+
+    cpu_irq_restore(flags);
+    return result;
+}
+
+/* Wake all sleepers */
+void wait_queue_wake_all(wait_queue_t* wq) {
+    uint32_t flags = cpu_irq_save();
+
+    uint32_t waiters = wq->waiters;
+    wq->waiters = 0;
+
+    while (waiters) {
+        uint32_t pid = __builtin_ctz(waiters);
+        waiters &= waiters - 1;
+        process_wake(pid);
+    }
+
+    cpu_irq_restore(flags);
+}
+
+/* Wake one given sleeper */
+void wait_queue_wake(wait_queue_t* wq, uint32_t pid) {
+    uint32_t flags = cpu_irq_save();
+
+    if (wq->waiters & (1u << pid)) {
+        wq->waiters &= ~(1u << pid);
+        process_wake(pid);
+    }
+
+    cpu_irq_restore(flags);
+}
+
+/* PID of the caller (0 during boot, before there are processes) */
+static uint32_t mutex_caller(void) {
+    process_t* proc = process_current();
+    return proc ? proc->pid : 0;
+}
+
+/* Take a mutex, sleeping while another process holds it */
+void mutex_lock(mutex_t* m) {
+    uint32_t flags = cpu_irq_save();
+    uint32_t pid = mutex_caller();
+
+    while (m->depth && m->owner != pid) {
+        if (wait_queue_sleep(&m->waiters) < 0) {
+            /* The idle process, or boot code, waiting on a holder that
+             * can never run while it spins with interrupts off */
+            kernel_panic("mutex_lock: caller cannot sleep");
+        }
+    }
+    m->owner = pid;
+    if (m->depth++ == 0) {
+        process_t* proc = process_current();
+        if (proc) {
+            proc->locks_held++;
+        }
+    }
+
+    cpu_irq_restore(flags);
+}
+
+/* Release one level; the last one wakes the sleepers to compete again */
+void mutex_unlock(mutex_t* m) {
+    uint32_t flags = cpu_irq_save();
+
+    if (m->depth && --m->depth == 0) {
+        process_t* proc = process_current();  /* The owner */
+        if (proc && proc->locks_held) {
+            proc->locks_held--;
+        }
+        if (wait_queue_active(&m->waiters)) {
+            wait_queue_wake_all(&m->waiters);
+        }
+    }
+
+    cpu_irq_restore(flags);
+
+    /* A kill deferred while the mutex was held takes effect now */
+    process_exit_if_killed();
+}
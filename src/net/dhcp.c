@@ -75,11 +75,13 @@ void dhcp_start(void) {
     if (bind(s, any, DHCP_SERVER_PORT) < 0) { vga_write_string("Failed to bind DHCP socket\n"); close(s); return; }
     dhcp_server.sockfd = s;
     dhcp_server.running = 1;
+    net_service_register(s, dhcp_poll);
     vga_write_string("DHCP server started on port 67\n");
 }
 
 void dhcp_stop(void) {
     if (!dhcp_server.running) { vga_write_string("DHCP server not running\n"); return; }
+    net_service_unregister(dhcp_server.sockfd);
     close(dhcp_server.sockfd);
     dhcp_server.sockfd = -1;
     dhcp_server.running = 0;
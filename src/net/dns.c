@@ -75,6 +75,7 @@ void dns_start(void) {
 
     dns_server.sockfd = s;
     dns_server.running = 1;
+    net_service_register(s, dns_poll);
     vga_write_string("DNS server started on port 53\n");
 }
 
@@ -83,6 +84,7 @@ void dns_stop(void) {
         vga_write_string("DNS server not running\n");
         return;
     }
+    net_service_unregister(dns_server.sockfd);
     close(dns_server.sockfd);
     dns_server.sockfd = -1;
     dns_server.running = 0;
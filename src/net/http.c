@@ -44,6 +44,7 @@ void http_server_start(void) {
 	}
 
 	http_server.running = 1;
+	net_service_register(http_server.server_socket, http_server_poll);
 	vga_write_string("HTTP server started on port 80\n");
 }
 
@@ -53,6 +54,7 @@ void http_server_stop(void) {
 		return;
 	}
 
+	net_service_unregister(http_server.server_socket);
 	close(http_server.server_socket);
 	http_server.running = 0;
 	vga_write_string("HTTP server stopped\n");
@@ -46,7 +46,7 @@ void ip_handle_packet(uint8_t* data, uint16_t len) {
 			break;
 
 		case IP_PROTO_UDP:
-			udp_handle_packet(payload, payload_len);
+			udp_handle_packet(ip->src_addr, payload, payload_len);
 			break;
 
 		case IP_PROTO_TCP:
@@ -3,6 +3,8 @@
 #include "string.h"
 #include "drivers.h"
 #include "types.h"
+#include "epoll.h"
+#include "process.h"
 
 /* Network interfaces (support single interface for now) */
 static net_interface_t interfaces[1];
@@ -19,6 +21,16 @@ struct arp_entry {
 static struct arp_entry arp_cache[32];
 static int arp_cache_size = 0;
 
+/* Server sockets served by netd */
+struct net_service {
+	int sockfd;                 /* -1 = free slot */
+	void (*handler)(void);
+};
+
+static struct net_service services[NET_MAX_SERVICES];
+static int service_epoll = -1;
+static int service_pid = -1;
+
 /* Initialize networking subsystem */
 void net_init(void) {
 	vga_write_string("Initializing network stack...\n");
@@ -30,9 +42,82 @@ void net_init(void) {
 	udp_init();
 	tcp_init();
 
+	for (int i = 0; i < NET_MAX_SERVICES; i++) {
+		services[i].sockfd = -1;
+		services[i].handler = NULL;
+	}
+
 	vga_write_string("Network stack initialized\n");
 }
 
+/* netd: sleep until any server socket is readable, then run its handler */
+static void net_service_loop(void) {
+	epoll_event_t events[NET_MAX_SERVICES];
+
+	while (1) {
+		int n = epoll_wait(service_epoll, events, NET_MAX_SERVICES, 1);
+		if (n < 0) {
+			return;
+		}
+
+		for (int i = 0; i < n; i++) {
+			uint32_t slot = events[i].data;
+			if (slot < NET_MAX_SERVICES && services[slot].handler) {
+				services[slot].handler();
+			}
+		}
+	}
+}
+
+/* Serve a socket from netd */
+int net_service_register(int sockfd, void (*handler)(void)) {
+	if (!handler) {
+		return -1;
+	}
+
+	if (service_epoll < 0) {
+		service_epoll = epoll_create();
+		if (service_epoll < 0) {
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < NET_MAX_SERVICES; i++) {
+		if (services[i].sockfd >= 0) {
+			continue;
+		}
+
+		if (epoll_ctl(service_epoll, EPOLL_CTL_ADD, EPOLL_SRC_SOCKET, sockfd,
+		              EPOLLIN, (uint32_t)i) < 0) {
+			return -1;
+		}
+		services[i].sockfd = sockfd;
+		services[i].handler = handler;
+
+		if (service_pid < 0) {
+			service_pid = process_spawn("netd", net_service_loop, 64);
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+/* Stop serving a socket (call before closing it) */
+void net_service_unregister(int sockfd) {
+	if (sockfd < 0) {
+		return;
+	}
+
+	for (int i = 0; i < NET_MAX_SERVICES; i++) {
+		if (services[i].sockfd == sockfd) {
+			epoll_ctl(service_epoll, EPOLL_CTL_DEL, EPOLL_SRC_SOCKET, sockfd, 0, 0);
+			services[i].sockfd = -1;
+			services[i].handler = NULL;
+		}
+	}
+}
+
 /* Network polling (called periodically) */
 void net_poll(void) {
 	/* Poll each interface for incoming packets */
@@ -2,8 +2,9 @@
 #include "string.h"
 #include "types.h"
 #include "disk.h"
+#include "bcache.h"
 #include "process.h"
-#include "filesystem.h"
+#include "vfs.h"
 #include "ipc.h"
 #include "net.h"
 #include "socket.h"
@@ -12,6 +13,11 @@
 #include "dhcp.h"
 #include "http_client.h"
 #include "ui.h"
+#include "elf.h"
+#include "schedstat.h"
+#include "shm.h"
+#include "timepage.h"
+#include "cpu.h"
 
 /* Network commands for shell */
 
@@ -308,9 +314,10 @@ int cmd_wget(int argc, char** argv) {
 /* Disk command */
 int cmd_disk(int argc, char** argv) {
 	if (argc < 2) {
-		vga_write_string("Usage: disk info|read|write\n");
+		vga_write_string("Usage: disk info|read|write|cache\n");
 		vga_write_string("  disk info              - Show disk information\n");
 		vga_write_string("  disk read <drive> <lba> - Read sector from disk\n");
+		vga_write_string("  disk cache [reset]     - Buffer cache statistics\n");
 		return 1;
 	}
 
@@ -404,19 +411,27 @@ int cmd_disk(int argc, char** argv) {
 	} else if (strcmp(argv[1], "write") == 0) {
 		vga_write_string("Write command not implemented\n");
 		return 1;
+	} else if (strcmp(argv[1], "cache") == 0) {
+		if (argc > 2 && strcmp(argv[2], "reset") == 0) {
+			bcache_reset_stats();
+			vga_write_string("Buffer cache statistics reset\n");
+			return 0;
+		}
+		bcache_display_info();
+		return 0;
 	} else {
 		vga_write_string("Unknown disk command\n");
 		return 1;
 	}
 }
 
+/* Entries listed by ls (kept off the stack) */
+#define LS_MAX_ENTRIES 512
+
 /* List directory command */
 int cmd_ls(int argc, char** argv) {
-	(void)argc;
-	(void)argv;
-
-	fs_dir_info_t entries[FS_ROOT_ENTRIES];
-	int count = fs_list_dir("", entries, FS_ROOT_ENTRIES);
+	static vfs_dirent_t entries[LS_MAX_ENTRIES];
+	int count = vfs_list_dir(argc > 1 ? argv[1] : "/", entries, LS_MAX_ENTRIES);
 
 	if (count < 0) {
 		vga_write_string("Failed to list directory\n");
@@ -429,20 +444,20 @@ int cmd_ls(int argc, char** argv) {
 
 	for (int i = 0; i < count; i++) {
 		/* Name */
-		vga_write_string(entries[i].filename);
-		for (int j = strlen(entries[i].filename); j < 16; j++) {
+		vga_write_string(entries[i].name);
+		for (int j = strlen(entries[i].name); j < 16; j++) {
 			vga_write_char(' ');
 		}
 
 		/* Size */
-		itoa(entries[i].file_size, buf, 10);
+		itoa(entries[i].size, buf, 10);
 		vga_write_string(buf);
 		for (int j = strlen(buf); j < 9; j++) {
 			vga_write_char(' ');
 		}
 
 		/* Attributes */
-		if (entries[i].attributes & FS_ATTR_DIRECTORY) {
+		if (entries[i].type == VFS_TYPE_DIR) {
 			vga_write_string("<DIR>");
 		} else {
 			vga_write_string("-");
@@ -465,14 +480,15 @@ int cmd_cat(int argc, char** argv) {
 		return 1;
 	}
 
-	if (!fs_file_exists(argv[1])) {
+	vfs_dirent_t info;
+	if (vfs_stat(argv[1], &info) < 0 || info.type != VFS_TYPE_FILE) {
 		vga_write_string("File not found: ");
 		vga_write_string(argv[1]);
 		vga_write_char('\n');
 		return 1;
 	}
 
-	int fd = fs_open(argv[1], 0);
+	int fd = vfs_open(argv[1], 0);
 	if (fd < 0) {
 		vga_write_string("Failed to open file\n");
 		return 1;
@@ -481,13 +497,99 @@ int cmd_cat(int argc, char** argv) {
 	uint8_t buffer[256];
 	int bytes_read;
 
-	while ((bytes_read = fs_read(fd, buffer, sizeof(buffer))) > 0) {
+	while ((bytes_read = vfs_read(fd, buffer, sizeof(buffer))) > 0) {
 		for (int i = 0; i < bytes_read; i++) {
 			vga_write_char((char)buffer[i]);
 		}
 	}
 
-	fs_close(fd);
+	vfs_close(fd);
+	vga_write_char('\n');
+	return 0;
+}
+
+/* Write back cached filesystem changes */
+int cmd_sync(int argc, char** argv) {
+	(void)argc;
+	(void)argv;
+
+	if (vfs_sync() < 0) {
+		vga_write_string("Sync failed\n");
+		return 1;
+	}
+	vga_write_string("Filesystem synced\n");
+	return 0;
+}
+
+/* Create a directory */
+int cmd_mkdir(int argc, char** argv) {
+	if (argc < 2) {
+		vga_write_string("Usage: mkdir <dir>\n");
+		return 1;
+	}
+
+	if (vfs_mkdir(argv[1]) < 0) {
+		vga_write_string("Cannot create directory: ");
+		vga_write_string(argv[1]);
+		vga_write_char('\n');
+		return 1;
+	}
+	return 0;
+}
+
+/* Remove an empty directory */
+int cmd_rmdir(int argc, char** argv) {
+	if (argc < 2) {
+		vga_write_string("Usage: rmdir <dir>\n");
+		return 1;
+	}
+
+	if (vfs_rmdir(argv[1]) < 0) {
+		vga_write_string("Cannot remove directory: ");
+		vga_write_string(argv[1]);
+		vga_write_char('\n');
+		return 1;
+	}
+	return 0;
+}
+
+/* Show the mount table, or mount a filesystem */
+int cmd_mount(int argc, char** argv) {
+	if (argc == 1) {
+		vfs_display_mounts();
+		return 0;
+	}
+	if (argc < 3) {
+		vga_write_string("Usage: mount [<type> <path> [source]]\n");
+		return 1;
+	}
+
+	if (vfs_mount(argv[1], argv[2], argc > 3 ? argv[3] : NULL) < 0) {
+		vga_write_string("Mount failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* Run an ELF program from disk */
+int cmd_exec(int argc, char** argv) {
+	if (argc < 2) {
+		vga_write_string("Usage: exec <file> [args...]\n");
+		return 1;
+	}
+
+	int pid = elf_exec(argv[1], argc - 1, (const char**)&argv[1]);
+	if (pid < 0) {
+		vga_write_string("Failed to execute: ");
+		vga_write_string(argv[1]);
+		vga_write_char('\n');
+		return 1;
+	}
+
+	char buf[16];
+	vga_write_string("Started process ");
+	itoa(pid, buf, 10);
+	vga_write_string(buf);
 	vga_write_char('\n');
 	return 0;
 }
@@ -499,30 +601,29 @@ int cmd_file(int argc, char** argv) {
 		return 1;
 	}
 
-	fs_dir_info_t info;
-	if (fs_get_file_info(argv[1], &info) < 0) {
+	vfs_dirent_t info;
+	if (vfs_stat(argv[1], &info) < 0) {
 		vga_write_string("File not found\n");
 		return 1;
 	}
 
 	char buf[32];
 	vga_write_string("File: ");
-	vga_write_string(info.filename);
+	vga_write_string(info.name);
 	vga_write_char('\n');
 	
 	vga_write_string("Size: ");
-	itoa(info.file_size, buf, 10);
+	itoa(info.size, buf, 10);
 	vga_write_string(buf);
 	vga_write_string(" bytes\n");
 	
-	vga_write_string("Start cluster: ");
-	itoa(info.start_cluster, buf, 10);
+	vga_write_string("Node: ");
+	itoa(info.ino, buf, 10);
 	vga_write_string(buf);
 	vga_write_char('\n');
 	
-	vga_write_string("Attributes: ");
-	itoa(info.attributes, buf, 16);
-	vga_write_string(buf);
+	vga_write_string("Type: ");
+	vga_write_string(info.type == VFS_TYPE_DIR ? "directory" : "file");
 	vga_write_char('\n');
 
 	return 0;
@@ -548,21 +649,25 @@ int cmd_pipe(int argc, char** argv) {
 	vga_write_char('\n');
 
 	/* Test write */
+	const char* msg = "hello through the pipe";
 	vga_write_string("Writing test message...\n");
-	ipc_pipe_write(pipe_id, 0x12345678);
-	ipc_pipe_write(pipe_id, 0xDEADBEEF);
+	int written = ipc_pipe_write(pipe_id, msg, strlen(msg) + 1);
 
 	/* Test read */
-	uint32_t msg1, msg2;
-	ipc_pipe_read(pipe_id, &msg1);
-	ipc_pipe_read(pipe_id, &msg2);
+	char data[32];
+	int got = ipc_pipe_read(pipe_id, data, sizeof(data));
 
-	vga_write_string("Read from pipe: 0x");
-	itoa(msg1, buf, 16);
+	vga_write_string("Wrote ");
+	itoa(written, buf, 10);
 	vga_write_string(buf);
-	vga_write_string(" and 0x");
-	itoa(msg2, buf, 16);
+	vga_write_string(" bytes, read ");
+	itoa(got, buf, 10);
 	vga_write_string(buf);
+	vga_write_string(" bytes: ");
+	if (got > 0) {
+		data[sizeof(data) - 1] = '\0';
+		vga_write_string(data);
+	}
 	vga_write_char('\n');
 
 	ipc_pipe_close(pipe_id);
@@ -571,6 +676,96 @@ int cmd_pipe(int argc, char** argv) {
 	return 0;
 }
 
+/* Echo server for the rpc command: replies with word 0 incremented */
+static void rpc_echo_server(void) {
+	ipc_msg_t msg;
+	int caller = ipc_reply_wait(-1, NULL, &msg);
+
+	while (caller >= 0) {
+		msg.w[0]++;
+		caller = ipc_reply_wait(caller, &msg, &msg);
+	}
+}
+
+/* Synchronous IPC round-trip benchmark */
+int cmd_rpc(int argc, char** argv) {
+	uint32_t count = (argc >= 2) ? (uint32_t)atoi(argv[1]) : 1000;
+	char buf[16];
+
+	if (count == 0) {
+		vga_write_string("Usage: rpc [calls]\n");
+		return 1;
+	}
+
+	int server = process_spawn("rpc-echo", rpc_echo_server, 1);
+	if (server < 0) {
+		vga_write_string("Failed to start echo server\n");
+		return 1;
+	}
+
+	ipc_msg_t msg = {{ 0, 0, 0, 0 }};
+	uint64_t start = sched_clock();
+	for (uint32_t i = 0; i < count; i++) {
+		if (ipc_call((uint32_t)server, &msg) < 0) {
+			vga_write_string("Call failed\n");
+			break;
+		}
+	}
+	uint64_t cycles = sched_clock() - start;
+
+	process_kill((uint32_t)server);
+
+	itoa((int)msg.w[0], buf, 10);
+	vga_write_string(buf);
+	vga_write_string(" round trips");
+
+	uint32_t khz = time_page()->tsc_khz;
+	if (start && khz && msg.w[0]) {
+		/* Average in ns: cycles per call * 10^6 / khz */
+		uint32_t per_call = cpu_div64_32(cycles, msg.w[0]);
+		vga_write_string(", ");
+		itoa((int)cpu_div64_32((uint64_t)per_call * 1000000u, khz), buf, 10);
+		vga_write_string(buf);
+		vga_write_string(" ns each");
+	}
+	vga_write_char('\n');
+	return 0;
+}
+
+/* Shared memory command: list regions, or create/destroy one */
+int cmd_shm(int argc, char** argv) {
+	char buf[16];
+
+	if (argc >= 3 && strcmp(argv[1], "create") == 0) {
+		int shm_id = shm_create((uint32_t)atoi(argv[2]));
+		if (shm_id < 0) {
+			vga_write_string("Failed to create region\n");
+			return 1;
+		}
+		vga_write_string("Region created: ID=");
+		itoa(shm_id, buf, 10);
+		vga_write_string(buf);
+		vga_write_char('\n');
+		return 0;
+	}
+
+	if (argc >= 3 && strcmp(argv[1], "destroy") == 0) {
+		if (shm_destroy(atoi(argv[2])) < 0) {
+			vga_write_string("Region not found or not owned by the shell\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (argc >= 2) {
+		vga_write_string("Usage: shm [create <size>|destroy <id>]\n");
+		return 1;
+	}
+
+	shm_display_info();
+	return 0;
+}
+
 /* UI command */
 int cmd_ui(int argc, char** argv) {
 	if (argc < 2) {
@@ -606,6 +801,24 @@ int cmd_ps(int argc, char** argv) {
 	return 0;
 }
 
+/* Scheduler latency histograms command */
+int cmd_sched(int argc, char** argv) {
+	if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+		schedstat_reset();
+		vga_write_string("Scheduler statistics cleared\n");
+		return 0;
+	}
+
+	int pid = (argc >= 2) ? atoi(argv[1]) : -1;
+	if (schedstat_display(pid) < 0) {
+		if (pid >= 0) {
+			vga_write_string("Process not found\n");
+		}
+		return 1;
+	}
+	return 0;
+}
+
 /* Kill process command */
 int cmd_kill(int argc, char** argv) {
 	if (argc < 2) {
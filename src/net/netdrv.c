@@ -2,6 +2,7 @@
 #include "net.h"
 #include "drivers.h"
 #include "memory.h"
+#include "spsc_ring.h"
 
 /* RTL8139 Driver - Stub Implementation
  * 
@@ -17,9 +18,33 @@
 
 static net_interface_t* net_iface = NULL;
 
+/* RX: filled by the interrupt path, drained by rtl8139_receive()
+ * TX: filled by rtl8139_send(), drained by the transmitter */
+static netdrv_frame_t rx_frames[NETDRV_RX_SLOTS];
+static netdrv_frame_t tx_frames[NETDRV_TX_SLOTS];
+static spsc_ring_t rx_ring;
+static spsc_ring_t tx_ring;
+
+/* Hand queued TX frames to the hardware (simulated: just report them) */
+static void rtl8139_tx_drain(void) {
+	netdrv_frame_t* frame;
+	char buf[16];
+
+	while ((frame = spsc_ring_consumer_slot(&tx_ring)) != NULL) {
+		vga_write_string("TX: ");
+		itoa(frame->len, buf, 10);
+		vga_write_string(buf);
+		vga_write_string(" bytes\n");
+		spsc_ring_consume(&tx_ring);
+	}
+}
+
 void rtl8139_init(void) {
 	vga_write_string("Initializing RTL8139 network driver...\n");
 
+	spsc_ring_init(&rx_ring, rx_frames, NETDRV_RX_SLOTS, sizeof(netdrv_frame_t));
+	spsc_ring_init(&tx_ring, tx_frames, NETDRV_TX_SLOTS, sizeof(netdrv_frame_t));
+
 	/* Register network interface */
 	net_iface = net_register_interface("eth0");
 	if (!net_iface) {
@@ -63,19 +88,34 @@ void rtl8139_send(uint8_t* data, uint16_t len) {
 		return;
 	}
 
-	/* In a real implementation:
-	 * 1. Copy data to TX ring buffer
-	 * 2. Update TX descriptor
-	 * 3. Trigger transmission
-	 * 4. Handle TX completion interrupt
-	 */
+	/* Copy the frame straight into a TX slot; drop it if the ring is full */
+	netdrv_frame_t* frame = spsc_ring_producer_slot(&tx_ring);
+	if (!frame) {
+		return;
+	}
+	memcpy(frame->data, data, len);
+	frame->len = len;
+	spsc_ring_produce(&tx_ring);
 
-	/* For now, just simulate - don't actually send */
-	vga_write_string("TX: ");
-	char buf[16];
-	itoa(len, buf, 10);
-	vga_write_string(buf);
-	vga_write_string(" bytes\n");
+	/* In a real implementation the TX descriptors would be loaded here and
+	 * the TX-complete interrupt would release the slots */
+	rtl8139_tx_drain();
+}
+
+/* Queue a received frame; returns -1 if the RX ring is full (frame dropped) */
+int rtl8139_rx_queue(const uint8_t* data, uint16_t len) {
+	if (!data || len > NETDRV_FRAME_MAX) {
+		return -1;
+	}
+
+	netdrv_frame_t* frame = spsc_ring_producer_slot(&rx_ring);
+	if (!frame) {
+		return -1;
+	}
+	memcpy(frame->data, data, len);
+	frame->len = len;
+	spsc_ring_produce(&rx_ring);
+	return 0;
 }
 
 void rtl8139_receive(void) {
@@ -83,16 +123,14 @@ void rtl8139_receive(void) {
 		return;
 	}
 
-	/* In a real implementation:
-	 * 1. Check RX ring for available packets
-	 * 2. Read packet from RX buffer
-	 * 3. Update RX pointer
-	 * 4. Call net_receive_frame()
-	 * 5. Acknowledge interrupt
-	 */
-
-	/* For now, check for any test packets */
-	/* This would be called periodically by net_poll() */
+	/* Called periodically by net_poll(): hand queued frames to the stack.
+	 * A real implementation would fill the ring from the RX buffer in
+	 * rtl8139_irq_handler() via rtl8139_rx_queue(). */
+	netdrv_frame_t* frame;
+	while ((frame = spsc_ring_consumer_slot(&rx_ring)) != NULL) {
+		net_receive_frame(frame->data, frame->len);
+		spsc_ring_consume(&rx_ring);
+	}
 }
 
 void rtl8139_irq_handler(void) {
@@ -101,9 +139,9 @@ void rtl8139_irq_handler(void) {
 		return;
 	}
 
-	/* Would check interrupt status register and handle accordingly */
-	/* Send EOI to PIC */
-	outb(0x20, 0x20);
+	/* Would check the interrupt status register, queue received frames
+	 * with rtl8139_rx_queue() and release completed TX slots.
+	 * EOI is sent by irq_handler. */
 }
 
 /* Initialize network driver subsystem */
@@ -1,5 +1,6 @@
 #include "socket.h"
 #include "memory.h"
+#include "cpu.h"
 
 #define MAX_SOCKETS 16
 
@@ -22,6 +23,7 @@ int socket(int domain, int type, int protocol) {
 			sockets[i].local_port = 0;
 			sockets[i].buffer = malloc(NET_MTU);
 			sockets[i].buf_len = 0;
+			poll_head_init(&sockets[i].poll);
 			return sockets[i].fd;
 		}
 	}
@@ -90,11 +92,31 @@ int send(int sockfd, uint8_t* buffer, uint16_t len) {
 	return -1;
 }
 
+/* Take the buffered datagram, if any (non-blocking: 0 when empty) */
+static int socket_take(socket_t* sock, uint8_t* buffer, uint16_t maxlen,
+                       ipv4_addr_t* addr, uint16_t* port) {
+	uint32_t flags = cpu_irq_save();
+
+	uint16_t len = sock->buf_len < maxlen ? sock->buf_len : maxlen;
+	if (len && buffer) {
+		memcpy(buffer, sock->buffer, len);
+	}
+	if (addr) {
+		*addr = sock->from_ip;
+	}
+	if (port) {
+		*port = sock->from_port;
+	}
+	sock->buf_len = 0;
+
+	cpu_irq_restore(flags);
+	return len;
+}
+
 int recv(int sockfd, uint8_t* buffer, uint16_t maxlen) {
 	for (int i = 0; i < MAX_SOCKETS; i++) {
 		if (sockets[i].fd == sockfd && sockets[i].state == SOCK_CONNECTED) {
-			/* Would receive data */
-			return sockets[i].buf_len;
+			return socket_take(&sockets[i], buffer, maxlen, NULL, NULL);
 		}
 	}
 	return -1;
@@ -114,9 +136,8 @@ int sendto(int sockfd, uint8_t* buffer, uint16_t len, ipv4_addr_t addr, uint16_t
 
 int recvfrom(int sockfd, uint8_t* buffer, uint16_t maxlen, ipv4_addr_t* addr, uint16_t* port) {
 	for (int i = 0; i < MAX_SOCKETS; i++) {
-		if (sockets[i].fd == sockfd) {
-			/* Would receive UDP packet */
-			return sockets[i].buf_len;
+		if (sockets[i].fd == sockfd && sockets[i].state != SOCK_CLOSED) {
+			return socket_take(&sockets[i], buffer, maxlen, addr, port);
 		}
 	}
 	return -1;
@@ -125,12 +146,91 @@ int recvfrom(int sockfd, uint8_t* buffer, uint16_t maxlen, ipv4_addr_t* addr, ui
 int close(int sockfd) {
 	for (int i = 0; i < MAX_SOCKETS; i++) {
 		if (sockets[i].fd == sockfd && sockets[i].state != SOCK_CLOSED) {
-			if (sockets[i].buffer) {
-				free(sockets[i].buffer);
-			}
+			/* Detach the buffer first: the receive path may run at any time */
+			uint32_t flags = cpu_irq_save();
+			void* buffer = sockets[i].buffer;
+			sockets[i].buffer = NULL;
+			sockets[i].buf_len = 0;
 			sockets[i].state = SOCK_CLOSED;
+			cpu_irq_restore(flags);
+
+			free(buffer);
+			poll_wake(&sockets[i].poll);
 			return 0;
 		}
 	}
 	return -1;
 }
+
+/* Readiness for epoll */
+int socket_poll(int sockfd, poll_head_t** head) {
+	for (int i = 0; i < MAX_SOCKETS; i++) {
+		socket_t* sock = &sockets[i];
+		if (sock->fd != sockfd || sock->state == SOCK_CLOSED) {
+			continue;
+		}
+
+		if (head) {
+			*head = &sock->poll;
+		}
+
+		int events = 0;
+		if (sock->buf_len > 0) {
+			events |= EPOLLIN;
+		}
+		if (sock->type == SOCK_DGRAM || sock->state == SOCK_CONNECTED) {
+			events |= EPOLLOUT;
+		}
+		return events;
+	}
+	return -1;
+}
+
+/* Receive path: UDP datagram for a local port */
+void socket_deliver_udp(uint16_t port, ipv4_addr_t from, uint16_t from_port,
+                        const uint8_t* data, uint16_t len) {
+	if (len > NET_MTU) {
+		return;
+	}
+
+	for (int i = 0; i < MAX_SOCKETS; i++) {
+		socket_t* sock = &sockets[i];
+		if (sock->state == SOCK_CLOSED || sock->type != SOCK_DGRAM ||
+		    sock->local_port != port) {
+			continue;
+		}
+
+		uint32_t flags = cpu_irq_save();
+		if (sock->buf_len == 0 && sock->buffer) {
+			memcpy(sock->buffer, data, len);
+			sock->buf_len = len;
+			sock->from_ip = from;
+			sock->from_port = from_port;
+		}
+		cpu_irq_restore(flags);
+
+		poll_wake(&sock->poll);
+		return;
+	}
+}
+
+/* Descriptor operations */
+
+static int socket_fd_read(int sockfd, void* buffer, uint32_t count) {
+	return recv(sockfd, (uint8_t*) buffer, count > NET_MTU ? NET_MTU : (uint16_t) count);
+}
+
+static int socket_fd_write(int sockfd, const void* buffer, uint32_t count) {
+	if (count > NET_MTU) {
+		return -1;  /* One datagram per write */
+	}
+	return send(sockfd, (uint8_t*) buffer, (uint16_t) count);
+}
+
+const file_ops_t socket_ops = {
+	.name = "socket",
+	.poll_source = EPOLL_SRC_SOCKET,
+	.read = socket_fd_read,
+	.write = socket_fd_write,
+	.close = close,
+};
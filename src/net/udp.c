@@ -1,20 +1,25 @@
 #include "net.h"
 #include "memory.h"
+#include "socket.h"
 
 void udp_init(void) {
 	/* Initialize UDP layer */
 }
 
-void udp_handle_packet(uint8_t* data, uint16_t len) {
+void udp_handle_packet(ipv4_addr_t src, uint8_t* data, uint16_t len) {
 	if (len < sizeof(udp_hdr_t)) {
 		return;
 	}
 
 	udp_hdr_t* udp = (udp_hdr_t*) data;
+	uint16_t udp_len = net_ntohs(udp->length);
+	if (udp_len < sizeof(udp_hdr_t) || udp_len > len) {
+		return;
+	}
 
-	/* UDP packet received */
-	/* Dispatch to application layer */
-	/* For now, just log it */
+	/* Dispatch to the socket bound to the destination port */
+	socket_deliver_udp(net_ntohs(udp->dest_port), src, net_ntohs(udp->src_port),
+	                   data + sizeof(udp_hdr_t), udp_len - sizeof(udp_hdr_t));
 }
 
 void udp_send_packet(ipv4_addr_t dest, uint16_t src_port, uint16_t dest_port, uint8_t* data, uint16_t len) {
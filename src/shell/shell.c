@@ -34,10 +34,18 @@ extern int cmd_wget(int argc, char** argv);
 extern int cmd_disk(int argc, char** argv);
 extern int cmd_ps(int argc, char** argv);
 extern int cmd_kill(int argc, char** argv);
+extern int cmd_sched(int argc, char** argv);
 extern int cmd_ls(int argc, char** argv);
 extern int cmd_cat(int argc, char** argv);
 extern int cmd_file(int argc, char** argv);
+extern int cmd_sync(int argc, char** argv);
+extern int cmd_mkdir(int argc, char** argv);
+extern int cmd_rmdir(int argc, char** argv);
+extern int cmd_mount(int argc, char** argv);
+extern int cmd_exec(int argc, char** argv);
 extern int cmd_pipe(int argc, char** argv);
+extern int cmd_shm(int argc, char** argv);
+extern int cmd_rpc(int argc, char** argv);
 extern int cmd_ui(int argc, char** argv);
 static int cmd_clear(int argc, char** argv);
 static int cmd_uptime(int argc, char** argv);
@@ -60,13 +68,21 @@ static struct command commands[] = {
 	{"dns",      cmd_dns,       "DNS server control (start|stop|status)"},
 	{"dhcp",     cmd_dhcp,      "DHCP server control (start|stop|status)"},
 	{"wget",     cmd_wget,      "HTTP client (fetch and display web pages)"},
-	{"disk",     cmd_disk,      "Disk operations (info|read|write)"},
+	{"disk",     cmd_disk,      "Disk operations (info|read|write|cache)"},
 	{"ps",       cmd_ps,        "List running processes"},
 	{"kill",     cmd_kill,      "Terminate a process (kill <pid>)"},
-	{"ls",       cmd_ls,        "List directory contents"},
+	{"sched",    cmd_sched,     "Scheduler latency histograms (sched [pid|reset])"},
+	{"ls",       cmd_ls,        "List directory contents (ls [dir])"},
 	{"cat",      cmd_cat,       "Display file contents (cat <file>)"},
 	{"file",     cmd_file,      "Show file information (file <file>)"},
+	{"sync",     cmd_sync,      "Write cached filesystem changes to disk"},
+	{"mkdir",    cmd_mkdir,     "Create a directory (mkdir <dir>)"},
+	{"rmdir",    cmd_rmdir,     "Remove an empty directory (rmdir <dir>)"},
+	{"mount",    cmd_mount,     "Mount table (mount [<type> <path> [source]])"},
+	{"exec",     cmd_exec,      "Run an ELF program (exec <file> [args])"},
 	{"pipe",     cmd_pipe,      "Test pipe/IPC functionality"},
+	{"rpc",      cmd_rpc,       "Synchronous IPC round-trip benchmark (rpc [calls])"},
+	{"shm",      cmd_shm,       "Shared memory regions (shm [create <size>|destroy <id>])"},
 	{"ui",       cmd_ui,        "Enhanced UI control (on|off|status)"},
 	{NULL,       NULL,          NULL}
 };
@@ -2,19 +2,41 @@
 
 #include "types.h"
 #include "syscall.h"
-#include "filesystem.h"
+#include "vfs.h"
 #include "process.h"
 #include "drivers.h"
 #include "shell.h"
+#include "paging.h"
+#include "elf.h"
+#include "ipc.h"
+#include "shm.h"
+#include "epoll.h"
+#include "socket.h"
+#include "futex.h"
+#include "memory.h"
+
+/* Descriptor table of the calling process */
+static fd_table_t* current_fds(void) {
+    process_t* proc = process_current();
+    return proc ? &proc->fds : NULL;
+}
 
-/* Global file descriptor table for kernel */
-#define KERNEL_MAX_FILES 16
-static int g_kernel_fds[KERNEL_MAX_FILES] = {-1};
+/* Entry of an open descriptor of the caller */
+static fd_entry_t* current_fd(int fd) {
+    fd_table_t* fds = current_fds();
+    return fds ? fd_get(fds, fd) : NULL;
+}
 
-/* Standard I/O streams (reserved) */
-#define STDIN_FD   0
-#define STDOUT_FD  1
-#define STDERR_FD  2
+/* Give the caller a descriptor for an object, closing the object if the
+ * table cannot take it */
+static int current_fd_install(const file_ops_t* ops, int handle) {
+    fd_table_t* fds = current_fds();
+    int fd = fds ? fd_install(fds, ops, handle) : -1;
+    if (fd < 0 && ops->close) {
+        ops->close(handle);
+    }
+    return fd;
+}
 
 /* System call handler dispatcher */
 void syscall_handler(syscall_context_t* ctx) {
@@ -42,6 +64,22 @@ void syscall_handler(syscall_context_t* ctx) {
             result = sys_close((int)ctx->ebx);
             break;
 
+        case SYS_UNLINK:
+            result = sys_unlink((const char*)ctx->ebx);
+            break;
+
+        case SYS_SYNC:
+            result = sys_sync();
+            break;
+
+        case SYS_MKDIR:
+            result = sys_mkdir((const char*)ctx->ebx);
+            break;
+
+        case SYS_RMDIR:
+            result = sys_rmdir((const char*)ctx->ebx);
+            break;
+
         case SYS_GETPID:
             result = (int32_t)sys_getpid();
             break;
@@ -54,10 +92,77 @@ void syscall_handler(syscall_context_t* ctx) {
             result = sys_pipe((int*)ctx->ebx);
             break;
 
+        case SYS_EXEC:
+            result = sys_exec((const char*)ctx->ebx, (const char**)ctx->ecx);
+            break;
+
         case SYS_SEEK:
             result = sys_seek((int)ctx->ebx, ctx->ecx);
             break;
 
+        case SYS_SHM_CREATE:
+            result = sys_shm_create(ctx->ebx);
+            break;
+
+        case SYS_SHM_MAP:
+            result = (int32_t)sys_shm_map((int)ctx->ebx);
+            break;
+
+        case SYS_SHM_UNMAP:
+            result = sys_shm_unmap(ctx->ebx);
+            break;
+
+        case SYS_SHM_DESTROY:
+            result = sys_shm_destroy((int)ctx->ebx);
+            break;
+
+        case SYS_EPOLL_CREATE:
+            result = sys_epoll_create();
+            break;
+
+        case SYS_EPOLL_CTL:
+            result = sys_epoll_ctl((int)ctx->ebx, (int)ctx->ecx, (int)ctx->edx, ctx->esi, ctx->edi);
+            break;
+
+        case SYS_EPOLL_WAIT:
+            result = sys_epoll_wait((int)ctx->ebx, (epoll_event_t*)ctx->ecx, (int)ctx->edx,
+                                    (int)ctx->esi);
+            break;
+
+        case SYS_SOCKET:
+            result = sys_socket((int)ctx->ebx);
+            break;
+
+        case SYS_CONNECT:
+            result = sys_connect((int)ctx->ebx, ctx->ecx, (uint16_t)ctx->edx);
+            break;
+
+        case SYS_MQ_CREATE:
+            result = sys_mq_create(ctx->ebx);
+            break;
+
+        case SYS_FUTEX:
+            result = sys_futex((uint32_t*)ctx->ebx, (int)ctx->ecx, ctx->edx);
+            break;
+
+        /* Synchronous IPC: the first two message words travel in ESI/EDI,
+         * which both the int 0x80 and SYSENTER paths hand back */
+        case SYS_IPC_CALL: {
+            ipc_msg_t msg = {{ ctx->esi, ctx->edi, 0, 0 }};
+            result = ipc_call(ctx->ebx, &msg);
+            ctx->esi = msg.w[0];
+            ctx->edi = msg.w[1];
+            break;
+        }
+
+        case SYS_IPC_REPLY_WAIT: {
+            ipc_msg_t msg = {{ ctx->esi, ctx->edi, 0, 0 }};
+            result = ipc_reply_wait((int)ctx->ebx, &msg, &msg);
+            ctx->esi = msg.w[0];
+            ctx->edi = msg.w[1];
+            break;
+        }
+
         default:
             result = -1;  /* Unknown syscall */
             break;
@@ -73,106 +178,90 @@ void sys_exit(int code) {
 
 /* Write to file descriptor */
 int sys_write(int fd, const void* buffer, uint32_t count) {
-    if (!buffer || count == 0) {
+    if (!buffer || count == 0 || vmm_prefault((uint32_t)buffer, count) < 0) {
         return -1;
     }
 
-    /* Handle standard streams */
-    if (fd == STDOUT_FD || fd == STDERR_FD) {
-        /* Write to VGA display */
-        const char* str = (const char*)buffer;
-        for (uint32_t i = 0; i < count && str[i]; i++) {
-            vga_write_char(str[i]);
-        }
-        return (int)count;
-    }
-
-    if (fd == STDIN_FD) {
-        return -1;  /* Can't write to stdin */
-    }
-
-    /* File operations */
-    if (fd >= FIRST_USER_FD && fd < (FIRST_USER_FD + KERNEL_MAX_FILES)) {
-        int real_fd = g_kernel_fds[fd - FIRST_USER_FD];
-        if (real_fd >= 0) {
-            return fs_write(real_fd, (const uint8_t*)buffer, (uint16_t)count);
-        }
+    fd_entry_t* entry = current_fd(fd);
+    if (!entry || !entry->ops->write) {
+        return -1;
     }
-
-    return -1;
+    return entry->ops->write(entry->handle, buffer, count);
 }
 
 /* Read from file descriptor */
 int sys_read(int fd, void* buffer, uint32_t count) {
-    if (!buffer || count == 0) {
+    if (!buffer || count == 0 || vmm_prefault((uint32_t)buffer, count) < 0) {
         return -1;
     }
 
-    if (fd == STDIN_FD) {
-        /* Read from keyboard */
-        char* str = (char*)buffer;
-        uint32_t i = 0;
-        while (i < count) {
-            char c = keyboard_read_char();
-            if (c == '\n') {
-                str[i] = 0;
-                return (int)i;
-            }
-            str[i++] = c;
-        }
-        return (int)count;
+    fd_entry_t* entry = current_fd(fd);
+    if (!entry || !entry->ops->read) {
+        return -1;
     }
+    return entry->ops->read(entry->handle, buffer, count);
+}
 
-    if (fd >= FIRST_USER_FD && fd < (FIRST_USER_FD + KERNEL_MAX_FILES)) {
-        int real_fd = g_kernel_fds[fd - FIRST_USER_FD];
-        if (real_fd >= 0) {
-            return fs_read(real_fd, (uint8_t*)buffer, (uint16_t)count);
-        }
+/* Copy a path argument into the kernel before the VFS walks it, so a bad
+ * or kernel pointer fails here; -1 if it is longer than VFS_PATH_MAX */
+static int copy_user_path(char* path, const char* user_path) {
+    if (!user_path || vmm_copy_user_string(path, user_path, VFS_PATH_MAX) < 0) {
+        return -1;
     }
-
-    return -1;
+    return 0;
 }
 
 /* Open file */
 int sys_open(const char* filename, uint32_t flags) {
-    if (!filename) {
+    char path[VFS_PATH_MAX];
+    if (copy_user_path(path, filename) < 0) {
         return -1;
     }
 
-    int real_fd = fs_open(filename, 0);
-    if (real_fd < 0) {
+    const file_ops_t* ops;
+    int handle;
+    if (vfs_open_file(path, flags, &ops, &handle) < 0) {
         return -1;
     }
+    return current_fd_install(ops, handle);
+}
 
-    /* Find free user-mode file descriptor slot */
-    for (int i = 0; i < KERNEL_MAX_FILES; i++) {
-        if (g_kernel_fds[i] == -1) {
-            g_kernel_fds[i] = real_fd;
-            return FIRST_USER_FD + i;
-        }
+/* Remove a file */
+int sys_unlink(const char* filename) {
+    char path[VFS_PATH_MAX];
+    if (copy_user_path(path, filename) < 0) {
+        return -1;
     }
-
-    /* Too many open files */
-    fs_close(real_fd);
-    return -1;
+    return vfs_unlink(path);
 }
 
-/* Close file */
-int sys_close(int fd) {
-    if (fd == STDIN_FD || fd == STDOUT_FD || fd == STDERR_FD) {
-        return 0;  /* Can't close standard streams */
+/* Create a directory */
+int sys_mkdir(const char* path) {
+    char kpath[VFS_PATH_MAX];
+    if (copy_user_path(kpath, path) < 0) {
+        return -1;
     }
+    return vfs_mkdir(kpath);
+}
 
-    if (fd >= FIRST_USER_FD && fd < (FIRST_USER_FD + KERNEL_MAX_FILES)) {
-        int real_fd = g_kernel_fds[fd - FIRST_USER_FD];
-        if (real_fd >= 0) {
-            int result = fs_close(real_fd);
-            g_kernel_fds[fd - FIRST_USER_FD] = -1;
-            return result;
-        }
+/* Remove an empty directory */
+int sys_rmdir(const char* path) {
+    char kpath[VFS_PATH_MAX];
+    if (copy_user_path(kpath, path) < 0) {
+        return -1;
     }
+    return vfs_rmdir(kpath);
+}
 
-    return -1;
+/* Write back cached filesystem changes */
+int sys_sync(void) {
+    return vfs_sync();
+}
+
+/* Close any descriptor */
+int sys_close(int fd) {
+    fd_table_t* fds = current_fds();
+    return fds ? fd_close(fds, fd) : -1;
 }
 
 /* Get current process ID */
@@ -190,19 +279,191 @@ int sys_kill(uint32_t pid, int signal) {
     return process_kill(pid);
 }
 
-/* Pipe (stub) */
+/* Create a pipe: fds[0] is the read end, fds[1] the write end */
 int sys_pipe(int* fds) {
-    (void)fds;
-    return -1;  /* Not implemented yet */
+    if (!fds || vmm_prefault((uint32_t)fds, 2 * sizeof(int)) < 0) {
+        return -1;
+    }
+
+    int pipe_id = ipc_pipe_create();
+    if (pipe_id < 0) {
+        return -1;
+    }
+
+    fd_table_t* table = current_fds();
+    int rfd = table ? fd_install(table, &ipc_pipe_read_ops, pipe_id) : -1;
+    int wfd = (rfd >= 0) ? fd_install(table, &ipc_pipe_write_ops, pipe_id) : -1;
+    if (wfd < 0) {
+        if (rfd >= 0) {
+            fd_remove(table, rfd);
+        }
+        ipc_pipe_close(pipe_id);
+        return -1;
+    }
+
+    fds[0] = rfd;
+    fds[1] = wfd;
+    return 0;
+}
+
+/* Kernel copies of exec arguments; too big for a 4 KB kernel stack, so
+ * each call gets its own from the heap */
+typedef struct {
+    char path[64];
+    char args[PROCESS_MAX_ARGS][64];
+} exec_args_t;
+
+/* Copy the path and argv into the kernel before the caller's pages can
+ * change; returns argc or -1 */
+static int exec_copy_args(exec_args_t* copy, const char* filename, const char* argv[],
+                          const char* arg_ptrs[]) {
+    int argc = 0;
+
+    if (vmm_copy_user_string(copy->path, filename, sizeof(copy->path)) < 0) {
+        return -1;
+    }
+
+    while (argv) {
+        if (vmm_prefault((uint32_t)&argv[argc], sizeof(argv[0])) < 0) {
+            return -1;
+        }
+        if (!argv[argc]) {
+            break;
+        }
+        if (argc >= PROCESS_MAX_ARGS ||
+            vmm_copy_user_string(copy->args[argc], argv[argc], sizeof(copy->args[0])) < 0) {
+            return -1;
+        }
+        arg_ptrs[argc] = copy->args[argc];
+        argc++;
+    }
+    return argc;
+}
+
+/* Execute program: load an ELF file as a new process, returns its PID */
+int sys_exec(const char* filename, const char* argv[]) {
+    const char* arg_ptrs[PROCESS_MAX_ARGS];
+
+    if (!filename) {
+        return -1;
+    }
+    exec_args_t* copy = (exec_args_t*)malloc(sizeof(exec_args_t));
+    if (!copy) {
+        return -1;
+    }
+
+    int argc = exec_copy_args(copy, filename, argv, arg_ptrs);
+    int result = (argc < 0) ? -1 : elf_exec(copy->path, argc, arg_ptrs);
+
+    free(copy);
+    return result;
 }
 
 /* Seek in file */
 int sys_seek(int fd, uint32_t offset) {
-    if (fd >= FIRST_USER_FD && fd < (FIRST_USER_FD + KERNEL_MAX_FILES)) {
-        int real_fd = g_kernel_fds[fd - FIRST_USER_FD];
-        if (real_fd >= 0) {
-            return fs_seek(real_fd, offset);
-        }
+    fd_entry_t* entry = current_fd(fd);
+    if (!entry || !entry->ops->seek) {
+        return -1;
+    }
+    return entry->ops->seek(entry->handle, offset);
+}
+
+/* Create a shared memory region */
+int sys_shm_create(uint32_t size) {
+    return shm_create(size);
+}
+
+/* Map a region into the caller; 0 on error */
+uint32_t sys_shm_map(int shm_id) {
+    return (uint32_t)shm_map(shm_id);
+}
+
+/* Unmap a region mapped by sys_shm_map */
+int sys_shm_unmap(uint32_t addr) {
+    return shm_unmap((void*)addr);
+}
+
+/* Drop the creator's reference to a region */
+int sys_shm_destroy(int shm_id) {
+    return shm_destroy(shm_id);
+}
+
+/* Create an epoll instance as a descriptor */
+int sys_epoll_create(void) {
+    int epfd = epoll_create();
+    if (epfd < 0) {
+        return -1;
+    }
+    return current_fd_install(&epoll_ops, epfd);
+}
+
+/* Watch any pollable descriptor (stdin is the keyboard) */
+int sys_epoll_ctl(int epfd, int op, int fd, uint32_t events, uint32_t data) {
+    fd_entry_t* ep = current_fd(epfd);
+    if (!ep || ep->ops != &epoll_ops) {
+        return -1;
+    }
+
+    fd_entry_t* entry = current_fd(fd);
+    if (!entry || !entry->ops->poll_source) {
+        return -1;
+    }
+    return epoll_ctl(ep->handle, op, entry->ops->poll_source, entry->handle, events, data);
+}
+
+/* Wait for ready descriptors */
+int sys_epoll_wait(int epfd, epoll_event_t* events, int max_events, int block) {
+    fd_entry_t* ep = current_fd(epfd);
+    if (!ep || ep->ops != &epoll_ops || max_events <= 0) {
+        return -1;
+    }
+
+    /* Events are stored with interrupts disabled, so no faults allowed */
+    if (vmm_prefault((uint32_t)events, (uint32_t)max_events * sizeof(epoll_event_t)) < 0) {
+        return -1;
+    }
+    return epoll_wait(ep->handle, events, max_events, block);
+}
+
+/* Create a socket descriptor (SOCK_DGRAM or SOCK_STREAM) */
+int sys_socket(int type) {
+    int protocol = (type == SOCK_STREAM) ? IPPROTO_TCP : IPPROTO_UDP;
+    int sockfd = socket(AF_INET, type, protocol);
+    if (sockfd < 0) {
+        return -1;
+    }
+    return current_fd_install(&socket_ops, sockfd);
+}
+
+/* Set the peer of a socket; addr holds the first octet in its low byte */
+int sys_connect(int fd, uint32_t addr, uint16_t port) {
+    fd_entry_t* entry = current_fd(fd);
+    if (!entry || entry->ops != &socket_ops) {
+        return -1;
+    }
+
+    ipv4_addr_t ip;
+    memcpy(ip.octets, &addr, sizeof(ip.octets));
+    return connect(entry->handle, ip, port);
+}
+
+/* Create a message queue descriptor: one message per read/write */
+int sys_mq_create(uint32_t size) {
+    int queue_id = ipc_queue_create(size);
+    if (queue_id < 0) {
+        return -1;
+    }
+    return current_fd_install(&ipc_queue_ops, queue_id);
+}
+
+/* Wait on or wake a futex word in the caller's memory */
+int sys_futex(uint32_t* addr, int op, uint32_t value) {
+    switch (op) {
+        case FUTEX_WAIT:
+            return futex_wait(addr, value);
+        case FUTEX_WAKE:
+            return futex_wake(addr, value);
+        default:
+            return -1;
     }
-    return -1;
 }